@@ -0,0 +1,147 @@
+#pragma once
+
+#include <r200_driver/DSAPI.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+struct BufferPoolOptions
+{
+    int bufferCount;   // Number of buffers, shared by every pool DSAPI creates
+    size_t bufferSize; // Size of each buffer, must cover the largest size DSAPI passes to CreatePool. Rounded up to a multiple of 64 bytes.
+    bool useHugePages; // Back the buffers with 2 MB pages. Falls back to regular pages (with transparent huge pages requested) if none are reserved.
+    bool lockMemory;   // mlock() the buffers so that they can never be paged out
+
+    BufferPoolOptions()
+        : bufferCount(16)
+        , bufferSize(1920 * 1080 * 4)
+        , useHugePages(false)
+        , lockMemory(false)
+    {
+    }
+};
+
+class BufferPool;
+
+// Shared reference to one buffer of a BufferPool. The buffer is only returned to the free list once DSAPI has released it and the last
+// BufferRef to it has been destroyed, which is what lets frames outlive the next grab() without being copied.
+class BufferRef
+{
+    BufferPool * pool;
+    int index;
+
+    friend class BufferPool;
+    BufferRef(BufferPool * pool, int index)
+        : pool(pool)
+        , index(index)
+    {
+    }
+
+public:
+    BufferRef()
+        : pool()
+        , index(-1)
+    {
+    }
+    BufferRef(const BufferRef & other);
+    BufferRef(BufferRef && other)
+        : pool(other.pool)
+        , index(other.index)
+    {
+        other.pool = nullptr;
+    }
+    BufferRef & operator=(BufferRef other)
+    {
+        std::swap(pool, other.pool);
+        std::swap(index, other.index);
+        return *this;
+    }
+    ~BufferRef() { reset(); }
+
+    void reset();
+    explicit operator bool() const { return pool != nullptr; }
+    const uint8_t * data() const;
+};
+
+struct BufferPoolStats
+{
+    int bufferCount;
+    size_t bufferSize;
+    bool hugePages;           // True if the buffers are really on 2 MB pages
+    bool locked;              // True if mlock() succeeded
+    int poolsCreated;         // CreatePool calls accepted and not yet matched by DestroyPool
+    int largestRequest;       // Largest size DSAPI has asked for through CreatePool
+    int outstanding;          // Buffers currently handed out, to DSAPI or still referenced by a BufferRef
+    int shared;               // Live BufferRefs
+    int highWaterMark;        // Most buffers ever handed out at once
+    uint64_t allocations;     // Successful GetBuffer calls
+    uint64_t allocationFailures; // GetBuffer calls with no free buffer left, plus CreatePool calls larger than bufferSize
+    uint64_t invalidReleases; // ReleaseBuffer calls with a pointer that did not come from this pool, or that was already released, plus
+                              // DestroyPool calls larger than bufferSize
+};
+
+// Fixed pool of 64 byte aligned buffers for DSAPI::registerBufferAllocationCallbacks.
+// All memory is reserved and touched in the constructor, so once capture starts, handing out and taking back buffers never calls into the
+// heap and never page faults. GetBuffer and ReleaseBuffer are lock-free and may be called from any thread.
+// Each buffer is reference counted: GetBuffer hands DSAPI the first reference, Share() hands out more as BufferRefs, and the buffer only
+// becomes free again when all of them are gone. Size bufferCount for what DSAPI keeps in flight plus every frame the application holds.
+class BufferPool
+{
+    static const size_t ALIGNMENT = 64;
+    static const uint32_t NONE = 0xFFFFFFFF;
+
+    BufferPoolOptions options;
+    size_t stride, mappedSize;
+    uint8_t * memory;
+    bool hugePages, locked;
+
+    // Treiber stack of free buffer indices. The upper 32 bits of freeHead are a tag bumped on every change to rule out ABA.
+    std::unique_ptr<std::atomic<uint32_t>[]> nextFree;
+    std::atomic<uint64_t> freeHead;
+    std::unique_ptr<std::atomic<int>[]> references;
+
+    std::atomic<int> poolsCreated, largestRequest, outstanding, highWaterMark, shared;
+    std::atomic<uint64_t> allocations, allocationFailures, invalidReleases;
+
+    BufferPool(const BufferPool &) DS_DELETED_FUNCTION;
+    BufferPool & operator=(const BufferPool &) DS_DELETED_FUNCTION;
+
+    static bool OnCreatePool(int size, void * userContext);
+    static bool OnGetBuffer(uint8_t ** out, void * userContext);
+    static bool OnReleaseBuffer(uint8_t * buffer, void * userContext);
+    static bool OnDestroyPool(int size, void * userContext);
+
+    friend class BufferRef;
+    bool AddReference(int index);
+    bool DropReference(int index);
+    void PushFree(int index);
+
+public:
+    explicit BufferPool(const BufferPoolOptions & options = BufferPoolOptions());
+    ~BufferPool();
+
+    // False if the memory could not be reserved, in which case Register() does nothing
+    bool valid() const { return memory != nullptr; }
+
+    // Installs this pool as the buffer allocator of ds. Must be called before startCapture(), and the pool must outlive ds.
+    void Register(DSAPI & ds);
+
+    bool CreatePool(int size);
+    bool GetBuffer(uint8_t ** out);
+    bool ReleaseBuffer(uint8_t * buffer);
+    bool DestroyPool(int size);
+
+    // Index of the buffer containing address, or -1 if the address is not inside this pool
+    int IndexOf(const void * address) const;
+    uint8_t * Buffer(int index) const { return memory + index * stride; }
+    size_t BufferSize() const { return stride; }
+
+    // Takes an additional reference to a buffer that is currently handed out, e.g. the one behind an image pointer DSAPI returned after grab().
+    // Empty if the buffer is free, as one DSAPI has already released is.
+    BufferRef Share(int index);
+
+    BufferPoolStats GetStats() const;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <r200_driver/BufferPool.h>
+#include <r200_driver/DSAPI.h>
+#include <r200_driver/FrameMailbox.h>
+#include <r200_driver/FrameRing.h>
+#include <r200_driver/FrameSet.h>
+#include <r200_driver/PacingMonitor.h>
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+typedef FrameRing<FrameSet>::Handle FrameSetHandle;
+typedef FrameRing<FrameSet>::Reader FrameSetReader;
+
+// Runs DSAPI::grab() on a dedicated thread and publishes every frame set into a FrameRing, so that consumers (display, recording,
+// control loops) can each run at their own rate through a FrameRing<FrameSet>::Reader without ever holding up the camera.
+// While the engine is running, the grab thread is the only one allowed to call grab() and the image accessors of the DSAPI instance.
+class CaptureEngine
+{
+    DSAPI & ds;
+    FrameRing<FrameSet> ring;
+    std::thread thread;
+    std::atomic<bool> running, stopRequested;
+    std::atomic<uint64_t> grabCount, grabFailures;
+    std::atomic<int> lastGrabStatus;
+    std::atomic<FrameMailbox *> mailbox;
+    BufferPool * pool;
+    int cpu;
+    std::atomic<int64_t> lastFrameTime;
+    std::promise<bool> firstGrab; // Set by the grab thread once the first grab() of a Start() returns
+
+    // Updated on the grab thread from every grab, including frames the ring had to drop. Copies for other threads are published under
+    // pacingMutex, which the grab thread only ever try-locks so that a reader can never hold it up.
+    PacingMonitor pacing, thirdPacing;
+    mutable std::mutex pacingMutex;
+    PacingStats pacingStats, thirdPacingStats;
+
+    // One eventfd per possible reader, created up front so that the grab thread never writes to a descriptor that is being closed
+    int notifierCount;
+    std::unique_ptr<int[]> notifierFds;
+    std::unique_ptr<std::atomic<bool>[]> notifierUsed;
+
+    CaptureEngine(const CaptureEngine &) DS_DELETED_FUNCTION;
+    CaptureEngine & operator=(const CaptureEngine &) DS_DELETED_FUNCTION;
+
+    void Run();
+    void UpdatePacing();
+    void Notify();
+
+public:
+    // ringCapacity is the number of most recent frame sets readers can reach back to, maxReaders the number of readers that can be attached at once
+    explicit CaptureEngine(DSAPI & ds, int ringCapacity = 4, int maxReaders = 4, FrameDropPolicy policy = FRAME_DROP_OLDEST);
+    ~CaptureEngine();
+
+    // Starts the grab thread and waits for its first grab(). DSAPI::startCapture() must have been called already.
+    // False if the thread could not be started or the first grab() failed, in which case GetLastGrabStatus() tells why.
+    bool Start();
+    // Asks the grab thread to exit after the grab() in progress and waits for it.
+    void Stop();
+    // False before Start(), after Stop(), or after grab() failed, in which case GetLastGrabStatus() tells why.
+    bool IsRunning() const { return running.load(std::memory_order_acquire); }
+
+    FrameRing<FrameSet> & Frames() { return ring; }
+
+    // Also publish every grab into mailbox, from the grab thread, for a reader that only wants the newest frame set. Pass nullptr to detach.
+    // The mailbox must outlive the engine or be detached first.
+    void SetMailbox(FrameMailbox * mailbox) { this->mailbox.store(mailbox, std::memory_order_release); }
+
+    // Share the capture buffers of pool with the frame sets instead of copying them. Call while the engine is stopped; nullptr goes back to copying.
+    // Every frame set in the ring keeps its buffers out of the pool until it is recycled, and so does every copy a reader makes of one, so
+    // the pool needs room for (ringCapacity + maxReaders + 1) frame sets and whatever readers hold on to, on top of what DSAPI keeps in flight.
+    void SetBufferPool(BufferPool * pool) { this->pool = pool; }
+
+    // Reserves an eventfd that the grab thread signals after every frame set it publishes and once more when it exits.
+    // Returns a slot for NotifierFd() and ReleaseNotifier(), or -1 if all maxReaders of them are taken. Linux only.
+    int AcquireNotifier();
+    void ReleaseNotifier(int slot);
+    int NotifierFd(int slot) const { return notifierFds[slot]; }
+
+    // GetHostTime() of the last frame set published, or of Start() if none was published since
+    int64_t GetLastFrameTime() const { return lastFrameTime.load(std::memory_order_acquire); }
+
+    // Pin the grab thread to one CPU, from the next Start() on. -1 (the default) leaves it to the scheduler.
+    void SetCpuAffinity(int cpu) { this->cpu = cpu; }
+
+    // Pacing of the left/right/Z stream and of the third stream since the last Start(), as of the last grab
+    PacingStats GetPacingStats() const;
+    PacingStats GetThirdPacingStats() const;
+
+    uint64_t GetGrabCount() const { return grabCount.load(std::memory_order_relaxed); }
+    uint64_t GetGrabFailureCount() const { return grabFailures.load(std::memory_order_relaxed); }
+    DSStatus GetLastGrabStatus() const { return static_cast<DSStatus>(lastGrabStatus.load(std::memory_order_acquire)); }
+};
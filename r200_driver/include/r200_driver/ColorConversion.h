@@ -0,0 +1,79 @@
+#pragma once
+
+#include <r200_driver/ImageConversion.h>
+#include <r200_driver/TaskScheduler.h>
+
+#include <cstdint>
+
+// YUV to RGB conversion of the third camera's YUY2 images and of NV12 images from other cameras, in fixed point with SIMD kernels
+// picked like the ones of ImageConversion.h. Every kernel computes exactly the same result, so the output does not depend on the CPU.
+
+enum YuvMatrix
+{
+    YUV_BT601, // Standard definition, what libDSAPI uses
+    YUV_BT709  // High definition
+};
+
+enum YuvRange
+{
+    YUV_LIMITED_RANGE, // Y in 16-235 and U, V in 16-240, what the camera sends
+    YUV_FULL_RANGE     // Everything in 0-255
+};
+
+struct YuvConversionOptions
+{
+    YuvMatrix matrix;
+    YuvRange range;
+    TaskScheduler * scheduler; // If set, split the image into bands of rows converted on its workers and the calling thread
+    int bands;                 // Number of bands, each rounded up to rows starting a cache line of the destination. 0 splits the rows by
+                               // the kernel's grain, 32 KB of source, into at most 4 bands per thread, as ParallelForRows() does.
+    ConversionRegion region;   // Part of the source to convert and where it goes, by default all of it to the top left. Source x and width are even.
+
+    YuvConversionOptions()
+        : matrix(YUV_BT601)
+        , range(YUV_LIMITED_RANGE)
+        , scheduler(nullptr)
+        , bands(0)
+    {
+    }
+};
+
+// sourceStride and destStride are in bytes from one row to the next. Width is even, as each pair of YUY2
+// pixels shares one U and one V sample.
+void ConvertYUY2ToRGB8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                       const YuvConversionOptions & options = YuvConversionOptions());
+void ConvertYUY2ToBGRA8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                        const YuvConversionOptions & options = YuvConversionOptions());
+// The luminance outputs are the Y samples as sent, whatever the options, like libDSAPI. Luminance16 shifts them left by shift.
+void ConvertYUY2ToLuminance8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                             const YuvConversionOptions & options = YuvConversionOptions());
+void ConvertYUY2ToLuminance16(const void * sourceImage, int width, int height, int sourceStride, int shift, uint16_t * destImage, int destStride,
+                              const YuvConversionOptions & options = YuvConversionOptions());
+
+// Drop-in replacements for the libDSAPI functions, with packed rows and BT.601 limited range. They match libDSAPI to within one level.
+void ConvertYUY2ToRGB8(const void * sourceImage, int width, int height, uint8_t * destImage);
+void ConvertYUY2ToBGRA8(const void * sourceImage, int width, int height, uint8_t * destImage);
+void ConvertYUY2ToLuminance8(const void * sourceImage, int width, int height, uint8_t * destImage);
+void ConvertYUY2ToLuminance16(const void * sourceImage, int width, int height, int shift, uint16_t * destImage);
+
+// NV12 is a plane of Y samples followed by a plane of half the height with the U and V samples of each 2x2 block interleaved. Both planes
+// have rows sourceStride bytes apart and the second starts right after the first, height rows on. Width and height are even.
+void ConvertNV12ToRGB8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                       const YuvConversionOptions & options = YuvConversionOptions());
+void ConvertNV12ToBGR8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                       const YuvConversionOptions & options = YuvConversionOptions());
+void ConvertNV12ToBGRA8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                        const YuvConversionOptions & options = YuvConversionOptions());
+void ConvertNV12ToLuminance8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                             const YuvConversionOptions & options = YuvConversionOptions());
+void ConvertNV12ToLuminance16(const void * sourceImage, int width, int height, int sourceStride, int shift, uint16_t * destImage, int destStride,
+                              const YuvConversionOptions & options = YuvConversionOptions());
+
+// The same with packed rows and BT.601 limited range, in place of the libDSAPI functions. Like libDSAPI, the color ones take Y below 16 as
+// 16, black, where the ones above stretch it below black, and they match it to within one level. The ones libDSAPI exports do not have
+// the parameters its header declares, and write RGB where it says BGR.
+void ConvertNV12ToRGB8(const void * sourceImage, int width, int height, uint8_t * destImage);
+void ConvertNV12ToBGR8(const void * sourceImage, int width, int height, uint8_t * destImage);
+void ConvertNV12ToBGRA8(const void * sourceImage, int width, int height, uint8_t * destImage);
+void ConvertNV12ToLuminance8(const void * sourceImage, int width, int height, uint8_t * destImage);
+void ConvertNV12ToLuminance16(const void * sourceImage, int width, int height, int shift, uint16_t * destImage);
@@ -11,6 +11,8 @@ Copyright(c) 2014-2015 Intel Corporation. All Rights Reserved.
 #pragma once
 
 #include <r200_driver/DSAPIUtil.h>
+#include <r200_driver/DepthColorizer.h>
+#include <r200_driver/Trace.h>
 
 #include <algorithm>
 #include <cstdlib>
@@ -79,46 +81,6 @@ public:
     }
 };
 
-// Produce an RGB image from a depth image by computing a cumulative histogram of depth values and using it to map each pixel between a near color and a far color
-inline void ConvertDepthToRGBUsingHistogram(const uint16_t depthImage[], int width, int height, const uint8_t nearColor[3], const uint8_t farColor[3], uint8_t rgbImage[])
-{
-    // Produce a cumulative histogram of depth values
-    int histogram[256 * 256] = {1};
-    for (int i = 0; i < width * height; ++i)
-    {
-        if (auto d = depthImage[i]) ++histogram[d];
-    }
-    for (int i = 1; i < 256 * 256; i++)
-    {
-        histogram[i] += histogram[i - 1];
-    }
-
-    // Remap the cumulative histogram to the range 0..256
-    for (int i = 1; i < 256 * 256; i++)
-    {
-        histogram[i] = (histogram[i] << 8) / histogram[256 * 256 - 1];
-    }
-
-    // Produce RGB image by using the histogram to interpolate between two colors
-    auto rgb = rgbImage;
-    for (int i = 0; i < width * height; i++)
-    {
-        if (uint16_t d = depthImage[i]) // For valid depth values (depth > 0)
-        {
-            auto t = histogram[d]; // Use the histogram entry (in the range of 0..256) to interpolate between nearColor and farColor
-            *rgb++ = ((256 - t) * nearColor[0] + t * farColor[0]) >> 8;
-            *rgb++ = ((256 - t) * nearColor[1] + t * farColor[1]) >> 8;
-            *rgb++ = ((256 - t) * nearColor[2] + t * farColor[2]) >> 8;
-        }
-        else // Use black pixels for invalid values (depth == 0)
-        {
-            *rgb++ = 0;
-            *rgb++ = 0;
-            *rgb++ = 0;
-        }
-    }
-}
-
 // Print an non-rectified image's intrinsic properties to stdout
 std::ostream & operator<<(std::ostream & out, const DSCalibIntrinsicsNonRectified & i)
 {
@@ -211,6 +173,17 @@ inline void DrawString(int x, int y, const char * format, ...)
     glPopAttrib();
 }
 
+// Draws the p50/p95/p99 latency of every traced stage, one line each starting at (x, y), while tracing is enabled
+inline void DrawTraceStats(int x, int y)
+{
+    if (!Tracer::IsEnabled()) return;
+    const std::vector<TraceStageStats> stats = Tracer::GetStageStats();
+    for (size_t i = 0; i < stats.size(); ++i, y += 18)
+    {
+        DrawString(x, y, "%s: %0.2f / %0.2f / %0.2f ms", stats[i].name.c_str(), stats[i].p50 * 1e-6, stats[i].p95 * 1e-6, stats[i].p99 * 1e-6);
+    }
+}
+
 class GlutWindow
 {
 
@@ -306,7 +279,7 @@ public:
         End();
     }
 
-    void DrawImage(GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid * pixels, GLfloat multiplier)
+    void DrawImage(GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid * pixels, GLfloat multiplier)
     {
         Begin();
 
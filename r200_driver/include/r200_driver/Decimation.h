@@ -0,0 +1,38 @@
+#pragma once
+
+#include <r200_driver/DepthPyramid.h>
+#include <r200_driver/TaskScheduler.h>
+#include <r200_driver/DSAPI/DSCalibRectParameters.h>
+
+#include <cstdint>
+
+// Decimation of Z16 depth images by an integer factor from 2 to 8, for processing that does not need the full resolution. Each block of
+// factor x factor pixels becomes one, reduced from its valid pixels only, and 0 if it has none; DepthReduction says how the median differs
+// from the one of the levels of DepthPyramid.h. The median sorts the keys of each block with a sorting network, one block per lane of a
+// vector, on kernels picked like the ones of ImageConversion.h that give the same result as the scalar one.
+
+struct DecimationOptions
+{
+    int factor;                // 2 to 8
+    DepthReduction reduction;  // DEPTH_REDUCE_MEDIAN takes the lower median of the valid depths of the whole block, not of 2x2 medians
+    TaskScheduler * scheduler; // If set, bands of rows of the decimated image are made on its workers and the calling thread
+
+    DecimationOptions()
+        : factor(2)
+        , reduction(DEPTH_REDUCE_MEDIAN)
+        , scheduler(nullptr)
+    {
+    }
+};
+
+// The decimated image is width / factor x height / factor pixels: pixels past the last whole block are left out. depthStride and
+// decimatedStride are in bytes from one row to the next; the shorthand takes packed rows.
+void DecimateDepth(const uint16_t * depthImage, int width, int height, int depthStride, uint16_t * decimated, int decimatedStride,
+                   const DecimationOptions & options = DecimationOptions());
+void DecimateDepth(const uint16_t * depthImage, int width, int height, uint16_t * decimated,
+                   const DecimationOptions & options = DecimationOptions());
+
+// The intrinsics of the decimated image, given those of the image it was decimated from, such as getCalibIntrinsicsZ() gives, so that the
+// helpers of DSCalibRectParametersUtil.h work on it. Pixel centers are at whole coordinates, so a decimated pixel's center is that of its
+// block: u' = (u + 0.5) / factor - 0.5.
+DSCalibIntrinsicsRectified DecimateIntrinsics(const DSCalibIntrinsicsRectified & intrinsics, int factor);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <r200_driver/ImageConversion.h>
+#include <r200_driver/TaskScheduler.h>
+
+#include <cstdint>
+
+// Demosaicing of the third camera's DS_NATIVE_RAW10 images: 10 bit RGGB Bayer pixels packed 4 to 5 bytes, the first four bytes holding
+// the high 8 bits of each pixel and the fifth their low 2 bits, first pixel in the top bits. The image is converted in bands of rows
+// small enough to stay in cache, unpacked with the SIMD kernels picked like the ones of ImageConversion.h, interpolated, and mapped to
+// 8 bits through a table that also applies the white balance and gamma.
+
+enum DemosaicMethod
+{
+    DEMOSAIC_BILINEAR, // Average of the nearest samples of each color: fastest, soft edges with color fringes
+    DEMOSAIC_MALVAR    // Malvar-He-Cutler: bilinear corrected by the gradient of the sample's own color, much sharper for little more work
+};
+
+struct DemosaicOptions
+{
+    DemosaicMethod method;
+    float redGain, greenGain, blueGain; // White balance, each color is multiplied by its gain and clipped
+    float gamma;                        // Output is 255 * value ^ (1 / gamma) for values from 0 to 1, so 1 keeps it linear
+    TaskScheduler * scheduler;          // If set, the bands are converted on its workers and the calling thread
+    int bandRows;                       // Rows per band, 0 to pick from the width
+    ConversionRegion region;            // Part of the image to convert and where it goes, by default all of it to the top left. Source x and width are even.
+
+    DemosaicOptions()
+        : method(DEMOSAIC_MALVAR)
+        , redGain(1)
+        , greenGain(1)
+        , blueGain(1)
+        , gamma(1)
+        , scheduler(nullptr)
+        , bandRows(0)
+    {
+    }
+};
+
+// Width is a multiple of 4 and height a multiple of 2. sourceStride and destStride are in bytes from one row to the next.
+void ConvertRaw10ToRGB8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                        const DemosaicOptions & options = DemosaicOptions());
+void ConvertRaw10ToBGRA8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                         const DemosaicOptions & options = DemosaicOptions());
+
+// The same with packed rows, in place of the libDSAPI functions. libDSAPI smooths the image more, so the two do not match exactly.
+void ConvertRaw10ToRGB8(const void * sourceImage, int width, int height, uint8_t * destImage);
+void ConvertRaw10ToBGRA8(const void * sourceImage, int width, int height, uint8_t * destImage);
+
+// Unpacks the Bayer samples as they are, one 10 bit value per 16 bit word, e.g. to run another demosaic. destStride is in bytes, and the
+// x and width of the region are multiples of 4.
+void UnpackRaw10(const void * sourceImage, int width, int height, int sourceStride, uint16_t * destImage, int destStride,
+                 const ConversionRegion & region = ConversionRegion());
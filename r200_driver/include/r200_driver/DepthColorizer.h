@@ -0,0 +1,66 @@
+#pragma once
+
+#include <r200_driver/TaskScheduler.h>
+
+#include <cstdint>
+#include <vector>
+
+// Colorization of Z16 depth images for display. Each depth is mapped to one of 256 colors through a table of the palette index of every
+// depth, and invalid pixels (depth 0) are black. With AVX2 the table and the palette are read with gathers, 8 pixels at a time.
+
+enum DepthColormap
+{
+    DEPTH_COLORMAP_HISTOGRAM, // Near color to far color, spread by the cumulative histogram of each frame so that every depth seen gets its share
+    DEPTH_COLORMAP_JET,       // Blue through green to red, over a fixed range of depths
+    DEPTH_COLORMAP_TURBO,     // Like jet, but with smooth changes of lightness, over a fixed range of depths
+    DEPTH_COLORMAP_GRAYSCALE  // Black to white, over a fixed range of depths
+};
+
+struct DepthColorizerOptions
+{
+    DepthColormap colormap;
+    uint8_t nearColor[3], farColor[3]; // RGB ends of DEPTH_COLORMAP_HISTOGRAM
+    uint16_t minZ, maxZ;               // Depths given the first and last colors of the fixed colormaps, nearer and further ones clamped
+    TaskScheduler * scheduler;         // If set, the pixels are mapped in bands of rows on its workers and the calling thread
+
+    DepthColorizerOptions()
+        : colormap(DEPTH_COLORMAP_HISTOGRAM)
+        , minZ(0)
+        , maxZ(4000)
+        , scheduler(nullptr)
+    {
+        nearColor[0] = 255;
+        nearColor[1] = nearColor[2] = 0;
+        farColor[0] = 20;
+        farColor[1] = 40;
+        farColor[2] = 255;
+    }
+};
+
+// Keeps its tables from one frame to the next. The fixed colormaps build theirs once, in SetOptions. The histogram is counted for every
+// frame, but only its bins from the nearest to the furthest depth of the frame are summed, turned into palette indices and cleared for the
+// next one, so a frame costs one pass to count and one to map however few depths it holds. Not safe to use from several threads at once.
+class DepthColorizer
+{
+    DepthColorizerOptions options;
+    std::vector<uint32_t> histogram; // Pixels of each depth, all 0 between frames
+    std::vector<uint8_t> indices;    // Palette index of each depth, padded for the gathers
+    uint32_t palette[256];           // Red in the low byte, then green and blue
+
+    void UpdateHistogram(const uint16_t * depthImage, int width, int height, int depthStride);
+
+public:
+    explicit DepthColorizer(const DepthColorizerOptions & options = DepthColorizerOptions());
+
+    const DepthColorizerOptions & GetOptions() const { return options; }
+    void SetOptions(const DepthColorizerOptions & options);
+
+    // depthStride and rgbStride are in bytes from one row to the next; the shorthand takes packed rows
+    void Colorize(const uint16_t * depthImage, int width, int height, int depthStride, uint8_t * rgbImage, int rgbStride);
+    void Colorize(const uint16_t * depthImage, int width, int height, uint8_t * rgbImage);
+};
+
+// Produce an RGB image from a depth image by computing a cumulative histogram of depth values and using it to map each pixel between a near color and a far color.
+// If scheduler is set, the pixels are mapped in bands of rows on its workers and the calling thread. Reuses a DepthColorizer of the calling thread.
+void ConvertDepthToRGBUsingHistogram(const uint16_t depthImage[], int width, int height, const uint8_t nearColor[3], const uint8_t farColor[3], uint8_t rgbImage[],
+                                     TaskScheduler * scheduler = nullptr);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <r200_driver/TaskScheduler.h>
+
+#include <cstdint>
+
+// Downscaling of Z16 depth images by 2, 4 and 8 in one pass over the source, for previews and coarse-to-fine processing. A depth of 0 is
+// no measurement, so every reduction takes only the valid pixels of a block and gives 0 where there are none: averaging zeros in with
+// real depths would make surfaces that are not there, nearer than anything seen. The rows of the source are read once, eight at a time,
+// and the smaller levels made from the larger ones while those rows are still in cache. The reductions run on the SIMD kernels picked
+// like the ones of ImageConversion.h, and every kernel computes exactly the same result.
+
+// How a block of depths becomes one. MIN and MEAN give the same result for a block whatever its size, but MEDIAN does not: a pyramid
+// level takes the median of 2x2 medians of the level below, which is not the median of the block of the full image, while DecimateDepth()
+// takes the median of the whole factor x factor block in one step. The two only agree for one level or a factor of 2.
+enum DepthReduction
+{
+    DEPTH_REDUCE_MIN,    // Nearest valid depth of the block, for obstacle detection: nothing seen gets further away
+    DEPTH_REDUCE_MEDIAN, // Lower median of the valid depths, which drops lone outliers: of each 2x2 block of the level below in a pyramid,
+                         // of the whole block in DecimateDepth()
+    DEPTH_REDUCE_MEAN    // Mean of the valid depths of the whole block, rounded to nearest
+};
+
+struct DepthPyramidOptions
+{
+    DepthReduction reduction;
+    TaskScheduler * scheduler; // If set, bands of eight source rows are reduced on its workers and the calling thread
+
+    DepthPyramidOptions()
+        : reduction(DEPTH_REDUCE_MIN)
+        , scheduler(nullptr)
+    {
+    }
+};
+
+// Level i of the pyramid is the depth image downscaled by 2 << i, so (width >> (i + 1)) x (height >> (i + 1)) pixels: the 2x, 4x and 8x
+// levels. Pixels past the last whole block of a level are left out of it. stride and levelStrides are in bytes from one row to the next;
+// the shorthand takes packed rows.
+void BuildDepthPyramid(const uint16_t * depthImage, int width, int height, int stride, uint16_t * const levels[3],
+                       const int levelStrides[3], const DepthPyramidOptions & options = DepthPyramidOptions());
+void BuildDepthPyramid(const uint16_t * depthImage, int width, int height, uint16_t * const levels[3],
+                       const DepthPyramidOptions & options = DepthPyramidOptions());
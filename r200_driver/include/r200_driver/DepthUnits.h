@@ -0,0 +1,52 @@
+#pragma once
+
+#include <r200_driver/TaskScheduler.h>
+#include <r200_driver/DSAPI/DSAPITypes.h>
+
+#include <cstdint>
+
+// Whole-frame counterparts of the helpers of DSUnitConversion.h: conversion of Z16 depth images to other Z units, to metres in single
+// precision or to metres in half precision, each clipping the depths to a range and optionally making a bitmask of the pixels kept, all
+// in one pass over the image. The range is converted to the Z units of the source once per frame, so every pixel is kept or dropped by
+// integer compares, and no conversion divides per pixel. The kernels are SSE2 or NEON, with F16C for half precision under AVX2, picked like
+// the ones of ImageConversion.h, and give the same result as the scalar one.
+
+struct DepthRangeOptions
+{
+    int zUnits;                // Micrometres per Z unit of the source, from DSAPI::getZUnits(), such as a DSZUnits value
+    double minDepth, maxDepth; // Depths kept, in rangeUnits; the others become 0 like invalid pixels. maxDepth 0 for no upper bound.
+    int rangeUnits;            // Micrometres per unit of minDepth and maxDepth, such as a DSZUnits value
+    uint8_t * validMask;       // If set, bit x % 8 of byte x / 8 of each row is set where pixel x is valid and within the range
+    int validMaskStride;       // Bytes from one row of validMask to the next, 0 for (width + 7) / 8
+    TaskScheduler * scheduler; // If set, bands of rows are converted on its workers and the calling thread
+
+    DepthRangeOptions()
+        : zUnits(DS_MILLIMETERS)
+        , minDepth(0)
+        , maxDepth(0)
+        , rangeUnits(DS_MILLIMETERS)
+        , validMask(nullptr)
+        , validMaskStride(0)
+        , scheduler(nullptr)
+    {
+    }
+};
+
+// Depths in destZUnits micrometres per unit, rounded to nearest in single precision; those that do not fit 16 bits become 0. Ratios of
+// the DSZUnits values that are whole numbers, and a destZUnits equal to zUnits, which only clips, have kernels of their own that
+// multiply by a constant or copy. depthStride and destStride are in bytes from one row to the next; the shorthands take packed rows.
+void ConvertDepthUnits(const uint16_t * depthImage, int width, int height, int depthStride, uint16_t * destImage, int destStride, int destZUnits,
+                       const DepthRangeOptions & options = DepthRangeOptions());
+void ConvertDepthUnits(const uint16_t * depthImage, int width, int height, uint16_t * destImage, int destZUnits,
+                       const DepthRangeOptions & options = DepthRangeOptions());
+
+// Depths in metres, 0 where dropped
+void ConvertDepthToMeters(const uint16_t * depthImage, int width, int height, int depthStride, float * meters, int metersStride,
+                          const DepthRangeOptions & options = DepthRangeOptions());
+void ConvertDepthToMeters(const uint16_t * depthImage, int width, int height, float * meters, const DepthRangeOptions & options = DepthRangeOptions());
+
+// Depths in metres as IEEE 754 half precision numbers, rounded to nearest even from single precision, 0 where dropped
+void ConvertDepthToHalfMeters(const uint16_t * depthImage, int width, int height, int depthStride, uint16_t * halfMeters, int halfStride,
+                              const DepthRangeOptions & options = DepthRangeOptions());
+void ConvertDepthToHalfMeters(const uint16_t * depthImage, int width, int height, uint16_t * halfMeters,
+                              const DepthRangeOptions & options = DepthRangeOptions());
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <r200_driver/DSAPI.h>
+#include <r200_driver/FrameSet.h>
+
+#include <atomic>
+
+// Wait-free single-producer / single-consumer triple buffer. The producer always has a back buffer to write into, the consumer always
+// has a complete front buffer to read from, and the middle buffer is handed between them with one atomic exchange on each side.
+// Publishing never waits for the consumer and the consumer always swaps in the most recently published value, so older values are simply overwritten.
+template <typename T>
+class TripleBuffer
+{
+    static const int INDEX_MASK = 0x3;
+    static const int FRESH = 0x4; // Set in middle when it holds a value the consumer has not taken yet
+
+    T buffers[3];
+    std::atomic<int> middle;
+    int back, front; // Private to the producer and the consumer respectively
+
+public:
+    TripleBuffer()
+        : middle(1)
+        , back(0)
+        , front(2)
+    {
+    }
+
+    // Producer only. The buffer to fill for the next Publish().
+    T & Back() { return buffers[back]; }
+    // Producer only. Makes the back buffer the latest value.
+    void Publish() { back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX_MASK; }
+
+    // Consumer only. Swaps in the latest value if one was published since the last call, returns true if it did.
+    bool Update()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+    // Consumer only. The value obtained by the last successful Update().
+    const T & Front() const { return buffers[front]; }
+};
+
+// What a FrameMailbox reader gets: the most recent complete frame set plus how stale it is
+struct MailboxFrame
+{
+    const FrameSet * frameSet; // nullptr until the first frame set has been published. Valid until the next Read().
+    bool isNew;                // False if no frame set was published since the previous Read()
+    double age;                // Seconds from getFrameTime(true) to now. Assumes the DSAPI performance counter is CLOCK_MONOTONIC, like steady_clock on Linux.
+    double sinceGrab;          // Seconds from the return of grab() to now, measured on the host clock only
+};
+
+// Latest-frame handoff for latency-critical consumers, such as a control loop that only ever wants the newest depth image.
+// The capturing thread publishes straight from the DSAPI image accessors, the reader picks up the most recent complete frame set in O(1)
+// with no locks and no torn reads. Exactly one thread may publish and exactly one thread may read.
+class FrameMailbox
+{
+    TripleBuffer<FrameSet> frames;
+    const unsigned streams;
+    uint64_t published; // Producer only
+
+public:
+    // streams is a FrameStream mask of the images to copy, e.g. FRAME_STREAM_Z to avoid paying for images the reader ignores
+    explicit FrameMailbox(unsigned streams = FRAME_STREAM_ALL)
+        : streams(streams)
+        , published()
+    {
+    }
+
+    // Producer only. Copies the current grab() into the mailbox and makes it the latest frame set. Call right after grab() returns.
+    // With a pool, images in its buffers are shared instead of copied, see CaptureFrameSet().
+    void Publish(DSAPI & ds, BufferPool * pool = nullptr);
+
+    // Consumer only. Returns the latest frame set, without waiting.
+    MailboxFrame Read();
+};
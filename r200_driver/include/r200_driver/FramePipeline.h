@@ -0,0 +1,86 @@
+#pragma once
+
+#include <r200_driver/CaptureEngine.h>
+#include <r200_driver/TaskScheduler.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Runs one stage on one frame set. slot (0 to maxInFlight - 1) is the frame's place in the pipeline, for indexing per-frame outputs: no
+// two frames in flight share a slot, so a stage can write its result to buffers[slot] and a dependent stage read it from there.
+typedef std::function<void(const FrameSet & frame, int slot)> FrameStageFunction;
+
+struct FramePipelineStats
+{
+    uint64_t submitted; // Frame sets accepted by Submit or TrySubmit
+    uint64_t completed; // Frame sets every stage has finished with
+    uint64_t rejected;  // TrySubmit calls turned away because maxInFlight frame sets were in flight
+    int inFlight;
+};
+
+// Runs a dependency graph of stages on every submitted frame set, on the workers of a TaskScheduler. Stages whose dependencies are done
+// run in parallel, and frames overlap: stage A of frame N + 1 can run while stage B of frame N is still going. An ordered stage (the
+// default) also waits for itself on the previous frame, so it sees frames in order and never runs twice at once, which is what stages
+// with state of their own (a histogram, a file being written) need.
+// At most maxInFlight frame sets are in the pipeline at once; Submit blocks and TrySubmit fails beyond that. Each one keeps its FrameRing
+// buffer pinned until its last stage finishes, so keep maxInFlight below the ring capacity.
+class FramePipeline
+{
+    struct Stage
+    {
+        const char * name;
+        int traceStage;
+        FrameStageFunction function;
+        int dependencies;
+        std::vector<int> dependents;
+        bool ordered;
+    };
+
+    struct Slot
+    {
+        FrameSetHandle frame;
+        bool busy;
+        int remaining;            // Stages not finished yet
+        std::vector<int> pending; // Per stage, dependencies not finished yet
+        std::vector<bool> done;
+        int next;                 // Slot of the frame submitted after this one, while both are in flight
+    };
+
+    TaskScheduler & scheduler;
+    std::vector<Stage> stages;
+    std::vector<Slot> slots;
+    std::mutex mutex;
+    std::condition_variable slotFreed;
+    int inFlight, newest;
+    uint64_t submitted, completed, rejected;
+
+    FramePipeline(const FramePipeline &) DS_DELETED_FUNCTION;
+    FramePipeline & operator=(const FramePipeline &) DS_DELETED_FUNCTION;
+
+    static void RunStage(void * context, int slot, int stage);
+    void Start(std::unique_lock<std::mutex> & lock, FrameSetHandle frame);
+    void Finish(int slot, int stage);
+
+public:
+    explicit FramePipeline(TaskScheduler & scheduler, int maxInFlight = 2);
+    // Waits for the frame sets in flight
+    ~FramePipeline();
+
+    // Adds a stage that runs once all of dependencies (ids returned by earlier AddStage calls) are done with the same frame set.
+    // name is used for tracing and must stay valid for the life of the pipeline. Returns the stage id, or -1 for an invalid dependency
+    // or once frames have been submitted.
+    int AddStage(const char * name, FrameStageFunction function, const std::vector<int> & dependencies = std::vector<int>(), bool ordered = true);
+
+    // Starts the stages on frame, after waiting for a free slot if maxInFlight frame sets are in flight. False for an empty handle.
+    bool Submit(FrameSetHandle frame);
+    // Same as Submit, but fails instead of waiting
+    bool TrySubmit(FrameSetHandle frame);
+    // Waits until every frame set submitted so far has been through all stages
+    void Flush();
+
+    int MaxInFlight() const { return static_cast<int>(slots.size()); }
+    FramePipelineStats GetStats();
+};
@@ -0,0 +1,330 @@
+#pragma once
+
+#include <r200_driver/DSAPI/DSAPITypes.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+
+// What the producer of a FrameRing does when it cannot store a new frame without losing one that a reader has not seen yet.
+// In both cases the producer itself never waits on a reader.
+enum FrameDropPolicy
+{
+    FRAME_DROP_OLDEST, // Overwrite the oldest frame. Readers that fall a full ring behind skip ahead and count the frames they missed.
+    FRAME_DROP_NEWEST  // Discard the incoming frame while the slowest reader is a full ring behind.
+};
+
+// Producer side counters of a FrameRing
+struct FrameRingStats
+{
+    uint64_t published;       // Frames made visible to readers
+    uint64_t droppedByPolicy; // Incoming frames discarded under FRAME_DROP_NEWEST
+    uint64_t droppedNoBuffer; // Incoming frames discarded because every buffer was pinned by readers
+};
+
+// Bounded single-producer / multi-consumer broadcast ring of preallocated T values, without locks.
+// Every reader sees every published frame in order, unless it falls behind far enough for the frame to be recycled, in which case the loss is counted.
+// The ring owns capacity + maxReaders + 1 buffers. The ring exposes the newest capacity frames, each reader may pin one more frame while the
+// producer fills the last, so under normal use the producer always finds a free buffer.
+// Each buffer has a single atomic state word holding (sequence << 16 | pin count). The producer only recycles buffers with no pins, and a reader
+// only pins a buffer whose sequence is the one it is looking for, so a reader never observes a buffer while it is being written.
+template <typename T>
+class FrameRing
+{
+    static const int PIN_BITS = 16;
+    static const uint64_t PIN_MASK = (1u << PIN_BITS) - 1;
+
+    struct Buffer
+    {
+        std::atomic<uint64_t> state; // sequence << PIN_BITS | pins. Sequence 0 means empty or being written.
+        T value;
+
+        Buffer() : state(0), value() {}
+    };
+
+    struct ReaderSlot
+    {
+        std::atomic<bool> used, active;
+        std::atomic<uint64_t> cursor;    // Sequence of the last frame this reader consumed or skipped
+        std::atomic<uint64_t> delivered; // Frames returned to the reader
+        std::atomic<uint64_t> dropped;   // Frames recycled before the reader got to them
+        std::atomic<uint64_t> skipped;   // Frames the reader chose to skip by asking for the latest frame
+
+        ReaderSlot() : used(false), active(false), cursor(0), delivered(0), dropped(0), skipped(0) {}
+    };
+
+    const int capacity, bufferCount, maxReaders;
+    const FrameDropPolicy policy;
+    std::unique_ptr<Buffer[]> buffers;
+    std::unique_ptr<std::atomic<uint64_t>[]> entries; // sequence << PIN_BITS | buffer index, for sequence % capacity
+    std::unique_ptr<ReaderSlot[]> readers;
+    std::atomic<uint64_t> head; // Sequence of the most recently published frame, 0 if none yet
+
+    // Only touched by the producer thread
+    int writing;
+    uint64_t writeSequence;
+
+    std::atomic<uint64_t> published, droppedByPolicy, droppedNoBuffer;
+
+    uint64_t MinReaderCursor(uint64_t fallback) const
+    {
+        uint64_t minCursor = fallback;
+        for (int i = 0; i < maxReaders; ++i)
+        {
+            if (readers[i].active.load(std::memory_order_acquire))
+                minCursor = std::min(minCursor, readers[i].cursor.load(std::memory_order_acquire));
+        }
+        return minCursor;
+    }
+
+public:
+    // A pinned, read-only frame. The producer will not recycle the buffer until every Handle referring to it has been destroyed.
+    class Handle
+    {
+        Buffer * buffer;
+
+        friend class FrameRing;
+        explicit Handle(Buffer * buffer) : buffer(buffer) {}
+
+    public:
+        Handle() : buffer() {}
+        Handle(const Handle & other) : buffer(other.buffer)
+        {
+            if (buffer) buffer->state.fetch_add(1, std::memory_order_relaxed);
+        }
+        Handle(Handle && other) : buffer(other.buffer) { other.buffer = nullptr; }
+        Handle & operator=(Handle other)
+        {
+            std::swap(buffer, other.buffer);
+            return *this;
+        }
+        ~Handle() { reset(); }
+
+        void reset()
+        {
+            if (buffer) buffer->state.fetch_sub(1, std::memory_order_release);
+            buffer = nullptr;
+        }
+
+        explicit operator bool() const { return buffer != nullptr; }
+        const T & operator*() const { return buffer->value; }
+        const T * operator->() const { return &buffer->value; }
+        const T * get() const { return buffer ? &buffer->value : nullptr; }
+    };
+
+    // A consumer of the ring, with its own position and counters. Each Reader must only be used from one thread at a time.
+    class Reader
+    {
+        FrameRing * ring;
+        ReaderSlot * slot;
+        uint64_t cursor;
+
+        Reader(const Reader &) DS_DELETED_FUNCTION;
+        Reader & operator=(const Reader &) DS_DELETED_FUNCTION;
+
+    public:
+        // Registers with the ring and starts after the most recently published frame. Check valid() in case all reader slots were taken.
+        explicit Reader(FrameRing & ring)
+            : ring(&ring)
+            , slot()
+            , cursor(ring.head.load(std::memory_order_acquire))
+        {
+            for (int i = 0; i < ring.maxReaders && !slot; ++i)
+            {
+                bool expected = false;
+                if (ring.readers[i].used.compare_exchange_strong(expected, true))
+                {
+                    slot = &ring.readers[i];
+                    slot->cursor.store(cursor, std::memory_order_release);
+                    slot->delivered.store(0);
+                    slot->dropped.store(0);
+                    slot->skipped.store(0);
+                    slot->active.store(true, std::memory_order_release);
+                }
+            }
+        }
+
+        ~Reader()
+        {
+            if (slot)
+            {
+                slot->active.store(false, std::memory_order_release);
+                slot->used.store(false, std::memory_order_release);
+            }
+        }
+
+        bool valid() const { return slot != nullptr; }
+
+        // Returns the next frame after the last one returned, or an empty handle if there is none yet. Never blocks.
+        Handle Pop()
+        {
+            uint64_t last = ring->head.load(std::memory_order_acquire);
+            while (slot && cursor < last)
+            {
+                uint64_t next = cursor + 1;
+                const uint64_t oldest = last > static_cast<uint64_t>(ring->capacity) ? last - ring->capacity + 1 : 1;
+                if (next < oldest)
+                {
+                    slot->dropped.fetch_add(oldest - next, std::memory_order_relaxed);
+                    next = oldest;
+                }
+
+                Handle handle = ring->Pin(next);
+                Advance(next);
+                if (handle)
+                {
+                    slot->delivered.fetch_add(1, std::memory_order_relaxed);
+                    return handle;
+                }
+                slot->dropped.fetch_add(1, std::memory_order_relaxed);
+                last = ring->head.load(std::memory_order_acquire);
+            }
+            return Handle();
+        }
+
+        // Returns the most recently published frame if it is newer than the last one returned, skipping everything in between. Never blocks.
+        Handle PopLatest()
+        {
+            while (slot)
+            {
+                const uint64_t last = ring->head.load(std::memory_order_acquire);
+                if (last <= cursor) return Handle();
+
+                Handle handle = ring->Pin(last);
+                if (handle)
+                {
+                    slot->skipped.fetch_add(last - cursor - 1, std::memory_order_relaxed);
+                    slot->delivered.fetch_add(1, std::memory_order_relaxed);
+                    Advance(last);
+                    return handle;
+                }
+                // The producer recycled the frame between reading head and pinning it, so a newer one is available
+            }
+            return Handle();
+        }
+
+        // Number of published frames this reader has not consumed yet
+        uint64_t Pending() const { return ring->head.load(std::memory_order_acquire) - cursor; }
+
+        uint64_t Delivered() const { return slot ? slot->delivered.load(std::memory_order_relaxed) : 0; }
+        uint64_t Dropped() const { return slot ? slot->dropped.load(std::memory_order_relaxed) : 0; }
+        uint64_t Skipped() const { return slot ? slot->skipped.load(std::memory_order_relaxed) : 0; }
+
+    private:
+        void Advance(uint64_t sequence)
+        {
+            cursor = sequence;
+            slot->cursor.store(sequence, std::memory_order_release);
+        }
+    };
+
+    FrameRing(int capacity, int maxReaders, FrameDropPolicy policy)
+        : capacity(std::max(capacity, 1))
+        , bufferCount(std::max(capacity, 1) + std::max(maxReaders, 1) + 1)
+        , maxReaders(std::max(maxReaders, 1))
+        , policy(policy)
+        , buffers(new Buffer[bufferCount])
+        , entries(new std::atomic<uint64_t>[this->capacity])
+        , readers(new ReaderSlot[this->maxReaders])
+        , head(0)
+        , writing(-1)
+        , writeSequence(0)
+        , published(0)
+        , droppedByPolicy(0)
+        , droppedNoBuffer(0)
+    {
+        for (int i = 0; i < this->capacity; ++i) entries[i].store(0);
+    }
+
+    int Capacity() const { return capacity; }
+    FrameDropPolicy Policy() const { return policy; }
+
+    // Producer only. Claims a buffer for the next frame and returns it together with the sequence number the frame will be published under,
+    // or returns nullptr if the frame must be dropped. Never blocks. Must be followed by CommitWrite() or AbortWrite() if a buffer was returned.
+    T * BeginWrite(uint64_t & sequence)
+    {
+        const uint64_t next = writeSequence + 1;
+        const uint64_t minCursor = MinReaderCursor(writeSequence);
+        if (policy == FRAME_DROP_NEWEST && next - minCursor > static_cast<uint64_t>(capacity))
+        {
+            droppedByPolicy.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        // Recycle the unpinned buffer holding the oldest frame. A failed exchange means a reader pinned it in the meantime, so look again.
+        for (int attempt = 0; attempt < bufferCount; ++attempt)
+        {
+            int best = -1;
+            uint64_t bestState = 0, bestSequence = std::numeric_limits<uint64_t>::max();
+            for (int i = 0; i < bufferCount; ++i)
+            {
+                const uint64_t state = buffers[i].state.load(std::memory_order_acquire);
+                if ((state & PIN_MASK) == 0 && (state >> PIN_BITS) < bestSequence)
+                {
+                    best = i;
+                    bestState = state;
+                    bestSequence = state >> PIN_BITS;
+                }
+            }
+            if (best < 0 || (policy == FRAME_DROP_NEWEST && bestSequence > minCursor)) break;
+
+            if (buffers[best].state.compare_exchange_strong(bestState, 0, std::memory_order_acq_rel))
+            {
+                writing = best;
+                sequence = next;
+                return &buffers[best].value;
+            }
+        }
+
+        droppedNoBuffer.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    // Producer only. Publishes the frame returned by BeginWrite().
+    void CommitWrite()
+    {
+        const uint64_t sequence = ++writeSequence;
+        buffers[writing].state.store(sequence << PIN_BITS, std::memory_order_release);
+        entries[sequence % capacity].store(sequence << PIN_BITS | static_cast<uint64_t>(writing), std::memory_order_release);
+        head.store(sequence, std::memory_order_release);
+        published.fetch_add(1, std::memory_order_relaxed);
+        writing = -1;
+    }
+
+    // Producer only. Returns the buffer from BeginWrite() unpublished, e.g. because filling it failed.
+    void AbortWrite()
+    {
+        buffers[writing].state.store(0, std::memory_order_release);
+        writing = -1;
+    }
+
+    // Pins the frame published under the given sequence, or returns an empty handle if it has not been published or was already recycled
+    Handle Pin(uint64_t sequence)
+    {
+        const uint64_t entry = entries[sequence % capacity].load(std::memory_order_acquire);
+        if (entry >> PIN_BITS != sequence) return Handle();
+
+        Buffer & buffer = buffers[entry & PIN_MASK];
+        uint64_t state = buffer.state.load(std::memory_order_acquire);
+        while (state >> PIN_BITS == sequence && (state & PIN_MASK) != PIN_MASK)
+        {
+            if (buffer.state.compare_exchange_weak(state, state + 1, std::memory_order_acquire)) return Handle(&buffer);
+        }
+        return Handle();
+    }
+
+    // Sequence of the most recently published frame, 0 if none yet
+    uint64_t Head() const { return head.load(std::memory_order_acquire); }
+
+    FrameRingStats GetStats() const
+    {
+        FrameRingStats stats;
+        stats.published = published.load(std::memory_order_relaxed);
+        stats.droppedByPolicy = droppedByPolicy.load(std::memory_order_relaxed);
+        stats.droppedNoBuffer = droppedNoBuffer.load(std::memory_order_relaxed);
+        return stats;
+    }
+};
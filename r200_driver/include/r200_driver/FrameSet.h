@@ -0,0 +1,124 @@
+#pragma once
+
+#include <r200_driver/BufferPool.h>
+#include <r200_driver/DSAPI.h>
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Images a frame set can carry, combined as a bit mask to choose which ones get copied
+enum FrameStream
+{
+    FRAME_STREAM_Z = 0x1,
+    FRAME_STREAM_LEFT = 0x2,
+    FRAME_STREAM_RIGHT = 0x4,
+    FRAME_STREAM_THIRD = 0x8,
+    FRAME_STREAM_ALL = 0xF
+};
+
+// Host monotonic time (std::chrono::steady_clock) in nanoseconds, the clock used for FrameSet::hostTime
+inline int64_t GetHostTime()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Returns the number of bytes occupied by one row of pixels in the given format, or 0 if the format is unknown.
+// For the pixel-interleaved stereo formats a "pixel" is a right/left pair, matching what getLImage() returns in those modes.
+inline int GetRowBytes(DSPixelFormat format, int width)
+{
+    switch (format)
+    {
+    case DS_LUMINANCE8:
+    case DS_NATIVE_L_LUMINANCE8:
+        return width;
+    case DS_LUMINANCE16:
+    case DS_NATIVE_L_LUMINANCE16:
+    case DS_NATIVE_RL_LUMINANCE8:
+    case DS_NATIVE_YUY2:
+        return width * 2;
+    case DS_RGB8:
+    case DS_NATIVE_RL_LUMINANCE12:
+        return width * 3;
+    case DS_BGRA8:
+    case DS_NATIVE_RL_LUMINANCE16:
+        return width * 4;
+    case DS_NATIVE_RAW10:
+        return width * 5 / 4;
+    default:
+        return 0;
+    }
+}
+
+// Returns true if the left image in this format carries both the right and left pixels, in which case there is no separate right image.
+inline bool IsInterleavedLRFormat(DSPixelFormat format)
+{
+    return format == DS_NATIVE_RL_LUMINANCE8 || format == DS_NATIVE_RL_LUMINANCE12 || format == DS_NATIVE_RL_LUMINANCE16;
+}
+
+// One image from a frame set, kept valid after the next grab(). Either the pixels were copied into storage, or the image shares the
+// capture buffer DSAPI wrote them into (see CaptureFrameSet()), in which case copying the FrameImage only takes another reference.
+struct FrameImage
+{
+    int width, height, stride;
+    DSPixelFormat format;
+    const uint8_t * pixels;       // Points into the buffer if the image is shared, otherwise into storage
+    BufferRef buffer;             // Capture buffer holding the pixels, empty if they were copied
+    std::vector<uint8_t> storage; // Private copy of the pixels, unused while the image is shared
+
+    FrameImage()
+        : width()
+        , height()
+        , stride()
+        , format(DS_LUMINANCE8)
+        , pixels()
+    {
+    }
+    FrameImage(const FrameImage & other);
+    FrameImage(FrameImage && other);
+    FrameImage & operator=(const FrameImage & other);
+    FrameImage & operator=(FrameImage && other);
+
+    bool valid() const { return width > 0 && height > 0 && pixels; }
+    bool shared() const { return static_cast<bool>(buffer); }
+    const void * data() const { return pixels; }
+    template <typename P> const P * dataAs() const { return reinterpret_cast<const P *>(pixels); }
+};
+
+// A snapshot of everything grab() made available: the enabled images plus the frame numbers and timestamps describing them
+struct FrameSet
+{
+    FrameImage z, left, right, third;
+
+    uint64_t sequence;      // Assigned by the capture engine, increases by one for every frame set published
+    int frameNumber;        // DSAPI::getFrameNumber()
+    double frameTime;       // DSAPI::getFrameTime(false), seconds since the epoch (UTC)
+    double frameTimePerf;   // DSAPI::getFrameTime(true), performance counter seconds
+    int thirdFrameNumber;   // DSThird::getThirdFrameNumber()
+    double thirdFrameTime;  // DSThird::getThirdFrameTime(false)
+    int64_t hostTime;       // std::chrono::steady_clock nanoseconds, taken when grab() returned
+
+    FrameSet()
+        : sequence()
+        , frameNumber()
+        , frameTime()
+        , frameTimePerf()
+        , thirdFrameNumber()
+        , thirdFrameTime()
+        , hostTime()
+    {
+    }
+};
+
+// Size the image buffers of frameSet for the current configuration of ds, so that CopyFrameSet() does not need to allocate.
+// Must be called after startCapture(), when the stream resolutions and formats are final. Only allocates when an image grew.
+// Streams left out of the FrameStream mask are released, and CopyFrameSet() will skip them.
+void ReserveFrameSet(DSAPI & ds, FrameSet & frameSet, unsigned streams = FRAME_STREAM_ALL);
+
+// Copy the images and frame information of the current grab() into frameSet. Must be called from the thread calling grab().
+void CopyFrameSet(DSAPI & ds, FrameSet & frameSet);
+
+// Like ReserveFrameSet() followed by CopyFrameSet(), except that every image DSAPI returns from inside one of pool's buffers is shared
+// rather than copied, holding that buffer out of the pool until the last FrameImage referring to it is gone. Images DSAPI had to produce
+// elsewhere (e.g. converted left/right images) are still copied. pool must be registered with ds and outlive frameSet and all its copies.
+void CaptureFrameSet(DSAPI & ds, BufferPool & pool, FrameSet & frameSet, unsigned streams = FRAME_STREAM_ALL);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <r200_driver/TaskScheduler.h>
+
+#include <cstdint>
+
+// Filling of the invalid pixels (depth 0) of Z16 images, such as those the outlier rejection of DSDepthControlParameters leaves, with the
+// depth of valid pixels near them. Every mode reads each row of the source once, in one pass over the image, with SSE2 or NEON kernels
+// picked like the ones of ImageConversion.h that give the same result as the scalar one.
+
+enum HoleFillMode
+{
+    HOLE_FILL_LEFT,     // The nearest valid depth to the left on the row
+    HOLE_FILL_FARTHEST, // The farthest valid depth around, which never puts a surface nearer than one seen: the safe one for obstacle avoidance
+    HOLE_FILL_NEAREST   // The nearest valid depth around
+};
+
+struct HoleFillOptions
+{
+    HoleFillMode mode;
+    int radius;                // Largest distance in pixels along each axis from a hole to the depth that fills it. The around modes take
+                               // the square of that radius, from 1 (the 8 neighbours, the default) to 8. The left mode takes any radius,
+                               // 0 or one above 32766 for no bound.
+    const uint8_t * mask;      // If set, only holes whose byte in it is not 0 are filled
+    int maskStride;            // Bytes from one row of the mask to the next, 0 for packed rows
+    TaskScheduler * scheduler; // If set, bands of rows are filled on its workers and the calling thread
+
+    HoleFillOptions()
+        : mode(HOLE_FILL_FARTHEST)
+        , radius(1)
+        , mask(nullptr)
+        , maskStride(0)
+        , scheduler(nullptr)
+    {
+    }
+};
+
+// Holes of one frame, counted in the source, and how many of them got a depth
+struct HoleFillStats
+{
+    int holes;
+    int filled;
+
+    HoleFillStats()
+        : holes(0)
+        , filled(0)
+    {
+    }
+    // 1 for a frame without holes, as none was left unfilled
+    double FillRatio() const { return holes ? static_cast<double>(filled) / holes : 1.0; }
+};
+
+// Fills the holes of depthImage into filled, which must not overlap it. depthStride and filledStride are in bytes from one row to the
+// next; the shorthand takes packed rows.
+HoleFillStats FillDepthHoles(const uint16_t * depthImage, int width, int height, int depthStride, uint16_t * filled, int filledStride,
+                             const HoleFillOptions & options = HoleFillOptions());
+HoleFillStats FillDepthHoles(const uint16_t * depthImage, int width, int height, uint16_t * filled,
+                             const HoleFillOptions & options = HoleFillOptions());
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <r200_driver/TaskScheduler.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Open implementations of the DSConvert* image conversions of libDSAPI, vectorized for SSE2, SSSE3 and AVX2 (NEON on ARM) with the instruction
+// set picked at run time. Every function gives bit-identical results to the libDSAPI function of the same name, quirks included, and
+// takes the same parameters: width and height in pixels, stride in bytes from one source row to the next.
+
+enum ConversionIsa
+{
+    CONVERSION_ISA_SCALAR,
+    CONVERSION_ISA_SSE2,
+    CONVERSION_ISA_SSSE3,
+    CONVERSION_ISA_AVX2,
+    CONVERSION_ISA_NEON
+};
+
+// Best instruction set this CPU supports, which is what the conversions use unless told otherwise
+ConversionIsa GetBestConversionIsa();
+ConversionIsa GetConversionIsa();
+// Makes every conversion use isa from now on, e.g. to benchmark or check one code path. False if the CPU does not support it.
+bool SetConversionIsa(ConversionIsa isa);
+const char * ConversionIsaString(ConversionIsa isa);
+
+// A rectangle of an image, in pixels, for conversions of only part of it
+struct ImageRegion
+{
+    int x, y, width, height;
+
+    ImageRegion()
+        : x(0)
+        , y(0)
+        , width(0)
+        , height(0)
+    {
+    }
+    ImageRegion(int x, int y, int width, int height)
+        : x(x)
+        , y(y)
+        , width(width)
+        , height(height)
+    {
+    }
+
+    bool IsEmpty() const { return width <= 0 || height <= 0; }
+};
+
+// Which part of the source a conversion reads and where it writes it: the pixels of source, or of the whole image if it is empty, go to
+// the destination with their top left at pixel (destX, destY). The default converts the whole image to the top left of the destination.
+struct ConversionRegion
+{
+    ImageRegion source;
+    int destX, destY;
+
+    ConversionRegion()
+        : destX(0)
+        , destY(0)
+    {
+    }
+    ConversionRegion(const ImageRegion & source, int destX = 0, int destY = 0)
+        : source(source)
+        , destX(destX)
+        , destY(destY)
+    {
+    }
+
+    ImageRegion SourceIn(int width, int height) const { return source.IsEmpty() ? ImageRegion(0, 0, width, height) : source; }
+
+    // First pixel written to a destination image with rows stride bytes apart and pixelSize bytes per pixel
+    template <class T> T * DestinationIn(T * image, int stride, int pixelSize) const
+    {
+        return reinterpret_cast<T *>(reinterpret_cast<uint8_t *>(image) + static_cast<ptrdiff_t>(destY) * stride + destX * pixelSize);
+    }
+};
+
+// Every conversion has a general form taking sourceStride and destStride, in bytes from one row to the next, the region to convert and
+// optionally a scheduler on whose workers and the calling thread bands of rows are converted. The others are shorthands for it with packed
+// rows and the whole image, on the calling thread.
+
+// Interleaved left/right formats. Each pixel of DS_NATIVE_RL_LUMINANCE8 is a left byte then a right byte, each pixel of
+// DS_NATIVE_RL_LUMINANCE16 a left word then a right word, and each pixel of DS_NATIVE_RL_LUMINANCE12 three bytes holding the 12 bit
+// right value in its low bits and the 12 bit left value in its high bits.
+void ConvertRLLuminance8ToLuminance8(const void * sourceImage, int width, int height, uint8_t * leftImage, uint8_t * rightImage);
+void ConvertRLLuminance8ToLuminance8(const void * sourceImage, int width, int height, int stride, uint8_t * leftImage, uint8_t * rightImage);
+void ConvertRLLuminance8ToLuminance8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * leftImage, uint8_t * rightImage,
+                                     int destStride, const ConversionRegion & region = ConversionRegion(), TaskScheduler * scheduler = nullptr);
+
+void ConvertRLLuminance16ToLuminance16(const void * sourceImage, int width, int height, uint16_t * leftImage, uint16_t * rightImage);
+void ConvertRLLuminance16ToLuminance16(const void * sourceImage, int width, int height, int stride, uint16_t * leftImage, uint16_t * rightImage);
+void ConvertRLLuminance16ToLuminance16(const void * sourceImage, int width, int height, int sourceStride, uint16_t * leftImage, uint16_t * rightImage,
+                                       int destStride, const ConversionRegion & region = ConversionRegion(), TaskScheduler * scheduler = nullptr);
+
+// Keeps the low 8 bits of each value shifted right by shift. Like libDSAPI, this writes the right word of each pixel to leftImage and
+// the left word to rightImage, the other way round from ConvertRLLuminance16ToLuminance16.
+void ConvertRLLuminance16ToLuminance8(const void * sourceImage, int width, int height, int shift, uint8_t * leftImage, uint8_t * rightImage);
+void ConvertRLLuminance16ToLuminance8(const void * sourceImage, int width, int height, int stride, int shift, uint8_t * leftImage, uint8_t * rightImage);
+void ConvertRLLuminance16ToLuminance8(const void * sourceImage, int width, int height, int sourceStride, int shift, uint8_t * leftImage, uint8_t * rightImage,
+                                      int destStride, const ConversionRegion & region = ConversionRegion(), TaskScheduler * scheduler = nullptr);
+
+// Keeps the low 8 bits of each value shifted right by shift
+void ConvertRLLuminance12ToLuminance8(const void * sourceImage, int width, int height, int shift, uint8_t * leftImage, uint8_t * rightImage);
+void ConvertRLLuminance12ToLuminance8(const void * sourceImage, int width, int height, int stride, int shift, uint8_t * leftImage, uint8_t * rightImage);
+void ConvertRLLuminance12ToLuminance8(const void * sourceImage, int width, int height, int sourceStride, int shift, uint8_t * leftImage, uint8_t * rightImage,
+                                      int destStride, const ConversionRegion & region = ConversionRegion(), TaskScheduler * scheduler = nullptr);
+
+void ConvertRLLuminance12ToLuminance16(const void * sourceImage, int width, int height, uint16_t * leftImage, uint16_t * rightImage);
+void ConvertRLLuminance12ToLuminance16(const void * sourceImage, int width, int height, int stride, uint16_t * leftImage, uint16_t * rightImage);
+void ConvertRLLuminance12ToLuminance16(const void * sourceImage, int width, int height, int sourceStride, uint16_t * leftImage, uint16_t * rightImage,
+                                       int destStride, const ConversionRegion & region = ConversionRegion(), TaskScheduler * scheduler = nullptr);
+
+// Both of the above in one pass over the source, e.g. 8 bit images for display plus 16 bit ones keeping the full range for processing
+void ConvertRLLuminance12ToLuminance8And16(const void * sourceImage, int width, int height, int shift, uint8_t * leftImage8, uint8_t * rightImage8,
+                                           uint16_t * leftImage16, uint16_t * rightImage16);
+void ConvertRLLuminance12ToLuminance8And16(const void * sourceImage, int width, int height, int stride, int shift, uint8_t * leftImage8, uint8_t * rightImage8,
+                                           uint16_t * leftImage16, uint16_t * rightImage16);
+// destStride8 and destStride16 are those of the 8 and 16 bit images
+void ConvertRLLuminance12ToLuminance8And16(const void * sourceImage, int width, int height, int sourceStride, int shift, uint8_t * leftImage8, uint8_t * rightImage8,
+                                           int destStride8, uint16_t * leftImage16, uint16_t * rightImage16, int destStride16,
+                                           const ConversionRegion & region = ConversionRegion(), TaskScheduler * scheduler = nullptr);
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <r200_driver/CaptureEngine.h>
+#include <r200_driver/DSAPI.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct MultiCameraOptions
+{
+    DSPlatform platform;   // Passed to DSCreate() for every camera
+    int ringCapacity;      // Frame sets each camera's CaptureEngine keeps for matching
+    int firstCpu;          // Capture thread of camera i is pinned to CPU (firstCpu + i) modulo the CPU count. -1 disables pinning.
+    int64_t tolerance;     // Largest difference in FrameSet::hostTime, in nanoseconds, between frame sets put in the same bundle
+
+    MultiCameraOptions()
+        : platform(DS_DS4_PLATFORM)
+        , ringCapacity(4)
+        , firstCpu(-1)
+        , tolerance(8000000)
+    {
+    }
+};
+
+// One frame set from every camera, all captured within the matching tolerance of each other. Must be released before the manager is closed.
+struct FrameBundle
+{
+    std::vector<FrameSetHandle> frames; // Indexed like the cameras of the manager
+    int64_t hostTime;                   // Oldest FrameSet::hostTime in the bundle
+    int64_t spread;                     // Newest minus oldest FrameSet::hostTime, never more than the tolerance
+
+    FrameBundle()
+        : hostTime()
+        , spread()
+    {
+    }
+};
+
+// Runs several cameras at once, each with its own DSAPI instance and CaptureEngine on its own (optionally pinned) grab thread, and
+// matches their frame sets by host timestamp into FrameBundles. Matching happens on the thread calling NextBundle(), which only reads the
+// engines' lock-free rings, so the capture threads never wait on each other or on the consumer.
+class MultiCameraManager
+{
+    struct Camera
+    {
+        uint32_t serialNumber;
+        std::shared_ptr<DSAPI> ds; // Declared first so that it is destroyed after the engine and everything pinning its ring
+        std::unique_ptr<CaptureEngine> engine;
+        std::unique_ptr<FrameSetReader> reader;
+        int notifier;
+        FrameSetHandle head;       // Oldest frame set not yet bundled or discarded
+        uint64_t unmatched;
+        bool capturing;            // startCapture() succeeded and stopCapture() has not been called since
+    };
+
+    MultiCameraOptions options;
+    std::vector<std::unique_ptr<Camera>> cameras;
+    uint64_t bundles;
+    std::string lastError;
+
+    MultiCameraManager(const MultiCameraManager &) DS_DELETED_FUNCTION;
+    MultiCameraManager & operator=(const MultiCameraManager &) DS_DELETED_FUNCTION;
+
+    bool Fail(Camera & camera, const char * what);
+
+public:
+    explicit MultiCameraManager(const MultiCameraOptions & options = MultiCameraOptions());
+    ~MultiCameraManager();
+
+    // Opens and probes the cameras with the given serial numbers, in that order, or every connected camera if serialNumbers is empty.
+    // On failure nothing stays open and GetLastError() says which camera failed and why.
+    bool Open(const std::vector<uint32_t> & serialNumbers = std::vector<uint32_t>());
+    void Close();
+
+    int GetCameraCount() const { return static_cast<int>(cameras.size()); }
+    uint32_t GetSerialNumber(int camera) const { return cameras[camera]->serialNumber; }
+    // For configuring a camera before StartCapture(). While capturing, its grab thread owns grab() and the image accessors.
+    DSAPI & GetCamera(int camera) { return *cameras[camera]->ds; }
+    CaptureEngine & GetEngine(int camera) { return *cameras[camera]->engine; }
+
+    // startCapture() on every camera, then starts the grab threads. Stops everything again if any camera fails.
+    bool StartCapture();
+    void StopCapture();
+    // False if any grab thread has stopped, e.g. because a camera was unplugged
+    bool IsRunning() const;
+
+    // Returns the next bundle if one can be completed from the frame sets already captured, without blocking
+    bool TryNextBundle(FrameBundle & bundle);
+    // Waits up to timeout for the next bundle. Frame sets with no partner within the tolerance are discarded along the way.
+    bool NextBundle(FrameBundle & bundle, std::chrono::nanoseconds timeout);
+
+    uint64_t GetBundleCount() const { return bundles; }
+    // Frame sets of one camera discarded because no other camera had a frame set close enough in time
+    uint64_t GetUnmatchedCount(int camera) const { return cameras[camera]->unmatched; }
+    const std::string & GetLastError() const { return lastError; }
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Pacing of one stream over the most recent frames, all times in seconds
+struct PacingStats
+{
+    uint64_t frames;         // New frames seen since the last Reset()
+    uint64_t dropped;        // Frame numbers skipped, i.e. frames the camera produced that never reached us
+    uint64_t repeated;       // Calls that carried the same frame number as the previous one
+    double framesPerSecond;  // From host arrival times, over the window
+    double meanInterval;     // Host arrival interval over the window
+    double minInterval, maxInterval;
+    double jitter;           // Standard deviation of the host arrival interval
+    double deviceJitter;     // Standard deviation of the interval between device timestamps (getFrameTime(true))
+    double meanLatency;      // Host arrival time minus device timestamp. Assumes the DSAPI performance counter is CLOCK_MONOTONIC, like steady_clock on Linux.
+    double maxLatency;
+};
+
+// Measures frame pacing with std::chrono::steady_clock resolution: inter-frame intervals and their jitter, frames dropped according to
+// gaps in the frame number, and how late frames arrive on the host compared to the device timestamp. Needs no window system.
+// Not thread-safe; CaptureEngine keeps one per stream on its grab thread and hands out copies of the stats.
+class PacingMonitor
+{
+    struct Sample
+    {
+        double hostInterval, deviceInterval, latency;
+    };
+
+    std::vector<Sample> window;
+    size_t next, count;
+    bool started;
+    int lastFrameNumber;
+    int64_t lastHostTime;
+    double lastDeviceTime;
+    uint64_t frames, dropped, repeated;
+
+public:
+    // window is the number of most recent frames the interval, jitter and latency figures are computed over
+    explicit PacingMonitor(int window = 120);
+
+    // Call once per grab with getFrameNumber() (or getThirdFrameNumber()), getFrameTime(true) (or getThirdFrameTime(true)) and GetHostTime().
+    // Returns false if the frame number did not change, in which case only the repeat is counted.
+    bool OnFrame(int frameNumber, double deviceTime, int64_t hostTime);
+    void Reset();
+
+    PacingStats GetStats() const;
+};
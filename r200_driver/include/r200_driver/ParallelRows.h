@@ -0,0 +1,18 @@
+#pragma once
+
+#include <r200_driver/TaskScheduler.h>
+
+#include <functional>
+
+// Splitting of an image kernel into bands of rows run on the workers of a TaskScheduler and the calling thread, shared by every kernel of
+// the driver that can run in bands. A band starts on a row that starts a cache line of the destination, so that no two threads ever write
+// the same line, and has at least the kernel's grain of rows: the fewest worth handing to another thread.
+
+// Rows of rowBytes bytes each making up at least bytes, and at least one
+int GrainRows(int rowBytes, int bytes);
+
+// Calls body(begin, end) on bands of the rows [0, height) covering each row once, or once on all of them without a scheduler. destStride
+// is the distance in bytes between rows of the destination, whose first row is taken to start a cache line. With bands above 0, the rows
+// are split into that many bands instead of by grain.
+void ParallelForRows(TaskScheduler * scheduler, int height, int destStride, int grainRows, const std::function<void(int begin, int end)> & body,
+                     int bands = 0);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <r200_driver/CaptureEngine.h>
+
+#include <chrono>
+#include <cstdint>
+
+enum GrabResult
+{
+    GRAB_FRAME,   // A new frame set was returned
+    GRAB_TIMEOUT, // Nothing arrived within the timeout
+    GRAB_STALLED, // Nothing arrived within the timeout, and the stream has been silent for longer than the stall timeout
+    GRAB_STOPPED  // The engine is not running, CaptureEngine::GetLastGrabStatus() tells why if grab() failed
+};
+
+// Non-blocking front end to a CaptureEngine. The blocking DSAPI::grab() stays on the engine's thread, while this exposes a readable
+// eventfd for poll/epoll loops plus tryGrab() and grabFor(), so one thread can service several cameras, sockets and timers, and a
+// stalled USB stream shows up within a bounded time instead of hanging a thread in grab() forever.
+// Each PollableGrabber is one reader of the engine's ring and must be used from a single thread.
+class PollableGrabber
+{
+    CaptureEngine & engine;
+    FrameSetReader reader;
+    int slot;
+    int64_t stallTimeout;
+
+    PollableGrabber(const PollableGrabber &) DS_DELETED_FUNCTION;
+    PollableGrabber & operator=(const PollableGrabber &) DS_DELETED_FUNCTION;
+
+public:
+    // stallTimeout is how long the stream may stay silent while the engine is running before grabFor() reports GRAB_STALLED
+    explicit PollableGrabber(CaptureEngine & engine, std::chrono::nanoseconds stallTimeout = std::chrono::seconds(1));
+    ~PollableGrabber();
+
+    // False if the engine had no reader slot or notifier left
+    bool valid() const { return reader.valid() && slot >= 0; }
+
+    // Becomes readable when a new frame set is available or the engine stops. Owned by the engine, do not close it.
+    // tryGrab() and grabFor() clear it, so an edge-triggered epoll should call tryGrab() until it returns false.
+    int fd() const { return slot >= 0 ? engine.NotifierFd(slot) : -1; }
+
+    // Takes the newest frame set published since the last call, if any, without blocking. Older unread ones are skipped.
+    bool tryGrab(FrameSetHandle & frame);
+    // Waits up to timeout for a new frame set
+    GrabResult grabFor(FrameSetHandle & frame, std::chrono::nanoseconds timeout);
+
+    // True if the engine is running but has not published anything for longer than the stall timeout
+    bool IsStalled() const;
+    // Seconds since the engine last published a frame set (or was started)
+    double GetSecondsSinceLastFrame() const;
+};
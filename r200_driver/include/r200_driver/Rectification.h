@@ -0,0 +1,60 @@
+#pragma once
+
+#include <r200_driver/ColorConversion.h>
+#include <r200_driver/Demosaic.h>
+#include <r200_driver/ImageConversion.h>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Rectification of the third camera's native YUY2 and Raw10 images in one pass, in place of converting the whole image to BGRA8, calling
+// DSRectifyBGRA8ToBGRA8 and resizing the result. The destination is made in tiles: for each one, only the source pixels its part of the
+// rectification table samples are converted, into a buffer small enough to stay in cache, and its pixels are sampled from there. Nothing
+// the size of the image is written in between.
+//
+// Each rectified pixel is interpolated exactly like DSRectifyBGRA8ToBGRA8 does, so without downscaling the result is bit-identical to the
+// three separate passes.
+class FusedRectifier
+{
+    // A rectangle of the output and the part of the source its table entries sample, neighbours included
+    struct Tile
+    {
+        int x, y, width, height;
+        ImageRegion source;
+    };
+
+    // Converts the source pixels of region into a BGRA8 buffer with rows stride bytes apart
+    typedef std::function<void(const ImageRegion & region, uint8_t * buffer, int stride)> ConvertFunction;
+
+    std::vector<uint32_t> table;
+    int sourceWidth, sourceHeight, tableWidth, downscale;
+    int width, height;
+    std::vector<Tile> tiles;
+
+    void Rectify(const ConvertFunction & convert, TaskScheduler * scheduler, uint8_t * destImage, int destStride, int pixelSize) const;
+    void RectifyYUY2(const void * sourceImage, int sourceStride, uint8_t * destImage, int destStride, int pixelSize,
+                     const YuvConversionOptions & options) const;
+    void RectifyRaw10(const void * sourceImage, int sourceStride, uint8_t * destImage, int destStride, int pixelSize,
+                      const DemosaicOptions & options) const;
+
+public:
+    // table is what DSRectificationTable made for a tableWidth x tableHeight rectified image of a sourceWidth x sourceHeight one, and is
+    // copied. Each output pixel is the average of a downscale x downscale block of rectified pixels, so the output is tableWidth / downscale
+    // by tableHeight / downscale.
+    FusedRectifier(const uint32_t * table, int sourceWidth, int sourceHeight, int tableWidth, int tableHeight, int downscale = 1);
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+    // sourceStride and destStride are in bytes from one row to the next. The options are those of the conversion, except that their
+    // region is ignored and their scheduler, if set, converts and samples whole tiles on its workers and the calling thread.
+    void RectifyYUY2ToRGB8(const void * sourceImage, int sourceStride, uint8_t * destImage, int destStride,
+                           const YuvConversionOptions & options = YuvConversionOptions()) const;
+    void RectifyYUY2ToBGRA8(const void * sourceImage, int sourceStride, uint8_t * destImage, int destStride,
+                            const YuvConversionOptions & options = YuvConversionOptions()) const;
+    void RectifyRaw10ToRGB8(const void * sourceImage, int sourceStride, uint8_t * destImage, int destStride,
+                            const DemosaicOptions & options = DemosaicOptions()) const;
+    void RectifyRaw10ToBGRA8(const void * sourceImage, int sourceStride, uint8_t * destImage, int destStride,
+                             const DemosaicOptions & options = DemosaicOptions()) const;
+};
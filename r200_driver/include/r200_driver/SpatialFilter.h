@@ -0,0 +1,35 @@
+#pragma once
+
+#include <r200_driver/TaskScheduler.h>
+
+#include <cstdint>
+
+// Edge-preserving smoothing of Z16 depth images with a recursive domain-transform filter. Each pass runs a first-order recursive filter
+// along every row, both ways, then along every column, both ways: a pixel moves towards the one before it by 1 - alpha of the difference,
+// unless the difference is delta or more, which is taken as a depth edge and cuts the chain. Invalid pixels (depth 0) are left as they are
+// and cut it too, so nothing bleeds into or out of a hole. The rows are filtered several at a time, one per lane of a vector, and the
+// columns side by side, with SSE2 or NEON kernels picked like the ones of ImageConversion.h that give the same result as the scalar one.
+
+struct SpatialFilterOptions
+{
+    float alpha;               // Weight of each pixel against the filtered one before it, from 0.25 (strongest smoothing) to 1 (none)
+    float delta;               // Smallest step in depth, in millimetres, kept as an edge
+    int iterations;            // Passes over the image, 1 to 5
+    int zUnits;                // Micrometres per Z unit, from DSAPI::getZUnits(), to convert delta
+    TaskScheduler * scheduler; // If set, bands of rows and of columns are filtered on its workers and the calling thread
+
+    SpatialFilterOptions()
+        : alpha(0.5f)
+        , delta(20)
+        , iterations(2)
+        , zUnits(1000)
+        , scheduler(nullptr)
+    {
+    }
+};
+
+// depthStride and filteredStride are in bytes from one row to the next; the shorthand takes packed rows. filtered may be depthImage itself.
+void FilterDepthSpatial(const uint16_t * depthImage, int width, int height, int depthStride, uint16_t * filtered, int filteredStride,
+                        const SpatialFilterOptions & options = SpatialFilterOptions());
+void FilterDepthSpatial(const uint16_t * depthImage, int width, int height, uint16_t * filtered,
+                        const SpatialFilterOptions & options = SpatialFilterOptions());
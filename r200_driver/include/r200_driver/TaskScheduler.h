@@ -0,0 +1,80 @@
+#pragma once
+
+#include <r200_driver/DSAPI.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A unit of work: function(context, a, b). Plain data so that spawning one never allocates beyond the worker's queue.
+typedef void (*TaskFunction)(void * context, int a, int b);
+
+struct Task
+{
+    TaskFunction function;
+    void * context;
+    int a, b;
+};
+
+struct TaskSchedulerStats
+{
+    int workers;
+    int queued;        // Tasks waiting to run
+    uint64_t executed; // Tasks run so far
+    uint64_t stolen;   // Tasks a worker took from another worker's queue
+};
+
+// Fixed set of worker threads with one task queue each. A task spawned from a worker goes to that worker's own queue, which it runs
+// newest first while the data is still in its cache; a task spawned from any other thread is dealt round-robin. Idle workers steal the
+// oldest task from the other queues before going to sleep.
+class TaskScheduler
+{
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<int> queued;
+    std::atomic<bool> stopping;
+    std::atomic<unsigned> nextWorker;
+    std::atomic<uint64_t> executed, stolen;
+
+    TaskScheduler(const TaskScheduler &) DS_DELETED_FUNCTION;
+    TaskScheduler & operator=(const TaskScheduler &) DS_DELETED_FUNCTION;
+
+    void Run(int index);
+    bool Pop(int index, Task & task);
+    bool Steal(int index, Task & task);
+
+public:
+    // threads 0 starts one worker per hardware thread. With firstCpu >= 0, worker i is pinned to CPU (firstCpu + i) modulo
+    // the CPU count.
+    explicit TaskScheduler(int threads = 0, int firstCpu = -1);
+    // Runs every task still queued, then joins the workers
+    ~TaskScheduler();
+
+    int WorkerCount() const { return static_cast<int>(workers.size()); }
+
+    // Queues function(context, a, b) to run on one of the workers. Safe from any thread, including from inside a task.
+    void Spawn(TaskFunction function, void * context, int a = 0, int b = 0);
+
+    // Index of the worker of this scheduler running the calling thread, or -1 on any other thread
+    int CurrentWorker() const;
+
+    // Splits [0, count) into parts contiguous ranges and calls body(begin, end) on each, on the workers and on the calling thread, returning
+    // once every range is done. Ranges go to whichever thread is free first. Safe from inside a task, which never waits on a busy queue.
+    void ParallelFor(int count, int parts, const std::function<void(int begin, int end)> & body);
+
+    TaskSchedulerStats GetStats() const;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <r200_driver/TaskScheduler.h>
+
+#include <cstdint>
+#include <vector>
+
+// Temporal filtering of a stream of Z16 depth images, against the flicker of the depth of low-texture surfaces. Each pixel is smoothed
+// exponentially while it moves less than a threshold from one frame to the next, and jumps to the new depth on larger changes, which are
+// real motion. A history of which of the last 8 frames each pixel was valid in lets a pixel that was valid often enough keep its depth
+// through a short dropout. The kernels are SSE2 or NEON, picked like the ones of ImageConversion.h, and give the same result as the scalar one.
+
+struct TemporalFilterOptions
+{
+    float alpha;               // Weight of the new depth in the smoothed one, from 0 (frozen) to 1 (no smoothing), in steps of 1/256
+    int delta;                 // Largest change in Z units still smoothed, up to 32767. Larger changes replace the smoothed depth.
+    int persistenceValid;      // A pixel missing from a frame keeps its smoothed depth if it was valid in at least persistenceValid of
+    int persistenceFrames;     // the last persistenceFrames frames, this one included, up to 8. 0 valid frames always keeps it.
+    TaskScheduler * scheduler; // If set, bands of rows are filtered on its workers and the calling thread
+
+    TemporalFilterOptions()
+        : alpha(0.4f)
+        , delta(20)
+        , persistenceValid(2)
+        , persistenceFrames(4)
+        , scheduler(nullptr)
+    {
+    }
+};
+
+// Keeps the smoothed depth and the validity history of every pixel of one resolution, allocated up front so that filtering a frame
+// allocates nothing. Not safe to use from several threads at once; split a frame with the scheduler of the options instead.
+class TemporalDepthFilter
+{
+    TemporalFilterOptions options;
+    int width, height;
+    std::vector<uint16_t> smoothed;
+    std::vector<uint8_t> history; // Bit i set if the pixel was valid i frames ago
+
+public:
+    TemporalDepthFilter(int width, int height, const TemporalFilterOptions & options = TemporalFilterOptions());
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    const TemporalFilterOptions & GetOptions() const { return options; }
+    void SetOptions(const TemporalFilterOptions & options) { this->options = options; }
+
+    // Forgets every frame seen so far, keeping the resolution
+    void Reset();
+    // Allocates the state for another resolution, which also resets it
+    void Resize(int width, int height);
+
+    // Filters the next frame of the stream, of the filter's resolution, into filtered, which may be depthImage itself. depthStride and
+    // filteredStride are in bytes from one row to the next; the shorthand takes packed rows.
+    void Filter(const uint16_t * depthImage, int depthStride, uint16_t * filtered, int filteredStride);
+    void Filter(const uint16_t * depthImage, uint16_t * filtered);
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <r200_driver/FrameSet.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Latency percentiles of one traced stage, in nanoseconds
+struct TraceStageStats
+{
+    std::string name;
+    uint64_t count;
+    int64_t p50, p95, p99, max;
+};
+
+// Low overhead tracing of pipeline stages. Every thread records into its own lock-free ring of the most recent events, so recording never
+// takes a lock or allocates after the first event of a thread, and every stage also feeds a latency histogram that can be read at any time.
+// The ring of a thread that exits goes, with its events, to the next thread that starts recording, so there are never more rings than
+// threads tracing at once. While disabled, a TRACE_SCOPE costs one relaxed atomic load.
+class Tracer
+{
+public:
+    static const int MAX_STAGES = 64;
+    static const int EVENTS_PER_THREAD = 16384;
+
+    static void Enable(bool enabled);
+    static bool IsEnabled();
+
+    // Returns the id of the stage with this name, registering it on first use. name must stay valid for the life of the program.
+    static int RegisterStage(const char * name);
+    // Records one execution of stage on the calling thread. begin and end are GetHostTime() values, arg is shown in the trace (e.g. a frame number).
+    static void Record(int stage, int64_t begin, int64_t end, int64_t arg = -1);
+    // Names the calling thread in exported traces. name must stay valid for the life of the thread.
+    static void SetThreadName(const char * name);
+
+    // Writes the events still held in the per-thread rings as Chrome trace-event JSON (chrome://tracing, Perfetto). Safe while tracing.
+    static bool WriteChromeTrace(const char * path);
+
+    // Percentiles of every stage recorded so far
+    static std::vector<TraceStageStats> GetStageStats();
+    static void ResetStats();
+};
+
+extern std::atomic<bool> g_traceEnabled;
+
+inline bool Tracer::IsEnabled()
+{
+    return g_traceEnabled.load(std::memory_order_relaxed);
+}
+
+// Records the enclosing scope as one execution of a stage, if tracing is enabled when the scope is entered
+class TraceScope
+{
+    int stage;
+    int64_t begin, arg;
+
+    TraceScope(const TraceScope &) DS_DELETED_FUNCTION;
+    TraceScope & operator=(const TraceScope &) DS_DELETED_FUNCTION;
+
+public:
+    explicit TraceScope(int stage, int64_t arg = -1)
+        : stage(stage)
+        , begin(Tracer::IsEnabled() ? GetHostTime() : 0)
+        , arg(arg)
+    {
+    }
+    ~TraceScope()
+    {
+        if (begin) Tracer::Record(stage, begin, GetHostTime(), arg);
+    }
+
+    // For arguments only known at the end of the stage, such as the frame number after grab()
+    void SetArg(int64_t value) { arg = value; }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// Traces the rest of the enclosing scope as the stage called name (a string literal)
+#define TRACE_SCOPE(name)                                                                    \
+    static const int TRACE_CONCAT(traceStage, __LINE__) = Tracer::RegisterStage(name);     \
+    TraceScope TRACE_CONCAT(traceScope, __LINE__)(TRACE_CONCAT(traceStage, __LINE__))
+
+// Same as TRACE_SCOPE, with an argument shown in the trace
+#define TRACE_SCOPE_ARG(name, arg)                                                           \
+    static const int TRACE_CONCAT(traceStage, __LINE__) = Tracer::RegisterStage(name);     \
+    TraceScope TRACE_CONCAT(traceScope, __LINE__)(TRACE_CONCAT(traceStage, __LINE__), (arg))
@@ -0,0 +1,271 @@
+#include <r200_driver/BufferPool.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+size_t RoundUp(size_t value, size_t multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+void UpdateMax(std::atomic<int> & maximum, int value)
+{
+    int current = maximum.load(std::memory_order_relaxed);
+    while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+}
+
+BufferPool::BufferPool(const BufferPoolOptions & options)
+    : options(options)
+    , stride(RoundUp(options.bufferSize, ALIGNMENT))
+    , mappedSize()
+    , memory()
+    , hugePages(false)
+    , locked(false)
+    , nextFree(new std::atomic<uint32_t>[options.bufferCount > 0 ? options.bufferCount : 1])
+    , freeHead(NONE)
+    , references(new std::atomic<int>[options.bufferCount > 0 ? options.bufferCount : 1])
+    , poolsCreated(0)
+    , largestRequest(0)
+    , outstanding(0)
+    , highWaterMark(0)
+    , shared(0)
+    , allocations(0)
+    , allocationFailures(0)
+    , invalidReleases(0)
+{
+    if (options.bufferCount <= 0 || options.bufferSize == 0) return;
+
+#ifdef _WIN32
+    mappedSize = stride * options.bufferCount;
+    memory = static_cast<uint8_t *>(_aligned_malloc(mappedSize, ALIGNMENT));
+    if (!memory) return;
+#else
+    if (options.useHugePages)
+    {
+        mappedSize = RoundUp(stride * options.bufferCount, HUGE_PAGE_SIZE);
+        void * p = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            memory = static_cast<uint8_t *>(p);
+            hugePages = true;
+        }
+    }
+    if (!memory)
+    {
+        mappedSize = RoundUp(stride * options.bufferCount, HUGE_PAGE_SIZE);
+        void * p = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return;
+        memory = static_cast<uint8_t *>(p);
+#ifdef MADV_HUGEPAGE
+        if (options.useHugePages) madvise(memory, mappedSize, MADV_HUGEPAGE);
+#endif
+    }
+    if (options.lockMemory) locked = mlock(memory, mappedSize) == 0;
+#endif
+
+    // Touch every page now so that the capture path never takes a page fault
+    memset(memory, 0, mappedSize);
+
+    for (int i = 0; i < options.bufferCount; ++i)
+    {
+        nextFree[i].store(i + 1 < options.bufferCount ? i + 1 : NONE, std::memory_order_relaxed);
+        references[i].store(0, std::memory_order_relaxed);
+    }
+    freeHead.store(0, std::memory_order_release);
+}
+
+BufferPool::~BufferPool()
+{
+    if (!memory) return;
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    if (locked) munlock(memory, mappedSize);
+    munmap(memory, mappedSize);
+#endif
+}
+
+void BufferPool::Register(DSAPI & ds)
+{
+    if (valid()) ds.registerBufferAllocationCallbacks(&BufferPool::OnCreatePool, &BufferPool::OnGetBuffer, &BufferPool::OnReleaseBuffer, &BufferPool::OnDestroyPool, this);
+}
+
+bool BufferPool::CreatePool(int size)
+{
+    UpdateMax(largestRequest, size);
+    if (!memory || size < 0 || static_cast<size_t>(size) > stride)
+    {
+        allocationFailures.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    poolsCreated.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool BufferPool::GetBuffer(uint8_t ** out)
+{
+    uint64_t head = freeHead.load(std::memory_order_acquire);
+    for (;;)
+    {
+        const uint32_t index = static_cast<uint32_t>(head);
+        if (index == NONE)
+        {
+            allocationFailures.fetch_add(1, std::memory_order_relaxed);
+            *out = nullptr;
+            return false;
+        }
+        const uint64_t next = ((head >> 32) + 1) << 32 | nextFree[index].load(std::memory_order_relaxed);
+        if (freeHead.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            references[index].store(1, std::memory_order_relaxed);
+            *out = Buffer(index);
+            allocations.fetch_add(1, std::memory_order_relaxed);
+            UpdateMax(highWaterMark, outstanding.fetch_add(1, std::memory_order_relaxed) + 1);
+            return true;
+        }
+    }
+}
+
+bool BufferPool::ReleaseBuffer(uint8_t * buffer)
+{
+    const int index = IndexOf(buffer);
+    if (index < 0 || buffer != Buffer(index) || !DropReference(index))
+    {
+        invalidReleases.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+BufferRef BufferPool::Share(int index)
+{
+    if (index < 0 || index >= options.bufferCount || !memory || !AddReference(index)) return BufferRef();
+    return BufferRef(this, index);
+}
+
+bool BufferPool::AddReference(int index)
+{
+    // A buffer whose count reached 0 is already on the free list: reviving it would push it there a second time on the next drop
+    int count = references[index].load(std::memory_order_relaxed);
+    do
+    {
+        if (count <= 0) return false;
+    } while (!references[index].compare_exchange_weak(count, count + 1, std::memory_order_relaxed, std::memory_order_relaxed));
+
+    shared.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool BufferPool::DropReference(int index)
+{
+    int count = references[index].load(std::memory_order_relaxed);
+    do
+    {
+        if (count <= 0) return false;
+    } while (!references[index].compare_exchange_weak(count, count - 1, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+    if (count == 1) PushFree(index);
+    return true;
+}
+
+void BufferPool::PushFree(int index)
+{
+    uint64_t head = freeHead.load(std::memory_order_relaxed);
+    do
+    {
+        nextFree[index].store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+    } while (!freeHead.compare_exchange_weak(head, ((head >> 32) + 1) << 32 | static_cast<uint32_t>(index), std::memory_order_release, std::memory_order_relaxed));
+
+    outstanding.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool BufferPool::DestroyPool(int size)
+{
+    // A size CreatePool refused matches no pool it accepted
+    if (!memory || size < 0 || static_cast<size_t>(size) > stride)
+    {
+        invalidReleases.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    // The memory stays reserved until the BufferPool itself is destroyed, so that a later startCapture() can reuse it
+    poolsCreated.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+int BufferPool::IndexOf(const void * address) const
+{
+    const uint8_t * p = static_cast<const uint8_t *>(address);
+    if (!memory || p < memory || p >= memory + stride * options.bufferCount) return -1;
+    return static_cast<int>((p - memory) / stride);
+}
+
+BufferPoolStats BufferPool::GetStats() const
+{
+    BufferPoolStats stats;
+    stats.bufferCount = memory ? options.bufferCount : 0;
+    stats.bufferSize = stride;
+    stats.hugePages = hugePages;
+    stats.locked = locked;
+    stats.poolsCreated = poolsCreated.load(std::memory_order_relaxed);
+    stats.largestRequest = largestRequest.load(std::memory_order_relaxed);
+    stats.outstanding = outstanding.load(std::memory_order_relaxed);
+    stats.highWaterMark = highWaterMark.load(std::memory_order_relaxed);
+    stats.shared = shared.load(std::memory_order_relaxed);
+    stats.allocations = allocations.load(std::memory_order_relaxed);
+    stats.allocationFailures = allocationFailures.load(std::memory_order_relaxed);
+    stats.invalidReleases = invalidReleases.load(std::memory_order_relaxed);
+    return stats;
+}
+
+bool BufferPool::OnCreatePool(int size, void * userContext)
+{
+    return static_cast<BufferPool *>(userContext)->CreatePool(size);
+}
+
+bool BufferPool::OnGetBuffer(uint8_t ** out, void * userContext)
+{
+    return static_cast<BufferPool *>(userContext)->GetBuffer(out);
+}
+
+bool BufferPool::OnReleaseBuffer(uint8_t * buffer, void * userContext)
+{
+    return static_cast<BufferPool *>(userContext)->ReleaseBuffer(buffer);
+}
+
+bool BufferPool::OnDestroyPool(int size, void * userContext)
+{
+    return static_cast<BufferPool *>(userContext)->DestroyPool(size);
+}
+
+BufferRef::BufferRef(const BufferRef & other)
+    : pool(other.pool)
+    , index(other.index)
+{
+    if (pool) pool->AddReference(index);
+}
+
+void BufferRef::reset()
+{
+    if (pool)
+    {
+        pool->shared.fetch_sub(1, std::memory_order_relaxed);
+        pool->DropReference(index);
+    }
+    pool = nullptr;
+}
+
+const uint8_t * BufferRef::data() const
+{
+    return pool ? pool->Buffer(index) : nullptr;
+}
@@ -0,0 +1,202 @@
+#include <r200_driver/CaptureEngine.h>
+#include <r200_driver/Trace.h>
+
+#include <system_error>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+CaptureEngine::CaptureEngine(DSAPI & ds, int ringCapacity, int maxReaders, FrameDropPolicy policy)
+    : ds(ds)
+    , ring(ringCapacity, maxReaders, policy)
+    , running(false)
+    , stopRequested(false)
+    , grabCount(0)
+    , grabFailures(0)
+    , lastGrabStatus(DS_NO_ERROR)
+    , mailbox(nullptr)
+    , pool(nullptr)
+    , cpu(-1)
+    , lastFrameTime(0)
+    , pacingStats()
+    , thirdPacingStats()
+    , notifierCount(maxReaders > 0 ? maxReaders : 1)
+    , notifierFds(new int[notifierCount])
+    , notifierUsed(new std::atomic<bool>[notifierCount])
+{
+    for (int i = 0; i < notifierCount; ++i)
+    {
+        notifierFds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        notifierUsed[i].store(false, std::memory_order_relaxed);
+    }
+}
+
+CaptureEngine::~CaptureEngine()
+{
+    Stop();
+    for (int i = 0; i < notifierCount; ++i)
+        if (notifierFds[i] >= 0) close(notifierFds[i]);
+}
+
+bool CaptureEngine::Start()
+{
+    Stop();
+    stopRequested.store(false);
+    lastGrabStatus.store(DS_NO_ERROR);
+    lastFrameTime.store(GetHostTime(), std::memory_order_release);
+    pacing.Reset();
+    thirdPacing.Reset();
+    {
+        std::lock_guard<std::mutex> lock(pacingMutex);
+        pacingStats = thirdPacingStats = PacingStats();
+    }
+    firstGrab = std::promise<bool>();
+    std::future<bool> started = firstGrab.get_future();
+    running.store(true, std::memory_order_release);
+    try
+    {
+        thread = std::thread(&CaptureEngine::Run, this);
+    }
+    catch (const std::system_error &)
+    {
+        running.store(false, std::memory_order_release);
+        return false;
+    }
+    if (cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+    }
+    if (started.get()) return true;
+    Stop();
+    return false;
+}
+
+void CaptureEngine::Stop()
+{
+    stopRequested.store(true);
+    if (thread.joinable()) thread.join();
+    running.store(false, std::memory_order_release);
+}
+
+void CaptureEngine::Run()
+{
+    Tracer::SetThreadName("grab");
+    static const int grabStage = Tracer::RegisterStage("grab");
+    bool first = true;
+    while (!stopRequested.load(std::memory_order_relaxed))
+    {
+        {
+            TraceScope trace(grabStage);
+            const bool grabbed = ds.grab();
+            if (!grabbed)
+            {
+                grabFailures.fetch_add(1, std::memory_order_relaxed);
+                lastGrabStatus.store(ds.getLastErrorStatus(), std::memory_order_release);
+            }
+            if (first)
+            {
+                firstGrab.set_value(grabbed);
+                first = false;
+            }
+            if (!grabbed) break;
+            trace.SetArg(ds.getFrameNumber());
+        }
+        grabCount.fetch_add(1, std::memory_order_relaxed);
+        UpdatePacing();
+
+        if (FrameMailbox * latest = mailbox.load(std::memory_order_acquire))
+        {
+            TRACE_SCOPE("publish mailbox");
+            latest->Publish(ds, pool);
+        }
+
+        // If no buffer is available the ring has counted the drop. Either way we go straight back to grab().
+        uint64_t sequence = 0;
+        if (FrameSet * frameSet = ring.BeginWrite(sequence))
+        {
+            TRACE_SCOPE("publish ring");
+            if (pool)
+                CaptureFrameSet(ds, *pool, *frameSet);
+            else
+            {
+                ReserveFrameSet(ds, *frameSet);
+                CopyFrameSet(ds, *frameSet);
+            }
+            frameSet->sequence = sequence;
+            ring.CommitWrite();
+            lastFrameTime.store(frameSet->hostTime, std::memory_order_release);
+            Notify();
+        }
+    }
+    if (first) firstGrab.set_value(false); // Stopped before the first grab()
+    running.store(false, std::memory_order_release);
+    Notify();
+}
+
+void CaptureEngine::UpdatePacing()
+{
+    const int64_t now = GetHostTime();
+    pacing.OnFrame(ds.getFrameNumber(), ds.getFrameTime(true), now);
+    DSThird * third = ds.accessThird();
+    if (third && third->isThirdEnabled()) thirdPacing.OnFrame(third->getThirdFrameNumber(), third->getThirdFrameTime(true), now);
+
+    const PacingStats stats = pacing.GetStats(), thirdStats = thirdPacing.GetStats();
+    if (pacingMutex.try_lock())
+    {
+        pacingStats = stats;
+        thirdPacingStats = thirdStats;
+        pacingMutex.unlock();
+    }
+}
+
+PacingStats CaptureEngine::GetPacingStats() const
+{
+    std::lock_guard<std::mutex> lock(pacingMutex);
+    return pacingStats;
+}
+
+PacingStats CaptureEngine::GetThirdPacingStats() const
+{
+    std::lock_guard<std::mutex> lock(pacingMutex);
+    return thirdPacingStats;
+}
+
+void CaptureEngine::Notify()
+{
+    const uint64_t one = 1;
+    for (int i = 0; i < notifierCount; ++i)
+    {
+        if (!notifierUsed[i].load(std::memory_order_acquire)) continue;
+        // A full counter (EAGAIN) still leaves the descriptor readable, which is all a poller needs
+        const ssize_t written = write(notifierFds[i], &one, sizeof(one));
+        (void)written;
+    }
+}
+
+int CaptureEngine::AcquireNotifier()
+{
+    for (int i = 0; i < notifierCount; ++i)
+    {
+        bool expected = false;
+        if (notifierFds[i] >= 0 && notifierUsed[i].compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+        {
+            // Clear anything signalled for a previous owner of the slot
+            uint64_t count;
+            while (read(notifierFds[i], &count, sizeof(count)) > 0)
+            {
+            }
+            return i;
+        }
+    }
+    return -1;
+}
+
+void CaptureEngine::ReleaseNotifier(int slot)
+{
+    if (slot >= 0 && slot < notifierCount) notifierUsed[slot].store(false, std::memory_order_release);
+}
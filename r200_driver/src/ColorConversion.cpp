@@ -0,0 +1,1049 @@
+#include <r200_driver/ColorConversion.h>
+#include <r200_driver/ParallelRows.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVERSION_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERSION_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+// The conversion in 13 bit fixed point: with u = U - 128 and v = V - 128,
+//   R = (y * (Y - yOffset) + rv * v + 4096) >> 13
+//   G = (y * (Y - yOffset) + gu * u + gv * v + 4096) >> 13
+//   B = (y * (Y - yOffset) + bu * u + 4096) >> 13
+// clamped to 0-255. Every term fits 32 bits, so the SIMD kernels compute exactly what the scalar one does.
+struct YuvCoefficients
+{
+    int y, yBias; // yBias = 4096 - y * yOffset
+    int rv, gu, gv, bu;
+    int yMin; // The NV12 kernels take Y samples below it as yMin
+};
+
+YuvCoefficients GetCoefficients(YuvMatrix matrix, YuvRange range)
+{
+    const double kr = matrix == YUV_BT709 ? 0.2126 : 0.299;
+    const double kb = matrix == YUV_BT709 ? 0.0722 : 0.114;
+    const double kg = 1 - kr - kb;
+    // Limited range stretches 219 levels of luma and 224 levels of chroma to 255
+    const double luma = range == YUV_LIMITED_RANGE ? 255.0 / 219 : 1;
+    const double chroma = range == YUV_LIMITED_RANGE ? 255.0 / 224 : 1;
+    const int yOffset = range == YUV_LIMITED_RANGE ? 16 : 0;
+
+    YuvCoefficients k;
+    k.y = static_cast<int>(std::lround(luma * 8192));
+    k.yBias = 4096 - k.y * yOffset;
+    k.rv = static_cast<int>(std::lround(2 * (1 - kr) * chroma * 8192));
+    k.gu = static_cast<int>(std::lround(-2 * (1 - kb) * kb / kg * chroma * 8192));
+    k.gv = static_cast<int>(std::lround(-2 * (1 - kr) * kr / kg * chroma * 8192));
+    k.bu = static_cast<int>(std::lround(2 * (1 - kb) * chroma * 8192));
+    k.yMin = 0;
+    return k;
+}
+
+// One row of each conversion, like the kernels of ImageConversion.cpp. Width is even, so every vector starts on a pixel pair.
+struct YuvKernels
+{
+    void (*toRgb8)(const uint8_t * source, int width, const YuvCoefficients & k, uint8_t * dest);
+    void (*toBgra8)(const uint8_t * source, int width, const YuvCoefficients & k, uint8_t * dest);
+    void (*toL8)(const uint8_t * source, int width, uint8_t * dest);
+    void (*toL16)(const uint8_t * source, int width, int shift, uint16_t * dest);
+};
+
+// The same for NV12, from a row of Y samples and the row of U, V pairs it shares with its neighbour. Luminance8 is a plain copy.
+struct Nv12Kernels
+{
+    void (*toRgb8)(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & k, uint8_t * dest);
+    void (*toBgr8)(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & k, uint8_t * dest);
+    void (*toBgra8)(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & k, uint8_t * dest);
+    void (*toL16)(const uint8_t * luma, int width, int shift, uint16_t * dest);
+};
+
+inline uint8_t Clamp(int value)
+{
+    return static_cast<uint8_t>(std::min(std::max(value >> 13, 0), 255));
+}
+
+// Writes a pair of pixels sharing the chroma samples u and v to dest, with step bytes per pixel and R, G and B at offsets r, g and b
+inline void ConvertPairScalar(int y0, int y1, int u, int v, const YuvCoefficients & k, uint8_t * dest, int step, int r, int g, int b)
+{
+    u -= 128;
+    v -= 128;
+    const int red = k.rv * v, green = k.gu * u + k.gv * v, blue = k.bu * u;
+    const int y[2] = {k.y * y0 + k.yBias, k.y * y1 + k.yBias};
+    for (int i = 0; i < 2; ++i, dest += step)
+    {
+        dest[r] = Clamp(y[i] + red);
+        dest[g] = Clamp(y[i] + green);
+        dest[b] = Clamp(y[i] + blue);
+    }
+}
+
+void YUY2ToRGB8Scalar(const uint8_t * source, int width, const YuvCoefficients & k, uint8_t * dest)
+{
+    for (int x = 0; x < width; x += 2, source += 4)
+        ConvertPairScalar(source[0], source[2], source[1], source[3], k, dest + 3 * x, 3, 0, 1, 2);
+}
+
+void YUY2ToBGRA8Scalar(const uint8_t * source, int width, const YuvCoefficients & k, uint8_t * dest)
+{
+    for (int x = 0; x < width; x += 2, source += 4)
+    {
+        ConvertPairScalar(source[0], source[2], source[1], source[3], k, dest + 4 * x, 4, 2, 1, 0);
+        dest[4 * x + 3] = dest[4 * x + 7] = 255;
+    }
+}
+
+void YUY2ToL8Scalar(const uint8_t * source, int width, uint8_t * dest)
+{
+    for (int x = 0; x < width; ++x)
+        dest[x] = source[2 * x];
+}
+
+void YUY2ToL16Scalar(const uint8_t * source, int width, int shift, uint16_t * dest)
+{
+    for (int x = 0; x < width; ++x)
+        dest[x] = static_cast<uint16_t>(source[2 * x] << shift);
+}
+
+void NV12ToRGB8Scalar(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & k, uint8_t * dest)
+{
+    for (int x = 0; x < width; x += 2)
+        ConvertPairScalar(std::max<int>(luma[x], k.yMin), std::max<int>(luma[x + 1], k.yMin), chroma[x], chroma[x + 1], k, dest + 3 * x, 3, 0, 1, 2);
+}
+
+void NV12ToBGR8Scalar(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & k, uint8_t * dest)
+{
+    for (int x = 0; x < width; x += 2)
+        ConvertPairScalar(std::max<int>(luma[x], k.yMin), std::max<int>(luma[x + 1], k.yMin), chroma[x], chroma[x + 1], k, dest + 3 * x, 3, 2, 1, 0);
+}
+
+void NV12ToBGRA8Scalar(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & k, uint8_t * dest)
+{
+    for (int x = 0; x < width; x += 2)
+    {
+        ConvertPairScalar(std::max<int>(luma[x], k.yMin), std::max<int>(luma[x + 1], k.yMin), chroma[x], chroma[x + 1], k, dest + 4 * x, 4, 2, 1, 0);
+        dest[4 * x + 3] = dest[4 * x + 7] = 255;
+    }
+}
+
+void NV12ToL16Scalar(const uint8_t * luma, int width, int shift, uint16_t * dest)
+{
+    for (int x = 0; x < width; ++x)
+        dest[x] = static_cast<uint16_t>(luma[x] << shift);
+}
+
+#ifdef CONVERSION_X86
+// A pair of words, low first, as one 32 bit lane
+inline int WordPair(int low, int high)
+{
+    return static_cast<int>((static_cast<uint32_t>(low) & 0xFFFF) | static_cast<uint32_t>(high) << 16);
+}
+
+// The coefficients as pairs of words for pmaddwd, which multiplies a (Y, U), (Y, V) or (U, V) pair of words and adds the two products
+struct YuvConstantsSSE2
+{
+    __m128i y, yBias, rv, g, bu, yMin;
+
+    TARGET_SSE2 explicit YuvConstantsSSE2(const YuvCoefficients & k)
+        : y(_mm_set1_epi32(WordPair(k.y, 0)))
+        , yBias(_mm_set1_epi32(k.yBias))
+        , rv(_mm_set1_epi32(WordPair(0, k.rv)))
+        , g(_mm_set1_epi32(WordPair(k.gu, k.gv)))
+        , bu(_mm_set1_epi32(WordPair(k.bu, 0)))
+        , yMin(_mm_set1_epi8(static_cast<char>(k.yMin)))
+    {
+    }
+};
+
+// Four pixels from their words Y0 U0 Y1 V0 Y2 U1 Y3 V1, as one 32 bit value per pixel before the final shift
+TARGET_SSE2 inline void ConvertQuadSSE2(__m128i words, const YuvConstantsSSE2 & k, __m128i & r, __m128i & g, __m128i & b)
+{
+    // Each (Y, U) or (Y, V) pair times (y, 0) leaves y * Y, and each pixel gets the (U, V) pair of its chroma sample
+    const __m128i y = _mm_add_epi32(_mm_madd_epi16(words, k.y), k.yBias);
+    const __m128i uv = _mm_sub_epi16(_mm_shufflehi_epi16(_mm_shufflelo_epi16(words, _MM_SHUFFLE(3, 1, 3, 1)), _MM_SHUFFLE(3, 1, 3, 1)), _mm_set1_epi16(128));
+    r = _mm_srai_epi32(_mm_add_epi32(y, _mm_madd_epi16(uv, k.rv)), 13);
+    g = _mm_srai_epi32(_mm_add_epi32(y, _mm_madd_epi16(uv, k.g)), 13);
+    b = _mm_srai_epi32(_mm_add_epi32(y, _mm_madd_epi16(uv, k.bu)), 13);
+}
+
+// Sixteen pixels from 32 bytes of YUY2 in two registers, clamped to one byte per channel
+TARGET_SSE2 inline void Convert16SSE2(const __m128i * yuy2, const YuvConstantsSSE2 & k, __m128i & r, __m128i & g, __m128i & b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i r16[2], g16[2], b16[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        const __m128i v = yuy2[i];
+        __m128i r0, g0, b0, r1, g1, b1;
+        ConvertQuadSSE2(_mm_unpacklo_epi8(v, zero), k, r0, g0, b0);
+        ConvertQuadSSE2(_mm_unpackhi_epi8(v, zero), k, r1, g1, b1);
+        r16[i] = _mm_packs_epi32(r0, r1);
+        g16[i] = _mm_packs_epi32(g0, g1);
+        b16[i] = _mm_packs_epi32(b0, b1);
+    }
+    r = _mm_packus_epi16(r16[0], r16[1]);
+    g = _mm_packus_epi16(g16[0], g16[1]);
+    b = _mm_packus_epi16(b16[0], b16[1]);
+}
+
+TARGET_SSE2 inline void Convert16SSE2(const uint8_t * source, const YuvConstantsSSE2 & k, __m128i & r, __m128i & g, __m128i & b)
+{
+    const __m128i yuy2[2] = {_mm_loadu_si128(reinterpret_cast<const __m128i *>(source)),
+                             _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 16))};
+    Convert16SSE2(yuy2, k, r, g, b);
+}
+
+// Sixteen pixels of NV12. Interleaving the Y and the U, V bytes gives them in YUY2 order.
+TARGET_SSE2 inline void Convert16SSE2(const uint8_t * luma, const uint8_t * chroma, const YuvConstantsSSE2 & k, __m128i & r, __m128i & g, __m128i & b)
+{
+    const __m128i y = _mm_max_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(luma)), k.yMin);
+    const __m128i uv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(chroma));
+    const __m128i yuy2[2] = {_mm_unpacklo_epi8(y, uv), _mm_unpackhi_epi8(y, uv)};
+    Convert16SSE2(yuy2, k, r, g, b);
+}
+
+TARGET_SSE2 inline void StoreBGRA16SSE2(__m128i r, __m128i g, __m128i b, uint8_t * dest)
+{
+    const __m128i alpha = _mm_set1_epi8(-1);
+    const __m128i bgLow = _mm_unpacklo_epi8(b, g), bgHigh = _mm_unpackhi_epi8(b, g);
+    const __m128i raLow = _mm_unpacklo_epi8(r, alpha), raHigh = _mm_unpackhi_epi8(r, alpha);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dest), _mm_unpacklo_epi16(bgLow, raLow));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + 16), _mm_unpackhi_epi16(bgLow, raLow));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + 32), _mm_unpacklo_epi16(bgHigh, raHigh));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + 48), _mm_unpackhi_epi16(bgHigh, raHigh));
+}
+
+TARGET_SSE2 void YUY2ToBGRA8SSE2(const uint8_t * source, int width, const YuvCoefficients & coefficients, uint8_t * dest)
+{
+    if (width < 16)
+    {
+        YUY2ToBGRA8Scalar(source, width, coefficients, dest);
+        return;
+    }
+    const YuvConstantsSSE2 k(coefficients);
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        __m128i r, g, b;
+        Convert16SSE2(source + 2 * x, k, r, g, b);
+        StoreBGRA16SSE2(r, g, b, dest + 4 * x);
+        if (x + 16 == width) break;
+    }
+}
+
+TARGET_SSE2 void NV12ToBGRA8SSE2(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & coefficients, uint8_t * dest)
+{
+    if (width < 16)
+    {
+        NV12ToBGRA8Scalar(luma, chroma, width, coefficients, dest);
+        return;
+    }
+    const YuvConstantsSSE2 k(coefficients);
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        __m128i r, g, b;
+        Convert16SSE2(luma + x, chroma + x, k, r, g, b);
+        StoreBGRA16SSE2(r, g, b, dest + 4 * x);
+        if (x + 16 == width) break;
+    }
+}
+
+TARGET_SSE2 void YUY2ToL8SSE2(const uint8_t * source, int width, uint8_t * dest)
+{
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    if (width < 16)
+    {
+        YUY2ToL8Scalar(source, width, dest);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 2 * x));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 2 * x + 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + x), _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low)));
+        if (x + 16 == width) break;
+    }
+}
+
+TARGET_SSE2 void YUY2ToL16SSE2(const uint8_t * source, int width, int shift, uint16_t * dest)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    if (width < 8)
+    {
+        YUY2ToL16Scalar(source, width, shift, dest);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 8, width - 8))
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 2 * x));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + x), _mm_sll_epi16(_mm_and_si128(v, low), count));
+        if (x + 8 == width) break;
+    }
+}
+
+TARGET_SSE2 void NV12ToL16SSE2(const uint8_t * luma, int width, int shift, uint16_t * dest)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m128i zero = _mm_setzero_si128();
+    if (width < 16)
+    {
+        NV12ToL16Scalar(luma, width, shift, dest);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(luma + x));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + x), _mm_sll_epi16(_mm_unpacklo_epi8(v, zero), count));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + x + 8), _mm_sll_epi16(_mm_unpackhi_epi8(v, zero), count));
+        if (x + 16 == width) break;
+    }
+}
+
+// Interleaves 16 bytes each of R, G and B into 48 bytes of RGB
+TARGET_SSSE3 inline void StoreRGB16SSSE3(__m128i r, __m128i g, __m128i b, uint8_t * dest)
+{
+    const __m128i r0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+    const __m128i g0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+    const __m128i b0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+    const __m128i g1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+    const __m128i b1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+    const __m128i b2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dest),
+                     _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r0), _mm_shuffle_epi8(g, g0)), _mm_shuffle_epi8(b, b0)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + 16),
+                     _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r1), _mm_shuffle_epi8(g, g1)), _mm_shuffle_epi8(b, b1)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + 32),
+                     _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r2), _mm_shuffle_epi8(g, g2)), _mm_shuffle_epi8(b, b2)));
+}
+
+TARGET_SSSE3 void YUY2ToRGB8SSSE3(const uint8_t * source, int width, const YuvCoefficients & coefficients, uint8_t * dest)
+{
+    if (width < 16)
+    {
+        YUY2ToRGB8Scalar(source, width, coefficients, dest);
+        return;
+    }
+    const YuvConstantsSSE2 k(coefficients);
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        __m128i r, g, b;
+        Convert16SSE2(source + 2 * x, k, r, g, b);
+        StoreRGB16SSSE3(r, g, b, dest + 3 * x);
+        if (x + 16 == width) break;
+    }
+}
+
+TARGET_SSSE3 void NV12ToRGB8SSSE3(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & coefficients, uint8_t * dest)
+{
+    if (width < 16)
+    {
+        NV12ToRGB8Scalar(luma, chroma, width, coefficients, dest);
+        return;
+    }
+    const YuvConstantsSSE2 k(coefficients);
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        __m128i r, g, b;
+        Convert16SSE2(luma + x, chroma + x, k, r, g, b);
+        StoreRGB16SSSE3(r, g, b, dest + 3 * x);
+        if (x + 16 == width) break;
+    }
+}
+
+TARGET_SSSE3 void NV12ToBGR8SSSE3(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & coefficients, uint8_t * dest)
+{
+    if (width < 16)
+    {
+        NV12ToBGR8Scalar(luma, chroma, width, coefficients, dest);
+        return;
+    }
+    const YuvConstantsSSE2 k(coefficients);
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        __m128i r, g, b;
+        Convert16SSE2(luma + x, chroma + x, k, r, g, b);
+        StoreRGB16SSSE3(b, g, r, dest + 3 * x);
+        if (x + 16 == width) break;
+    }
+}
+
+struct YuvConstantsAVX2
+{
+    __m256i y, yBias, rv, g, bu, yMin;
+
+    TARGET_AVX2 explicit YuvConstantsAVX2(const YuvCoefficients & k)
+        : y(_mm256_set1_epi32(WordPair(k.y, 0)))
+        , yBias(_mm256_set1_epi32(k.yBias))
+        , rv(_mm256_set1_epi32(WordPair(0, k.rv)))
+        , g(_mm256_set1_epi32(WordPair(k.gu, k.gv)))
+        , bu(_mm256_set1_epi32(WordPair(k.bu, 0)))
+        , yMin(_mm256_set1_epi8(static_cast<char>(k.yMin)))
+    {
+    }
+};
+
+TARGET_AVX2 inline void ConvertQuadsAVX2(__m256i words, const YuvConstantsAVX2 & k, __m256i & r, __m256i & g, __m256i & b)
+{
+    const __m256i y = _mm256_add_epi32(_mm256_madd_epi16(words, k.y), k.yBias);
+    const __m256i uv =
+        _mm256_sub_epi16(_mm256_shufflehi_epi16(_mm256_shufflelo_epi16(words, _MM_SHUFFLE(3, 1, 3, 1)), _MM_SHUFFLE(3, 1, 3, 1)), _mm256_set1_epi16(128));
+    r = _mm256_srai_epi32(_mm256_add_epi32(y, _mm256_madd_epi16(uv, k.rv)), 13);
+    g = _mm256_srai_epi32(_mm256_add_epi32(y, _mm256_madd_epi16(uv, k.g)), 13);
+    b = _mm256_srai_epi32(_mm256_add_epi32(y, _mm256_madd_epi16(uv, k.bu)), 13);
+}
+
+// Thirty-two pixels from 64 bytes of YUY2. Widening and packing both work within 128 bit lanes: the unpacks of each 32 bytes give pixels
+// 0-3 | 8-11 and 4-7 | 12-15, which the first pack puts back in order, and the second pack's 64 bit quarters are put in order by the permute.
+TARGET_AVX2 inline void Convert32AVX2(const __m256i * yuy2, const YuvConstantsAVX2 & k, __m256i & r, __m256i & g, __m256i & b)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i r16[2], g16[2], b16[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        const __m256i v = yuy2[i];
+        __m256i r0, g0, b0, r1, g1, b1;
+        ConvertQuadsAVX2(_mm256_unpacklo_epi8(v, zero), k, r0, g0, b0);
+        ConvertQuadsAVX2(_mm256_unpackhi_epi8(v, zero), k, r1, g1, b1);
+        r16[i] = _mm256_packs_epi32(r0, r1);
+        g16[i] = _mm256_packs_epi32(g0, g1);
+        b16[i] = _mm256_packs_epi32(b0, b1);
+    }
+    r = _mm256_permute4x64_epi64(_mm256_packus_epi16(r16[0], r16[1]), _MM_SHUFFLE(3, 1, 2, 0));
+    g = _mm256_permute4x64_epi64(_mm256_packus_epi16(g16[0], g16[1]), _MM_SHUFFLE(3, 1, 2, 0));
+    b = _mm256_permute4x64_epi64(_mm256_packus_epi16(b16[0], b16[1]), _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+TARGET_AVX2 inline void Convert32AVX2(const uint8_t * source, const YuvConstantsAVX2 & k, __m256i & r, __m256i & g, __m256i & b)
+{
+    const __m256i yuy2[2] = {_mm256_loadu_si256(reinterpret_cast<const __m256i *>(source)),
+                             _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + 32))};
+    Convert32AVX2(yuy2, k, r, g, b);
+}
+
+// The byte interleave works within 128 bit lanes, giving pixels 0-7 | 16-23 and 8-15 | 24-31, so the lanes are swapped back in order
+TARGET_AVX2 inline void Convert32AVX2(const uint8_t * luma, const uint8_t * chroma, const YuvConstantsAVX2 & k, __m256i & r, __m256i & g, __m256i & b)
+{
+    const __m256i y = _mm256_max_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(luma)), k.yMin);
+    const __m256i uv = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(chroma));
+    const __m256i low = _mm256_unpacklo_epi8(y, uv), high = _mm256_unpackhi_epi8(y, uv);
+    const __m256i yuy2[2] = {_mm256_permute2x128_si256(low, high, 0x20), _mm256_permute2x128_si256(low, high, 0x31)};
+    Convert32AVX2(yuy2, k, r, g, b);
+}
+
+TARGET_AVX2 inline void StoreRGB32AVX2(__m256i r, __m256i g, __m256i b, uint8_t * dest)
+{
+    StoreRGB16SSSE3(_mm256_castsi256_si128(r), _mm256_castsi256_si128(g), _mm256_castsi256_si128(b), dest);
+    StoreRGB16SSSE3(_mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(b, 1), dest + 48);
+}
+
+TARGET_AVX2 inline void StoreBGRA32AVX2(__m256i r, __m256i g, __m256i b, uint8_t * dest)
+{
+    // The unpacks give pixels 0-7 | 16-23 and 8-15 | 24-31, and then groups of four pixels that the lane permutes put in order
+    const __m256i alpha = _mm256_set1_epi8(-1);
+    const __m256i bgLow = _mm256_unpacklo_epi8(b, g), bgHigh = _mm256_unpackhi_epi8(b, g);
+    const __m256i raLow = _mm256_unpacklo_epi8(r, alpha), raHigh = _mm256_unpackhi_epi8(r, alpha);
+    const __m256i q0 = _mm256_unpacklo_epi16(bgLow, raLow), q1 = _mm256_unpackhi_epi16(bgLow, raLow);
+    const __m256i q2 = _mm256_unpacklo_epi16(bgHigh, raHigh), q3 = _mm256_unpackhi_epi16(bgHigh, raHigh);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest), _mm256_permute2x128_si256(q0, q1, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + 32), _mm256_permute2x128_si256(q2, q3, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + 64), _mm256_permute2x128_si256(q0, q1, 0x31));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + 96), _mm256_permute2x128_si256(q2, q3, 0x31));
+}
+
+TARGET_AVX2 void YUY2ToRGB8AVX2(const uint8_t * source, int width, const YuvCoefficients & coefficients, uint8_t * dest)
+{
+    if (width < 32)
+    {
+        _mm256_zeroupper();
+        YUY2ToRGB8SSSE3(source, width, coefficients, dest);
+        return;
+    }
+    const YuvConstantsAVX2 k(coefficients);
+    for (int x = 0;; x = std::min(x + 32, width - 32))
+    {
+        __m256i r, g, b;
+        Convert32AVX2(source + 2 * x, k, r, g, b);
+        StoreRGB32AVX2(r, g, b, dest + 3 * x);
+        if (x + 32 == width) break;
+    }
+}
+
+TARGET_AVX2 void YUY2ToBGRA8AVX2(const uint8_t * source, int width, const YuvCoefficients & coefficients, uint8_t * dest)
+{
+    if (width < 32)
+    {
+        _mm256_zeroupper();
+        YUY2ToBGRA8SSE2(source, width, coefficients, dest);
+        return;
+    }
+    const YuvConstantsAVX2 k(coefficients);
+    for (int x = 0;; x = std::min(x + 32, width - 32))
+    {
+        __m256i r, g, b;
+        Convert32AVX2(source + 2 * x, k, r, g, b);
+        StoreBGRA32AVX2(r, g, b, dest + 4 * x);
+        if (x + 32 == width) break;
+    }
+}
+
+TARGET_AVX2 void YUY2ToL8AVX2(const uint8_t * source, int width, uint8_t * dest)
+{
+    const __m256i low = _mm256_set1_epi16(0x00FF);
+    if (width < 32)
+    {
+        _mm256_zeroupper();
+        YUY2ToL8SSE2(source, width, dest);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 32, width - 32))
+    {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + 2 * x));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + 2 * x + 32));
+        const __m256i y = _mm256_packus_epi16(_mm256_and_si256(a, low), _mm256_and_si256(b, low));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + x), _mm256_permute4x64_epi64(y, _MM_SHUFFLE(3, 1, 2, 0)));
+        if (x + 32 == width) break;
+    }
+}
+
+TARGET_AVX2 void YUY2ToL16AVX2(const uint8_t * source, int width, int shift, uint16_t * dest)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m256i low = _mm256_set1_epi16(0x00FF);
+    if (width < 16)
+    {
+        _mm256_zeroupper();
+        YUY2ToL16SSE2(source, width, shift, dest);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + 2 * x));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + x), _mm256_sll_epi16(_mm256_and_si256(v, low), count));
+        if (x + 16 == width) break;
+    }
+}
+
+TARGET_AVX2 void NV12ToRGB8AVX2(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & coefficients, uint8_t * dest)
+{
+    if (width < 32)
+    {
+        _mm256_zeroupper();
+        NV12ToRGB8SSSE3(luma, chroma, width, coefficients, dest);
+        return;
+    }
+    const YuvConstantsAVX2 k(coefficients);
+    for (int x = 0;; x = std::min(x + 32, width - 32))
+    {
+        __m256i r, g, b;
+        Convert32AVX2(luma + x, chroma + x, k, r, g, b);
+        StoreRGB32AVX2(r, g, b, dest + 3 * x);
+        if (x + 32 == width) break;
+    }
+}
+
+TARGET_AVX2 void NV12ToBGR8AVX2(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & coefficients, uint8_t * dest)
+{
+    if (width < 32)
+    {
+        _mm256_zeroupper();
+        NV12ToBGR8SSSE3(luma, chroma, width, coefficients, dest);
+        return;
+    }
+    const YuvConstantsAVX2 k(coefficients);
+    for (int x = 0;; x = std::min(x + 32, width - 32))
+    {
+        __m256i r, g, b;
+        Convert32AVX2(luma + x, chroma + x, k, r, g, b);
+        StoreRGB32AVX2(b, g, r, dest + 3 * x);
+        if (x + 32 == width) break;
+    }
+}
+
+TARGET_AVX2 void NV12ToBGRA8AVX2(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & coefficients, uint8_t * dest)
+{
+    if (width < 32)
+    {
+        _mm256_zeroupper();
+        NV12ToBGRA8SSE2(luma, chroma, width, coefficients, dest);
+        return;
+    }
+    const YuvConstantsAVX2 k(coefficients);
+    for (int x = 0;; x = std::min(x + 32, width - 32))
+    {
+        __m256i r, g, b;
+        Convert32AVX2(luma + x, chroma + x, k, r, g, b);
+        StoreBGRA32AVX2(r, g, b, dest + 4 * x);
+        if (x + 32 == width) break;
+    }
+}
+
+TARGET_AVX2 void NV12ToL16AVX2(const uint8_t * luma, int width, int shift, uint16_t * dest)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    if (width < 16)
+    {
+        _mm256_zeroupper();
+        NV12ToL16SSE2(luma, width, shift, dest);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        const __m256i v = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(luma + x)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + x), _mm256_sll_epi16(v, count));
+        if (x + 16 == width) break;
+    }
+}
+#endif
+
+#ifdef CONVERSION_NEON
+inline uint8x8_t ClampNEON(int32x4_t low, int32x4_t high)
+{
+    return vqmovun_s16(vcombine_s16(vqmovn_s32(vshrq_n_s32(low, 13)), vqmovn_s32(vshrq_n_s32(high, 13))));
+}
+
+// Sixteen pixels from their 8 even Y, U, odd Y and V samples
+inline uint8x16x3_t Convert16NEON(const uint8x8x4_t & v, const YuvCoefficients & k)
+{
+    const int16x8_t u = vreinterpretq_s16_u16(vsubl_u8(v.val[1], vdup_n_u8(128)));
+    const int16x8_t w = vreinterpretq_s16_u16(vsubl_u8(v.val[3], vdup_n_u8(128)));
+    const int32x4_t bias = vdupq_n_s32(k.yBias);
+
+    int32x4_t red[2], green[2], blue[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        const int16x4_t ui = i ? vget_high_s16(u) : vget_low_s16(u);
+        const int16x4_t vi = i ? vget_high_s16(w) : vget_low_s16(w);
+        red[i] = vmull_n_s16(vi, static_cast<int16_t>(k.rv));
+        green[i] = vmlal_n_s16(vmull_n_s16(ui, static_cast<int16_t>(k.gu)), vi, static_cast<int16_t>(k.gv));
+        blue[i] = vmull_n_s16(ui, static_cast<int16_t>(k.bu));
+    }
+
+    // Channel values of the even and the odd pixels, zipped back together
+    uint8x8_t r[2], g[2], b[2];
+    for (int odd = 0; odd < 2; ++odd)
+    {
+        const int16x8_t y = vreinterpretq_s16_u16(vmovl_u8(v.val[2 * odd]));
+        const int32x4_t low = vmlaq_n_s32(bias, vmovl_s16(vget_low_s16(y)), k.y);
+        const int32x4_t high = vmlaq_n_s32(bias, vmovl_s16(vget_high_s16(y)), k.y);
+        r[odd] = ClampNEON(vaddq_s32(low, red[0]), vaddq_s32(high, red[1]));
+        g[odd] = ClampNEON(vaddq_s32(low, green[0]), vaddq_s32(high, green[1]));
+        b[odd] = ClampNEON(vaddq_s32(low, blue[0]), vaddq_s32(high, blue[1]));
+    }
+    const uint8x8x2_t rs = vzip_u8(r[0], r[1]), gs = vzip_u8(g[0], g[1]), bs = vzip_u8(b[0], b[1]);
+    uint8x16x3_t rgb;
+    rgb.val[0] = vcombine_u8(rs.val[0], rs.val[1]);
+    rgb.val[1] = vcombine_u8(gs.val[0], gs.val[1]);
+    rgb.val[2] = vcombine_u8(bs.val[0], bs.val[1]);
+    return rgb;
+}
+
+// Sixteen pixels from 32 bytes of YUY2, which the structure load splits into the samples above
+inline uint8x16x3_t Convert16NEON(const uint8_t * source, const YuvCoefficients & k)
+{
+    return Convert16NEON(vld4_u8(source), k);
+}
+
+// Sixteen pixels of NV12, from the even and odd Y samples and the U and V samples split the same way
+inline uint8x16x3_t Convert16NEON(const uint8_t * luma, const uint8_t * chroma, const YuvCoefficients & k)
+{
+    const uint8x8x2_t y = vld2_u8(luma), uv = vld2_u8(chroma);
+    const uint8x8_t yMin = vdup_n_u8(static_cast<uint8_t>(k.yMin));
+    uint8x8x4_t v;
+    v.val[0] = vmax_u8(y.val[0], yMin);
+    v.val[1] = uv.val[0];
+    v.val[2] = vmax_u8(y.val[1], yMin);
+    v.val[3] = uv.val[1];
+    return Convert16NEON(v, k);
+}
+
+void YUY2ToRGB8NEON(const uint8_t * source, int width, const YuvCoefficients & k, uint8_t * dest)
+{
+    if (width < 16)
+    {
+        YUY2ToRGB8Scalar(source, width, k, dest);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        vst3q_u8(dest + 3 * x, Convert16NEON(source + 2 * x, k));
+        if (x + 16 == width) break;
+    }
+}
+
+void YUY2ToBGRA8NEON(const uint8_t * source, int width, const YuvCoefficients & k, uint8_t * dest)
+{
+    if (width < 16)
+    {
+        YUY2ToBGRA8Scalar(source, width, k, dest);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        const uint8x16x3_t rgb = Convert16NEON(source + 2 * x, k);
+        uint8x16x4_t bgra;
+        bgra.val[0] = rgb.val[2];
+        bgra.val[1] = rgb.val[1];
+        bgra.val[2] = rgb.val[0];
+        bgra.val[3] = vdupq_n_u8(255);
+        vst4q_u8(dest + 4 * x, bgra);
+        if (x + 16 == width) break;
+    }
+}
+
+void YUY2ToL8NEON(const uint8_t * source, int width, uint8_t * dest)
+{
+    if (width < 16)
+    {
+        YUY2ToL8Scalar(source, width, dest);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        vst1q_u8(dest + x, vld2q_u8(source + 2 * x).val[0]);
+        if (x + 16 == width) break;
+    }
+}
+
+void YUY2ToL16NEON(const uint8_t * source, int width, int shift, uint16_t * dest)
+{
+    const int16x8_t count = vdupq_n_s16(static_cast<int16_t>(shift));
+    if (width < 8)
+    {
+        YUY2ToL16Scalar(source, width, shift, dest);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 8, width - 8))
+    {
+        vst1q_u16(dest + x, vshlq_u16(vmovl_u8(vld2_u8(source + 2 * x).val[0]), count));
+        if (x + 8 == width) break;
+    }
+}
+
+void NV12ToRGB8NEON(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & k, uint8_t * dest)
+{
+    if (width < 16)
+    {
+        NV12ToRGB8Scalar(luma, chroma, width, k, dest);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        vst3q_u8(dest + 3 * x, Convert16NEON(luma + x, chroma + x, k));
+        if (x + 16 == width) break;
+    }
+}
+
+void NV12ToBGR8NEON(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & k, uint8_t * dest)
+{
+    if (width < 16)
+    {
+        NV12ToBGR8Scalar(luma, chroma, width, k, dest);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        uint8x16x3_t bgr = Convert16NEON(luma + x, chroma + x, k);
+        std::swap(bgr.val[0], bgr.val[2]);
+        vst3q_u8(dest + 3 * x, bgr);
+        if (x + 16 == width) break;
+    }
+}
+
+void NV12ToBGRA8NEON(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & k, uint8_t * dest)
+{
+    if (width < 16)
+    {
+        NV12ToBGRA8Scalar(luma, chroma, width, k, dest);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        const uint8x16x3_t rgb = Convert16NEON(luma + x, chroma + x, k);
+        uint8x16x4_t bgra;
+        bgra.val[0] = rgb.val[2];
+        bgra.val[1] = rgb.val[1];
+        bgra.val[2] = rgb.val[0];
+        bgra.val[3] = vdupq_n_u8(255);
+        vst4q_u8(dest + 4 * x, bgra);
+        if (x + 16 == width) break;
+    }
+}
+
+void NV12ToL16NEON(const uint8_t * luma, int width, int shift, uint16_t * dest)
+{
+    const int16x8_t count = vdupq_n_s16(static_cast<int16_t>(shift));
+    if (width < 8)
+    {
+        NV12ToL16Scalar(luma, width, shift, dest);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 8, width - 8))
+    {
+        vst1q_u16(dest + x, vshlq_u16(vmovl_u8(vld1_u8(luma + x)), count));
+        if (x + 8 == width) break;
+    }
+}
+#endif
+
+const YuvKernels g_scalarKernels = {YUY2ToRGB8Scalar, YUY2ToBGRA8Scalar, YUY2ToL8Scalar, YUY2ToL16Scalar};
+#ifdef CONVERSION_X86
+// Interleaving three channels takes a byte shuffle, which SSE2 does not have
+const YuvKernels g_sse2Kernels = {YUY2ToRGB8Scalar, YUY2ToBGRA8SSE2, YUY2ToL8SSE2, YUY2ToL16SSE2};
+const YuvKernels g_ssse3Kernels = {YUY2ToRGB8SSSE3, YUY2ToBGRA8SSE2, YUY2ToL8SSE2, YUY2ToL16SSE2};
+const YuvKernels g_avx2Kernels = {YUY2ToRGB8AVX2, YUY2ToBGRA8AVX2, YUY2ToL8AVX2, YUY2ToL16AVX2};
+#endif
+#ifdef CONVERSION_NEON
+const YuvKernels g_neonKernels = {YUY2ToRGB8NEON, YUY2ToBGRA8NEON, YUY2ToL8NEON, YUY2ToL16NEON};
+#endif
+
+const Nv12Kernels g_scalarNv12Kernels = {NV12ToRGB8Scalar, NV12ToBGR8Scalar, NV12ToBGRA8Scalar, NV12ToL16Scalar};
+#ifdef CONVERSION_X86
+const Nv12Kernels g_sse2Nv12Kernels = {NV12ToRGB8Scalar, NV12ToBGR8Scalar, NV12ToBGRA8SSE2, NV12ToL16SSE2};
+const Nv12Kernels g_ssse3Nv12Kernels = {NV12ToRGB8SSSE3, NV12ToBGR8SSSE3, NV12ToBGRA8SSE2, NV12ToL16SSE2};
+const Nv12Kernels g_avx2Nv12Kernels = {NV12ToRGB8AVX2, NV12ToBGR8AVX2, NV12ToBGRA8AVX2, NV12ToL16AVX2};
+#endif
+#ifdef CONVERSION_NEON
+const Nv12Kernels g_neonNv12Kernels = {NV12ToRGB8NEON, NV12ToBGR8NEON, NV12ToBGRA8NEON, NV12ToL16NEON};
+#endif
+
+// Follows SetConversionIsa() of ImageConversion.h
+const YuvKernels & GetKernels()
+{
+    switch (GetConversionIsa())
+    {
+#ifdef CONVERSION_X86
+    case CONVERSION_ISA_SSE2:
+        return g_sse2Kernels;
+    case CONVERSION_ISA_SSSE3:
+        return g_ssse3Kernels;
+    case CONVERSION_ISA_AVX2:
+        return g_avx2Kernels;
+#endif
+#ifdef CONVERSION_NEON
+    case CONVERSION_ISA_NEON:
+        return g_neonKernels;
+#endif
+    default:
+        return g_scalarKernels;
+    }
+}
+
+const Nv12Kernels & GetNv12Kernels()
+{
+    switch (GetConversionIsa())
+    {
+#ifdef CONVERSION_X86
+    case CONVERSION_ISA_SSE2:
+        return g_sse2Nv12Kernels;
+    case CONVERSION_ISA_SSSE3:
+        return g_ssse3Nv12Kernels;
+    case CONVERSION_ISA_AVX2:
+        return g_avx2Nv12Kernels;
+#endif
+#ifdef CONVERSION_NEON
+    case CONVERSION_ISA_NEON:
+        return g_neonNv12Kernels;
+#endif
+    default:
+        return g_scalarNv12Kernels;
+    }
+}
+
+// Least source bytes in a band of rows handed to another thread
+const int g_bandBytes = 32 * 1024;
+
+// Calls row(y) for every row, on the calling thread or split into bands as the options say. sourceRowBytes sets the grain of the bands and
+// destStride where they may start.
+template <class RowFunction> void ForEachRow(int height, int sourceRowBytes, int destStride, const YuvConversionOptions & options, RowFunction row)
+{
+    ParallelForRows(options.scheduler, height, destStride, GrainRows(sourceRowBytes, g_bandBytes), [&row](int begin, int end) {
+        for (int y = begin; y < end; ++y)
+            row(y);
+    }, options.bands);
+}
+
+// Calls row(y, source, width) for every row of the region, with source its first pixel
+template <class RowFunction>
+void ForEachYUY2Row(const void * sourceImage, int width, int height, int sourceStride, int destStride, const YuvConversionOptions & options, RowFunction row)
+{
+    const ImageRegion region = options.region.SourceIn(width, height);
+    const uint8_t * source = static_cast<const uint8_t *>(sourceImage) + region.y * sourceStride + region.x * 2;
+    ForEachRow(region.height, region.width * 2, destStride, options, [&](int y) { row(y, source + y * sourceStride, region.width); });
+}
+
+// Calls row(y, luma, chroma, width) for every row of the region, with luma and chroma its first Y sample and U, V pair
+template <class RowFunction>
+void ForEachNV12Row(const void * sourceImage, int width, int height, int sourceStride, int destStride, const YuvConversionOptions & options, RowFunction row)
+{
+    const ImageRegion region = options.region.SourceIn(width, height);
+    const uint8_t * luma = static_cast<const uint8_t *>(sourceImage) + region.x;
+    const uint8_t * chroma = luma + height * sourceStride;
+    ForEachRow(region.height, region.width * 3 / 2, destStride, options, [&](int y) {
+        const int sourceRow = region.y + y;
+        row(y, luma + sourceRow * sourceStride, chroma + sourceRow / 2 * sourceStride, region.width);
+    });
+}
+
+typedef void (*Nv12ColorKernel)(const uint8_t * luma, const uint8_t * chroma, int width, const YuvCoefficients & k, uint8_t * dest);
+
+// Converts with the kernel toColor of the Nv12Kernels, which writes pixelSize bytes per pixel
+void ConvertNV12ToColor(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                        const YuvConversionOptions & options, const YuvCoefficients & k, Nv12ColorKernel Nv12Kernels::*toColor, int pixelSize)
+{
+    const Nv12ColorKernel kernel = GetNv12Kernels().*toColor;
+    uint8_t * dest = options.region.DestinationIn(destImage, destStride, pixelSize);
+    ForEachNV12Row(sourceImage, width, height, sourceStride, destStride, options, [&](int y, const uint8_t * luma, const uint8_t * chroma, int w) {
+        kernel(luma, chroma, w, k, dest + y * destStride);
+    });
+}
+
+// What libDSAPI converts NV12 with: BT.601 limited range, taking Y below 16 as 16 rather than stretching it below black
+YuvCoefficients GetDSAPINv12Coefficients()
+{
+    YuvCoefficients k = GetCoefficients(YUV_BT601, YUV_LIMITED_RANGE);
+    k.yMin = 16;
+    return k;
+}
+}
+
+void ConvertYUY2ToRGB8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                       const YuvConversionOptions & options)
+{
+    const YuvKernels & kernels = GetKernels();
+    const YuvCoefficients k = GetCoefficients(options.matrix, options.range);
+    uint8_t * dest = options.region.DestinationIn(destImage, destStride, 3);
+    ForEachYUY2Row(sourceImage, width, height, sourceStride, destStride, options,
+                   [&](int y, const uint8_t * source, int w) { kernels.toRgb8(source, w, k, dest + y * destStride); });
+}
+
+void ConvertYUY2ToBGRA8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                        const YuvConversionOptions & options)
+{
+    const YuvKernels & kernels = GetKernels();
+    const YuvCoefficients k = GetCoefficients(options.matrix, options.range);
+    uint8_t * dest = options.region.DestinationIn(destImage, destStride, 4);
+    ForEachYUY2Row(sourceImage, width, height, sourceStride, destStride, options,
+                   [&](int y, const uint8_t * source, int w) { kernels.toBgra8(source, w, k, dest + y * destStride); });
+}
+
+void ConvertYUY2ToLuminance8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                             const YuvConversionOptions & options)
+{
+    const YuvKernels & kernels = GetKernels();
+    uint8_t * dest = options.region.DestinationIn(destImage, destStride, 1);
+    ForEachYUY2Row(sourceImage, width, height, sourceStride, destStride, options,
+                   [&](int y, const uint8_t * source, int w) { kernels.toL8(source, w, dest + y * destStride); });
+}
+
+void ConvertYUY2ToLuminance16(const void * sourceImage, int width, int height, int sourceStride, int shift, uint16_t * destImage, int destStride,
+                              const YuvConversionOptions & options)
+{
+    const YuvKernels & kernels = GetKernels();
+    uint8_t * dest = options.region.DestinationIn(reinterpret_cast<uint8_t *>(destImage), destStride, 2);
+    ForEachYUY2Row(sourceImage, width, height, sourceStride, destStride, options, [&](int y, const uint8_t * source, int w) {
+        kernels.toL16(source, w, shift, reinterpret_cast<uint16_t *>(dest + y * destStride));
+    });
+}
+
+void ConvertYUY2ToRGB8(const void * sourceImage, int width, int height, uint8_t * destImage)
+{
+    ConvertYUY2ToRGB8(sourceImage, width, height, width * 2, destImage, width * 3);
+}
+
+void ConvertYUY2ToBGRA8(const void * sourceImage, int width, int height, uint8_t * destImage)
+{
+    ConvertYUY2ToBGRA8(sourceImage, width, height, width * 2, destImage, width * 4);
+}
+
+void ConvertYUY2ToLuminance8(const void * sourceImage, int width, int height, uint8_t * destImage)
+{
+    ConvertYUY2ToLuminance8(sourceImage, width, height, width * 2, destImage, width);
+}
+
+void ConvertYUY2ToLuminance16(const void * sourceImage, int width, int height, int shift, uint16_t * destImage)
+{
+    ConvertYUY2ToLuminance16(sourceImage, width, height, width * 2, shift, destImage, width * 2);
+}
+
+void ConvertNV12ToRGB8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                       const YuvConversionOptions & options)
+{
+    ConvertNV12ToColor(sourceImage, width, height, sourceStride, destImage, destStride, options, GetCoefficients(options.matrix, options.range),
+                       &Nv12Kernels::toRgb8, 3);
+}
+
+void ConvertNV12ToBGR8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                       const YuvConversionOptions & options)
+{
+    ConvertNV12ToColor(sourceImage, width, height, sourceStride, destImage, destStride, options, GetCoefficients(options.matrix, options.range),
+                       &Nv12Kernels::toBgr8, 3);
+}
+
+void ConvertNV12ToBGRA8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                        const YuvConversionOptions & options)
+{
+    ConvertNV12ToColor(sourceImage, width, height, sourceStride, destImage, destStride, options, GetCoefficients(options.matrix, options.range),
+                        &Nv12Kernels::toBgra8, 4);
+}
+
+void ConvertNV12ToLuminance8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride,
+                             const YuvConversionOptions & options)
+{
+    uint8_t * dest = options.region.DestinationIn(destImage, destStride, 1);
+    ForEachNV12Row(sourceImage, width, height, sourceStride, destStride, options,
+                   [&](int y, const uint8_t * luma, const uint8_t *, int w) { memcpy(dest + y * destStride, luma, w); });
+}
+
+void ConvertNV12ToLuminance16(const void * sourceImage, int width, int height, int sourceStride, int shift, uint16_t * destImage, int destStride,
+                              const YuvConversionOptions & options)
+{
+    const Nv12Kernels & kernels = GetNv12Kernels();
+    uint8_t * dest = options.region.DestinationIn(reinterpret_cast<uint8_t *>(destImage), destStride, 2);
+    ForEachNV12Row(sourceImage, width, height, sourceStride, destStride, options, [&](int y, const uint8_t * luma, const uint8_t *, int w) {
+        kernels.toL16(luma, w, shift, reinterpret_cast<uint16_t *>(dest + y * destStride));
+    });
+}
+
+void ConvertNV12ToRGB8(const void * sourceImage, int width, int height, uint8_t * destImage)
+{
+    ConvertNV12ToColor(sourceImage, width, height, width, destImage, width * 3, YuvConversionOptions(), GetDSAPINv12Coefficients(), &Nv12Kernels::toRgb8,
+                       3);
+}
+
+void ConvertNV12ToBGR8(const void * sourceImage, int width, int height, uint8_t * destImage)
+{
+    ConvertNV12ToColor(sourceImage, width, height, width, destImage, width * 3, YuvConversionOptions(), GetDSAPINv12Coefficients(), &Nv12Kernels::toBgr8,
+                       3);
+}
+
+void ConvertNV12ToBGRA8(const void * sourceImage, int width, int height, uint8_t * destImage)
+{
+    ConvertNV12ToColor(sourceImage, width, height, width, destImage, width * 4, YuvConversionOptions(), GetDSAPINv12Coefficients(), &Nv12Kernels::toBgra8,
+                       4);
+}
+
+void ConvertNV12ToLuminance8(const void * sourceImage, int width, int height, uint8_t * destImage)
+{
+    ConvertNV12ToLuminance8(sourceImage, width, height, width, destImage, width);
+}
+
+void ConvertNV12ToLuminance16(const void * sourceImage, int width, int height, int shift, uint16_t * destImage)
+{
+    ConvertNV12ToLuminance16(sourceImage, width, height, width, shift, destImage, width * 2);
+}
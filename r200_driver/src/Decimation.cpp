@@ -0,0 +1,321 @@
+#include <r200_driver/Decimation.h>
+#include <r200_driver/ImageConversion.h>
+#include <r200_driver/ParallelRows.h>
+
+#include <algorithm>
+#include <vector>
+
+// Gathering the blocks is the same loads whatever the instruction set, and the minimum and the network a few operations per pixel, so
+// SSE2 does them on every x86 instruction set
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define CONVERSION_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERSION_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+// As in DepthPyramid.cpp, the minimum and the median work on keys, depth - 1 wrapped to 16 bits, so that 0 sorts after every valid depth.
+// Key() makes them from depths one at a time, as the blocks are gathered.
+struct ScalarOps
+{
+    typedef int Vector;
+    static const int size = 1;
+    static const uint16_t invalid = 0xFFFF;
+    static uint16_t Key(uint16_t depth) { return static_cast<uint16_t>(depth - 1); }
+    static Vector LoadKeys(const uint16_t * p) { return *p; }
+    static Vector LoadDepthKeys(const uint16_t * p) { return Key(*p); }
+    static void StoreKeys(uint16_t * p, Vector key) { *p = static_cast<uint16_t>(key); }
+    static void Store(uint16_t * p, Vector key) { *p = static_cast<uint16_t>(key + 1); }
+    static Vector Set(int value) { return value; }
+    static Vector Min(Vector a, Vector b) { return std::min(a, b); }
+    static Vector Max(Vector a, Vector b) { return std::max(a, b); }
+    static Vector Equal(Vector a, Vector b) { return a == b ? -1 : 0; }
+    static Vector Select(Vector mask, Vector a, Vector b) { return mask ? a : b; }
+    static Vector Add(Vector a, Vector b) { return a + b; }
+    static Vector Subtract(Vector a, Vector b) { return a - b; }
+    static Vector HalveSigned(Vector a) { return a >> 1; }
+};
+
+#ifdef CONVERSION_X86
+// SSE2 only compares signed words, so the keys are flipped to signed: the key of 0 is then 0x7FFF
+struct Sse2Ops
+{
+    typedef __m128i Vector;
+    static const int size = 8;
+    static const uint16_t invalid = 0x7FFF;
+    static uint16_t Key(uint16_t depth) { return static_cast<uint16_t>((depth - 1) ^ 0x8000); }
+    static Vector LoadKeys(const uint16_t * p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+    static Vector LoadDepthKeys(const uint16_t * p) { return _mm_xor_si128(_mm_add_epi16(LoadKeys(p), _mm_set1_epi16(-1)), _mm_set1_epi16(-0x8000)); }
+    static void StoreKeys(uint16_t * p, Vector key) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), key); }
+    static void Store(uint16_t * p, Vector key)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm_add_epi16(_mm_xor_si128(key, _mm_set1_epi16(-0x8000)), _mm_set1_epi16(1)));
+    }
+    static Vector Set(int value) { return _mm_set1_epi16(static_cast<int16_t>(value)); }
+    static Vector Min(Vector a, Vector b) { return _mm_min_epi16(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm_max_epi16(a, b); }
+    static Vector Equal(Vector a, Vector b) { return _mm_cmpeq_epi16(a, b); }
+    static Vector Select(Vector mask, Vector a, Vector b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+    static Vector Add(Vector a, Vector b) { return _mm_add_epi16(a, b); }
+    static Vector Subtract(Vector a, Vector b) { return _mm_sub_epi16(a, b); }
+    static Vector HalveSigned(Vector a) { return _mm_srai_epi16(a, 1); }
+};
+#endif
+
+#ifdef CONVERSION_NEON
+struct NeonOps
+{
+    typedef uint16x8_t Vector;
+    static const int size = 8;
+    static const uint16_t invalid = 0xFFFF;
+    static uint16_t Key(uint16_t depth) { return static_cast<uint16_t>(depth - 1); }
+    static Vector LoadKeys(const uint16_t * p) { return vld1q_u16(p); }
+    static Vector LoadDepthKeys(const uint16_t * p) { return vsubq_u16(vld1q_u16(p), vdupq_n_u16(1)); }
+    static void StoreKeys(uint16_t * p, Vector key) { vst1q_u16(p, key); }
+    static void Store(uint16_t * p, Vector key) { vst1q_u16(p, vaddq_u16(key, vdupq_n_u16(1))); }
+    static Vector Set(int value) { return vreinterpretq_u16_s16(vdupq_n_s16(static_cast<int16_t>(value))); }
+    static Vector Min(Vector a, Vector b) { return vminq_u16(a, b); }
+    static Vector Max(Vector a, Vector b) { return vmaxq_u16(a, b); }
+    static Vector Equal(Vector a, Vector b) { return vceqq_u16(a, b); }
+    static Vector Select(Vector mask, Vector a, Vector b) { return vbslq_u16(mask, a, b); }
+    static Vector Add(Vector a, Vector b) { return vaddq_u16(a, b); }
+    static Vector Subtract(Vector a, Vector b) { return vsubq_u16(a, b); }
+    static Vector HalveSigned(Vector a) { return vreinterpretq_u16_s16(vshrq_n_s16(vreinterpretq_s16_u16(a), 1)); }
+};
+#endif
+
+const int g_maxFactor = 8;
+const int g_maxKeys = g_maxFactor * g_maxFactor;
+
+// Batcher's odd-even merge sort of the keys of a block, as the pairs of positions each step orders. It sorts the next power of two of
+// keys; the positions past the last key stand for keys larger than any, which no step moves, so the steps that reach them are left out.
+struct SortingNetwork
+{
+    std::vector<uint8_t> pairs; // Lower and upper position of each step
+
+    explicit SortingNetwork(int keys)
+    {
+        int padded = 1;
+        while (padded < keys)
+            padded *= 2;
+        for (int p = 1; p < padded; p *= 2)
+            for (int k = p; k >= 1; k /= 2)
+                for (int j = k % p; j + k < padded; j += 2 * k)
+                    for (int i = 0; i < std::min(k, padded - j - k); ++i)
+                        if ((i + j) / (2 * p) == (i + j + k) / (2 * p) && i + j + k < keys)
+                        {
+                            pairs.push_back(static_cast<uint8_t>(i + j));
+                            pairs.push_back(static_cast<uint8_t>(i + j + k));
+                        }
+    }
+};
+
+const SortingNetwork & GetSortingNetwork(int factor)
+{
+    static const SortingNetwork networks[g_maxFactor - 1] = {SortingNetwork(4),  SortingNetwork(9),  SortingNetwork(16), SortingNetwork(25),
+                                                             SortingNetwork(36), SortingNetwork(49), SortingNetwork(64)};
+    return networks[factor - 2];
+}
+
+// The rows of the source one row of the decimated image is made from, and how
+struct BlockRow
+{
+    const uint16_t * rows[g_maxFactor];
+    int factor;
+    DepthReduction reduction;
+    const SortingNetwork * network;
+};
+
+// Keys of the columns of one row of blocks, for the minimum
+thread_local std::vector<uint16_t> t_columns;
+
+// The minimum of the rows of the blocks first, reading them whole vectors at a time, then of the columns of each block, gathered like the
+// keys of the median
+template <class V> void MinRow(const BlockRow & row, int width, uint16_t * dest)
+{
+    typedef typename V::Vector Vector;
+    const int factor = row.factor, span = width * factor;
+    std::vector<uint16_t> & columns = t_columns;
+    columns.resize(span);
+    int x = 0;
+    for (; x + V::size <= span; x += V::size)
+    {
+        Vector key = V::LoadDepthKeys(row.rows[0] + x);
+        for (int r = 1; r < factor; ++r)
+            key = V::Min(key, V::LoadDepthKeys(row.rows[r] + x));
+        V::StoreKeys(columns.data() + x, key);
+    }
+    for (; x < span; ++x)
+    {
+        uint16_t depthKey = ScalarOps::Key(row.rows[0][x]);
+        for (int r = 1; r < factor; ++r)
+            depthKey = std::min(depthKey, ScalarOps::Key(row.rows[r][x]));
+        columns[x] = V::Key(static_cast<uint16_t>(depthKey + 1));
+    }
+
+    for (x = 0; x + V::size <= width; x += V::size)
+    {
+        uint16_t keys[g_maxFactor][V::size];
+        for (int i = 0; i < V::size; ++i)
+        {
+            keys[0][i] = columns[(x + i) * factor];
+            for (int c = 1; c < factor; ++c)
+                keys[c][i] = columns[(x + i) * factor + c];
+        }
+        Vector key = V::LoadKeys(keys[0]);
+        for (int c = 1; c < factor; ++c)
+            key = V::Min(key, V::LoadKeys(keys[c]));
+        V::Store(dest + x, key);
+    }
+    if (V::size > 1 && x < width)
+    {
+        BlockRow tail = row;
+        for (int r = 0; r < factor; ++r)
+            tail.rows[r] += x * factor;
+        MinRow<ScalarOps>(tail, width - x, dest + x);
+    }
+}
+
+// Makes width decimated pixels, size at a time: the keys of the blocks are gathered so that keys[k] holds key k of every block, one block
+// per lane, then sorted across the vectors.
+template <class V> void DecimateRow(const BlockRow & row, int width, uint16_t * dest)
+{
+    typedef typename V::Vector Vector;
+    if (row.reduction == DEPTH_REDUCE_MIN) return MinRow<V>(row, width, dest);
+    const int factor = row.factor, count = factor * factor;
+    int x = 0;
+    for (; x + V::size <= width; x += V::size)
+    {
+        uint16_t keys[g_maxKeys][V::size];
+        for (int r = 0; r < factor; ++r)
+        {
+            const uint16_t * source = row.rows[r] + x * factor;
+            for (int i = 0; i < V::size; ++i)
+                for (int c = 0; c < factor; ++c)
+                    keys[r * factor + c][i] = V::Key(source[i * factor + c]);
+        }
+
+        Vector sorted[g_maxKeys];
+        for (int k = 0; k < count; ++k)
+            sorted[k] = V::LoadKeys(keys[k]);
+        const std::vector<uint8_t> & pairs = row.network->pairs;
+        for (size_t p = 0; p < pairs.size(); p += 2)
+        {
+            const Vector a = sorted[pairs[p]], b = sorted[pairs[p + 1]];
+            sorted[pairs[p]] = V::Min(a, b);
+            sorted[pairs[p + 1]] = V::Max(a, b);
+        }
+        // The invalid keys sort last, so the lower median of the valid ones is key (valid - 1) / 2, and none is taken without any. Each
+        // invalid key adds the -1 of its mask to the count.
+        const Vector invalid = V::Set(V::invalid);
+        Vector valid = V::Set(count);
+        for (int k = 0; k < count; ++k)
+            valid = V::Add(valid, V::Equal(sorted[k], invalid));
+        const Vector rank = V::HalveSigned(V::Subtract(valid, V::Set(1)));
+        Vector median = invalid;
+        for (int k = 0; k < (count + 1) / 2; ++k)
+            median = V::Select(V::Equal(rank, V::Set(k)), sorted[k], median);
+        V::Store(dest + x, median);
+    }
+    if (V::size > 1 && x < width)
+    {
+        BlockRow tail = row;
+        for (int r = 0; r < factor; ++r)
+            tail.rows[r] += x * factor;
+        DecimateRow<ScalarOps>(tail, width - x, dest + x);
+    }
+}
+
+// The mean sums the depths of each block as it reads them, which is the whole of the work whatever the instruction set
+void DecimateRowMean(const BlockRow & row, int width, uint16_t * dest)
+{
+    const int factor = row.factor;
+    for (int x = 0; x < width; ++x)
+    {
+        uint32_t sum = 0, count = 0;
+        for (int r = 0; r < factor; ++r)
+        {
+            const uint16_t * source = row.rows[r] + x * factor;
+            for (int c = 0; c < factor; ++c)
+            {
+                sum += source[c];
+                count += source[c] != 0;
+            }
+        }
+        dest[x] = static_cast<uint16_t>(count ? (sum + count / 2) / count : 0);
+    }
+}
+
+typedef void (*DecimateRowFunction)(const BlockRow & row, int width, uint16_t * dest);
+
+// Follows SetConversionIsa() of ImageConversion.h
+DecimateRowFunction GetDecimateRow()
+{
+    switch (GetConversionIsa())
+    {
+#ifdef CONVERSION_X86
+    case CONVERSION_ISA_SSE2:
+    case CONVERSION_ISA_SSSE3:
+    case CONVERSION_ISA_AVX2:
+        return DecimateRow<Sse2Ops>;
+#endif
+#ifdef CONVERSION_NEON
+    case CONVERSION_ISA_NEON:
+        return DecimateRow<NeonOps>;
+#endif
+    default:
+        return DecimateRow<ScalarOps>;
+    }
+}
+
+// Least source bytes in a band of rows handed to another thread
+const int g_bandBytes = 64 * 1024;
+}
+
+void DecimateDepth(const uint16_t * depthImage, int width, int height, int depthStride, uint16_t * decimated, int decimatedStride,
+                   const DecimationOptions & options)
+{
+    const int factor = std::min(g_maxFactor, std::max(2, options.factor));
+    const int decimatedWidth = width / factor, decimatedHeight = height / factor;
+    if (decimatedWidth <= 0 || decimatedHeight <= 0) return;
+
+    const DepthReduction reduction = options.reduction;
+    const DecimateRowFunction decimateRow = reduction == DEPTH_REDUCE_MEAN ? DecimateRowMean : GetDecimateRow();
+    const SortingNetwork * const network = &GetSortingNetwork(factor);
+    ParallelForRows(options.scheduler, decimatedHeight, decimatedStride, GrainRows(factor * width * 2, g_bandBytes), [=](int begin, int end) {
+        BlockRow row;
+        row.factor = factor;
+        row.reduction = reduction;
+        row.network = network;
+        for (int y = begin; y < end; ++y)
+        {
+            for (int r = 0; r < factor; ++r)
+                row.rows[r] = reinterpret_cast<const uint16_t *>(reinterpret_cast<const uint8_t *>(depthImage) + static_cast<ptrdiff_t>(y * factor + r) * depthStride);
+            decimateRow(row, decimatedWidth, reinterpret_cast<uint16_t *>(reinterpret_cast<uint8_t *>(decimated) + static_cast<ptrdiff_t>(y) * decimatedStride));
+        }
+    });
+}
+
+void DecimateDepth(const uint16_t * depthImage, int width, int height, uint16_t * decimated, const DecimationOptions & options)
+{
+    const int factor = std::min(g_maxFactor, std::max(2, options.factor));
+    DecimateDepth(depthImage, width, height, width * 2, decimated, width / factor * 2, options);
+}
+
+DSCalibIntrinsicsRectified DecimateIntrinsics(const DSCalibIntrinsicsRectified & intrinsics, int factor)
+{
+    factor = std::min(g_maxFactor, std::max(2, factor));
+    DSCalibIntrinsicsRectified decimated;
+    decimated.rfx = intrinsics.rfx / factor;
+    decimated.rfy = intrinsics.rfy / factor;
+    decimated.rpx = (intrinsics.rpx + 0.5f) / factor - 0.5f;
+    decimated.rpy = (intrinsics.rpy + 0.5f) / factor - 0.5f;
+    decimated.rw = static_cast<uint16_t>(intrinsics.rw / factor);
+    decimated.rh = static_cast<uint16_t>(intrinsics.rh / factor);
+    return decimated;
+}
@@ -0,0 +1,516 @@
+#include <r200_driver/Demosaic.h>
+#include <r200_driver/ParallelRows.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// The interpolation is written with SSE2, which every x86-64 CPU has
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define CONVERSION_X86 1
+#include <immintrin.h>
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERSION_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Each unpacked row is split into planes of its even and odd pixels, so that every sample of one color in a row is one step from the
+// next. The rows of the band are unpacked once, with two rows above and below it, then interpolated a row at a time.
+//
+// A row of the image is seen as sites of its own color (red on even rows, blue on odd ones) on the A columns, with green on the B columns
+// in between. Odd rows are viewed one pixel to the right, so that their blue sites are on A columns like the red ones of even rows and
+// both kinds of rows take the same interpolation: the color c of the row's own sites, green g and the other color x.
+
+namespace
+{
+// Padding on each side of a plane, for the samples mirrored past the edges and the vectors running past the end
+const int g_planePadding = 32;
+
+// Planes of one unpacked row, already shifted for the row being interpolated
+struct PlaneRow
+{
+    const int16_t * a;
+    const int16_t * b;
+};
+
+// What the interpolation adds to the samples of a row: green and the other color at the A columns, the row's color and the other
+// color at the B columns
+struct InterpolatedRow
+{
+    int16_t * gA, * xA;
+    int16_t * cB, * xB;
+};
+
+// The operations the interpolation needs on vectors of 16 bit values, or single values for the scalar version. Every sum stays within
+// 16 bits, so all versions give the same result.
+struct ScalarOps
+{
+    typedef int Vector;
+    static const int size = 1;
+    static Vector Load(const int16_t * p) { return *p; }
+    static void Store(int16_t * p, Vector v) { *p = static_cast<int16_t>(v); }
+    static Vector Add(Vector a, Vector b) { return a + b; }
+    static Vector Sub(Vector a, Vector b) { return a - b; }
+    static Vector Mul(Vector a, int b) { return a * b; }
+    template <int n> static Vector Round(Vector a) { return (a + (1 << (n - 1))) >> n; }
+    static Vector Clamp(Vector a) { return std::min(std::max(a, 0), 1023); }
+};
+
+#ifdef CONVERSION_X86
+struct Sse2Ops
+{
+    typedef __m128i Vector;
+    static const int size = 8;
+    static Vector Load(const int16_t * p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+    static void Store(int16_t * p, Vector v) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v); }
+    static Vector Add(Vector a, Vector b) { return _mm_add_epi16(a, b); }
+    static Vector Sub(Vector a, Vector b) { return _mm_sub_epi16(a, b); }
+    static Vector Mul(Vector a, int b) { return _mm_mullo_epi16(a, _mm_set1_epi16(static_cast<int16_t>(b))); }
+    template <int n> static Vector Round(Vector a) { return _mm_srai_epi16(_mm_add_epi16(a, _mm_set1_epi16(1 << (n - 1))), n); }
+    static Vector Clamp(Vector a) { return _mm_min_epi16(_mm_max_epi16(a, _mm_setzero_si128()), _mm_set1_epi16(1023)); }
+};
+#endif
+
+#ifdef CONVERSION_NEON
+struct NeonOps
+{
+    typedef int16x8_t Vector;
+    static const int size = 8;
+    static Vector Load(const int16_t * p) { return vld1q_s16(p); }
+    static void Store(int16_t * p, Vector v) { vst1q_s16(p, v); }
+    static Vector Add(Vector a, Vector b) { return vaddq_s16(a, b); }
+    static Vector Sub(Vector a, Vector b) { return vsubq_s16(a, b); }
+    static Vector Mul(Vector a, int b) { return vmulq_n_s16(a, static_cast<int16_t>(b)); }
+    template <int n> static Vector Round(Vector a) { return vrshrq_n_s16(a, n); }
+    static Vector Clamp(Vector a) { return vminq_s16(vmaxq_s16(a, vdupq_n_s16(0)), vdupq_n_s16(1023)); }
+};
+#endif
+
+// rows[2] is the row being interpolated, rows[0] and rows[4] the ones two above and below it. Interpolates the sites from begin to past
+// end in whole vectors.
+template <class V> void InterpolateBilinear(const PlaneRow * rows, int begin, int end, const InterpolatedRow & out)
+{
+    typedef typename V::Vector Vector;
+    const PlaneRow & above = rows[1], & row = rows[2], & below = rows[3];
+    for (int i = begin; i < end; i += V::size)
+    {
+        const Vector green = V::Add(V::Add(V::Load(row.b + i - 1), V::Load(row.b + i)), V::Add(V::Load(above.a + i), V::Load(below.a + i)));
+        const Vector diagonal =
+            V::Add(V::Add(V::Load(above.b + i - 1), V::Load(above.b + i)), V::Add(V::Load(below.b + i - 1), V::Load(below.b + i)));
+        V::Store(out.gA + i, V::template Round<2>(green));
+        V::Store(out.xA + i, V::template Round<2>(diagonal));
+        V::Store(out.cB + i, V::template Round<1>(V::Add(V::Load(row.a + i), V::Load(row.a + i + 1))));
+        V::Store(out.xB + i, V::template Round<1>(V::Add(V::Load(above.b + i), V::Load(below.b + i))));
+    }
+}
+
+// The Malvar-He-Cutler kernels, doubled so that their weights are whole numbers, hence the division by 16
+template <class V> void InterpolateMalvar(const PlaneRow * rows, int begin, int end, const InterpolatedRow & out)
+{
+    typedef typename V::Vector Vector;
+    const PlaneRow & above2 = rows[0], & above = rows[1], & row = rows[2], & below = rows[3], & below2 = rows[4];
+    for (int i = begin; i < end; i += V::size)
+    {
+        // At A: the site, its green neighbours, the same color two away and the other color on the diagonals
+        const Vector c = V::Load(row.a + i);
+        const Vector green = V::Add(V::Add(V::Load(row.b + i - 1), V::Load(row.b + i)), V::Add(V::Load(above.a + i), V::Load(below.a + i)));
+        const Vector cross = V::Add(V::Add(V::Load(row.a + i - 1), V::Load(row.a + i + 1)), V::Add(V::Load(above2.a + i), V::Load(below2.a + i)));
+        const Vector diagonal =
+            V::Add(V::Add(V::Load(above.b + i - 1), V::Load(above.b + i)), V::Add(V::Load(below.b + i - 1), V::Load(below.b + i)));
+        V::Store(out.gA + i, V::Clamp(V::template Round<4>(V::Sub(V::Add(V::Mul(c, 8), V::Mul(green, 4)), V::Mul(cross, 2)))));
+        V::Store(out.xA + i, V::Clamp(V::template Round<4>(V::Sub(V::Add(V::Mul(c, 12), V::Mul(diagonal, 4)), V::Mul(cross, 3)))));
+
+        // At B: the green site, the row's color left and right, the other color above and below, and green all around
+        const Vector g = V::Load(row.b + i);
+        const Vector horizontal = V::Add(V::Load(row.a + i), V::Load(row.a + i + 1));
+        const Vector vertical = V::Add(V::Load(above.b + i), V::Load(below.b + i));
+        const Vector corners = V::Add(V::Add(V::Load(above.a + i), V::Load(above.a + i + 1)), V::Add(V::Load(below.a + i), V::Load(below.a + i + 1)));
+        const Vector horizontal2 = V::Add(V::Load(row.b + i - 1), V::Load(row.b + i + 1));
+        const Vector vertical2 = V::Add(V::Load(above2.b + i), V::Load(below2.b + i));
+        const Vector base = V::Sub(V::Mul(g, 10), V::Mul(corners, 2));
+        V::Store(out.cB + i,
+                 V::Clamp(V::template Round<4>(V::Add(V::Sub(V::Add(base, V::Mul(horizontal, 8)), V::Mul(horizontal2, 2)), vertical2))));
+        V::Store(out.xB + i,
+                 V::Clamp(V::template Round<4>(V::Add(V::Sub(V::Add(base, V::Mul(vertical, 8)), V::Mul(vertical2, 2)), horizontal2))));
+    }
+}
+
+typedef void (*InterpolateFunction)(const PlaneRow * rows, int begin, int end, const InterpolatedRow & out);
+
+struct DemosaicKernels
+{
+    // Unpacks one row of width pixels into its even and odd pixels, or into even in order if odd is null
+    void (*unpack)(const uint8_t * source, int width, int16_t * even, int16_t * odd);
+    InterpolateFunction interpolate[2]; // By DemosaicMethod
+};
+
+void UnpackRaw10Scalar(const uint8_t * source, int width, int16_t * even, int16_t * odd)
+{
+    for (int x = 0; x < width; x += 4, source += 5)
+    {
+        int16_t pixels[4];
+        for (int k = 0; k < 4; ++k)
+            pixels[k] = static_cast<int16_t>(source[k] << 2 | (source[4] >> (6 - 2 * k) & 3));
+        if (odd)
+        {
+            even[x / 2] = pixels[0];
+            odd[x / 2] = pixels[1];
+            even[x / 2 + 1] = pixels[2];
+            odd[x / 2 + 1] = pixels[3];
+        }
+        else
+            std::copy(pixels, pixels + 4, even + x);
+    }
+}
+
+#ifdef CONVERSION_X86
+// Sixteen pixels from 20 bytes, loaded as bytes 0-15 and 4-19 so that the first two groups come from one and the last two from the
+// other. Each word gets the high byte of its pixel and the byte of low bits, whose pair of bits for pixel k a multiply by 4 << 2k moves
+// to bits 8 and 9.
+TARGET_SSSE3 inline void Unpack16SSSE3(__m128i a, __m128i b, __m128i & even, __m128i & odd)
+{
+    const __m128i evenA = _mm_setr_epi8(0, -1, 2, -1, 5, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i evenB = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 6, -1, 8, -1, 11, -1, 13, -1);
+    const __m128i oddA = _mm_setr_epi8(1, -1, 3, -1, 6, -1, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i oddB = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 7, -1, 9, -1, 12, -1, 14, -1);
+    const __m128i lowA = _mm_setr_epi8(4, -1, 4, -1, 9, -1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i lowB = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 10, -1, 10, -1, 15, -1, 15, -1);
+    const __m128i three = _mm_set1_epi16(3);
+    const __m128i low = _mm_or_si128(_mm_shuffle_epi8(a, lowA), _mm_shuffle_epi8(b, lowB));
+    const __m128i evenHigh = _mm_or_si128(_mm_shuffle_epi8(a, evenA), _mm_shuffle_epi8(b, evenB));
+    const __m128i oddHigh = _mm_or_si128(_mm_shuffle_epi8(a, oddA), _mm_shuffle_epi8(b, oddB));
+    even = _mm_or_si128(_mm_slli_epi16(evenHigh, 2), _mm_and_si128(_mm_srli_epi16(_mm_mullo_epi16(low, _mm_setr_epi16(4, 64, 4, 64, 4, 64, 4, 64)), 8), three));
+    odd = _mm_or_si128(_mm_slli_epi16(oddHigh, 2), _mm_and_si128(_mm_srli_epi16(_mm_mullo_epi16(low, _mm_setr_epi16(16, 256, 16, 256, 16, 256, 16, 256)), 8), three));
+}
+
+TARGET_SSSE3 void UnpackRaw10SSSE3(const uint8_t * source, int width, int16_t * even, int16_t * odd)
+{
+    if (width < 16)
+    {
+        UnpackRaw10Scalar(source, width, even, odd);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        const uint8_t * s = source + x / 4 * 5;
+        __m128i e, o;
+        Unpack16SSSE3(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 4)), e, o);
+        if (odd)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(even + x / 2), e);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(odd + x / 2), o);
+        }
+        else
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(even + x), _mm_unpacklo_epi16(e, o));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(even + x + 8), _mm_unpackhi_epi16(e, o));
+        }
+        if (x + 16 == width) break;
+    }
+}
+
+// The same on 32 pixels, one group of 16 in each 128 bit lane
+TARGET_AVX2 void UnpackRaw10AVX2(const uint8_t * source, int width, int16_t * even, int16_t * odd)
+{
+    if (width < 32)
+    {
+        _mm256_zeroupper();
+        UnpackRaw10SSSE3(source, width, even, odd);
+        return;
+    }
+    const __m256i evenA = _mm256_setr_epi8(0, -1, 2, -1, 5, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, -1, 2, -1, 5, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i evenB = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 6, -1, 8, -1, 11, -1, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, 6, -1, 8, -1, 11, -1, 13, -1);
+    const __m256i oddA = _mm256_setr_epi8(1, -1, 3, -1, 6, -1, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, -1, 3, -1, 6, -1, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i oddB = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 7, -1, 9, -1, 12, -1, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, 7, -1, 9, -1, 12, -1, 14, -1);
+    const __m256i lowA = _mm256_setr_epi8(4, -1, 4, -1, 9, -1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, 4, -1, 4, -1, 9, -1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i lowB = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 10, -1, 10, -1, 15, -1, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, 10, -1, 10, -1, 15, -1, 15, -1);
+    const __m256i evenShift = _mm256_setr_epi16(4, 64, 4, 64, 4, 64, 4, 64, 4, 64, 4, 64, 4, 64, 4, 64);
+    const __m256i oddShift = _mm256_setr_epi16(16, 256, 16, 256, 16, 256, 16, 256, 16, 256, 16, 256, 16, 256, 16, 256);
+    const __m256i three = _mm256_set1_epi16(3);
+    for (int x = 0;; x = std::min(x + 32, width - 32))
+    {
+        const uint8_t * s = source + x / 4 * 5;
+        const __m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s))),
+                                                  _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 20)), 1);
+        const __m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 4))),
+                                                  _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 24)), 1);
+        const __m256i low = _mm256_or_si256(_mm256_shuffle_epi8(a, lowA), _mm256_shuffle_epi8(b, lowB));
+        const __m256i evenHigh = _mm256_or_si256(_mm256_shuffle_epi8(a, evenA), _mm256_shuffle_epi8(b, evenB));
+        const __m256i oddHigh = _mm256_or_si256(_mm256_shuffle_epi8(a, oddA), _mm256_shuffle_epi8(b, oddB));
+        const __m256i e = _mm256_or_si256(_mm256_slli_epi16(evenHigh, 2), _mm256_and_si256(_mm256_srli_epi16(_mm256_mullo_epi16(low, evenShift), 8), three));
+        const __m256i o = _mm256_or_si256(_mm256_slli_epi16(oddHigh, 2), _mm256_and_si256(_mm256_srli_epi16(_mm256_mullo_epi16(low, oddShift), 8), three));
+        if (odd)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(even + x / 2), e);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(odd + x / 2), o);
+        }
+        else
+        {
+            // The unpacks give pixels 0-7 | 16-23 and 8-15 | 24-31
+            const __m256i first = _mm256_unpacklo_epi16(e, o), second = _mm256_unpackhi_epi16(e, o);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(even + x), _mm256_permute2x128_si256(first, second, 0x20));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(even + x + 16), _mm256_permute2x128_si256(first, second, 0x31));
+        }
+        if (x + 32 == width) break;
+    }
+}
+#endif
+
+#if defined(CONVERSION_NEON) && defined(__aarch64__)
+// Like the SSSE3 version, with table lookups for the byte shuffles. ARMv7 has no 16 byte table lookup and uses the scalar version.
+void UnpackRaw10NEON(const uint8_t * source, int width, int16_t * even, int16_t * odd)
+{
+    static const uint8_t evenA[] = {0, 255, 2, 255, 5, 255, 7, 255, 255, 255, 255, 255, 255, 255, 255, 255};
+    static const uint8_t evenB[] = {255, 255, 255, 255, 255, 255, 255, 255, 6, 255, 8, 255, 11, 255, 13, 255};
+    static const uint8_t oddA[] = {1, 255, 3, 255, 6, 255, 8, 255, 255, 255, 255, 255, 255, 255, 255, 255};
+    static const uint8_t oddB[] = {255, 255, 255, 255, 255, 255, 255, 255, 7, 255, 9, 255, 12, 255, 14, 255};
+    static const uint8_t lowA[] = {4, 255, 4, 255, 9, 255, 9, 255, 255, 255, 255, 255, 255, 255, 255, 255};
+    static const uint8_t lowB[] = {255, 255, 255, 255, 255, 255, 255, 255, 10, 255, 10, 255, 15, 255, 15, 255};
+    static const uint16_t evenShift[] = {4, 64, 4, 64, 4, 64, 4, 64};
+    static const uint16_t oddShift[] = {16, 256, 16, 256, 16, 256, 16, 256};
+    if (width < 16)
+    {
+        UnpackRaw10Scalar(source, width, even, odd);
+        return;
+    }
+    const uint16x8_t three = vdupq_n_u16(3);
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        const uint8_t * s = source + x / 4 * 5;
+        const uint8x16_t a = vld1q_u8(s), b = vld1q_u8(s + 4);
+        const uint16x8_t low = vreinterpretq_u16_u8(vorrq_u8(vqtbl1q_u8(a, vld1q_u8(lowA)), vqtbl1q_u8(b, vld1q_u8(lowB))));
+        const uint16x8_t evenHigh = vreinterpretq_u16_u8(vorrq_u8(vqtbl1q_u8(a, vld1q_u8(evenA)), vqtbl1q_u8(b, vld1q_u8(evenB))));
+        const uint16x8_t oddHigh = vreinterpretq_u16_u8(vorrq_u8(vqtbl1q_u8(a, vld1q_u8(oddA)), vqtbl1q_u8(b, vld1q_u8(oddB))));
+        int16x8x2_t pixels;
+        pixels.val[0] = vreinterpretq_s16_u16(vorrq_u16(vshlq_n_u16(evenHigh, 2), vandq_u16(vshrq_n_u16(vmulq_u16(low, vld1q_u16(evenShift)), 8), three)));
+        pixels.val[1] = vreinterpretq_s16_u16(vorrq_u16(vshlq_n_u16(oddHigh, 2), vandq_u16(vshrq_n_u16(vmulq_u16(low, vld1q_u16(oddShift)), 8), three)));
+        if (odd)
+        {
+            vst1q_s16(even + x / 2, pixels.val[0]);
+            vst1q_s16(odd + x / 2, pixels.val[1]);
+        }
+        else
+            vst2q_s16(even + x, pixels);
+        if (x + 16 == width) break;
+    }
+}
+#endif
+
+const DemosaicKernels g_scalarKernels = {UnpackRaw10Scalar, {InterpolateBilinear<ScalarOps>, InterpolateMalvar<ScalarOps>}};
+#ifdef CONVERSION_X86
+// The interpolation is SSE2 on every x86 instruction set: it is a handful of adds per sample and cheap next to the unpacking and the
+// final table lookups. Unpacking needs a byte shuffle, which SSE2 does not have.
+const DemosaicKernels g_sse2Kernels = {UnpackRaw10Scalar, {InterpolateBilinear<Sse2Ops>, InterpolateMalvar<Sse2Ops>}};
+const DemosaicKernels g_ssse3Kernels = {UnpackRaw10SSSE3, {InterpolateBilinear<Sse2Ops>, InterpolateMalvar<Sse2Ops>}};
+const DemosaicKernels g_avx2Kernels = {UnpackRaw10AVX2, {InterpolateBilinear<Sse2Ops>, InterpolateMalvar<Sse2Ops>}};
+#endif
+#ifdef CONVERSION_NEON
+#ifdef __aarch64__
+const DemosaicKernels g_neonKernels = {UnpackRaw10NEON, {InterpolateBilinear<NeonOps>, InterpolateMalvar<NeonOps>}};
+#else
+const DemosaicKernels g_neonKernels = {UnpackRaw10Scalar, {InterpolateBilinear<NeonOps>, InterpolateMalvar<NeonOps>}};
+#endif
+#endif
+
+// Follows SetConversionIsa() of ImageConversion.h
+const DemosaicKernels & GetKernels()
+{
+    switch (GetConversionIsa())
+    {
+#ifdef CONVERSION_X86
+    case CONVERSION_ISA_SSE2:
+        return g_sse2Kernels;
+    case CONVERSION_ISA_SSSE3:
+        return g_ssse3Kernels;
+    case CONVERSION_ISA_AVX2:
+        return g_avx2Kernels;
+#endif
+#ifdef CONVERSION_NEON
+    case CONVERSION_ISA_NEON:
+        return g_neonKernels;
+#endif
+    default:
+        return g_scalarKernels;
+    }
+}
+
+// Mirrors rows past the edges of the image about the first and last row, which keeps the colors of the Bayer pattern in place
+int ReflectRow(int y, int height)
+{
+    while (y < 0 || y >= height)
+        y = y < 0 ? -y : 2 * (height - 1) - y;
+    return y;
+}
+
+struct Raw10Conversion
+{
+    const uint8_t * source;
+    int width, height, sourceStride;
+    ImageRegion region; // Part of the image written to dest
+    uint8_t * dest;
+    int destStride;
+    int pixelSize;  // 3 for RGB8, 4 for BGRA8
+    int red, blue;  // Offsets of red and blue in a pixel
+    int bandRows;
+    const DemosaicKernels * kernels;
+    InterpolateFunction interpolate;
+    uint8_t table[3][1024]; // Red, green and blue values after white balance and gamma
+};
+
+thread_local std::vector<int16_t> t_planes;
+
+// The c, g and x values of the pixels at the even and at the odd columns of a row
+struct RowValues
+{
+    const int16_t * c[2], * g[2], * x[2];
+};
+
+// Maps the values of one row through the tables into pixels. Every pointer is copied to a local first: stores through uint8_t pointers
+// may alias anything, which would otherwise make the compiler reload them for every pixel.
+template <int pixelSize> void WriteRow(const Raw10Conversion & conversion, const RowValues & values, int phase, uint8_t * dest)
+{
+    const uint8_t * cTable = conversion.table[phase ? 2 : 0], * gTable = conversion.table[1], * xTable = conversion.table[phase ? 0 : 2];
+    const int cOffset = phase ? conversion.blue : conversion.red, xOffset = phase ? conversion.red : conversion.blue;
+    const int16_t * c0 = values.c[0], * g0 = values.g[0], * x0 = values.x[0];
+    const int16_t * c1 = values.c[1], * g1 = values.g[1], * x1 = values.x[1];
+    const int end = (conversion.region.x + conversion.region.width) / 2;
+    for (int i = conversion.region.x / 2; i < end; ++i, dest += 2 * pixelSize)
+    {
+        dest[cOffset] = cTable[c0[i]];
+        dest[1] = gTable[g0[i]];
+        dest[xOffset] = xTable[x0[i]];
+        dest[pixelSize + cOffset] = cTable[c1[i]];
+        dest[pixelSize + 1] = gTable[g1[i]];
+        dest[pixelSize + xOffset] = xTable[x1[i]];
+        if (pixelSize == 4) dest[3] = dest[7] = 255;
+    }
+}
+
+void ConvertBand(const Raw10Conversion & conversion, int top, int bottom)
+{
+    const int half = conversion.width / 2;
+    const int stride = (half + 2 * g_planePadding + 15) / 16 * 16;
+    const int planeRows = bottom - top + 4;
+    // Two planes per unpacked row, then the four planes of the interpolation
+    const size_t size = static_cast<size_t>(2 * planeRows + 4) * stride;
+    if (t_planes.size() < size) t_planes.resize(size);
+    int16_t * planes = t_planes.data() + g_planePadding;
+
+    for (int r = 0; r < planeRows; ++r)
+    {
+        int16_t * even = planes + 2 * r * stride, * odd = even + stride;
+        conversion.kernels->unpack(conversion.source + static_cast<size_t>(ReflectRow(top - 2 + r, conversion.height)) * conversion.sourceStride,
+                                   conversion.width, even, odd);
+        even[-1] = even[1];
+        odd[-1] = odd[0];
+        even[half] = even[half - 1];
+        odd[half] = odd[half - 2];
+    }
+
+    int16_t * interpolated = planes + 2 * planeRows * stride;
+    const InterpolatedRow out = {interpolated, interpolated + stride, interpolated + 2 * stride, interpolated + 3 * stride};
+    for (int y = top; y < bottom; ++y)
+    {
+        // Odd rows are seen one pixel to the right: their A columns are the odd pixels, their B columns the even ones after them
+        const int phase = y & 1;
+        PlaneRow rows[5];
+        for (int k = 0; k < 5; ++k)
+        {
+            const int16_t * even = planes + 2 * (y - top + k) * stride, * odd = even + stride;
+            rows[k].a = phase ? odd : even;
+            rows[k].b = phase ? even + 1 : odd;
+        }
+        // Only the sites of the region, starting one early for the B site before it, which on odd rows is the region's first pixel
+        conversion.interpolate(rows, conversion.region.x / 2 - 1, (conversion.region.x + conversion.region.width) / 2, out);
+
+        // The A sites are the even pixels of even rows and the odd pixels of odd rows
+        const RowValues values = phase ? RowValues{{out.cB - 1, rows[2].a}, {rows[2].b - 1, out.gA}, {out.xB - 1, out.xA}}
+                                       : RowValues{{rows[2].a, out.cB}, {out.gA, rows[2].b}, {out.xA, out.xB}};
+        uint8_t * dest = conversion.dest + static_cast<size_t>(y - conversion.region.y) * conversion.destStride;
+        if (conversion.pixelSize == 3)
+            WriteRow<3>(conversion, values, phase, dest);
+        else
+            WriteRow<4>(conversion, values, phase, dest);
+    }
+}
+
+void FillTable(uint8_t * table, float gain, float gamma)
+{
+    for (int v = 0; v < 1024; ++v)
+    {
+        const double value = std::min(1.0, v * gain / 1023.0);
+        table[v] = static_cast<uint8_t>(std::lround(255 * (gamma == 1 ? value : std::pow(value, 1.0 / gamma))));
+    }
+}
+
+void ConvertRaw10(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride, int pixelSize, int red,
+                  int blue, const DemosaicOptions & options)
+{
+    if (width < 4 || height < 2) return;
+
+    Raw10Conversion conversion;
+    conversion.source = static_cast<const uint8_t *>(sourceImage);
+    conversion.width = width;
+    conversion.height = height;
+    conversion.sourceStride = sourceStride;
+    conversion.region = options.region.SourceIn(width, height);
+    conversion.dest = options.region.DestinationIn(destImage, destStride, pixelSize);
+    conversion.destStride = destStride;
+    conversion.pixelSize = pixelSize;
+    conversion.red = red;
+    conversion.blue = blue;
+    conversion.kernels = &GetKernels();
+    conversion.interpolate = conversion.kernels->interpolate[options.method == DEMOSAIC_BILINEAR ? 0 : 1];
+    FillTable(conversion.table[0], options.redGain, options.gamma);
+    FillTable(conversion.table[1], options.greenGain, options.gamma);
+    FillTable(conversion.table[2], options.blueGain, options.gamma);
+
+    // By default, as many rows as keep the planes of a band within 128 KB, which stays in the L2 cache of most cores
+    int bandRows = options.bandRows;
+    if (bandRows <= 0) bandRows = std::max(2, 128 * 1024 / (4 * (width / 2 + 2 * g_planePadding)) - 4);
+    bandRows = std::max(2, bandRows & ~1);
+    conversion.bandRows = bandRows;
+
+    // Bands handed to other threads start on an even row of the region: their rows are the even bandRows rounded up to whole cache lines of
+    // the destination, and the rows per cache line are a power of two
+    const int top = conversion.region.y, bottom = top + conversion.region.height;
+    ParallelForRows(options.scheduler, conversion.region.height, destStride, bandRows, [&conversion, top, bottom](int begin, int end) {
+        for (int y = top + begin; y < top + end; y += conversion.bandRows)
+            ConvertBand(conversion, y, std::min(bottom, y + conversion.bandRows));
+    });
+}
+}
+
+void ConvertRaw10ToRGB8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride, const DemosaicOptions & options)
+{
+    ConvertRaw10(sourceImage, width, height, sourceStride, destImage, destStride, 3, 0, 2, options);
+}
+
+void ConvertRaw10ToBGRA8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * destImage, int destStride, const DemosaicOptions & options)
+{
+    ConvertRaw10(sourceImage, width, height, sourceStride, destImage, destStride, 4, 2, 0, options);
+}
+
+void ConvertRaw10ToRGB8(const void * sourceImage, int width, int height, uint8_t * destImage)
+{
+    ConvertRaw10ToRGB8(sourceImage, width, height, width / 4 * 5, destImage, width * 3);
+}
+
+void ConvertRaw10ToBGRA8(const void * sourceImage, int width, int height, uint8_t * destImage)
+{
+    ConvertRaw10ToBGRA8(sourceImage, width, height, width / 4 * 5, destImage, width * 4);
+}
+
+void UnpackRaw10(const void * sourceImage, int width, int height, int sourceStride, uint16_t * destImage, int destStride, const ConversionRegion & region)
+{
+    const DemosaicKernels & kernels = GetKernels();
+    const ImageRegion r = region.SourceIn(width, height);
+    const uint8_t * source = static_cast<const uint8_t *>(sourceImage) + static_cast<ptrdiff_t>(r.y) * sourceStride + r.x / 4 * 5;
+    uint8_t * dest = region.DestinationIn(reinterpret_cast<uint8_t *>(destImage), destStride, 2);
+    for (int y = 0; y < r.height; ++y)
+        kernels.unpack(source + static_cast<ptrdiff_t>(y) * sourceStride, r.width, reinterpret_cast<int16_t *>(dest + static_cast<ptrdiff_t>(y) * destStride), nullptr);
+}
@@ -0,0 +1,189 @@
+#include <r200_driver/DepthColorizer.h>
+#include <r200_driver/ImageConversion.h>
+#include <r200_driver/ParallelRows.h>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVERSION_X86 1
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace
+{
+// Bytes of padding after the palette index of depth 65535, which the gathers read 4 bytes at a time
+const int g_indexPadding = 4;
+
+// Least depth bytes in a band of rows handed to another thread
+const int g_bandBytes = 32 * 1024;
+
+// One row of the mapping. Without gathers the two lookups per pixel are the work, and they are the same loads whatever the instruction set,
+// so only AVX2 has its own version.
+typedef void (*ColorizeRowFunction)(const uint16_t * depth, int width, const uint8_t * indices, const uint32_t * palette, uint8_t * rgb);
+
+void ColorizeRowScalar(const uint16_t * depth, int width, const uint8_t * indices, const uint32_t * palette, uint8_t * rgb)
+{
+    for (int x = 0; x < width; ++x, rgb += 3)
+    {
+        const uint16_t d = depth[x];
+        const uint32_t color = d ? palette[indices[d]] : 0;
+        rgb[0] = static_cast<uint8_t>(color);
+        rgb[1] = static_cast<uint8_t>(color >> 8);
+        rgb[2] = static_cast<uint8_t>(color >> 16);
+    }
+}
+
+#ifdef CONVERSION_X86
+TARGET_AVX2 void ColorizeRowAVX2(const uint16_t * depth, int width, const uint8_t * indices, const uint32_t * palette, uint8_t * rgb)
+{
+    if (width < 8) return ColorizeRowScalar(depth, width, indices, palette, rgb);
+    // The three color bytes of each pixel to the first 12 bytes of each lane, then the first three words of each lane together
+    const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i join = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    for (int x = 0;; x += 8)
+    {
+        if (x > width - 8) x = width - 8;
+        const __m256i d = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(depth + x)));
+        const __m256i index = _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int *>(indices), d, 1), _mm256_set1_epi32(0xFF));
+        __m256i color = _mm256_i32gather_epi32(reinterpret_cast<const int *>(palette), index, 4);
+        color = _mm256_andnot_si256(_mm256_cmpeq_epi32(d, _mm256_setzero_si256()), color);
+        color = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(color, pack), join);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(rgb + 3 * x), _mm256_castsi256_si128(color));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(rgb + 3 * x + 16), _mm256_extracti128_si256(color, 1));
+        if (x + 8 == width) break;
+    }
+}
+#endif
+
+// Follows SetConversionIsa() of ImageConversion.h
+ColorizeRowFunction GetColorizeRow()
+{
+#ifdef CONVERSION_X86
+    if (GetConversionIsa() == CONVERSION_ISA_AVX2) return ColorizeRowAVX2;
+#endif
+    return ColorizeRowScalar;
+}
+
+uint32_t PackColor(double red, double green, double blue)
+{
+    const auto channel = [](double value) { return static_cast<uint32_t>(std::lround(255 * std::min(1.0, std::max(0.0, value)))); };
+    return channel(red) | channel(green) << 8 | channel(blue) << 16;
+}
+
+// Color at x from 0 to 1 of each fixed colormap. Turbo is the polynomial approximation published with it.
+uint32_t ColormapColor(DepthColormap colormap, double x)
+{
+    switch (colormap)
+    {
+    case DEPTH_COLORMAP_JET:
+        return PackColor(1.5 - std::abs(4 * x - 3), 1.5 - std::abs(4 * x - 2), 1.5 - std::abs(4 * x - 1));
+    case DEPTH_COLORMAP_TURBO:
+        return PackColor(0.13572138 + x * (4.61539260 + x * (-42.66032258 + x * (132.13108234 + x * (-152.94239396 + x * 59.28637943)))),
+                         0.09140261 + x * (2.19418839 + x * (4.84296658 + x * (-14.18503333 + x * (4.27729857 + x * 2.82956604)))),
+                         0.10667330 + x * (12.64194608 + x * (-60.58204836 + x * (110.36276771 + x * (-89.90310912 + x * 27.34824973)))));
+    default:
+        return PackColor(x, x, x);
+    }
+}
+}
+
+DepthColorizer::DepthColorizer(const DepthColorizerOptions & options)
+    : histogram(65536)
+    , indices(65536 + g_indexPadding)
+{
+    SetOptions(options);
+}
+
+void DepthColorizer::SetOptions(const DepthColorizerOptions & newOptions)
+{
+    options = newOptions;
+    if (options.colormap == DEPTH_COLORMAP_HISTOGRAM)
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            uint8_t color[3];
+            for (int c = 0; c < 3; ++c)
+                color[c] = static_cast<uint8_t>(((255 - i) * options.nearColor[c] + i * options.farColor[c] + 127) / 255);
+            palette[i] = color[0] | color[1] << 8 | color[2] << 16;
+        }
+        return;
+    }
+
+    for (int i = 0; i < 256; ++i)
+        palette[i] = ColormapColor(options.colormap, i / 255.0);
+    const int minZ = options.minZ, maxZ = options.maxZ;
+    for (int d = 0; d < 65536; ++d)
+    {
+        if (d <= minZ || d >= maxZ)
+            indices[d] = d >= maxZ ? 255 : 0;
+        else
+            indices[d] = static_cast<uint8_t>((255 * (d - minZ) + (maxZ - minZ) / 2) / (maxZ - minZ));
+    }
+}
+
+// Counts the depths of the frame, then gives each one from the nearest to the furthest the palette index of the share of valid pixels at
+// or nearer than it, and clears those bins again
+void DepthColorizer::UpdateHistogram(const uint16_t * depthImage, int width, int height, int depthStride)
+{
+    uint32_t * counts = histogram.data();
+    // depth - 1 wraps 0 to the largest value, so its minimum is that of the valid depths
+    uint16_t nearest = 0xFFFF, furthest = 0;
+    for (int y = 0; y < height; ++y)
+    {
+        const uint16_t * row = reinterpret_cast<const uint16_t *>(reinterpret_cast<const uint8_t *>(depthImage) + static_cast<ptrdiff_t>(y) * depthStride);
+        for (int x = 0; x < width; ++x)
+        {
+            const uint16_t d = row[x];
+            ++counts[d];
+            nearest = std::min(nearest, static_cast<uint16_t>(d - 1));
+            furthest = std::max(furthest, d);
+        }
+    }
+    counts[0] = 0;
+    if (!furthest) return;
+
+    const int minZ = nearest + 1, maxZ = furthest;
+    uint64_t total = 0;
+    for (int d = minZ; d <= maxZ; ++d)
+        total += counts[d];
+    uint64_t seen = 0;
+    for (int d = minZ; d <= maxZ; ++d)
+    {
+        seen += counts[d];
+        counts[d] = 0;
+        indices[d] = static_cast<uint8_t>(seen * 255 / total);
+    }
+}
+
+void DepthColorizer::Colorize(const uint16_t * depthImage, int width, int height, int depthStride, uint8_t * rgbImage, int rgbStride)
+{
+    if (options.colormap == DEPTH_COLORMAP_HISTOGRAM) UpdateHistogram(depthImage, width, height, depthStride);
+
+    const ColorizeRowFunction colorizeRow = GetColorizeRow();
+    const uint8_t * const table = indices.data();
+    const uint32_t * const colors = palette;
+    ParallelForRows(options.scheduler, height, rgbStride, GrainRows(width * 2, g_bandBytes), [=](int begin, int end) {
+        for (int y = begin; y < end; ++y)
+            colorizeRow(reinterpret_cast<const uint16_t *>(reinterpret_cast<const uint8_t *>(depthImage) + static_cast<ptrdiff_t>(y) * depthStride), width,
+                        table, colors, rgbImage + static_cast<ptrdiff_t>(y) * rgbStride);
+    });
+}
+
+void DepthColorizer::Colorize(const uint16_t * depthImage, int width, int height, uint8_t * rgbImage)
+{
+    Colorize(depthImage, width, height, width * 2, rgbImage, width * 3);
+}
+
+void ConvertDepthToRGBUsingHistogram(const uint16_t depthImage[], int width, int height, const uint8_t nearColor[3], const uint8_t farColor[3], uint8_t rgbImage[],
+                                     TaskScheduler * scheduler)
+{
+    thread_local DepthColorizer colorizer;
+    DepthColorizerOptions options;
+    std::copy(nearColor, nearColor + 3, options.nearColor);
+    std::copy(farColor, farColor + 3, options.farColor);
+    options.scheduler = scheduler;
+    colorizer.SetOptions(options);
+    colorizer.Colorize(depthImage, width, height, rgbImage);
+}
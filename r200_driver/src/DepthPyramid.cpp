@@ -0,0 +1,396 @@
+#include <r200_driver/DepthPyramid.h>
+#include <r200_driver/ImageConversion.h>
+#include <r200_driver/ParallelRows.h>
+
+#include <algorithm>
+#include <vector>
+
+// Every reduction is SSE2 on every x86 instruction set: a row takes a few operations per pixel, so the time goes into reading the source
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define CONVERSION_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERSION_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+// The minimum and the median work on keys: depth - 1, wrapped to 16 bits, so that 0 becomes the largest key and sorts after every valid
+// depth. The minimum of the keys of a block is then that of its valid depths, or the key of 0 if it has none.
+struct ScalarOps
+{
+    typedef int Vector;
+    static const int size = 1;
+    static Vector Key(uint16_t depth) { return (depth + 0xFFFF) & 0xFFFF; }
+    static void LoadPairs(const uint16_t * p, Vector & even, Vector & odd)
+    {
+        even = Key(p[0]);
+        odd = Key(p[1]);
+    }
+    static void Store(uint16_t * p, Vector key) { *p = static_cast<uint16_t>(key + 1); }
+    static Vector Min(Vector a, Vector b) { return std::min(a, b); }
+    static Vector Max(Vector a, Vector b) { return std::max(a, b); }
+    // low if high is the key of 0, else middle
+    static Vector SelectValid(Vector high, Vector middle, Vector low) { return high == 0xFFFF ? low : middle; }
+};
+
+#ifdef CONVERSION_X86
+// SSE2 only compares signed words, so the keys are flipped to signed: the key of 0 is then 0x7FFF
+struct Sse2Ops
+{
+    typedef __m128i Vector;
+    static const int size = 8;
+    static Vector Key(__m128i depth) { return _mm_xor_si128(_mm_add_epi16(depth, _mm_set1_epi16(-1)), _mm_set1_epi16(-0x8000)); }
+    static void LoadPairs(const uint16_t * p, Vector & even, Vector & odd)
+    {
+        const __m128i a = Key(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+        const __m128i b = Key(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 8)));
+        even = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+        odd = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+    }
+    static void Store(uint16_t * p, Vector key)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm_add_epi16(_mm_xor_si128(key, _mm_set1_epi16(-0x8000)), _mm_set1_epi16(1)));
+    }
+    static Vector Min(Vector a, Vector b) { return _mm_min_epi16(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm_max_epi16(a, b); }
+    static Vector SelectValid(Vector high, Vector middle, Vector low)
+    {
+        const __m128i invalid = _mm_cmpeq_epi16(high, _mm_set1_epi16(0x7FFF));
+        return _mm_or_si128(_mm_and_si128(invalid, low), _mm_andnot_si128(invalid, middle));
+    }
+};
+#endif
+
+#ifdef CONVERSION_NEON
+struct NeonOps
+{
+    typedef uint16x8_t Vector;
+    static const int size = 8;
+    static void LoadPairs(const uint16_t * p, Vector & even, Vector & odd)
+    {
+        const uint16x8x2_t pairs = vld2q_u16(p);
+        even = vsubq_u16(pairs.val[0], vdupq_n_u16(1));
+        odd = vsubq_u16(pairs.val[1], vdupq_n_u16(1));
+    }
+    static void Store(uint16_t * p, Vector key) { vst1q_u16(p, vaddq_u16(key, vdupq_n_u16(1))); }
+    static Vector Min(Vector a, Vector b) { return vminq_u16(a, b); }
+    static Vector Max(Vector a, Vector b) { return vmaxq_u16(a, b); }
+    static Vector SelectValid(Vector high, Vector middle, Vector low) { return vbslq_u16(vceqq_u16(high, vdupq_n_u16(0xFFFF)), low, middle); }
+};
+#endif
+
+// Calls step(x) on every vector of size pixels of a row of width pixels, the last one overlapping the one before it. False if the row is
+// narrower than one vector, which is then left to the scalar version.
+template <class Step> bool ForEachVector(int width, int size, Step step)
+{
+    if (width <= 0) return true;
+    if (width < size) return false;
+    for (int x = 0;; x += size)
+    {
+        if (x > width - size) x = width - size;
+        step(x);
+        if (x + size == width) break;
+    }
+    return true;
+}
+
+// One row of a level from the two rows of the level below, or of the source, that it halves: width is that of the new row
+template <class V> void ReduceMin(const uint16_t * top, const uint16_t * bottom, int width, uint16_t * dest)
+{
+    typedef typename V::Vector Vector;
+    const bool done = ForEachVector(width, V::size, [=](int x) {
+        Vector a, b, c, d;
+        V::LoadPairs(top + 2 * x, a, b);
+        V::LoadPairs(bottom + 2 * x, c, d);
+        V::Store(dest + x, V::Min(V::Min(a, b), V::Min(c, d)));
+    });
+    if (!done) ReduceMin<ScalarOps>(top, bottom, width, dest);
+}
+
+// Sorts the four keys of each block, the invalid ones last, and takes the second one if at least three are valid, else the first
+template <class V> void ReduceMedian(const uint16_t * top, const uint16_t * bottom, int width, uint16_t * dest)
+{
+    typedef typename V::Vector Vector;
+    const bool done = ForEachVector(width, V::size, [=](int x) {
+        Vector a, b, c, d;
+        V::LoadPairs(top + 2 * x, a, b);
+        V::LoadPairs(bottom + 2 * x, c, d);
+        const Vector low1 = V::Min(a, b), high1 = V::Max(a, b), low2 = V::Min(c, d), high2 = V::Max(c, d);
+        const Vector middle1 = V::Max(low1, low2), middle2 = V::Min(high1, high2);
+        V::Store(dest + x, V::SelectValid(V::Max(middle1, middle2), V::Min(middle1, middle2), V::Min(low1, low2)));
+    });
+    if (!done) ReduceMedian<ScalarOps>(top, bottom, width, dest);
+}
+
+// The mean keeps the sum and the count of the valid depths of every block, so that each level is the mean of its whole block rather than
+// of the rounded means below it. A block of the 8x level sums at most 64 depths, which fits 22 bits.
+void SumSourceScalar(const uint16_t * top, const uint16_t * bottom, int width, uint32_t * sum, uint32_t * count)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        const uint16_t a = top[2 * x], b = top[2 * x + 1], c = bottom[2 * x], d = bottom[2 * x + 1];
+        sum[x] = a + b + c + d;
+        count[x] = (a != 0) + (b != 0) + (c != 0) + (d != 0);
+    }
+}
+
+void SumSumsScalar(const uint32_t * topSum, const uint32_t * topCount, const uint32_t * bottomSum, const uint32_t * bottomCount, int width,
+                   uint32_t * sum, uint32_t * count)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        sum[x] = topSum[2 * x] + topSum[2 * x + 1] + bottomSum[2 * x] + bottomSum[2 * x + 1];
+        count[x] = topCount[2 * x] + topCount[2 * x + 1] + bottomCount[2 * x] + bottomCount[2 * x + 1];
+    }
+}
+
+void DivideScalar(const uint32_t * sum, const uint32_t * count, int width, uint16_t * dest)
+{
+    for (int x = 0; x < width; ++x)
+        dest[x] = static_cast<uint16_t>(count[x] ? (sum[x] + count[x] / 2) / count[x] : 0);
+}
+
+#ifdef CONVERSION_X86
+void SumSourceSSE2(const uint16_t * top, const uint16_t * bottom, int width, uint32_t * sum, uint32_t * count)
+{
+    const __m128i low = _mm_set1_epi32(0xFFFF), one = _mm_set1_epi16(1);
+    const bool done = ForEachVector(width, 4, [=](int x) {
+        const __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i *>(top + 2 * x));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bottom + 2 * x));
+        const __m128i sums = _mm_add_epi32(_mm_add_epi32(_mm_and_si128(t, low), _mm_srli_epi32(t, 16)),
+                                           _mm_add_epi32(_mm_and_si128(b, low), _mm_srli_epi32(b, 16)));
+        const __m128i validT = _mm_andnot_si128(_mm_cmpeq_epi16(t, _mm_setzero_si128()), one);
+        const __m128i validB = _mm_andnot_si128(_mm_cmpeq_epi16(b, _mm_setzero_si128()), one);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(sum + x), sums);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(count + x), _mm_madd_epi16(_mm_add_epi16(validT, validB), one));
+    });
+    if (!done) SumSourceScalar(top, bottom, width, sum, count);
+}
+
+// Sums of the pairs of 32 bit values in p[0] to p[7]
+inline __m128i AddPairs(const uint32_t * p)
+{
+    const __m128 a = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+    const __m128 b = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 4)));
+    return _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))), _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+}
+
+void SumSumsSSE2(const uint32_t * topSum, const uint32_t * topCount, const uint32_t * bottomSum, const uint32_t * bottomCount, int width,
+                 uint32_t * sum, uint32_t * count)
+{
+    const bool done = ForEachVector(width, 4, [=](int x) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(sum + x), _mm_add_epi32(AddPairs(topSum + 2 * x), AddPairs(bottomSum + 2 * x)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(count + x), _mm_add_epi32(AddPairs(topCount + 2 * x), AddPairs(bottomCount + 2 * x)));
+    });
+    if (!done) SumSumsScalar(topSum, topCount, bottomSum, bottomCount, width, sum, count);
+}
+
+// The division is in single precision, which gives exactly the integer quotient: the dividend fits 24 bits, and a quotient below 65536
+// that is not whole is at least 1/64 from the next whole number, much more than the rounding error of the division.
+void DivideSSE2(const uint32_t * sum, const uint32_t * count, int width, uint16_t * dest)
+{
+    const bool done = ForEachVector(width, 4, [=](int x) {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(sum + x));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(count + x));
+        // A block without valid depths sums to 0, which divided by 1 gives the 0 it needs
+        const __m128i divisor = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi32(c, _mm_setzero_si128()), _mm_set1_epi32(1)));
+        const __m128i quotient =
+            _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(_mm_add_epi32(s, _mm_srli_epi32(c, 1))), _mm_cvtepi32_ps(divisor)));
+        // Packing saturates to signed words, so the quotients are moved to the signed range and back
+        const __m128i packed = _mm_packs_epi32(_mm_sub_epi32(quotient, _mm_set1_epi32(0x8000)), _mm_setzero_si128());
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + x), _mm_xor_si128(packed, _mm_set1_epi16(-0x8000)));
+    });
+    if (!done) DivideScalar(sum, count, width, dest);
+}
+#endif
+
+#ifdef CONVERSION_NEON
+void SumSourceNEON(const uint16_t * top, const uint16_t * bottom, int width, uint32_t * sum, uint32_t * count)
+{
+    const uint16x4_t one = vdup_n_u16(1);
+    const bool done = ForEachVector(width, 4, [=](int x) {
+        const uint16x4x2_t t = vld2_u16(top + 2 * x), b = vld2_u16(bottom + 2 * x);
+        vst1q_u32(sum + x, vaddq_u32(vaddl_u16(t.val[0], t.val[1]), vaddl_u16(b.val[0], b.val[1])));
+        const uint32x4_t validT = vaddl_u16(vmin_u16(t.val[0], one), vmin_u16(t.val[1], one));
+        const uint32x4_t validB = vaddl_u16(vmin_u16(b.val[0], one), vmin_u16(b.val[1], one));
+        vst1q_u32(count + x, vaddq_u32(validT, validB));
+    });
+    if (!done) SumSourceScalar(top, bottom, width, sum, count);
+}
+
+void SumSumsNEON(const uint32_t * topSum, const uint32_t * topCount, const uint32_t * bottomSum, const uint32_t * bottomCount, int width,
+                 uint32_t * sum, uint32_t * count)
+{
+    const bool done = ForEachVector(width, 4, [=](int x) {
+        const uint32x4x2_t ts = vld2q_u32(topSum + 2 * x), bs = vld2q_u32(bottomSum + 2 * x);
+        const uint32x4x2_t tc = vld2q_u32(topCount + 2 * x), bc = vld2q_u32(bottomCount + 2 * x);
+        vst1q_u32(sum + x, vaddq_u32(vaddq_u32(ts.val[0], ts.val[1]), vaddq_u32(bs.val[0], bs.val[1])));
+        vst1q_u32(count + x, vaddq_u32(vaddq_u32(tc.val[0], tc.val[1]), vaddq_u32(bc.val[0], bc.val[1])));
+    });
+    if (!done) SumSumsScalar(topSum, topCount, bottomSum, bottomCount, width, sum, count);
+}
+
+#ifdef __aarch64__
+// Exact for the same reason as DivideSSE2
+void DivideNEON(const uint32_t * sum, const uint32_t * count, int width, uint16_t * dest)
+{
+    const bool done = ForEachVector(width, 4, [=](int x) {
+        const uint32x4_t s = vld1q_u32(sum + x), c = vld1q_u32(count + x);
+        const float32x4_t quotient = vdivq_f32(vcvtq_f32_u32(vaddq_u32(s, vshrq_n_u32(c, 1))), vcvtq_f32_u32(vmaxq_u32(c, vdupq_n_u32(1))));
+        vst1_u16(dest + x, vmovn_u32(vcvtq_u32_f32(quotient)));
+    });
+    if (!done) DivideScalar(sum, count, width, dest);
+}
+#endif
+#endif
+
+struct PyramidKernels
+{
+    void (*reduce[2])(const uint16_t * top, const uint16_t * bottom, int width, uint16_t * dest); // DEPTH_REDUCE_MIN and DEPTH_REDUCE_MEDIAN
+    void (*sumSource)(const uint16_t * top, const uint16_t * bottom, int width, uint32_t * sum, uint32_t * count);
+    void (*sumSums)(const uint32_t * topSum, const uint32_t * topCount, const uint32_t * bottomSum, const uint32_t * bottomCount, int width,
+                    uint32_t * sum, uint32_t * count);
+    void (*divide)(const uint32_t * sum, const uint32_t * count, int width, uint16_t * dest);
+};
+
+const PyramidKernels g_scalarKernels = {{ReduceMin<ScalarOps>, ReduceMedian<ScalarOps>}, SumSourceScalar, SumSumsScalar, DivideScalar};
+#ifdef CONVERSION_X86
+const PyramidKernels g_sse2Kernels = {{ReduceMin<Sse2Ops>, ReduceMedian<Sse2Ops>}, SumSourceSSE2, SumSumsSSE2, DivideSSE2};
+#endif
+#ifdef CONVERSION_NEON
+#ifdef __aarch64__
+const PyramidKernels g_neonKernels = {{ReduceMin<NeonOps>, ReduceMedian<NeonOps>}, SumSourceNEON, SumSumsNEON, DivideNEON};
+#else
+// ARMv7 NEON has no division, and its reciprocal estimate would not give the exact quotient
+const PyramidKernels g_neonKernels = {{ReduceMin<NeonOps>, ReduceMedian<NeonOps>}, SumSourceNEON, SumSumsNEON, DivideScalar};
+#endif
+#endif
+
+// Follows SetConversionIsa() of ImageConversion.h
+const PyramidKernels & GetKernels()
+{
+    switch (GetConversionIsa())
+    {
+#ifdef CONVERSION_X86
+    case CONVERSION_ISA_SSE2:
+    case CONVERSION_ISA_SSSE3:
+    case CONVERSION_ISA_AVX2:
+        return g_sse2Kernels;
+#endif
+#ifdef CONVERSION_NEON
+    case CONVERSION_ISA_NEON:
+        return g_neonKernels;
+#endif
+    default:
+        return g_scalarKernels;
+    }
+}
+
+// Least source bytes in a band of blocks handed to another thread
+const int g_bandBytes = 64 * 1024;
+
+struct PyramidBuild
+{
+    const uint8_t * source;
+    int sourceStride;
+    uint8_t * levels[3];
+    int strides[3], widths[3], heights[3];
+    DepthReduction reduction;
+    const PyramidKernels * kernels;
+
+    const uint16_t * Row(int level, int y) const
+    {
+        return reinterpret_cast<const uint16_t *>(level < 0 ? source + static_cast<ptrdiff_t>(y) * sourceStride
+                                                            : levels[level] + static_cast<ptrdiff_t>(y) * strides[level]);
+    }
+    uint16_t * DestRow(int level, int y) const { return reinterpret_cast<uint16_t *>(levels[level] + static_cast<ptrdiff_t>(y) * strides[level]); }
+};
+
+// Sums and counts of the rows of one block of each level, for the mean. Level l has 4 >> l rows in a block.
+struct BlockSums
+{
+    std::vector<uint32_t> sums, counts;
+    int offsets[3];
+
+    void Resize(const PyramidBuild & build)
+    {
+        int size = 0;
+        for (int level = 0; level < 3; ++level)
+        {
+            offsets[level] = size;
+            size += (4 >> level) * build.widths[level];
+        }
+        sums.resize(size);
+        counts.resize(size);
+    }
+    uint32_t * Sum(const PyramidBuild & build, int level, int row) { return sums.data() + offsets[level] + row * build.widths[level]; }
+    uint32_t * Count(const PyramidBuild & build, int level, int row) { return counts.data() + offsets[level] + row * build.widths[level]; }
+};
+
+thread_local BlockSums t_blockSums;
+
+// Makes rows 4 * block to 4 * block + 3 of the 2x level, then the rows of the 4x and 8x levels they cover, from eight rows of the source
+void BuildBlock(const PyramidBuild & build, int block)
+{
+    BlockSums & sums = t_blockSums;
+    for (int level = 0; level < 3; ++level)
+    {
+        const int rows = 4 >> level, first = block * rows;
+        for (int row = 0; row < rows && first + row < build.heights[level]; ++row)
+        {
+            const int y = first + row;
+            const uint16_t * top = build.Row(level - 1, 2 * y), * bottom = build.Row(level - 1, 2 * y + 1);
+            if (build.reduction != DEPTH_REDUCE_MEAN)
+            {
+                build.kernels->reduce[build.reduction](top, bottom, build.widths[level], build.DestRow(level, y));
+                continue;
+            }
+
+            uint32_t * sum = sums.Sum(build, level, row), * count = sums.Count(build, level, row);
+            if (level == 0)
+                build.kernels->sumSource(top, bottom, build.widths[level], sum, count);
+            else
+                build.kernels->sumSums(sums.Sum(build, level - 1, 2 * row), sums.Count(build, level - 1, 2 * row), sums.Sum(build, level - 1, 2 * row + 1),
+                                       sums.Count(build, level - 1, 2 * row + 1), build.widths[level], sum, count);
+            build.kernels->divide(sum, count, build.widths[level], build.DestRow(level, y));
+        }
+    }
+}
+}
+
+void BuildDepthPyramid(const uint16_t * depthImage, int width, int height, int stride, uint16_t * const levels[3], const int levelStrides[3],
+                       const DepthPyramidOptions & options)
+{
+    PyramidBuild build;
+    build.source = reinterpret_cast<const uint8_t *>(depthImage);
+    build.sourceStride = stride;
+    for (int level = 0; level < 3; ++level)
+    {
+        build.levels[level] = reinterpret_cast<uint8_t *>(levels[level]);
+        build.strides[level] = levelStrides[level];
+        build.widths[level] = width >> (level + 1);
+        build.heights[level] = height >> (level + 1);
+    }
+    build.reduction = options.reduction;
+    build.kernels = &GetKernels();
+    if (build.widths[0] <= 0 || build.heights[0] <= 0) return;
+
+    // A band of blocks starts rows of all three levels, so it must start a cache line of each
+    const int blocks = (build.heights[0] + 3) / 4;
+    const int blockStride = 4 * build.strides[0] | 2 * build.strides[1] | build.strides[2];
+    ParallelForRows(options.scheduler, blocks, blockStride, GrainRows(8 * width * 2, g_bandBytes), [&build](int begin, int end) {
+        if (build.reduction == DEPTH_REDUCE_MEAN) t_blockSums.Resize(build);
+        for (int block = begin; block < end; ++block)
+            BuildBlock(build, block);
+    });
+}
+
+void BuildDepthPyramid(const uint16_t * depthImage, int width, int height, uint16_t * const levels[3], const DepthPyramidOptions & options)
+{
+    const int levelStrides[3] = {(width >> 1) * 2, (width >> 2) * 2, (width >> 3) * 2};
+    BuildDepthPyramid(depthImage, width, height, width * 2, levels, levelStrides, options);
+}
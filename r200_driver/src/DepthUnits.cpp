@@ -0,0 +1,436 @@
+#include <r200_driver/DepthUnits.h>
+#include <r200_driver/ImageConversion.h>
+#include <r200_driver/ParallelRows.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Clipping and scaling are a few operations per pixel, so SSE2 does them on every x86 instruction set, and AVX2 only adds F16C for half
+// precision: every processor with AVX2 has it
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define CONVERSION_X86 1
+#include <immintrin.h>
+#define TARGET_AVX2_F16C __attribute__((target("avx2,f16c")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERSION_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+// The range in Z units of the source, and the factors from those to the destination units and to metres, made once per frame
+struct RangeParams
+{
+    int zMin, zMax; // zMin is at least 1, so that invalid pixels are never kept
+    float ratio;
+    float scale;
+};
+
+// Float to half precision with rounding to nearest even, for the positive finite numbers the conversions make, from the bits of the
+// float: numbers below the least normal half are rounded by the addition of a float whose unit in the last place is that of the
+// subnormal halves, the others by adding half a unit of the half's last place less one, plus the odd bit so that ties go to even.
+const uint32_t g_halfInfinity = 0x7C00;
+const uint32_t g_halfOverflow = (127 + 16) << 23; // 65536.0f: halves of floats from 65520 on are infinity, by the carry of the rounding below it
+const uint32_t g_halfNormal = (127 - 14) << 23;   // 2^-14, the least normal half
+const uint32_t g_subnormalMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+const uint32_t g_normalRebias = (static_cast<uint32_t>(15 - 127) << 23) + 0xFFF;
+
+uint16_t FloatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    if (bits >= g_halfOverflow) return g_halfInfinity;
+    if (bits < g_halfNormal)
+    {
+        float magic;
+        memcpy(&magic, &g_subnormalMagic, 4);
+        const float sum = value + magic;
+        memcpy(&bits, &sum, 4);
+        return static_cast<uint16_t>(bits - g_subnormalMagic);
+    }
+    return static_cast<uint16_t>((bits + g_normalRebias + ((bits >> 13) & 1)) >> 13);
+}
+
+// Keep() is all ones in the lanes of depths within the range, and MaskByte() makes the bits of the valid mask from it: one bit per lane
+// for the scalar ops, a whole byte for the others, whose 8 lanes start on one
+struct ScalarOps
+{
+    typedef int Vector;
+    static const int size = 1;
+    static Vector Load(const uint16_t * p) { return *p; }
+    static void Store(uint16_t * p, Vector v) { *p = static_cast<uint16_t>(v); }
+    static Vector Keep(Vector depth, const RangeParams & params) { return depth >= params.zMin && depth <= params.zMax ? -1 : 0; }
+    static Vector And(Vector a, Vector b) { return a & b; }
+    static int MaskByte(Vector keep) { return keep & 1; }
+    static Vector MultiplyOrZero(Vector depth, int factor, int limit) { return depth <= limit ? depth * factor : 0; }
+    static Vector ScaleRound(Vector depth, float ratio)
+    {
+        const float scaled = static_cast<float>(depth) * ratio + 0.5f;
+        return scaled < 65536.0f ? static_cast<int>(scaled) : 0;
+    }
+    static void StoreMeters(float * p, Vector depth, float scale) { *p = static_cast<float>(depth) * scale; }
+    static void StoreHalf(uint16_t * p, Vector depth, float scale) { *p = FloatToHalf(static_cast<float>(depth) * scale); }
+};
+
+#ifdef CONVERSION_X86
+struct Sse2Ops
+{
+    typedef __m128i Vector;
+    static const int size = 8;
+    static Vector Load(const uint16_t * p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+    static void Store(uint16_t * p, Vector v) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v); }
+    // SSE2 only compares signed words, so depth >= zMin is zMin - depth saturating to 0, and depth <= zMax depth - zMax
+    static Vector Keep(Vector depth, const RangeParams & params)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i above = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_set1_epi16(static_cast<int16_t>(params.zMin)), depth), zero);
+        const __m128i below = _mm_cmpeq_epi16(_mm_subs_epu16(depth, _mm_set1_epi16(static_cast<int16_t>(params.zMax))), zero);
+        return _mm_and_si128(above, below);
+    }
+    static Vector And(Vector a, Vector b) { return _mm_and_si128(a, b); }
+    static int MaskByte(Vector keep) { return _mm_movemask_epi8(_mm_packs_epi16(keep, _mm_setzero_si128())) & 0xFF; }
+    static Vector MultiplyOrZero(Vector depth, int factor, int limit)
+    {
+        const __m128i fits = _mm_cmpeq_epi16(_mm_subs_epu16(depth, _mm_set1_epi16(static_cast<int16_t>(limit))), _mm_setzero_si128());
+        return _mm_and_si128(_mm_mullo_epi16(depth, _mm_set1_epi16(static_cast<int16_t>(factor))), fits);
+    }
+    // Products from 65536 on fail the float compare before the conversion, which would make them negative
+    static Vector ScaleRound(Vector depth, float ratio)
+    {
+        const __m128 r = _mm_set1_ps(ratio), half = _mm_set1_ps(0.5f), limit = _mm_set1_ps(65536.0f);
+        const __m128 low = _mm_add_ps(_mm_mul_ps(ToFloat(_mm_unpacklo_epi16(depth, _mm_setzero_si128())), r), half);
+        const __m128 high = _mm_add_ps(_mm_mul_ps(ToFloat(_mm_unpackhi_epi16(depth, _mm_setzero_si128())), r), half);
+        const __m128i lowRounded = _mm_and_si128(_mm_cvttps_epi32(low), _mm_castps_si128(_mm_cmplt_ps(low, limit)));
+        const __m128i highRounded = _mm_and_si128(_mm_cvttps_epi32(high), _mm_castps_si128(_mm_cmplt_ps(high, limit)));
+        return PackUnsigned(lowRounded, highRounded);
+    }
+    static void StoreMeters(float * p, Vector depth, float scale)
+    {
+        const __m128 s = _mm_set1_ps(scale);
+        _mm_storeu_ps(p, _mm_mul_ps(ToFloat(_mm_unpacklo_epi16(depth, _mm_setzero_si128())), s));
+        _mm_storeu_ps(p + 4, _mm_mul_ps(ToFloat(_mm_unpackhi_epi16(depth, _mm_setzero_si128())), s));
+    }
+    static void StoreHalf(uint16_t * p, Vector depth, float scale)
+    {
+        const __m128 s = _mm_set1_ps(scale);
+        const __m128i low = ToHalf(_mm_mul_ps(ToFloat(_mm_unpacklo_epi16(depth, _mm_setzero_si128())), s));
+        const __m128i high = ToHalf(_mm_mul_ps(ToFloat(_mm_unpackhi_epi16(depth, _mm_setzero_si128())), s));
+        Store(p, _mm_packs_epi32(low, high)); // Halves of positive numbers are at most infinity, 0x7C00
+    }
+
+    static __m128 ToFloat(__m128i v) { return _mm_cvtepi32_ps(v); }
+    // 32-bit lanes of 0 to 65535 to words, by way of the signed pack
+    static Vector PackUnsigned(__m128i low, __m128i high)
+    {
+        const __m128i bias = _mm_set1_epi32(0x8000);
+        return _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(low, bias), _mm_sub_epi32(high, bias)), _mm_set1_epi16(-0x8000));
+    }
+    // FloatToHalf() on 4 lanes, whose bits compare right as signed numbers as they are positive
+    static __m128i ToHalf(__m128 value)
+    {
+        const __m128i bits = _mm_castps_si128(value);
+        const __m128i magic = _mm_set1_epi32(static_cast<int>(g_subnormalMagic));
+        const __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(value, _mm_castsi128_ps(magic))), magic);
+        const __m128i odd = _mm_and_si128(_mm_srli_epi32(bits, 13), _mm_set1_epi32(1));
+        const __m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(bits, _mm_set1_epi32(static_cast<int>(g_normalRebias))), odd), 13);
+        const __m128i isSubnormal = _mm_cmplt_epi32(bits, _mm_set1_epi32(static_cast<int>(g_halfNormal)));
+        const __m128i isInfinity = _mm_cmpgt_epi32(bits, _mm_set1_epi32(static_cast<int>(g_halfOverflow - 1)));
+        const __m128i half = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+        return _mm_or_si128(_mm_and_si128(isInfinity, _mm_set1_epi32(g_halfInfinity)), _mm_andnot_si128(isInfinity, half));
+    }
+};
+
+// F16C converts 8 floats in one instruction, rounding to nearest even like FloatToHalf()
+struct Avx2Ops : Sse2Ops
+{
+    TARGET_AVX2_F16C static void StoreHalf(uint16_t * p, Vector depth, float scale)
+    {
+        const __m256 meters = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(depth)), _mm256_set1_ps(scale));
+        Store(p, _mm256_cvtps_ph(meters, _MM_FROUND_TO_NEAREST_INT));
+    }
+};
+#endif
+
+#ifdef CONVERSION_NEON
+struct NeonOps
+{
+    typedef uint16x8_t Vector;
+    static const int size = 8;
+    static Vector Load(const uint16_t * p) { return vld1q_u16(p); }
+    static void Store(uint16_t * p, Vector v) { vst1q_u16(p, v); }
+    static Vector Keep(Vector depth, const RangeParams & params)
+    {
+        return vandq_u16(vcgeq_u16(depth, vdupq_n_u16(static_cast<uint16_t>(params.zMin))), vcleq_u16(depth, vdupq_n_u16(static_cast<uint16_t>(params.zMax))));
+    }
+    static Vector And(Vector a, Vector b) { return vandq_u16(a, b); }
+    static int MaskByte(Vector keep)
+    {
+        static const uint16_t weights[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+        uint8x8_t bits = vmovn_u16(vandq_u16(keep, vld1q_u16(weights)));
+        bits = vpadd_u8(bits, bits);
+        bits = vpadd_u8(bits, bits);
+        bits = vpadd_u8(bits, bits);
+        return vget_lane_u8(bits, 0);
+    }
+    static Vector MultiplyOrZero(Vector depth, int factor, int limit)
+    {
+        return vandq_u16(vmulq_n_u16(depth, static_cast<uint16_t>(factor)), vcleq_u16(depth, vdupq_n_u16(static_cast<uint16_t>(limit))));
+    }
+    static Vector ScaleRound(Vector depth, float ratio)
+    {
+        const float32x4_t limit = vdupq_n_f32(65536.0f);
+        const float32x4_t low = vaddq_f32(vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(depth))), ratio), vdupq_n_f32(0.5f));
+        const float32x4_t high = vaddq_f32(vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(depth))), ratio), vdupq_n_f32(0.5f));
+        const uint32x4_t lowRounded = vandq_u32(vcvtq_u32_f32(low), vcltq_f32(low, limit));
+        const uint32x4_t highRounded = vandq_u32(vcvtq_u32_f32(high), vcltq_f32(high, limit));
+        return vcombine_u16(vmovn_u32(lowRounded), vmovn_u32(highRounded));
+    }
+    static void StoreMeters(float * p, Vector depth, float scale)
+    {
+        vst1q_f32(p, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(depth))), scale));
+        vst1q_f32(p + 4, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(depth))), scale));
+    }
+    static void StoreHalf(uint16_t * p, Vector depth, float scale)
+    {
+        const uint32x4_t low = ToHalf(vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(depth))), scale));
+        const uint32x4_t high = ToHalf(vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(depth))), scale));
+        Store(p, vcombine_u16(vmovn_u32(low), vmovn_u32(high)));
+    }
+
+    // FloatToHalf() on 4 lanes: ARMv7 has no half precision conversion of its own
+    static uint32x4_t ToHalf(float32x4_t value)
+    {
+        const uint32x4_t bits = vreinterpretq_u32_f32(value);
+        const uint32x4_t magic = vdupq_n_u32(g_subnormalMagic);
+        const uint32x4_t subnormal = vsubq_u32(vreinterpretq_u32_f32(vaddq_f32(value, vreinterpretq_f32_u32(magic))), magic);
+        const uint32x4_t odd = vandq_u32(vshrq_n_u32(bits, 13), vdupq_n_u32(1));
+        const uint32x4_t normal = vshrq_n_u32(vaddq_u32(vaddq_u32(bits, vdupq_n_u32(g_normalRebias)), odd), 13);
+        const uint32x4_t half = vbslq_u32(vcltq_u32(bits, vdupq_n_u32(g_halfNormal)), subnormal, normal);
+        return vbslq_u32(vcgeq_u32(bits, vdupq_n_u32(g_halfOverflow)), vdupq_n_u32(g_halfInfinity), half);
+    }
+};
+#endif
+
+// What a row of kept depths becomes. Scale is the compile-time part of the conversion to other Z units: none between equal units, a
+// whole-number factor between the DSZUnits values that have one, or the ratio of any other two in single precision.
+struct IdentityScale
+{
+    template <class V> static typename V::Vector Apply(typename V::Vector depth, const RangeParams &) { return depth; }
+};
+
+template <int factor> struct IntegerScale
+{
+    template <class V> static typename V::Vector Apply(typename V::Vector depth, const RangeParams &)
+    {
+        return V::MultiplyOrZero(depth, factor, 65535 / factor);
+    }
+};
+
+struct FloatScale
+{
+    template <class V> static typename V::Vector Apply(typename V::Vector depth, const RangeParams & params)
+    {
+        return V::ScaleRound(depth, params.ratio);
+    }
+};
+
+template <class Scale> struct UnitsOutput
+{
+    typedef uint16_t Type;
+    template <class V> static void Store(uint16_t * p, typename V::Vector depth, const RangeParams & params)
+    {
+        V::Store(p, Scale::template Apply<V>(depth, params));
+    }
+};
+
+struct MetersOutput
+{
+    typedef float Type;
+    template <class V> static void Store(float * p, typename V::Vector depth, const RangeParams & params) { V::StoreMeters(p, depth, params.scale); }
+};
+
+struct HalfOutput
+{
+    typedef uint16_t Type;
+    template <class V> static void Store(uint16_t * p, typename V::Vector depth, const RangeParams & params) { V::StoreHalf(p, depth, params.scale); }
+};
+
+// Vectors start on multiples of 8 pixels, so that each makes one byte of the mask, and the scalar ops do the rest of the row, gathering
+// its bits into the last byte
+template <class V, class Output> void ConvertRow(const uint16_t * depth, int width, const RangeParams & params, typename Output::Type * dest, uint8_t * mask)
+{
+    int x = 0, bits = 0;
+    for (; x + V::size <= width; x += V::size)
+    {
+        const typename V::Vector d = V::Load(depth + x);
+        const typename V::Vector keep = V::Keep(d, params);
+        Output::template Store<V>(dest + x, V::And(d, keep), params);
+        if (!mask) continue;
+        if (V::size == 8)
+        {
+            mask[x / 8] = static_cast<uint8_t>(V::MaskByte(keep));
+            continue;
+        }
+        bits |= V::MaskByte(keep) << (x % 8);
+        if (x % 8 == 7 || x + 1 == width)
+        {
+            mask[x / 8] = static_cast<uint8_t>(bits);
+            bits = 0;
+        }
+    }
+    if (V::size > 1 && x < width) ConvertRow<ScalarOps, Output>(depth + x, width - x, params, dest + x, mask ? mask + x / 8 : nullptr);
+}
+
+typedef void (*UnitsRowFunction)(const uint16_t * depth, int width, const RangeParams & params, uint16_t * dest, uint8_t * mask);
+typedef void (*MetersRowFunction)(const uint16_t * depth, int width, const RangeParams & params, float * dest, uint8_t * mask);
+
+struct RangeKernels
+{
+    UnitsRowFunction identity, times10, times12, times100, times1000, scaled;
+    MetersRowFunction meters;
+    UnitsRowFunction half;
+};
+
+template <class V> RangeKernels MakeKernels()
+{
+    const RangeKernels kernels = {ConvertRow<V, UnitsOutput<IdentityScale>>,  ConvertRow<V, UnitsOutput<IntegerScale<10>>>,
+                                  ConvertRow<V, UnitsOutput<IntegerScale<12>>>, ConvertRow<V, UnitsOutput<IntegerScale<100>>>,
+                                  ConvertRow<V, UnitsOutput<IntegerScale<1000>>>, ConvertRow<V, UnitsOutput<FloatScale>>,
+                                  ConvertRow<V, MetersOutput>,                  ConvertRow<V, HalfOutput>};
+    return kernels;
+}
+
+const RangeKernels g_scalarKernels = MakeKernels<ScalarOps>();
+#ifdef CONVERSION_X86
+const RangeKernels g_sse2Kernels = MakeKernels<Sse2Ops>();
+const RangeKernels g_avx2Kernels = MakeKernels<Avx2Ops>();
+#endif
+#ifdef CONVERSION_NEON
+const RangeKernels g_neonKernels = MakeKernels<NeonOps>();
+#endif
+
+// Follows SetConversionIsa() of ImageConversion.h
+const RangeKernels & GetRangeKernels()
+{
+    switch (GetConversionIsa())
+    {
+#ifdef CONVERSION_X86
+    case CONVERSION_ISA_SSE2:
+    case CONVERSION_ISA_SSSE3:
+        return g_sse2Kernels;
+    case CONVERSION_ISA_AVX2:
+        return g_avx2Kernels;
+#endif
+#ifdef CONVERSION_NEON
+    case CONVERSION_ISA_NEON:
+        return g_neonKernels;
+#endif
+    default:
+        return g_scalarKernels;
+    }
+}
+
+// The whole-number ratios of the DSZUnits values: centimetres to millimetres, feet to inches, metres to centimetres and metres to
+// millimetres
+UnitsRowFunction GetUnitsRow(const RangeKernels & kernels, int zUnits, int destZUnits)
+{
+    if (zUnits == destZUnits) return kernels.identity;
+    if (zUnits % destZUnits == 0)
+    {
+        switch (zUnits / destZUnits)
+        {
+        case 10:
+            return kernels.times10;
+        case 12:
+            return kernels.times12;
+        case 100:
+            return kernels.times100;
+        case 1000:
+            return kernels.times1000;
+        }
+    }
+    return kernels.scaled;
+}
+
+// Depths from minDepth to maxDepth in rangeUnits as a range of Z units of the source, kept exact for ranges that are whole numbers of
+// them despite the rounding of the products
+RangeParams MakeRangeParams(const DepthRangeOptions & options, int destZUnits)
+{
+    const double epsilon = 1e-9;
+    const double zUnits = std::max(1, options.zUnits), rangeUnits = std::max(1, options.rangeUnits);
+    const double zMin = std::ceil(options.minDepth * rangeUnits / zUnits - epsilon);
+    const double zMax = options.maxDepth > 0 ? std::floor(options.maxDepth * rangeUnits / zUnits + epsilon) : 65535;
+
+    RangeParams params;
+    params.zMin = static_cast<int>(std::min(65535.0, std::max(1.0, zMin)));
+    params.zMax = static_cast<int>(std::min(65535.0, std::max(0.0, zMax)));
+    if (zMin > zMax)
+    {
+        // No depth at once at least 65535 and at most 0
+        params.zMin = 65535;
+        params.zMax = 0;
+    }
+    params.ratio = static_cast<float>(zUnits / std::max(1, destZUnits));
+    params.scale = static_cast<float>(zUnits / DS_METERS);
+    return params;
+}
+
+// Least depth bytes in a band of rows handed to another thread
+const int g_bandBytes = 32 * 1024;
+
+template <class T, class RowFunction>
+void ConvertRows(const uint16_t * depthImage, int width, int height, int depthStride, T * dest, int destStride, const DepthRangeOptions & options,
+                 const RangeParams & params, RowFunction convertRow)
+{
+    if (width <= 0 || height <= 0) return;
+    uint8_t * const mask = options.validMask;
+    const int maskStride = options.validMaskStride ? options.validMaskStride : (width + 7) / 8;
+
+    // Bands start on rows starting a cache line of both the destination and the mask
+    ParallelForRows(options.scheduler, height, mask ? destStride | maskStride : destStride, GrainRows(width * 2, g_bandBytes), [=](int begin, int end) {
+        for (int y = begin; y < end; ++y)
+        {
+            convertRow(reinterpret_cast<const uint16_t *>(reinterpret_cast<const uint8_t *>(depthImage) + static_cast<ptrdiff_t>(y) * depthStride), width,
+                       params, reinterpret_cast<T *>(reinterpret_cast<uint8_t *>(dest) + static_cast<ptrdiff_t>(y) * destStride),
+                       mask ? mask + static_cast<ptrdiff_t>(y) * maskStride : nullptr);
+        }
+    });
+}
+}
+
+void ConvertDepthUnits(const uint16_t * depthImage, int width, int height, int depthStride, uint16_t * destImage, int destStride, int destZUnits,
+                       const DepthRangeOptions & options)
+{
+    const UnitsRowFunction convertRow = GetUnitsRow(GetRangeKernels(), std::max(1, options.zUnits), std::max(1, destZUnits));
+    ConvertRows(depthImage, width, height, depthStride, destImage, destStride, options, MakeRangeParams(options, destZUnits), convertRow);
+}
+
+void ConvertDepthUnits(const uint16_t * depthImage, int width, int height, uint16_t * destImage, int destZUnits, const DepthRangeOptions & options)
+{
+    ConvertDepthUnits(depthImage, width, height, width * 2, destImage, width * 2, destZUnits, options);
+}
+
+void ConvertDepthToMeters(const uint16_t * depthImage, int width, int height, int depthStride, float * meters, int metersStride,
+                          const DepthRangeOptions & options)
+{
+    ConvertRows(depthImage, width, height, depthStride, meters, metersStride, options, MakeRangeParams(options, options.zUnits), GetRangeKernels().meters);
+}
+
+void ConvertDepthToMeters(const uint16_t * depthImage, int width, int height, float * meters, const DepthRangeOptions & options)
+{
+    ConvertDepthToMeters(depthImage, width, height, width * 2, meters, width * 4, options);
+}
+
+void ConvertDepthToHalfMeters(const uint16_t * depthImage, int width, int height, int depthStride, uint16_t * halfMeters, int halfStride,
+                              const DepthRangeOptions & options)
+{
+    ConvertRows(depthImage, width, height, depthStride, halfMeters, halfStride, options, MakeRangeParams(options, options.zUnits), GetRangeKernels().half);
+}
+
+void ConvertDepthToHalfMeters(const uint16_t * depthImage, int width, int height, uint16_t * halfMeters, const DepthRangeOptions & options)
+{
+    ConvertDepthToHalfMeters(depthImage, width, height, width * 2, halfMeters, width * 2, options);
+}
@@ -0,0 +1,29 @@
+#include <r200_driver/FrameMailbox.h>
+
+void FrameMailbox::Publish(DSAPI & ds, BufferPool * pool)
+{
+    FrameSet & frameSet = frames.Back();
+    if (pool)
+        CaptureFrameSet(ds, *pool, frameSet, streams);
+    else
+    {
+        ReserveFrameSet(ds, frameSet, streams);
+        CopyFrameSet(ds, frameSet);
+    }
+    frameSet.sequence = ++published;
+    frames.Publish();
+}
+
+MailboxFrame FrameMailbox::Read()
+{
+    MailboxFrame result;
+    result.isNew = frames.Update();
+
+    const FrameSet & frameSet = frames.Front();
+    result.frameSet = frameSet.hostTime ? &frameSet : nullptr;
+
+    const int64_t now = GetHostTime();
+    result.age = frameSet.hostTime ? now * 1e-9 - frameSet.frameTimePerf : 0;
+    result.sinceGrab = frameSet.hostTime ? (now - frameSet.hostTime) * 1e-9 : 0;
+    return result;
+}
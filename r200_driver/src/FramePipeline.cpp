@@ -0,0 +1,173 @@
+#include <r200_driver/FramePipeline.h>
+#include <r200_driver/Trace.h>
+
+#include <utility>
+
+FramePipeline::FramePipeline(TaskScheduler & scheduler, int maxInFlight)
+    : scheduler(scheduler)
+    , slots(maxInFlight > 0 ? maxInFlight : 1)
+    , inFlight(0)
+    , newest(-1)
+    , submitted(0)
+    , completed(0)
+    , rejected(0)
+{
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        slots[i].busy = false;
+        slots[i].remaining = 0;
+        slots[i].next = -1;
+    }
+}
+
+FramePipeline::~FramePipeline()
+{
+    Flush();
+}
+
+int FramePipeline::AddStage(const char * name, FrameStageFunction function, const std::vector<int> & dependencies, bool ordered)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    const int id = static_cast<int>(stages.size());
+    if (submitted) return -1;
+    for (size_t i = 0; i < dependencies.size(); ++i)
+        if (dependencies[i] < 0 || dependencies[i] >= id) return -1;
+
+    Stage stage;
+    stage.name = name;
+    stage.traceStage = Tracer::RegisterStage(name);
+    stage.function = std::move(function);
+    stage.dependencies = static_cast<int>(dependencies.size());
+    stage.ordered = ordered;
+    stages.push_back(std::move(stage));
+    for (size_t i = 0; i < dependencies.size(); ++i)
+        stages[dependencies[i]].dependents.push_back(id);
+
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        slots[i].pending.resize(stages.size());
+        slots[i].done.resize(stages.size());
+    }
+    return id;
+}
+
+bool FramePipeline::Submit(FrameSetHandle frame)
+{
+    if (!frame) return false;
+    std::unique_lock<std::mutex> lock(mutex);
+    slotFreed.wait(lock, [this] { return inFlight < static_cast<int>(slots.size()); });
+    Start(lock, std::move(frame));
+    return true;
+}
+
+bool FramePipeline::TrySubmit(FrameSetHandle frame)
+{
+    if (!frame) return false;
+    std::unique_lock<std::mutex> lock(mutex);
+    if (inFlight == static_cast<int>(slots.size()))
+    {
+        ++rejected;
+        return false;
+    }
+    Start(lock, std::move(frame));
+    return true;
+}
+
+void FramePipeline::Start(std::unique_lock<std::mutex> & lock, FrameSetHandle frame)
+{
+    // An ordered stage also waits for the same stage of the previous frame, if that one is still in flight and has not run it yet
+    Slot * previous = newest >= 0 && slots[newest].busy ? &slots[newest] : nullptr;
+
+    int index = 0;
+    while (slots[index].busy)
+        ++index;
+    Slot & slot = slots[index];
+    slot.frame = std::move(frame);
+    slot.busy = true;
+    slot.remaining = static_cast<int>(stages.size());
+    slot.next = -1;
+    if (previous) previous->next = index;
+    newest = index;
+
+    std::vector<int> ready;
+    for (size_t s = 0; s < stages.size(); ++s)
+    {
+        slot.done[s] = false;
+        slot.pending[s] = stages[s].dependencies + (stages[s].ordered && previous && !previous->done[s] ? 1 : 0);
+        if (!slot.pending[s]) ready.push_back(static_cast<int>(s));
+    }
+    ++inFlight;
+    ++submitted;
+
+    if (stages.empty())
+    {
+        Finish(index, -1);
+        return;
+    }
+    lock.unlock();
+    for (size_t i = 0; i < ready.size(); ++i)
+        scheduler.Spawn(&FramePipeline::RunStage, this, index, ready[i]);
+    lock.lock();
+}
+
+void FramePipeline::RunStage(void * context, int slot, int stage)
+{
+    FramePipeline & pipeline = *static_cast<FramePipeline *>(context);
+    // Neither the frame nor the stage list changes while a stage of the frame is pending, so both are safe to use unlocked
+    const FrameSet & frame = *pipeline.slots[slot].frame;
+    {
+        TraceScope trace(pipeline.stages[stage].traceStage, frame.frameNumber);
+        pipeline.stages[stage].function(frame, slot);
+    }
+
+    std::unique_lock<std::mutex> lock(pipeline.mutex);
+    pipeline.Finish(slot, stage);
+}
+
+// Called with mutex held. stage -1 completes a frame with no stages at all.
+void FramePipeline::Finish(int index, int stage)
+{
+    Slot & slot = slots[index];
+    std::vector<std::pair<int, int>> ready;
+    if (stage >= 0)
+    {
+        slot.done[stage] = true;
+        const std::vector<int> & dependents = stages[stage].dependents;
+        for (size_t i = 0; i < dependents.size(); ++i)
+            if (--slot.pending[dependents[i]] == 0) ready.push_back(std::make_pair(index, dependents[i]));
+
+        // The next frame was linked while this stage was not done yet, so it counted this stage as a dependency
+        if (stages[stage].ordered && slot.next >= 0 && --slots[slot.next].pending[stage] == 0) ready.push_back(std::make_pair(slot.next, stage));
+        --slot.remaining;
+    }
+
+    if (slot.remaining == 0)
+    {
+        slot.frame.reset();
+        slot.busy = false;
+        slot.next = -1;
+        --inFlight;
+        ++completed;
+        slotFreed.notify_all();
+    }
+
+    for (size_t i = 0; i < ready.size(); ++i)
+        scheduler.Spawn(&FramePipeline::RunStage, this, ready[i].first, ready[i].second);
+}
+
+void FramePipeline::Flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    slotFreed.wait(lock, [this] { return inFlight == 0; });
+}
+
+FramePipelineStats FramePipeline::GetStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    FramePipelineStats stats;
+    stats.submitted = submitted;
+    stats.completed = completed;
+    stats.rejected = rejected;
+    stats.inFlight = inFlight;
+    return stats;
+}
@@ -0,0 +1,179 @@
+#include <r200_driver/FrameSet.h>
+
+#include <cstring>
+
+namespace
+{
+void ReserveImage(FrameImage & image, DSPixelFormat format, int width, int height, bool allocate)
+{
+    image.format = format;
+    image.width = width;
+    image.height = height;
+    image.stride = GetRowBytes(format, width);
+    image.buffer.reset();
+    if (allocate)
+    {
+        image.storage.resize(static_cast<size_t>(image.stride) * height);
+        image.pixels = image.storage.data();
+    }
+    else
+        image.pixels = nullptr;
+}
+
+void ReleaseImage(FrameImage & image)
+{
+    image.width = image.height = image.stride = 0;
+    image.pixels = nullptr;
+    image.buffer.reset();
+    image.storage.clear();
+}
+
+void ReserveImages(DSAPI & ds, FrameSet & frameSet, unsigned streams, bool allocate)
+{
+    if ((streams & FRAME_STREAM_Z) && ds.isZEnabled())
+        ReserveImage(frameSet.z, DS_LUMINANCE16, ds.zWidth(), ds.zHeight(), allocate);
+    else
+        ReleaseImage(frameSet.z);
+
+    const DSPixelFormat lrFormat = ds.getLRPixelFormat();
+    if ((streams & FRAME_STREAM_LEFT) && (ds.isLeftEnabled() || (IsInterleavedLRFormat(lrFormat) && ds.isRightEnabled())))
+        ReserveImage(frameSet.left, lrFormat, ds.lrWidth(), ds.lrHeight(), allocate);
+    else
+        ReleaseImage(frameSet.left);
+
+    if ((streams & FRAME_STREAM_RIGHT) && ds.isRightEnabled() && !IsInterleavedLRFormat(lrFormat))
+        ReserveImage(frameSet.right, lrFormat, ds.lrWidth(), ds.lrHeight(), allocate);
+    else
+        ReleaseImage(frameSet.right);
+
+    DSThird * third = ds.accessThird();
+    if ((streams & FRAME_STREAM_THIRD) && third && third->isThirdEnabled())
+        ReserveImage(frameSet.third, third->getThirdPixelFormat(), third->thirdWidth(), third->thirdHeight(), allocate);
+    else
+        ReleaseImage(frameSet.third);
+}
+
+void CopyFrameInfo(DSAPI & ds, FrameSet & frameSet)
+{
+    frameSet.hostTime = GetHostTime();
+    frameSet.frameNumber = ds.getFrameNumber();
+    frameSet.frameTime = ds.getFrameTime(false);
+    frameSet.frameTimePerf = ds.getFrameTime(true);
+}
+
+void CopyImage(const void * source, FrameImage & image)
+{
+    if (source && !image.storage.empty())
+        memcpy(image.storage.data(), source, image.storage.size());
+}
+
+void ShareImage(BufferPool & pool, const void * source, FrameImage & image)
+{
+    if (!source) return;
+
+    const uint8_t * p = static_cast<const uint8_t *>(source);
+    const size_t size = static_cast<size_t>(image.stride) * image.height;
+    const int index = pool.IndexOf(p);
+    if (index >= 0 && p + size <= pool.Buffer(index) + pool.BufferSize()) image.buffer = pool.Share(index);
+    if (image.buffer)
+        image.pixels = p;
+    else
+    {
+        // Only allocates the first time a given image has to fall back to a copy
+        image.storage.resize(size);
+        memcpy(image.storage.data(), p, size);
+        image.pixels = image.storage.data();
+    }
+}
+}
+
+FrameImage::FrameImage(const FrameImage & other)
+    : width(other.width)
+    , height(other.height)
+    , stride(other.stride)
+    , format(other.format)
+    , pixels()
+    , buffer(other.buffer)
+    , storage(other.shared() ? std::vector<uint8_t>() : other.storage)
+{
+    if (other.pixels) pixels = shared() ? other.pixels : storage.data();
+}
+
+FrameImage::FrameImage(FrameImage && other)
+    : width(other.width)
+    , height(other.height)
+    , stride(other.stride)
+    , format(other.format)
+    , pixels(other.pixels)
+    , buffer(std::move(other.buffer))
+    , storage(std::move(other.storage))
+{
+    other.pixels = nullptr;
+}
+
+FrameImage & FrameImage::operator=(const FrameImage & other)
+{
+    if (this == &other) return *this;
+    width = other.width;
+    height = other.height;
+    stride = other.stride;
+    format = other.format;
+    buffer = other.buffer;
+    if (!other.shared()) storage.assign(other.storage.begin(), other.storage.end());
+    pixels = other.pixels ? (shared() ? other.pixels : storage.data()) : nullptr;
+    return *this;
+}
+
+FrameImage & FrameImage::operator=(FrameImage && other)
+{
+    if (this == &other) return *this;
+    width = other.width;
+    height = other.height;
+    stride = other.stride;
+    format = other.format;
+    pixels = other.pixels;
+    buffer = std::move(other.buffer);
+    storage = std::move(other.storage);
+    other.pixels = nullptr;
+    return *this;
+}
+
+void ReserveFrameSet(DSAPI & ds, FrameSet & frameSet, unsigned streams)
+{
+    ReserveImages(ds, frameSet, streams, true);
+}
+
+void CopyFrameSet(DSAPI & ds, FrameSet & frameSet)
+{
+    CopyFrameInfo(ds, frameSet);
+
+    if (frameSet.z.valid()) CopyImage(ds.getZImage(), frameSet.z);
+    if (frameSet.left.valid()) CopyImage(ds.getLImage(), frameSet.left);
+    if (frameSet.right.valid()) CopyImage(ds.getRImage(), frameSet.right);
+
+    if (frameSet.third.valid())
+    {
+        DSThird * third = ds.accessThird();
+        frameSet.thirdFrameNumber = third->getThirdFrameNumber();
+        frameSet.thirdFrameTime = third->getThirdFrameTime(false);
+        CopyImage(third->getThirdImage(), frameSet.third);
+    }
+}
+
+void CaptureFrameSet(DSAPI & ds, BufferPool & pool, FrameSet & frameSet, unsigned streams)
+{
+    ReserveImages(ds, frameSet, streams, false);
+    CopyFrameInfo(ds, frameSet);
+
+    if (frameSet.z.width) ShareImage(pool, ds.getZImage(), frameSet.z);
+    if (frameSet.left.width) ShareImage(pool, ds.getLImage(), frameSet.left);
+    if (frameSet.right.width) ShareImage(pool, ds.getRImage(), frameSet.right);
+
+    if (frameSet.third.width)
+    {
+        DSThird * third = ds.accessThird();
+        frameSet.thirdFrameNumber = third->getThirdFrameNumber();
+        frameSet.thirdFrameTime = third->getThirdFrameTime(false);
+        ShareImage(pool, third->getThirdImage(), frameSet.third);
+    }
+}
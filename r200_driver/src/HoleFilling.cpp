@@ -0,0 +1,373 @@
+#include <r200_driver/HoleFilling.h>
+#include <r200_driver/ImageConversion.h>
+#include <r200_driver/ParallelRows.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+// A row takes a few operations per pixel, so SSE2 does it on every x86 instruction set
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define CONVERSION_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERSION_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+// Masks are all ones or all zeros in each lane, counters count the lanes of the masks added to them
+struct ScalarOps
+{
+    typedef int Vector;
+    static const int size = 1;
+    static Vector Load(const uint16_t * p) { return *p; }
+    static void Store(uint16_t * p, Vector v) { *p = static_cast<uint16_t>(v); }
+    static Vector Zero() { return 0; }
+    static Vector And(Vector a, Vector b) { return a & b; }
+    static Vector AndNot(Vector a, Vector b) { return ~a & b; }
+    static Vector Or(Vector a, Vector b) { return a | b; }
+    static Vector Max(Vector a, Vector b) { return std::max(a, b); }
+    static Vector Negate(Vector a) { return -a & 0xFFFF; }
+    static Vector IsZero(Vector a) { return a ? 0 : -1; }
+    static Vector LoadMask(const uint8_t * p) { return *p ? -1 : 0; }
+    static Vector Count(Vector counter, Vector mask) { return counter - mask; }
+    static int Sum(Vector counter) { return counter; }
+};
+
+#ifdef CONVERSION_X86
+struct Sse2Ops
+{
+    typedef __m128i Vector;
+    static const int size = 8;
+    static Vector Load(const uint16_t * p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+    static void Store(uint16_t * p, Vector v) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v); }
+    static Vector Zero() { return _mm_setzero_si128(); }
+    static Vector And(Vector a, Vector b) { return _mm_and_si128(a, b); }
+    static Vector AndNot(Vector a, Vector b) { return _mm_andnot_si128(a, b); }
+    static Vector Or(Vector a, Vector b) { return _mm_or_si128(a, b); }
+    // SSE2 has no unsigned word maximum: a - b saturated at 0, plus b
+    static Vector Max(Vector a, Vector b) { return _mm_adds_epu16(_mm_subs_epu16(a, b), b); }
+    static Vector Negate(Vector a) { return _mm_sub_epi16(_mm_setzero_si128(), a); }
+    static Vector IsZero(Vector a) { return _mm_cmpeq_epi16(a, _mm_setzero_si128()); }
+    static Vector LoadMask(const uint8_t * p)
+    {
+        const __m128i bytes = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)), _mm_setzero_si128());
+        return _mm_xor_si128(_mm_cmpeq_epi16(bytes, _mm_setzero_si128()), _mm_set1_epi16(-1));
+    }
+    static Vector Count(Vector counter, Vector mask) { return _mm_sub_epi16(counter, mask); }
+    static int Sum(Vector counter)
+    {
+        __m128i sums = _mm_madd_epi16(counter, _mm_set1_epi16(1));
+        sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+        sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(sums);
+    }
+
+    // For the fill from the left, on signed words
+    static Vector Lanes() { return _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7); }
+    static Vector Set(int value) { return _mm_set1_epi16(static_cast<int16_t>(value)); }
+    template <int lanes> static Vector ShiftUp(Vector v) { return _mm_slli_si128(v, 2 * lanes); }
+    static Vector BroadcastLast(Vector v) { return _mm_unpackhi_epi64(_mm_shufflehi_epi16(v, 0xFF), _mm_shufflehi_epi16(v, 0xFF)); }
+    static Vector SubtractSaturated(Vector a, Vector b) { return _mm_subs_epi16(a, b); }
+    static Vector Greater(Vector a, Vector b) { return _mm_cmpgt_epi16(a, b); }
+};
+#endif
+
+#ifdef CONVERSION_NEON
+struct NeonOps
+{
+    typedef uint16x8_t Vector;
+    static const int size = 8;
+    static Vector Load(const uint16_t * p) { return vld1q_u16(p); }
+    static void Store(uint16_t * p, Vector v) { vst1q_u16(p, v); }
+    static Vector Zero() { return vdupq_n_u16(0); }
+    static Vector And(Vector a, Vector b) { return vandq_u16(a, b); }
+    static Vector AndNot(Vector a, Vector b) { return vbicq_u16(b, a); }
+    static Vector Or(Vector a, Vector b) { return vorrq_u16(a, b); }
+    static Vector Max(Vector a, Vector b) { return vmaxq_u16(a, b); }
+    static Vector Negate(Vector a) { return vsubq_u16(vdupq_n_u16(0), a); }
+    static Vector IsZero(Vector a) { return vceqq_u16(a, vdupq_n_u16(0)); }
+    static Vector LoadMask(const uint8_t * p)
+    {
+        const uint16x8_t bytes = vmovl_u8(vld1_u8(p));
+        return vtstq_u16(bytes, bytes);
+    }
+    static Vector Count(Vector counter, Vector mask) { return vsubq_u16(counter, mask); }
+    static int Sum(Vector counter)
+    {
+        const uint64x2_t sums = vpaddlq_u32(vpaddlq_u16(counter));
+        return static_cast<int>(vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1));
+    }
+
+    static Vector Lanes()
+    {
+        static const uint16_t lanes[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+        return vld1q_u16(lanes);
+    }
+    static Vector Set(int value) { return vreinterpretq_u16_s16(vdupq_n_s16(static_cast<int16_t>(value))); }
+    template <int lanes> static Vector ShiftUp(Vector v) { return vextq_u16(vdupq_n_u16(0), v, 8 - lanes); }
+    static Vector BroadcastLast(Vector v) { return vdupq_lane_u16(vget_high_u16(v), 3); }
+    static Vector SubtractSaturated(Vector a, Vector b) { return vreinterpretq_u16_s16(vqsubq_s16(vreinterpretq_s16_u16(a), vreinterpretq_s16_u16(b))); }
+    static Vector Greater(Vector a, Vector b) { return vcgtq_s16(vreinterpretq_s16_u16(a), vreinterpretq_s16_u16(b)); }
+};
+#endif
+
+// Calls step(x) on every vector of size pixels of a row of width pixels, the last one overlapping the one before it. False if the row is
+// narrower than one vector, which is then left to the scalar version.
+template <class Step> bool ForEachVector(int width, int size, Step step)
+{
+    if (width <= 0) return true;
+    if (width < size) return false;
+    for (int x = 0;; x += size)
+    {
+        if (x > width - size) x = width - size;
+        step(x);
+        if (x + size == width) break;
+    }
+    return true;
+}
+
+struct RowCounts
+{
+    int holes, filled;
+};
+
+// The fill from the left carries the last valid depth of the row and its position. Distances are capped at 32767, which a radius of
+// 32767 takes as no bound; lastPosition is relative to the start of depth.
+void FillLeftRowScalar(const uint16_t * depth, int width, const uint8_t * mask, int radius, int lastDepth, int lastPosition, uint16_t * out,
+                       RowCounts & counts)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        const int d = depth[x];
+        if (d)
+        {
+            lastDepth = d;
+            lastPosition = x;
+            out[x] = static_cast<uint16_t>(d);
+            continue;
+        }
+        const bool fill = lastDepth && std::min(32767, x - lastPosition) <= radius && (!mask || mask[x]);
+        out[x] = static_cast<uint16_t>(fill ? lastDepth : 0);
+        ++counts.holes;
+        counts.filled += fill;
+    }
+}
+
+// Each vector takes the last valid depth before each of its lanes in three steps, each moving the depths found so far up by twice as many
+// lanes into the lanes still without one, then the last one of the vector before it
+template <class V> void FillLeftRow(const uint16_t * depth, int width, const uint8_t * mask, int radius, uint16_t * out, RowCounts & counts)
+{
+    typedef typename V::Vector Vector;
+    const Vector lanes = V::Lanes(), limit = V::Set(radius), farthest = V::Set(-32768);
+    Vector lastDepth = V::Zero(), lastPosition = farthest, holes = V::Zero(), filled = V::Zero();
+    int x = 0;
+    for (; x + V::size <= width; x += V::size)
+    {
+        const Vector d = V::Load(depth + x), invalid = V::IsZero(d);
+        Vector found = d, position = V::Or(V::And(invalid, farthest), V::AndNot(invalid, lanes));
+        Vector take = V::IsZero(found);
+        found = V::Or(found, V::And(take, V::template ShiftUp<1>(found)));
+        position = V::Or(V::AndNot(take, position), V::And(take, V::template ShiftUp<1>(position)));
+        take = V::IsZero(found);
+        found = V::Or(found, V::And(take, V::template ShiftUp<2>(found)));
+        position = V::Or(V::AndNot(take, position), V::And(take, V::template ShiftUp<2>(position)));
+        take = V::IsZero(found);
+        found = V::Or(found, V::And(take, V::template ShiftUp<4>(found)));
+        position = V::Or(V::AndNot(take, position), V::And(take, V::template ShiftUp<4>(position)));
+        take = V::IsZero(found);
+        found = V::Or(found, V::And(take, lastDepth));
+        position = V::Or(V::AndNot(take, position), V::And(take, lastPosition));
+
+        Vector fill = V::AndNot(V::IsZero(found), V::AndNot(V::Greater(V::SubtractSaturated(lanes, position), limit), invalid));
+        if (mask) fill = V::And(fill, V::LoadMask(mask + x));
+        V::Store(out + x, V::Or(d, V::And(fill, found)));
+        holes = V::Count(holes, invalid);
+        filled = V::Count(filled, fill);
+        lastDepth = V::BroadcastLast(found);
+        lastPosition = V::SubtractSaturated(V::BroadcastLast(position), V::Set(V::size));
+    }
+    counts.holes += V::Sum(holes);
+    counts.filled += V::Sum(filled);
+
+    uint16_t carried[2][V::size];
+    V::Store(carried[0], lastDepth);
+    V::Store(carried[1], lastPosition);
+    FillLeftRowScalar(depth + x, width - x, mask ? mask + x : nullptr, radius, carried[0][0], static_cast<int16_t>(carried[1][0]), out + x,
+                      counts);
+}
+
+template <> void FillLeftRow<ScalarOps>(const uint16_t * depth, int width, const uint8_t * mask, int radius, uint16_t * out, RowCounts & counts)
+{
+    FillLeftRowScalar(depth, width, mask, radius, 0, -32768, out, counts);
+}
+
+// The modes around a hole take the largest of keys over the square of the radius about it, which is the largest of the rows of the
+// square of the largest over the width of the square in each row. Keys are the depths for the farthest, and the depths negated for the
+// nearest, which makes the nearest the largest; either way 0 stays 0, below every valid depth.
+//
+// The key row of a source row, from a copy of its keys with radius zeros on each side
+template <class V> void KeyRow(const uint16_t * depth, int width, int radius, bool nearest, uint16_t * padded, uint16_t * keys)
+{
+    typedef typename V::Vector Vector;
+    std::fill(padded, padded + radius, 0);
+    std::fill(padded + radius + width, padded + 2 * radius + width, 0);
+    bool done = ForEachVector(width, V::size, [=](int x) {
+        const Vector d = V::Load(depth + x);
+        V::Store(padded + radius + x, nearest ? V::Negate(d) : d);
+    });
+    done = done && ForEachVector(width, V::size, [=](int x) {
+        Vector key = V::Load(padded + x);
+        for (int i = 1; i <= 2 * radius; ++i)
+            key = V::Max(key, V::Load(padded + x + i));
+        V::Store(keys + x, key);
+    });
+    if (!done) KeyRow<ScalarOps>(depth, width, radius, nearest, padded, keys);
+}
+
+// Fills the holes of a row from the key rows of the rows of the square about it
+template <class V> void FillAroundRow(const uint16_t * depth, int width, const uint16_t * const * keys, int keyRows, bool nearest, const uint8_t * mask,
+                                      uint16_t * out, RowCounts & counts)
+{
+    typedef typename V::Vector Vector;
+    Vector holes = V::Zero(), filled = V::Zero();
+    int x = 0;
+    for (; x + V::size <= width; x += V::size)
+    {
+        Vector key = V::Load(keys[0] + x);
+        for (int i = 1; i < keyRows; ++i)
+            key = V::Max(key, V::Load(keys[i] + x));
+        const Vector found = nearest ? V::Negate(key) : key;
+        const Vector d = V::Load(depth + x), invalid = V::IsZero(d);
+        Vector fill = V::AndNot(V::IsZero(found), invalid);
+        if (mask) fill = V::And(fill, V::LoadMask(mask + x));
+        V::Store(out + x, V::Or(d, V::And(fill, found)));
+        holes = V::Count(holes, invalid);
+        filled = V::Count(filled, fill);
+    }
+    counts.holes += V::Sum(holes);
+    counts.filled += V::Sum(filled);
+    if (V::size > 1 && x < width)
+    {
+        const uint16_t * tail[17];
+        for (int i = 0; i < keyRows; ++i)
+            tail[i] = keys[i] + x;
+        FillAroundRow<ScalarOps>(depth + x, width - x, tail, keyRows, nearest, mask ? mask + x : nullptr, out + x, counts);
+    }
+}
+
+struct HoleFillKernels
+{
+    void (*fillLeftRow)(const uint16_t * depth, int width, const uint8_t * mask, int radius, uint16_t * out, RowCounts & counts);
+    void (*keyRow)(const uint16_t * depth, int width, int radius, bool nearest, uint16_t * padded, uint16_t * keys);
+    void (*fillAroundRow)(const uint16_t * depth, int width, const uint16_t * const * keys, int keyRows, bool nearest, const uint8_t * mask,
+                          uint16_t * out, RowCounts & counts);
+};
+
+const HoleFillKernels g_scalarKernels = {FillLeftRow<ScalarOps>, KeyRow<ScalarOps>, FillAroundRow<ScalarOps>};
+#ifdef CONVERSION_X86
+const HoleFillKernels g_sse2Kernels = {FillLeftRow<Sse2Ops>, KeyRow<Sse2Ops>, FillAroundRow<Sse2Ops>};
+#endif
+#ifdef CONVERSION_NEON
+const HoleFillKernels g_neonKernels = {FillLeftRow<NeonOps>, KeyRow<NeonOps>, FillAroundRow<NeonOps>};
+#endif
+
+// Follows SetConversionIsa() of ImageConversion.h
+const HoleFillKernels & GetKernels()
+{
+    switch (GetConversionIsa())
+    {
+#ifdef CONVERSION_X86
+    case CONVERSION_ISA_SSE2:
+    case CONVERSION_ISA_SSSE3:
+    case CONVERSION_ISA_AVX2:
+        return g_sse2Kernels;
+#endif
+#ifdef CONVERSION_NEON
+    case CONVERSION_ISA_NEON:
+        return g_neonKernels;
+#endif
+    default:
+        return g_scalarKernels;
+    }
+}
+
+// Least depth bytes in a band of rows handed to another thread
+const int g_bandBytes = 32 * 1024;
+
+// Key rows of the square about the current row, used as a ring, then a row of zeros for the rows outside the image, then the padded row
+thread_local std::vector<uint16_t> t_keys;
+}
+
+HoleFillStats FillDepthHoles(const uint16_t * depthImage, int width, int height, int depthStride, uint16_t * filled, int filledStride,
+                             const HoleFillOptions & options)
+{
+    HoleFillStats stats;
+    if (width <= 0 || height <= 0) return stats;
+
+    const HoleFillKernels & kernels = GetKernels();
+    const HoleFillMode mode = options.mode;
+    const int maskStride = options.maskStride ? options.maskStride : width;
+    const uint8_t * const mask = options.mask;
+    const auto sourceRow = [=](int y) {
+        return reinterpret_cast<const uint16_t *>(reinterpret_cast<const uint8_t *>(depthImage) + static_cast<ptrdiff_t>(y) * depthStride);
+    };
+    const auto destRow = [=](int y) { return reinterpret_cast<uint16_t *>(reinterpret_cast<uint8_t *>(filled) + static_cast<ptrdiff_t>(y) * filledStride); };
+    const auto maskRow = [=](int y) { return mask ? mask + static_cast<ptrdiff_t>(y) * maskStride : nullptr; };
+
+    std::atomic<int> holes(0), filledHoles(0);
+    if (mode == HOLE_FILL_LEFT)
+    {
+        const int radius = options.radius > 0 ? std::min(32767, options.radius) : 32767;
+        ParallelForRows(options.scheduler, height, filledStride, GrainRows(width * 2, g_bandBytes), [&, radius](int begin, int end) {
+            RowCounts counts = {0, 0};
+            for (int y = begin; y < end; ++y)
+                kernels.fillLeftRow(sourceRow(y), width, maskRow(y), radius, destRow(y), counts);
+            holes += counts.holes;
+            filledHoles += counts.filled;
+        });
+    }
+    else
+    {
+        // Each band reads radius rows beyond each end, so it makes their key rows before its first row
+        const int radius = std::min(8, std::max(1, options.radius)), keyRows = 2 * radius + 1;
+        const bool nearest = mode == HOLE_FILL_NEAREST;
+        const int grainRows = GrainRows(width * 2, g_bandBytes) + 2 * radius;
+        ParallelForRows(options.scheduler, height, filledStride, grainRows, [&, radius, keyRows, nearest](int begin, int end) {
+            std::vector<uint16_t> & keys = t_keys;
+            keys.assign(static_cast<size_t>(keyRows + 2) * width + 2 * radius, 0);
+            const uint16_t * const zeros = keys.data() + static_cast<size_t>(keyRows) * width;
+            uint16_t * const padded = keys.data() + static_cast<size_t>(keyRows + 1) * width;
+            const uint16_t * rows[17];
+            const auto makeKeys = [&](int y) -> const uint16_t * {
+                uint16_t * slot = keys.data() + static_cast<size_t>((y + keyRows) % keyRows) * width;
+                if (y < 0 || y >= height) return zeros;
+                kernels.keyRow(sourceRow(y), width, radius, nearest, padded, slot);
+                return slot;
+            };
+
+            for (int y = begin - radius; y < begin + radius; ++y)
+                rows[(y + keyRows) % keyRows] = makeKeys(y);
+            RowCounts counts = {0, 0};
+            for (int y = begin; y < end; ++y)
+            {
+                rows[(y + radius) % keyRows] = makeKeys(y + radius);
+                kernels.fillAroundRow(sourceRow(y), width, rows, keyRows, nearest, maskRow(y), destRow(y), counts);
+            }
+            holes += counts.holes;
+            filledHoles += counts.filled;
+        });
+    }
+    stats.holes = holes;
+    stats.filled = filledHoles;
+    return stats;
+}
+
+HoleFillStats FillDepthHoles(const uint16_t * depthImage, int width, int height, uint16_t * filled, const HoleFillOptions & options)
+{
+    return FillDepthHoles(depthImage, width, height, width * 2, filled, width * 2, options);
+}
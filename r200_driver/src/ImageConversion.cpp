@@ -0,0 +1,652 @@
+#include <r200_driver/ImageConversion.h>
+#include <r200_driver/ParallelRows.h>
+
+#include <algorithm>
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVERSION_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERSION_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+// One row of each conversion. The SIMD versions finish a row with a vector overlapping the one before it rather than with a scalar tail,
+// and hand rows narrower than one vector to the next simpler version.
+struct ConversionKernels
+{
+    void (*rl8ToL8)(const uint8_t * source, int width, uint8_t * left, uint8_t * right);
+    void (*rl16ToL16)(const uint16_t * source, int width, uint16_t * left, uint16_t * right);
+    void (*rl16ToL8)(const uint16_t * source, int width, int shift, uint8_t * left, uint8_t * right);
+    // Writes the 8 bit outputs unless left8 is null and the 16 bit outputs unless left16 is null
+    void (*rl12)(const uint8_t * source, int width, int shift, uint8_t * left8, uint8_t * right8, uint16_t * left16, uint16_t * right16);
+};
+
+void RL8ToL8Scalar(const uint8_t * source, int width, uint8_t * left, uint8_t * right)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        left[x] = source[2 * x];
+        right[x] = source[2 * x + 1];
+    }
+}
+
+void RL16ToL16Scalar(const uint16_t * source, int width, uint16_t * left, uint16_t * right)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        left[x] = source[2 * x];
+        right[x] = source[2 * x + 1];
+    }
+}
+
+void RL16ToL8Scalar(const uint16_t * source, int width, int shift, uint8_t * left, uint8_t * right)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        left[x] = static_cast<uint8_t>(source[2 * x + 1] >> shift);
+        right[x] = static_cast<uint8_t>(source[2 * x] >> shift);
+    }
+}
+
+void RL12Scalar(const uint8_t * source, int width, int shift, uint8_t * left8, uint8_t * right8, uint16_t * left16, uint16_t * right16)
+{
+    for (int x = 0; x < width; ++x, source += 3)
+    {
+        const uint16_t right = static_cast<uint16_t>(source[0] | (source[1] & 0x0F) << 8);
+        const uint16_t left = static_cast<uint16_t>(source[1] >> 4 | source[2] << 4);
+        if (left8)
+        {
+            left8[x] = static_cast<uint8_t>(left >> shift);
+            right8[x] = static_cast<uint8_t>(right >> shift);
+        }
+        if (left16)
+        {
+            left16[x] = left;
+            right16[x] = right;
+        }
+    }
+}
+
+#ifdef CONVERSION_X86
+// Splits 32 interleaved bytes into the 16 even and the 16 odd ones
+TARGET_SSE2 inline void DeinterleaveBytesSSE2(__m128i a, __m128i b, __m128i & even, __m128i & odd)
+{
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    even = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+    odd = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+}
+
+TARGET_SSE2 void RL8ToL8SSE2(const uint8_t * source, int width, uint8_t * left, uint8_t * right)
+{
+    if (width < 16)
+    {
+        RL8ToL8Scalar(source, width, left, right);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        __m128i even, odd;
+        DeinterleaveBytesSSE2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 2 * x)),
+                              _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 2 * x + 16)), even, odd);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(left + x), even);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(right + x), odd);
+        if (x + 16 == width) break;
+    }
+}
+
+TARGET_SSE2 void RL16ToL16SSE2(const uint16_t * source, int width, uint16_t * left, uint16_t * right)
+{
+    if (width < 8)
+    {
+        RL16ToL16Scalar(source, width, left, right);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 8, width - 8))
+    {
+        // Gather the even words of each vector into its low half and the odd words into its high half
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 2 * x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 2 * x + 8));
+        a = _mm_shuffle_epi32(_mm_shufflehi_epi16(_mm_shufflelo_epi16(a, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+        b = _mm_shuffle_epi32(_mm_shufflehi_epi16(_mm_shufflelo_epi16(b, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(left + x), _mm_unpacklo_epi64(a, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(right + x), _mm_unpackhi_epi64(a, b));
+        if (x + 8 == width) break;
+    }
+}
+
+TARGET_SSE2 void RL16ToL8SSE2(const uint16_t * source, int width, int shift, uint8_t * left, uint8_t * right)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift), low = _mm_set1_epi16(0x00FF);
+    if (width < 16)
+    {
+        RL16ToL8Scalar(source, width, shift, left, right);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        // Shift and truncate every word to a byte, which leaves the pixels interleaved like DS_NATIVE_RL_LUMINANCE8
+        __m128i v[4];
+        for (int i = 0; i < 4; ++i)
+            v[i] = _mm_and_si128(_mm_srl_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 2 * x + 8 * i)), count), low);
+        __m128i even, odd;
+        DeinterleaveBytesSSE2(_mm_packus_epi16(v[0], v[1]), _mm_packus_epi16(v[2], v[3]), even, odd);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(left + x), odd);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(right + x), even);
+        if (x + 16 == width) break;
+    }
+}
+
+// Unpacks 8 pixels (24 bytes) of DS_NATIVE_RL_LUMINANCE12. Pixels 0-3 come from bytes 0-11 and pixels 4-7 from bytes 12-23, loaded as
+// bytes 8-23 so as not to read past the end of the row. Each shuffle puts the two bytes holding the right value of each pixel in the low
+// half and the two holding the left value in the high half, leaving only a mask or a shift to do.
+TARGET_SSSE3 inline void UnpackRL12SSSE3(const uint8_t * source, __m128i & left, __m128i & right)
+{
+    const __m128i first = _mm_setr_epi8(0, 1, 3, 4, 6, 7, 9, 10, 1, 2, 4, 5, 7, 8, 10, 11);
+    const __m128i second = _mm_setr_epi8(4, 5, 7, 8, 10, 11, 13, 14, 5, 6, 8, 9, 11, 12, 14, 15);
+    const __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(source)), first);
+    const __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 8)), second);
+    right = _mm_and_si128(_mm_unpacklo_epi64(a, b), _mm_set1_epi16(0x0FFF));
+    left = _mm_srli_epi16(_mm_unpackhi_epi64(a, b), 4);
+}
+
+TARGET_SSSE3 void RL12SSSE3(const uint8_t * source, int width, int shift, uint8_t * left8, uint8_t * right8, uint16_t * left16, uint16_t * right16)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift), low = _mm_set1_epi16(0x00FF);
+    if (width < 8)
+    {
+        RL12Scalar(source, width, shift, left8, right8, left16, right16);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 8, width - 8))
+    {
+        __m128i left, right;
+        UnpackRL12SSSE3(source + 3 * x, left, right);
+        if (left8)
+        {
+            const __m128i packed = _mm_packus_epi16(_mm_and_si128(_mm_srl_epi16(left, count), low), _mm_and_si128(_mm_srl_epi16(right, count), low));
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(left8 + x), packed);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(right8 + x), _mm_srli_si128(packed, 8));
+        }
+        if (left16)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(left16 + x), left);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(right16 + x), right);
+        }
+        if (x + 8 == width) break;
+    }
+}
+
+// Splits 64 interleaved bytes into the 32 even and the 32 odd ones. The packs work within each 128 bit lane, so the 64 bit quarters
+// come out as a.lo, b.lo, a.hi, b.hi and are put back in order by the permute.
+TARGET_AVX2 inline void DeinterleaveBytesAVX2(__m256i a, __m256i b, __m256i & even, __m256i & odd)
+{
+    const __m256i low = _mm256_set1_epi16(0x00FF);
+    even = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(a, low), _mm256_and_si256(b, low)), _MM_SHUFFLE(3, 1, 2, 0));
+    odd = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)), _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+TARGET_AVX2 void RL8ToL8AVX2(const uint8_t * source, int width, uint8_t * left, uint8_t * right)
+{
+    if (width < 32)
+    {
+        _mm256_zeroupper();
+        RL8ToL8SSE2(source, width, left, right);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 32, width - 32))
+    {
+        __m256i even, odd;
+        DeinterleaveBytesAVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + 2 * x)),
+                              _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + 2 * x + 32)), even, odd);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(left + x), even);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(right + x), odd);
+        if (x + 32 == width) break;
+    }
+}
+
+TARGET_AVX2 void RL16ToL16AVX2(const uint16_t * source, int width, uint16_t * left, uint16_t * right)
+{
+    // Widen to 32 bit lanes, with the even words masked and the odd ones shifted down, so that the unsigned saturating pack is exact
+    const __m256i low = _mm256_set1_epi32(0xFFFF);
+    if (width < 16)
+    {
+        _mm256_zeroupper();
+        RL16ToL16SSE2(source, width, left, right);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + 2 * x));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + 2 * x + 16));
+        const __m256i even = _mm256_packus_epi32(_mm256_and_si256(a, low), _mm256_and_si256(b, low));
+        const __m256i odd = _mm256_packus_epi32(_mm256_srli_epi32(a, 16), _mm256_srli_epi32(b, 16));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(left + x), _mm256_permute4x64_epi64(even, _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(right + x), _mm256_permute4x64_epi64(odd, _MM_SHUFFLE(3, 1, 2, 0)));
+        if (x + 16 == width) break;
+    }
+}
+
+TARGET_AVX2 void RL16ToL8AVX2(const uint16_t * source, int width, int shift, uint8_t * left, uint8_t * right)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m256i low = _mm256_set1_epi16(0x00FF);
+    if (width < 32)
+    {
+        _mm256_zeroupper();
+        RL16ToL8SSE2(source, width, shift, left, right);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 32, width - 32))
+    {
+        __m256i v[4];
+        for (int i = 0; i < 4; ++i)
+            v[i] = _mm256_and_si256(_mm256_srl_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + 2 * x + 16 * i)), count), low);
+        const __m256i a = _mm256_permute4x64_epi64(_mm256_packus_epi16(v[0], v[1]), _MM_SHUFFLE(3, 1, 2, 0));
+        const __m256i b = _mm256_permute4x64_epi64(_mm256_packus_epi16(v[2], v[3]), _MM_SHUFFLE(3, 1, 2, 0));
+        __m256i even, odd;
+        DeinterleaveBytesAVX2(a, b, even, odd);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(left + x), odd);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(right + x), even);
+        if (x + 32 == width) break;
+    }
+}
+// Unpacks 16 pixels (48 bytes) of DS_NATIVE_RL_LUMINANCE12, 4 per 128 bit lane like UnpackRL12SSSE3: bytes 0-11, 12-23, 24-35 and 36-47,
+// the last loaded as bytes 32-47 so as not to read past the end of the row.
+TARGET_AVX2 inline void UnpackRL12AVX2(const uint8_t * source, __m256i & left, __m256i & right)
+{
+    const __m256i first = _mm256_setr_epi8(0, 1, 3, 4, 6, 7, 9, 10, 1, 2, 4, 5, 7, 8, 10, 11, 0, 1, 3, 4, 6, 7, 9, 10, 1, 2, 4, 5, 7, 8, 10, 11);
+    const __m256i second = _mm256_setr_epi8(0, 1, 3, 4, 6, 7, 9, 10, 1, 2, 4, 5, 7, 8, 10, 11, 4, 5, 7, 8, 10, 11, 13, 14, 5, 6, 8, 9, 11, 12, 14, 15);
+    const __m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(source))),
+                                              _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 12)), 1);
+    const __m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 24))),
+                                              _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + 32)), 1);
+    // The 64 bit quarters go from right 0-3, left 0-3, right 4-7, left 4-7 (and the same for 8-15) to all right values, then all left values
+    const __m256i c = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(a, first), _MM_SHUFFLE(3, 1, 2, 0));
+    const __m256i d = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(b, second), _MM_SHUFFLE(3, 1, 2, 0));
+    right = _mm256_and_si256(_mm256_permute2x128_si256(c, d, 0x20), _mm256_set1_epi16(0x0FFF));
+    left = _mm256_srli_epi16(_mm256_permute2x128_si256(c, d, 0x31), 4);
+}
+
+TARGET_AVX2 void RL12AVX2(const uint8_t * source, int width, int shift, uint8_t * left8, uint8_t * right8, uint16_t * left16, uint16_t * right16)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m256i low = _mm256_set1_epi16(0x00FF);
+    if (width < 16)
+    {
+        _mm256_zeroupper();
+        RL12SSSE3(source, width, shift, left8, right8, left16, right16);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        __m256i left, right;
+        UnpackRL12AVX2(source + 3 * x, left, right);
+        if (left8)
+        {
+            // The pack interleaves the lanes as left 0-7, right 0-7, left 8-15, right 8-15, and the permute puts the left bytes first
+            const __m256i packed = _mm256_permute4x64_epi64(
+                _mm256_packus_epi16(_mm256_and_si256(_mm256_srl_epi16(left, count), low), _mm256_and_si256(_mm256_srl_epi16(right, count), low)), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(left8 + x), _mm256_castsi256_si128(packed));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(right8 + x), _mm256_extracti128_si256(packed, 1));
+        }
+        if (left16)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(left16 + x), left);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(right16 + x), right);
+        }
+        if (x + 16 == width) break;
+    }
+}
+#endif
+
+#ifdef CONVERSION_NEON
+void RL8ToL8NEON(const uint8_t * source, int width, uint8_t * left, uint8_t * right)
+{
+    if (width < 16)
+    {
+        RL8ToL8Scalar(source, width, left, right);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 16, width - 16))
+    {
+        const uint8x16x2_t v = vld2q_u8(source + 2 * x);
+        vst1q_u8(left + x, v.val[0]);
+        vst1q_u8(right + x, v.val[1]);
+        if (x + 16 == width) break;
+    }
+}
+
+void RL16ToL16NEON(const uint16_t * source, int width, uint16_t * left, uint16_t * right)
+{
+    if (width < 8)
+    {
+        RL16ToL16Scalar(source, width, left, right);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 8, width - 8))
+    {
+        const uint16x8x2_t v = vld2q_u16(source + 2 * x);
+        vst1q_u16(left + x, v.val[0]);
+        vst1q_u16(right + x, v.val[1]);
+        if (x + 8 == width) break;
+    }
+}
+
+void RL16ToL8NEON(const uint16_t * source, int width, int shift, uint8_t * left, uint8_t * right)
+{
+    const int16x8_t count = vdupq_n_s16(static_cast<int16_t>(-shift));
+    if (width < 8)
+    {
+        RL16ToL8Scalar(source, width, shift, left, right);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 8, width - 8))
+    {
+        const uint16x8x2_t v = vld2q_u16(source + 2 * x);
+        vst1_u8(left + x, vmovn_u16(vshlq_u16(v.val[1], count)));
+        vst1_u8(right + x, vmovn_u16(vshlq_u16(v.val[0], count)));
+        if (x + 8 == width) break;
+    }
+}
+void RL12NEON(const uint8_t * source, int width, int shift, uint8_t * left8, uint8_t * right8, uint16_t * left16, uint16_t * right16)
+{
+    const int16x8_t count = vdupq_n_s16(static_cast<int16_t>(-shift));
+    if (width < 8)
+    {
+        RL12Scalar(source, width, shift, left8, right8, left16, right16);
+        return;
+    }
+    for (int x = 0;; x = std::min(x + 8, width - 8))
+    {
+        const uint8x8x3_t v = vld3_u8(source + 3 * x);
+        const uint16x8_t right = vorrq_u16(vmovl_u8(v.val[0]), vshll_n_u8(vand_u8(v.val[1], vdup_n_u8(0x0F)), 8));
+        const uint16x8_t left = vorrq_u16(vmovl_u8(vshr_n_u8(v.val[1], 4)), vshll_n_u8(v.val[2], 4));
+        if (left8)
+        {
+            vst1_u8(left8 + x, vmovn_u16(vshlq_u16(left, count)));
+            vst1_u8(right8 + x, vmovn_u16(vshlq_u16(right, count)));
+        }
+        if (left16)
+        {
+            vst1q_u16(left16 + x, left);
+            vst1q_u16(right16 + x, right);
+        }
+        if (x + 8 == width) break;
+    }
+}
+#endif
+
+const ConversionKernels g_scalarKernels = {RL8ToL8Scalar, RL16ToL16Scalar, RL16ToL8Scalar, RL12Scalar};
+#ifdef CONVERSION_X86
+// Unpacking 12 bit pixels takes a byte shuffle, which SSE2 does not have
+const ConversionKernels g_sse2Kernels = {RL8ToL8SSE2, RL16ToL16SSE2, RL16ToL8SSE2, RL12Scalar};
+const ConversionKernels g_ssse3Kernels = {RL8ToL8SSE2, RL16ToL16SSE2, RL16ToL8SSE2, RL12SSSE3};
+const ConversionKernels g_avx2Kernels = {RL8ToL8AVX2, RL16ToL16AVX2, RL16ToL8AVX2, RL12AVX2};
+#endif
+#ifdef CONVERSION_NEON
+const ConversionKernels g_neonKernels = {RL8ToL8NEON, RL16ToL16NEON, RL16ToL8NEON, RL12NEON};
+#endif
+
+bool IsSupported(ConversionIsa isa)
+{
+    switch (isa)
+    {
+    case CONVERSION_ISA_SCALAR:
+        return true;
+#ifdef CONVERSION_X86
+    case CONVERSION_ISA_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case CONVERSION_ISA_SSSE3:
+        return __builtin_cpu_supports("ssse3");
+    case CONVERSION_ISA_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef CONVERSION_NEON
+    case CONVERSION_ISA_NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+const ConversionKernels * KernelsFor(ConversionIsa isa)
+{
+    switch (isa)
+    {
+#ifdef CONVERSION_X86
+    case CONVERSION_ISA_SSE2:
+        return &g_sse2Kernels;
+    case CONVERSION_ISA_SSSE3:
+        return &g_ssse3Kernels;
+    case CONVERSION_ISA_AVX2:
+        return &g_avx2Kernels;
+#endif
+#ifdef CONVERSION_NEON
+    case CONVERSION_ISA_NEON:
+        return &g_neonKernels;
+#endif
+    default:
+        return &g_scalarKernels;
+    }
+}
+
+std::atomic<int> g_isa(-1);
+
+// Least source bytes in a band of rows handed to another thread: the conversions are so cheap that smaller bands cost more to hand out
+// than they save
+const int g_bandBytes = 64 * 1024;
+
+// The rows of the region a conversion reads, and of the destination it writes them to
+struct RegionRows
+{
+    const uint8_t * source;
+    int sourceStride, destStride;
+    int width, height, pixelSize;
+
+    RegionRows(const void * sourceImage, int imageWidth, int imageHeight, int sourceStride, int pixelSize, int destStride, const ConversionRegion & region)
+        : sourceStride(sourceStride)
+        , destStride(destStride)
+        , pixelSize(pixelSize)
+    {
+        const ImageRegion r = region.SourceIn(imageWidth, imageHeight);
+        source = static_cast<const uint8_t *>(sourceImage) + static_cast<ptrdiff_t>(r.y) * sourceStride + r.x * pixelSize;
+        width = r.width;
+        height = r.height;
+    }
+
+    const uint8_t * Source(int y) const { return source + static_cast<ptrdiff_t>(y) * sourceStride; }
+    template <class T> T * Dest(T * first, int y) const { return reinterpret_cast<T *>(reinterpret_cast<uint8_t *>(first) + static_cast<ptrdiff_t>(y) * destStride); }
+
+    // Calls row(y) for every row, in bands of at least g_bandBytes of source on the scheduler if there is one. otherDestStride is that of
+    // a second destination whose bands must start on a cache line too: rows start on one for both strides as often as for the one with
+    // the fewest trailing zero bits, which their bitwise or has.
+    template <class RowFunction> void ForEach(TaskScheduler * scheduler, RowFunction row, int otherDestStride = 0) const
+    {
+        ParallelForRows(scheduler, height, destStride | otherDestStride, GrainRows(width * pixelSize, g_bandBytes), [&row](int begin, int end) {
+            for (int y = begin; y < end; ++y)
+                row(y);
+        });
+    }
+};
+
+const ConversionKernels & GetKernels()
+{
+    int isa = g_isa.load(std::memory_order_relaxed);
+    if (isa < 0)
+    {
+        isa = GetBestConversionIsa();
+        g_isa.store(isa, std::memory_order_relaxed);
+    }
+    return *KernelsFor(static_cast<ConversionIsa>(isa));
+}
+}
+
+ConversionIsa GetBestConversionIsa()
+{
+    static const ConversionIsa order[] = {CONVERSION_ISA_AVX2, CONVERSION_ISA_NEON, CONVERSION_ISA_SSSE3, CONVERSION_ISA_SSE2};
+    for (int i = 0; i < 4; ++i)
+        if (IsSupported(order[i])) return order[i];
+    return CONVERSION_ISA_SCALAR;
+}
+
+ConversionIsa GetConversionIsa()
+{
+    GetKernels();
+    return static_cast<ConversionIsa>(g_isa.load(std::memory_order_relaxed));
+}
+
+bool SetConversionIsa(ConversionIsa isa)
+{
+    if (!IsSupported(isa)) return false;
+    g_isa.store(isa, std::memory_order_relaxed);
+    return true;
+}
+
+const char * ConversionIsaString(ConversionIsa isa)
+{
+    switch (isa)
+    {
+    case CONVERSION_ISA_SCALAR:
+        return "scalar";
+    case CONVERSION_ISA_SSE2:
+        return "SSE2";
+    case CONVERSION_ISA_SSSE3:
+        return "SSSE3";
+    case CONVERSION_ISA_AVX2:
+        return "AVX2";
+    case CONVERSION_ISA_NEON:
+        return "NEON";
+    }
+    return "unknown";
+}
+
+void ConvertRLLuminance8ToLuminance8(const void * sourceImage, int width, int height, uint8_t * leftImage, uint8_t * rightImage)
+{
+    ConvertRLLuminance8ToLuminance8(sourceImage, width, height, width * 2, leftImage, rightImage);
+}
+
+void ConvertRLLuminance8ToLuminance8(const void * sourceImage, int width, int height, int stride, uint8_t * leftImage, uint8_t * rightImage)
+{
+    ConvertRLLuminance8ToLuminance8(sourceImage, width, height, stride, leftImage, rightImage, width);
+}
+
+void ConvertRLLuminance8ToLuminance8(const void * sourceImage, int width, int height, int sourceStride, uint8_t * leftImage, uint8_t * rightImage,
+                                     int destStride, const ConversionRegion & region, TaskScheduler * scheduler)
+{
+    const ConversionKernels & kernels = GetKernels();
+    const RegionRows rows(sourceImage, width, height, sourceStride, 2, destStride, region);
+    uint8_t * left = region.DestinationIn(leftImage, destStride, 1), * right = region.DestinationIn(rightImage, destStride, 1);
+    rows.ForEach(scheduler, [&](int y) { kernels.rl8ToL8(rows.Source(y), rows.width, rows.Dest(left, y), rows.Dest(right, y)); });
+}
+
+void ConvertRLLuminance16ToLuminance16(const void * sourceImage, int width, int height, uint16_t * leftImage, uint16_t * rightImage)
+{
+    ConvertRLLuminance16ToLuminance16(sourceImage, width, height, width * 4, leftImage, rightImage);
+}
+
+void ConvertRLLuminance16ToLuminance16(const void * sourceImage, int width, int height, int stride, uint16_t * leftImage, uint16_t * rightImage)
+{
+    ConvertRLLuminance16ToLuminance16(sourceImage, width, height, stride, leftImage, rightImage, width * 2);
+}
+
+void ConvertRLLuminance16ToLuminance16(const void * sourceImage, int width, int height, int sourceStride, uint16_t * leftImage, uint16_t * rightImage,
+                                       int destStride, const ConversionRegion & region, TaskScheduler * scheduler)
+{
+    const ConversionKernels & kernels = GetKernels();
+    const RegionRows rows(sourceImage, width, height, sourceStride, 4, destStride, region);
+    uint16_t * left = region.DestinationIn(leftImage, destStride, 2), * right = region.DestinationIn(rightImage, destStride, 2);
+    rows.ForEach(scheduler, [&](int y) { kernels.rl16ToL16(reinterpret_cast<const uint16_t *>(rows.Source(y)), rows.width, rows.Dest(left, y), rows.Dest(right, y)); });
+}
+
+void ConvertRLLuminance16ToLuminance8(const void * sourceImage, int width, int height, int shift, uint8_t * leftImage, uint8_t * rightImage)
+{
+    ConvertRLLuminance16ToLuminance8(sourceImage, width, height, width * 4, shift, leftImage, rightImage);
+}
+
+void ConvertRLLuminance16ToLuminance8(const void * sourceImage, int width, int height, int stride, int shift, uint8_t * leftImage, uint8_t * rightImage)
+{
+    ConvertRLLuminance16ToLuminance8(sourceImage, width, height, stride, shift, leftImage, rightImage, width);
+}
+
+void ConvertRLLuminance16ToLuminance8(const void * sourceImage, int width, int height, int sourceStride, int shift, uint8_t * leftImage, uint8_t * rightImage,
+                                      int destStride, const ConversionRegion & region, TaskScheduler * scheduler)
+{
+    const ConversionKernels & kernels = GetKernels();
+    const RegionRows rows(sourceImage, width, height, sourceStride, 4, destStride, region);
+    uint8_t * left = region.DestinationIn(leftImage, destStride, 1), * right = region.DestinationIn(rightImage, destStride, 1);
+    rows.ForEach(scheduler, [&](int y) { kernels.rl16ToL8(reinterpret_cast<const uint16_t *>(rows.Source(y)), rows.width, shift, rows.Dest(left, y), rows.Dest(right, y)); });
+}
+
+void ConvertRLLuminance12ToLuminance8(const void * sourceImage, int width, int height, int shift, uint8_t * leftImage, uint8_t * rightImage)
+{
+    ConvertRLLuminance12ToLuminance8(sourceImage, width, height, width * 3, shift, leftImage, rightImage);
+}
+
+void ConvertRLLuminance12ToLuminance8(const void * sourceImage, int width, int height, int stride, int shift, uint8_t * leftImage, uint8_t * rightImage)
+{
+    ConvertRLLuminance12ToLuminance8(sourceImage, width, height, stride, shift, leftImage, rightImage, width);
+}
+
+void ConvertRLLuminance12ToLuminance8(const void * sourceImage, int width, int height, int sourceStride, int shift, uint8_t * leftImage, uint8_t * rightImage,
+                                      int destStride, const ConversionRegion & region, TaskScheduler * scheduler)
+{
+    const ConversionKernels & kernels = GetKernels();
+    const RegionRows rows(sourceImage, width, height, sourceStride, 3, destStride, region);
+    uint8_t * left = region.DestinationIn(leftImage, destStride, 1), * right = region.DestinationIn(rightImage, destStride, 1);
+    rows.ForEach(scheduler, [&](int y) { kernels.rl12(rows.Source(y), rows.width, shift, rows.Dest(left, y), rows.Dest(right, y), nullptr, nullptr); });
+}
+
+void ConvertRLLuminance12ToLuminance16(const void * sourceImage, int width, int height, uint16_t * leftImage, uint16_t * rightImage)
+{
+    ConvertRLLuminance12ToLuminance16(sourceImage, width, height, width * 3, leftImage, rightImage);
+}
+
+void ConvertRLLuminance12ToLuminance16(const void * sourceImage, int width, int height, int stride, uint16_t * leftImage, uint16_t * rightImage)
+{
+    ConvertRLLuminance12ToLuminance16(sourceImage, width, height, stride, leftImage, rightImage, width * 2);
+}
+
+void ConvertRLLuminance12ToLuminance16(const void * sourceImage, int width, int height, int sourceStride, uint16_t * leftImage, uint16_t * rightImage,
+                                       int destStride, const ConversionRegion & region, TaskScheduler * scheduler)
+{
+    const ConversionKernels & kernels = GetKernels();
+    const RegionRows rows(sourceImage, width, height, sourceStride, 3, destStride, region);
+    uint16_t * left = region.DestinationIn(leftImage, destStride, 2), * right = region.DestinationIn(rightImage, destStride, 2);
+    rows.ForEach(scheduler, [&](int y) { kernels.rl12(rows.Source(y), rows.width, 0, nullptr, nullptr, rows.Dest(left, y), rows.Dest(right, y)); });
+}
+
+void ConvertRLLuminance12ToLuminance8And16(const void * sourceImage, int width, int height, int shift, uint8_t * leftImage8, uint8_t * rightImage8,
+                                           uint16_t * leftImage16, uint16_t * rightImage16)
+{
+    ConvertRLLuminance12ToLuminance8And16(sourceImage, width, height, width * 3, shift, leftImage8, rightImage8, leftImage16, rightImage16);
+}
+
+void ConvertRLLuminance12ToLuminance8And16(const void * sourceImage, int width, int height, int stride, int shift, uint8_t * leftImage8, uint8_t * rightImage8,
+                                           uint16_t * leftImage16, uint16_t * rightImage16)
+{
+    ConvertRLLuminance12ToLuminance8And16(sourceImage, width, height, stride, shift, leftImage8, rightImage8, width, leftImage16, rightImage16, width * 2);
+}
+
+void ConvertRLLuminance12ToLuminance8And16(const void * sourceImage, int width, int height, int sourceStride, int shift, uint8_t * leftImage8, uint8_t * rightImage8,
+                                           int destStride8, uint16_t * leftImage16, uint16_t * rightImage16, int destStride16,
+                                           const ConversionRegion & region, TaskScheduler * scheduler)
+{
+    const ConversionKernels & kernels = GetKernels();
+    const RegionRows rows8(sourceImage, width, height, sourceStride, 3, destStride8, region);
+    const RegionRows rows16(sourceImage, width, height, sourceStride, 3, destStride16, region);
+    uint8_t * left8 = region.DestinationIn(leftImage8, destStride8, 1), * right8 = region.DestinationIn(rightImage8, destStride8, 1);
+    uint16_t * left16 = region.DestinationIn(leftImage16, destStride16, 2), * right16 = region.DestinationIn(rightImage16, destStride16, 2);
+    rows8.ForEach(scheduler, [&](int y) {
+        kernels.rl12(rows8.Source(y), rows8.width, shift, rows8.Dest(left8, y), rows8.Dest(right8, y), rows16.Dest(left16, y), rows16.Dest(right16, y));
+    }, destStride16);
+}
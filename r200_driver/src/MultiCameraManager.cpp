@@ -0,0 +1,205 @@
+#include <r200_driver/MultiCameraManager.h>
+#include <r200_driver/DSAPI/DSFactory.h>
+
+#include <cerrno>
+#include <poll.h>
+#include <sstream>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+MultiCameraManager::MultiCameraManager(const MultiCameraOptions & options)
+    : options(options)
+    , bundles(0)
+{
+}
+
+MultiCameraManager::~MultiCameraManager()
+{
+    Close();
+}
+
+bool MultiCameraManager::Fail(Camera & camera, const char * what)
+{
+    std::ostringstream ss;
+    ss << "Camera " << camera.serialNumber << ": " << what;
+    if (camera.ds) ss << " failed: " << DSStatusString(camera.ds->getLastErrorStatus()) << ": " << camera.ds->getLastErrorDescription();
+    lastError = ss.str();
+    return false;
+}
+
+bool MultiCameraManager::Open(const std::vector<uint32_t> & serialNumbers)
+{
+    Close();
+
+    std::vector<uint32_t> serials = serialNumbers;
+    if (serials.empty())
+    {
+        const int count = DSGetNumberOfCameras(true);
+        for (int i = 0; i < count; ++i)
+            serials.push_back(DSGetCameraSerialNumber(i));
+    }
+    if (serials.empty())
+    {
+        lastError = "No cameras found";
+        return false;
+    }
+
+    const int cpuCount = static_cast<int>(std::thread::hardware_concurrency());
+    for (size_t i = 0; i < serials.size(); ++i)
+    {
+        std::unique_ptr<Camera> camera(new Camera());
+        camera->serialNumber = serials[i];
+        camera->ds = std::shared_ptr<DSAPI>(DSCreate(options.platform), DSDestroy);
+        camera->notifier = -1;
+        camera->unmatched = 0;
+        camera->capturing = false;
+
+        bool ok = camera->ds ? true : Fail(*camera, "DSCreate");
+        ok = ok && (camera->ds->openDevice(camera->serialNumber) || Fail(*camera, "openDevice"));
+        ok = ok && (camera->ds->probeConfiguration() || Fail(*camera, "probeConfiguration"));
+        if (!ok)
+        {
+            Close();
+            return false;
+        }
+
+        // One reader is ours, the rest stay available to the application
+        camera->engine.reset(new CaptureEngine(*camera->ds, options.ringCapacity, 4, FRAME_DROP_OLDEST));
+        camera->reader.reset(new FrameSetReader(camera->engine->Frames()));
+        camera->notifier = camera->engine->AcquireNotifier();
+        if (options.firstCpu >= 0 && cpuCount > 0) camera->engine->SetCpuAffinity((options.firstCpu + static_cast<int>(i)) % cpuCount);
+        cameras.push_back(std::move(camera));
+    }
+    return true;
+}
+
+void MultiCameraManager::Close()
+{
+    StopCapture();
+    for (size_t i = 0; i < cameras.size(); ++i)
+    {
+        Camera & camera = *cameras[i];
+        camera.head.reset();
+        camera.reader.reset();
+        if (camera.engine) camera.engine->ReleaseNotifier(camera.notifier);
+        camera.engine.reset();
+        if (camera.ds) camera.ds->closeDevice();
+    }
+    cameras.clear();
+}
+
+bool MultiCameraManager::StartCapture()
+{
+    for (size_t i = 0; i < cameras.size(); ++i)
+    {
+        Camera & camera = *cameras[i];
+        camera.capturing = camera.ds->startCapture();
+        if (!camera.capturing || !camera.engine->Start())
+        {
+            // Once capturing, the engine fails to start when its first grab() does, whose status Fail() reports
+            Fail(camera, camera.capturing ? "grab" : "startCapture");
+            StopCapture();
+            return false;
+        }
+    }
+    return true;
+}
+
+void MultiCameraManager::StopCapture()
+{
+    // Stop every grab thread first, so that no camera keeps capturing while another one is already shut down. Only the cameras whose
+    // startCapture() succeeded get a stopCapture().
+    for (size_t i = 0; i < cameras.size(); ++i)
+        cameras[i]->engine->Stop();
+    for (size_t i = 0; i < cameras.size(); ++i)
+    {
+        Camera & camera = *cameras[i];
+        camera.head.reset();
+        if (camera.capturing) camera.ds->stopCapture();
+        camera.capturing = false;
+    }
+}
+
+bool MultiCameraManager::IsRunning() const
+{
+    for (size_t i = 0; i < cameras.size(); ++i)
+        if (!cameras[i]->engine->IsRunning()) return false;
+    return !cameras.empty();
+}
+
+bool MultiCameraManager::TryNextBundle(FrameBundle & bundle)
+{
+    if (cameras.empty()) return false;
+
+    for (;;)
+    {
+        // Every camera needs a candidate before anything can be decided
+        int64_t newest = 0;
+        for (size_t i = 0; i < cameras.size(); ++i)
+        {
+            Camera & camera = *cameras[i];
+            if (!camera.head)
+            {
+                // Clear the eventfd before reading, so that a frame set published in between leaves it readable for NextBundle()
+                uint64_t count;
+                const ssize_t result = read(camera.engine->NotifierFd(camera.notifier), &count, sizeof(count));
+                (void)result;
+                camera.head = camera.reader->Pop();
+                if (!camera.head) return false;
+            }
+            if (i == 0 || camera.head->hostTime > newest) newest = camera.head->hostTime;
+        }
+
+        // Candidates too old to pair with the newest one can never be matched, since the other cameras only produce newer frame sets
+        bool discarded = false;
+        for (size_t i = 0; i < cameras.size(); ++i)
+        {
+            Camera & camera = *cameras[i];
+            if (newest - camera.head->hostTime > options.tolerance)
+            {
+                camera.head.reset();
+                ++camera.unmatched;
+                discarded = true;
+            }
+        }
+        if (discarded) continue;
+
+        bundle.frames.resize(cameras.size());
+        bundle.hostTime = newest;
+        for (size_t i = 0; i < cameras.size(); ++i)
+        {
+            if (cameras[i]->head->hostTime < bundle.hostTime) bundle.hostTime = cameras[i]->head->hostTime;
+            bundle.frames[i] = std::move(cameras[i]->head);
+            cameras[i]->head.reset();
+        }
+        bundle.spread = newest - bundle.hostTime;
+        ++bundles;
+        return true;
+    }
+}
+
+bool MultiCameraManager::NextBundle(FrameBundle & bundle, std::chrono::nanoseconds timeout)
+{
+    const int64_t deadline = GetHostTime() + timeout.count();
+    std::vector<pollfd> fds;
+    for (;;)
+    {
+        if (TryNextBundle(bundle)) return true;
+        if (!IsRunning()) return false;
+
+        const int64_t remaining = deadline - GetHostTime();
+        if (remaining <= 0) return false;
+
+        // Only the cameras still missing a candidate can unblock matching
+        fds.clear();
+        for (size_t i = 0; i < cameras.size(); ++i)
+        {
+            if (cameras[i]->head) continue;
+            pollfd pfd = { cameras[i]->engine->NotifierFd(cameras[i]->notifier), POLLIN, 0 };
+            fds.push_back(pfd);
+        }
+        timespec wait = { static_cast<time_t>(remaining / 1000000000), static_cast<long>(remaining % 1000000000) };
+        if (ppoll(fds.data(), fds.size(), &wait, nullptr) < 0 && errno != EINTR) return false;
+    }
+}
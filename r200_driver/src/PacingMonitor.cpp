@@ -0,0 +1,82 @@
+#include <r200_driver/PacingMonitor.h>
+
+#include <algorithm>
+#include <cmath>
+
+PacingMonitor::PacingMonitor(int window)
+    : window(window > 1 ? window : 2)
+{
+    Reset();
+}
+
+void PacingMonitor::Reset()
+{
+    next = count = 0;
+    started = false;
+    lastFrameNumber = 0;
+    lastHostTime = 0;
+    lastDeviceTime = 0;
+    frames = dropped = repeated = 0;
+}
+
+bool PacingMonitor::OnFrame(int frameNumber, double deviceTime, int64_t hostTime)
+{
+    if (started && frameNumber == lastFrameNumber)
+    {
+        ++repeated;
+        return false;
+    }
+
+    ++frames;
+    // A frame number going backwards means the stream was restarted, which starts the intervals over but is not a drop
+    if (started && frameNumber > lastFrameNumber)
+    {
+        dropped += frameNumber - lastFrameNumber - 1;
+
+        Sample & sample = window[next];
+        sample.hostInterval = (hostTime - lastHostTime) * 1e-9;
+        sample.deviceInterval = deviceTime - lastDeviceTime;
+        sample.latency = hostTime * 1e-9 - deviceTime;
+        next = (next + 1) % window.size();
+        count = std::min(count + 1, window.size());
+    }
+
+    started = true;
+    lastFrameNumber = frameNumber;
+    lastHostTime = hostTime;
+    lastDeviceTime = deviceTime;
+    return true;
+}
+
+PacingStats PacingMonitor::GetStats() const
+{
+    PacingStats stats = PacingStats();
+    stats.frames = frames;
+    stats.dropped = dropped;
+    stats.repeated = repeated;
+    if (!count) return stats;
+
+    double hostSum = 0, hostSquares = 0, deviceSum = 0, deviceSquares = 0, latencySum = 0;
+    stats.minInterval = window[0].hostInterval;
+    stats.maxLatency = window[0].latency;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Sample & sample = window[i];
+        hostSum += sample.hostInterval;
+        hostSquares += sample.hostInterval * sample.hostInterval;
+        deviceSum += sample.deviceInterval;
+        deviceSquares += sample.deviceInterval * sample.deviceInterval;
+        latencySum += sample.latency;
+        stats.minInterval = std::min(stats.minInterval, sample.hostInterval);
+        stats.maxInterval = std::max(stats.maxInterval, sample.hostInterval);
+        stats.maxLatency = std::max(stats.maxLatency, sample.latency);
+    }
+
+    stats.meanInterval = hostSum / count;
+    stats.framesPerSecond = stats.meanInterval > 0 ? 1 / stats.meanInterval : 0;
+    stats.jitter = std::sqrt(std::max(0.0, hostSquares / count - stats.meanInterval * stats.meanInterval));
+    const double deviceMean = deviceSum / count;
+    stats.deviceJitter = std::sqrt(std::max(0.0, deviceSquares / count - deviceMean * deviceMean));
+    stats.meanLatency = latencySum / count;
+    return stats;
+}
@@ -0,0 +1,48 @@
+#include <r200_driver/ParallelRows.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace
+{
+const int g_cacheLineSize = 64;
+
+// Bands per thread when splitting by grain, so that the threads done first take over the bands of the ones slowed down by others
+const int g_bandsPerThread = 4;
+
+// Fewest rows after which rows of stride bytes start on a cache line again
+int CacheLineRows(int stride)
+{
+    int a = std::abs(stride) % g_cacheLineSize, b = g_cacheLineSize;
+    while (a)
+    {
+        const int r = b % a;
+        b = a;
+        a = r;
+    }
+    return g_cacheLineSize / b;
+}
+}
+
+int GrainRows(int rowBytes, int bytes)
+{
+    return rowBytes > 0 ? std::max(1, (bytes + rowBytes - 1) / rowBytes) : 1;
+}
+
+void ParallelForRows(TaskScheduler * scheduler, int height, int destStride, int grainRows, const std::function<void(int begin, int end)> & body,
+                     int bands)
+{
+    if (height <= 0) return;
+    if (!scheduler)
+    {
+        body(0, height);
+        return;
+    }
+
+    const int lineRows = CacheLineRows(destStride);
+    int grain = bands > 0 ? (height + bands - 1) / bands : std::max(1, grainRows);
+    grain = (grain + lineRows - 1) / lineRows * lineRows;
+    const int chunks = (height + grain - 1) / grain;
+    const int parts = bands > 0 ? chunks : std::min(chunks, g_bandsPerThread * (scheduler->WorkerCount() + 1));
+    scheduler->ParallelFor(chunks, parts, [&](int begin, int end) { body(begin * grain, std::min(height, end * grain)); });
+}
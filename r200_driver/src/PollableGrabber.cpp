@@ -0,0 +1,61 @@
+#include <r200_driver/PollableGrabber.h>
+
+#include <cerrno>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+PollableGrabber::PollableGrabber(CaptureEngine & engine, std::chrono::nanoseconds stallTimeout)
+    : engine(engine)
+    , reader(engine.Frames())
+    , slot(engine.AcquireNotifier())
+    , stallTimeout(stallTimeout.count())
+{
+}
+
+PollableGrabber::~PollableGrabber()
+{
+    engine.ReleaseNotifier(slot);
+}
+
+bool PollableGrabber::tryGrab(FrameSetHandle & frame)
+{
+    if (!valid()) return false;
+
+    // Clear the eventfd before looking at the ring, so a frame set published in between leaves it readable rather than being missed
+    uint64_t count;
+    const ssize_t result = read(fd(), &count, sizeof(count));
+    (void)result;
+
+    FrameSetHandle latest = reader.PopLatest();
+    if (!latest) return false;
+    frame = std::move(latest);
+    return true;
+}
+
+GrabResult PollableGrabber::grabFor(FrameSetHandle & frame, std::chrono::nanoseconds timeout)
+{
+    const int64_t deadline = GetHostTime() + timeout.count();
+    for (;;)
+    {
+        if (tryGrab(frame)) return GRAB_FRAME;
+        if (!valid() || !engine.IsRunning()) return GRAB_STOPPED;
+
+        const int64_t remaining = deadline - GetHostTime();
+        if (remaining <= 0) return IsStalled() ? GRAB_STALLED : GRAB_TIMEOUT;
+
+        pollfd pfd = { fd(), POLLIN, 0 };
+        timespec wait = { static_cast<time_t>(remaining / 1000000000), static_cast<long>(remaining % 1000000000) };
+        if (ppoll(&pfd, 1, &wait, nullptr) < 0 && errno != EINTR) return GRAB_STOPPED;
+    }
+}
+
+bool PollableGrabber::IsStalled() const
+{
+    return engine.IsRunning() && GetHostTime() - engine.GetLastFrameTime() > stallTimeout;
+}
+
+double PollableGrabber::GetSecondsSinceLastFrame() const
+{
+    return (GetHostTime() - engine.GetLastFrameTime()) * 1e-9;
+}
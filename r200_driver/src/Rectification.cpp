@@ -0,0 +1,337 @@
+#include <r200_driver/Rectification.h>
+
+#include <algorithm>
+
+// Sampling is written with SSE2, which every x86-64 CPU has
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define CONVERSION_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERSION_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Each entry of a DSRectificationTable holds the row of its sample in the high 16 bits and the column in the low 16 bits, both in pixels
+// times 32. The sample is the bilinear interpolation of the pixel there and its right, lower and lower right neighbours, with the 5 bit
+// fractions as weights out of 32, truncated to 8 bits. That is what DSRectifyBGRA8ToBGRA8 computes, in the same integers.
+
+namespace
+{
+// Size of a tile in rectified pixels. With the few degrees of rotation of a calibrated camera, the source pixels of a tile span a few
+// dozen rows more than the tile, which keeps its BGRA8 buffer around 100 KB.
+const int g_tileColumns = 256;
+const int g_tileRows = 64;
+
+// A converted tile in its buffer. offset takes pixel coordinates of the image to coordinates of the buffer.
+struct TileSource
+{
+    const uint8_t * data;
+    int stride, offset;
+
+    const uint8_t * At(uint32_t entry) const { return data + (static_cast<int>(entry >> 21) * stride + static_cast<int>(entry >> 5 & 0x7FF) * 4 + offset); }
+};
+
+inline int RowFraction(uint32_t entry)
+{
+    return entry >> 16 & 31;
+}
+
+inline int ColumnFraction(uint32_t entry)
+{
+    return entry & 31;
+}
+
+inline uint32_t AverageChannels(const int * sum, int count)
+{
+    uint32_t pixel = 0;
+    for (int c = 0; c < 4; ++c)
+        pixel |= static_cast<uint32_t>((sum[c] + count / 2) / count) << 8 * c;
+    return pixel;
+}
+
+// The interpolation of one sample, summed into the channels of a pixel, and the pixel made from the sums, with B, G, R and A from the low
+// byte up. The SIMD versions interpolate the four channels of a sample at once.
+struct ScalarSampler
+{
+    struct Sum
+    {
+        int c[4];
+    };
+    static Sum Zero() { return Sum{{0, 0, 0, 0}}; }
+    static void Add(Sum & sum, const TileSource & source, uint32_t entry)
+    {
+        const uint8_t * p = source.At(entry);
+        const int fx = ColumnFraction(entry), fy = RowFraction(entry);
+        for (int c = 0; c < 4; ++c)
+        {
+            const int top = p[c] * (32 - fx) + p[c + 4] * fx;
+            const int bottom = p[source.stride + c] * (32 - fx) + p[source.stride + c + 4] * fx;
+            sum.c[c] += (top * (32 - fy) + bottom * fy) >> 10;
+        }
+    }
+    static uint32_t Pack(const Sum & sum) { return AverageChannels(sum.c, 1); }
+    static uint32_t Average(const Sum & sum, int count) { return AverageChannels(sum.c, count); }
+};
+
+#ifdef CONVERSION_X86
+struct Sse2Sampler
+{
+    typedef __m128i Sum;
+    static Sum Zero() { return _mm_setzero_si128(); }
+    static void Add(Sum & sum, const TileSource & source, uint32_t entry)
+    {
+        const uint8_t * p = source.At(entry);
+        const int fx = ColumnFraction(entry), fy = RowFraction(entry);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i top = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)), zero);
+        const __m128i bottom = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p + source.stride)), zero);
+        const __m128i vertical = _mm_add_epi16(_mm_mullo_epi16(top, _mm_set1_epi16(static_cast<int16_t>(32 - fy))),
+                                               _mm_mullo_epi16(bottom, _mm_set1_epi16(static_cast<int16_t>(fy))));
+        // Pairs each channel of the left pixel with the same channel of the right one, for a multiply-add by the column weights
+        const __m128i pairs = _mm_unpacklo_epi16(vertical, _mm_srli_si128(vertical, 8));
+        sum = _mm_add_epi32(sum, _mm_srai_epi32(_mm_madd_epi16(pairs, _mm_set1_epi32((32 - fx) | fx << 16)), 10));
+    }
+    static uint32_t Pack(const Sum & sum) { return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(sum, sum), sum))); }
+    static uint32_t Average(const Sum & sum, int count)
+    {
+        int channels[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(channels), sum);
+        return AverageChannels(channels, count);
+    }
+};
+#endif
+
+#ifdef CONVERSION_NEON
+struct NeonSampler
+{
+    typedef uint32x4_t Sum;
+    static Sum Zero() { return vdupq_n_u32(0); }
+    static void Add(Sum & sum, const TileSource & source, uint32_t entry)
+    {
+        const uint8_t * p = source.At(entry);
+        const int fx = ColumnFraction(entry), fy = RowFraction(entry);
+        const uint16x8_t top = vmovl_u8(vld1_u8(p)), bottom = vmovl_u8(vld1_u8(p + source.stride));
+        const uint16x8_t vertical = vmlaq_n_u16(vmulq_n_u16(top, static_cast<uint16_t>(32 - fy)), bottom, static_cast<uint16_t>(fy));
+        const uint32x4_t value = vmlal_n_u16(vmull_n_u16(vget_low_u16(vertical), static_cast<uint16_t>(32 - fx)), vget_high_u16(vertical),
+                                             static_cast<uint16_t>(fx));
+        sum = vaddq_u32(sum, vshrq_n_u32(value, 10));
+    }
+    static uint32_t Pack(const Sum & sum)
+    {
+        const uint16x4_t narrow = vmovn_u32(sum);
+        return vget_lane_u32(vreinterpret_u32_u8(vmovn_u16(vcombine_u16(narrow, narrow))), 0);
+    }
+    static uint32_t Average(const Sum & sum, int count)
+    {
+        int channels[4];
+        vst1q_s32(channels, vreinterpretq_s32_u32(sum));
+        return AverageChannels(channels, count);
+    }
+};
+#endif
+
+template <int pixelSize> inline void WritePixel(uint32_t bgra, uint8_t * dest)
+{
+    if (pixelSize == 4)
+    {
+        dest[0] = static_cast<uint8_t>(bgra);
+        dest[1] = static_cast<uint8_t>(bgra >> 8);
+        dest[2] = static_cast<uint8_t>(bgra >> 16);
+        dest[3] = static_cast<uint8_t>(bgra >> 24);
+    }
+    else
+    {
+        dest[0] = static_cast<uint8_t>(bgra >> 16);
+        dest[1] = static_cast<uint8_t>(bgra >> 8);
+        dest[2] = static_cast<uint8_t>(bgra);
+    }
+}
+
+// Writes width pixels of one output row, each the average of the downscale x downscale table entries from table onward
+template <class S, int pixelSize>
+void SampleRow(const uint32_t * table, int tableWidth, int downscale, int width, const TileSource & source, uint8_t * dest)
+{
+    const int count = downscale * downscale;
+    for (int x = 0; x < width; ++x, table += downscale, dest += pixelSize)
+    {
+        typename S::Sum sum = S::Zero();
+        const uint32_t * entries = table;
+        for (int j = 0; j < downscale; ++j, entries += tableWidth)
+            for (int i = 0; i < downscale; ++i)
+                S::Add(sum, source, entries[i]);
+        WritePixel<pixelSize>(count == 1 ? S::Pack(sum) : S::Average(sum, count), dest);
+    }
+}
+
+typedef void (*SampleFunction)(const uint32_t * table, int tableWidth, int downscale, int width, const TileSource & source, uint8_t * dest);
+
+struct SampleKernels
+{
+    SampleFunction rgb8, bgra8;
+};
+
+const SampleKernels g_scalarKernels = {SampleRow<ScalarSampler, 3>, SampleRow<ScalarSampler, 4>};
+#ifdef CONVERSION_X86
+const SampleKernels g_sse2Kernels = {SampleRow<Sse2Sampler, 3>, SampleRow<Sse2Sampler, 4>};
+#endif
+#ifdef CONVERSION_NEON
+const SampleKernels g_neonKernels = {SampleRow<NeonSampler, 3>, SampleRow<NeonSampler, 4>};
+#endif
+
+// Follows SetConversionIsa() of ImageConversion.h, with SSE2 for every x86 instruction set: a sample is two 8 byte loads and a handful
+// of multiplies, which wider vectors would not speed up.
+const SampleKernels & GetKernels()
+{
+    switch (GetConversionIsa())
+    {
+#ifdef CONVERSION_X86
+    case CONVERSION_ISA_SSE2:
+    case CONVERSION_ISA_SSSE3:
+    case CONVERSION_ISA_AVX2:
+        return g_sse2Kernels;
+#endif
+#ifdef CONVERSION_NEON
+    case CONVERSION_ISA_NEON:
+        return g_neonKernels;
+#endif
+    default:
+        return g_scalarKernels;
+    }
+}
+
+thread_local std::vector<uint8_t> t_tile;
+}
+
+FusedRectifier::FusedRectifier(const uint32_t * rectificationTable, int sourceWidth, int sourceHeight, int tableWidth, int tableHeight, int downscale)
+    : table(rectificationTable, rectificationTable + static_cast<size_t>(tableWidth) * tableHeight)
+    , sourceWidth(sourceWidth)
+    , sourceHeight(sourceHeight)
+    , tableWidth(tableWidth)
+    , downscale(std::max(1, downscale))
+    , width(tableWidth / this->downscale)
+    , height(tableHeight / this->downscale)
+{
+    // Entries past the last row or column are moved onto it, and entries on it lose their fraction, so that no sample weighs a pixel
+    // outside the image
+    for (size_t i = 0; i < table.size(); ++i)
+    {
+        int row = table[i] >> 16, column = table[i] & 0xFFFF;
+        if (row >> 5 >= sourceHeight - 1) row = (sourceHeight - 1) << 5;
+        if (column >> 5 >= sourceWidth - 1) column = (sourceWidth - 1) << 5;
+        table[i] = static_cast<uint32_t>(row) << 16 | static_cast<uint32_t>(column);
+    }
+
+    const int tileWidth = std::max(1, g_tileColumns / this->downscale), tileHeight = std::max(1, g_tileRows / this->downscale);
+    for (int y = 0; y < height; y += tileHeight)
+        for (int x = 0; x < width; x += tileWidth)
+        {
+            Tile tile;
+            tile.x = x;
+            tile.y = y;
+            tile.width = std::min(tileWidth, width - x);
+            tile.height = std::min(tileHeight, height - y);
+            int left = sourceWidth, top = sourceHeight, right = 0, bottom = 0;
+            for (int ty = y * this->downscale; ty < (y + tile.height) * this->downscale; ++ty)
+                for (int tx = x * this->downscale; tx < (x + tile.width) * this->downscale; ++tx)
+                {
+                    const uint32_t entry = table[static_cast<size_t>(ty) * tableWidth + tx];
+                    const int row = entry >> 21, column = entry >> 5 & 0x7FF;
+                    left = std::min(left, column);
+                    right = std::max(right, column + 2);
+                    top = std::min(top, row);
+                    bottom = std::max(bottom, row + 2);
+                }
+            // YUY2 and the demosaic both convert whole pairs of pixels
+            left &= ~1;
+            right = std::min(sourceWidth, (right + 1) & ~1);
+            bottom = std::min(sourceHeight, bottom);
+            tile.source = ImageRegion(left, top, right - left, bottom - top);
+            tiles.push_back(tile);
+        }
+}
+
+void FusedRectifier::Rectify(const ConvertFunction & convert, TaskScheduler * scheduler, uint8_t * destImage, int destStride, int pixelSize) const
+{
+    const SampleFunction sample = pixelSize == 4 ? GetKernels().bgra8 : GetKernels().rgb8;
+    const auto rectify = [&](int begin, int end) {
+        for (int t = begin; t < end; ++t)
+        {
+            const Tile & tile = tiles[t];
+            // One column and one row more than the tile's source pixels, for the neighbours of the samples on the last column and row of
+            // the image, whose weight is 0
+            const int stride = (tile.source.width + 2) * 4;
+            const size_t size = static_cast<size_t>(tile.source.height + 1) * stride;
+            if (t_tile.size() < size) t_tile.resize(size);
+            convert(tile.source, t_tile.data(), stride);
+
+            const TileSource source = {t_tile.data(), stride, -(tile.source.y * stride + tile.source.x * 4)};
+            for (int y = tile.y; y < tile.y + tile.height; ++y)
+                sample(table.data() + static_cast<size_t>(y) * downscale * tableWidth + tile.x * downscale, tableWidth, downscale, tile.width, source,
+                       destImage + static_cast<size_t>(y) * destStride + tile.x * pixelSize);
+        }
+    };
+    const int count = static_cast<int>(tiles.size());
+    if (scheduler)
+        scheduler->ParallelFor(count, count, rectify);
+    else
+        rectify(0, count);
+}
+
+void FusedRectifier::RectifyYUY2(const void * sourceImage, int sourceStride, uint8_t * destImage, int destStride, int pixelSize,
+                                 const YuvConversionOptions & options) const
+{
+    // Each tile is converted on the thread that samples it
+    YuvConversionOptions tileOptions = options;
+    tileOptions.scheduler = nullptr;
+    Rectify(
+        [&](const ImageRegion & region, uint8_t * buffer, int stride) {
+            YuvConversionOptions regionOptions = tileOptions;
+            regionOptions.region = region;
+            ConvertYUY2ToBGRA8(sourceImage, sourceWidth, sourceHeight, sourceStride, buffer, stride, regionOptions);
+        },
+        options.scheduler, destImage, destStride, pixelSize);
+}
+
+void FusedRectifier::RectifyRaw10(const void * sourceImage, int sourceStride, uint8_t * destImage, int destStride, int pixelSize,
+                                  const DemosaicOptions & options) const
+{
+    DemosaicOptions tileOptions = options;
+    tileOptions.scheduler = nullptr;
+    Rectify(
+        [&](const ImageRegion & region, uint8_t * buffer, int stride) {
+            // The demosaic runs on a slice of the image starting on a group of 4 packed pixels, with 4 columns more on each side than the
+            // region. Its mirrored edges then never reach the region, which comes out the same as when demosaicing the whole image.
+            const int left = std::max(0, (region.x - 4) & ~3), right = std::min(sourceWidth, (region.x + region.width + 7) & ~3);
+            DemosaicOptions regionOptions = tileOptions;
+            regionOptions.region = ImageRegion(region.x - left, region.y, region.width, region.height);
+            ConvertRaw10ToBGRA8(static_cast<const uint8_t *>(sourceImage) + left / 4 * 5, right - left, sourceHeight, sourceStride, buffer, stride,
+                                regionOptions);
+        },
+        options.scheduler, destImage, destStride, pixelSize);
+}
+
+void FusedRectifier::RectifyYUY2ToRGB8(const void * sourceImage, int sourceStride, uint8_t * destImage, int destStride,
+                                       const YuvConversionOptions & options) const
+{
+    RectifyYUY2(sourceImage, sourceStride, destImage, destStride, 3, options);
+}
+
+void FusedRectifier::RectifyYUY2ToBGRA8(const void * sourceImage, int sourceStride, uint8_t * destImage, int destStride,
+                                        const YuvConversionOptions & options) const
+{
+    RectifyYUY2(sourceImage, sourceStride, destImage, destStride, 4, options);
+}
+
+void FusedRectifier::RectifyRaw10ToRGB8(const void * sourceImage, int sourceStride, uint8_t * destImage, int destStride,
+                                        const DemosaicOptions & options) const
+{
+    RectifyRaw10(sourceImage, sourceStride, destImage, destStride, 3, options);
+}
+
+void FusedRectifier::RectifyRaw10ToBGRA8(const void * sourceImage, int sourceStride, uint8_t * destImage, int destStride,
+                                         const DemosaicOptions & options) const
+{
+    RectifyRaw10(sourceImage, sourceStride, destImage, destStride, 4, options);
+}
@@ -0,0 +1,376 @@
+#include <r200_driver/SpatialFilter.h>
+#include <r200_driver/ImageConversion.h>
+#include <r200_driver/ParallelRows.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// The filter is a few operations per pixel and pass, so SSE2 does it on every x86 instruction set
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define CONVERSION_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERSION_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+// The options in the form the kernels use: a valid pixel within delta of the valid filtered one before it moves towards it by k of the
+// difference. The image is filtered in single precision, with the same operations in the same order in every version, so they all give
+// the same result.
+struct SpatialParams
+{
+    float k;     // 1 - alpha
+    float delta; // In Z units
+};
+
+struct ScalarOps
+{
+    typedef float Vector;
+    static const int size = 1;
+    static Vector Load(const float * p) { return *p; }
+    static void Store(float * p, Vector v) { *p = v; }
+    static Vector Set(float value) { return value; }
+    static void Transpose(Vector *) {}
+    static Vector Step(Vector current, Vector previous, Vector k, Vector delta)
+    {
+        const float difference = previous - current;
+        return current != 0 && previous != 0 && std::fabs(difference) < delta ? current + k * difference : current;
+    }
+};
+
+#ifdef CONVERSION_X86
+struct Sse2Ops
+{
+    typedef __m128 Vector;
+    static const int size = 4;
+    static Vector Load(const float * p) { return _mm_loadu_ps(p); }
+    static void Store(float * p, Vector v) { _mm_storeu_ps(p, v); }
+    static Vector Set(float value) { return _mm_set1_ps(value); }
+    static void Transpose(Vector * v) { _MM_TRANSPOSE4_PS(v[0], v[1], v[2], v[3]); }
+    static Vector Step(Vector current, Vector previous, Vector k, Vector delta)
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 difference = _mm_sub_ps(previous, current);
+        const __m128 distance = _mm_andnot_ps(_mm_set1_ps(-0.0f), difference);
+        const __m128 smooth = _mm_and_ps(_mm_and_ps(_mm_cmpneq_ps(current, zero), _mm_cmpneq_ps(previous, zero)), _mm_cmplt_ps(distance, delta));
+        return _mm_or_ps(_mm_and_ps(smooth, _mm_add_ps(current, _mm_mul_ps(k, difference))), _mm_andnot_ps(smooth, current));
+    }
+};
+#endif
+
+#ifdef CONVERSION_NEON
+struct NeonOps
+{
+    typedef float32x4_t Vector;
+    static const int size = 4;
+    static Vector Load(const float * p) { return vld1q_f32(p); }
+    static void Store(float * p, Vector v) { vst1q_f32(p, v); }
+    static Vector Set(float value) { return vdupq_n_f32(value); }
+    static void Transpose(Vector * v)
+    {
+        const float32x4x2_t ab = vtrnq_f32(v[0], v[1]), cd = vtrnq_f32(v[2], v[3]);
+        v[0] = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+        v[1] = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+        v[2] = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+        v[3] = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+    }
+    // Multiply and add kept apart rather than fused, to round like the other versions
+    static Vector Step(Vector current, Vector previous, Vector k, Vector delta)
+    {
+        const float32x4_t zero = vdupq_n_f32(0);
+        const float32x4_t difference = vsubq_f32(previous, current);
+        const uint32x4_t valid = vandq_u32(vmvnq_u32(vceqq_f32(current, zero)), vmvnq_u32(vceqq_f32(previous, zero)));
+        const uint32x4_t smooth = vandq_u32(valid, vcltq_f32(vabsq_f32(difference), delta));
+        return vbslq_f32(smooth, vaddq_f32(current, vmulq_f32(k, difference)), current);
+    }
+};
+#endif
+
+// Filters blocks * size rows, stride floats apart, along their width both ways, one row per lane. The vectors of size pixels of each row
+// are transposed so that each one holds a column of the rows, which steps all of them at once; the pixels after the last whole vector are
+// filtered one row at a time. Each step waits on the one before it, so several blocks of rows are stepped together to keep the pipeline
+// busy. The first pixel of each way has no pixel before it, which the 0 of an invalid one stands for.
+template <class V, int blocks> void FilterRowGroup(float * rows, int stride, int width, const SpatialParams & params)
+{
+    typedef typename V::Vector Vector;
+    const int size = V::size, count = blocks * size, vectorEnd = width / size * size;
+    const Vector k = V::Set(params.k), delta = V::Set(params.delta);
+    float previous[count];
+
+    Vector last[blocks];
+    for (int b = 0; b < blocks; ++b)
+        last[b] = V::Set(0);
+    for (int x = 0; x < vectorEnd; x += size)
+    {
+        Vector v[blocks][size];
+        for (int b = 0; b < blocks; ++b)
+        {
+            for (int i = 0; i < size; ++i)
+                v[b][i] = V::Load(rows + (b * size + i) * stride + x);
+            V::Transpose(v[b]);
+        }
+        for (int i = 0; i < size; ++i)
+            for (int b = 0; b < blocks; ++b)
+                last[b] = v[b][i] = V::Step(v[b][i], last[b], k, delta);
+        for (int b = 0; b < blocks; ++b)
+        {
+            V::Transpose(v[b]);
+            for (int i = 0; i < size; ++i)
+                V::Store(rows + (b * size + i) * stride + x, v[b][i]);
+        }
+    }
+    for (int b = 0; b < blocks; ++b)
+        V::Store(previous + b * size, last[b]);
+    for (int i = 0; i < count; ++i)
+    {
+        float * row = rows + i * stride;
+        for (int x = vectorEnd; x < width; ++x)
+            previous[i] = row[x] = ScalarOps::Step(row[x], previous[i], params.k, params.delta);
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        float * row = rows + i * stride;
+        previous[i] = 0;
+        for (int x = width - 1; x >= vectorEnd; --x)
+            previous[i] = row[x] = ScalarOps::Step(row[x], previous[i], params.k, params.delta);
+    }
+    for (int b = 0; b < blocks; ++b)
+        last[b] = V::Load(previous + b * size);
+    for (int x = vectorEnd - size; x >= 0; x -= size)
+    {
+        Vector v[blocks][size];
+        for (int b = 0; b < blocks; ++b)
+        {
+            for (int i = 0; i < size; ++i)
+                v[b][i] = V::Load(rows + (b * size + i) * stride + x);
+            V::Transpose(v[b]);
+        }
+        for (int i = size - 1; i >= 0; --i)
+            for (int b = 0; b < blocks; ++b)
+                last[b] = v[b][i] = V::Step(v[b][i], last[b], k, delta);
+        for (int b = 0; b < blocks; ++b)
+        {
+            V::Transpose(v[b]);
+            for (int i = 0; i < size; ++i)
+                V::Store(rows + (b * size + i) * stride + x, v[b][i]);
+        }
+    }
+}
+
+// Rows filtered together by FilterRowGroup: two blocks of vectors, which the bands of rows are made of
+const int g_blocks = 2;
+const int g_groupRows = 8;
+
+template <class V> void FilterRows(float * rows, int stride, int count, int width, const SpatialParams & params)
+{
+    int y = 0;
+    for (; y + g_blocks * V::size <= count; y += g_blocks * V::size)
+        FilterRowGroup<V, g_blocks>(rows + static_cast<ptrdiff_t>(y) * stride, stride, width, params);
+    for (; y + V::size <= count; y += V::size)
+        FilterRowGroup<V, 1>(rows + static_cast<ptrdiff_t>(y) * stride, stride, width, params);
+    for (; y < count; ++y)
+        FilterRowGroup<ScalarOps, 1>(rows + static_cast<ptrdiff_t>(y) * stride, stride, width, params);
+}
+
+// Floats in a cache line, the columns filtered together so that each row is read a whole line at a time
+const int g_lineFloats = 16;
+
+// Filters the columns [0, width) of the image along its height both ways, the columns side by side in the lanes. The columns after the
+// last whole vector are filtered one at a time.
+template <class V> void FilterColumns(float * image, int stride, int width, int height, const SpatialParams & params)
+{
+    typedef typename V::Vector Vector;
+    const int size = V::size;
+    const Vector k = V::Set(params.k), delta = V::Set(params.delta);
+    int x = 0;
+    for (int vectors; (vectors = std::min(g_lineFloats, width - x) / size) > 0; x += vectors * size)
+    {
+        Vector last[g_lineFloats / size];
+        std::fill(last, last + vectors, V::Set(0));
+        for (int y = 0; y < height; ++y)
+        {
+            float * row = image + static_cast<ptrdiff_t>(y) * stride + x;
+            for (int i = 0; i < vectors; ++i)
+                V::Store(row + i * size, last[i] = V::Step(V::Load(row + i * size), last[i], k, delta));
+        }
+        std::fill(last, last + vectors, V::Set(0));
+        for (int y = height - 1; y >= 0; --y)
+        {
+            float * row = image + static_cast<ptrdiff_t>(y) * stride + x;
+            for (int i = 0; i < vectors; ++i)
+                V::Store(row + i * size, last[i] = V::Step(V::Load(row + i * size), last[i], k, delta));
+        }
+    }
+    if (size > 1 && x < width) FilterColumns<ScalarOps>(image + x, stride, width - x, height, params);
+}
+
+// Calls step(x) on every vector of size pixels of a row of width pixels, the last one overlapping the one before it. False if the row is
+// narrower than one vector, which is then left to the scalar version.
+template <class Step> bool ForEachVector(int width, int size, Step step)
+{
+    if (width <= 0) return true;
+    if (width < size) return false;
+    for (int x = 0;; x += size)
+    {
+        if (x > width - size) x = width - size;
+        step(x);
+        if (x + size == width) break;
+    }
+    return true;
+}
+
+void LoadRowScalar(const uint16_t * depth, int width, float * row)
+{
+    for (int x = 0; x < width; ++x)
+        row[x] = depth[x];
+}
+
+// Every filtered pixel is a weighted mean of valid depths, so within 0 to 65535, and rounds to the nearest one
+void StoreRowScalar(const float * row, int width, uint16_t * depth)
+{
+    for (int x = 0; x < width; ++x)
+        depth[x] = static_cast<uint16_t>(static_cast<int>(row[x] + 0.5f));
+}
+
+#ifdef CONVERSION_X86
+void LoadRowSSE2(const uint16_t * depth, int width, float * row)
+{
+    const bool done = ForEachVector(width, 8, [=](int x) {
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(depth + x));
+        _mm_storeu_ps(row + x, _mm_cvtepi32_ps(_mm_unpacklo_epi16(d, _mm_setzero_si128())));
+        _mm_storeu_ps(row + x + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(d, _mm_setzero_si128())));
+    });
+    if (!done) LoadRowScalar(depth, width, row);
+}
+
+void StoreRowSSE2(const float * row, int width, uint16_t * depth)
+{
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128i bias = _mm_set1_epi32(0x8000);
+    const bool done = ForEachVector(width, 8, [=](int x) {
+        const __m128i a = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(row + x), half));
+        const __m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(row + x + 4), half));
+        // Packing saturates to signed words, so the depths are moved to the signed range and back
+        const __m128i packed = _mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(depth + x), _mm_xor_si128(packed, _mm_set1_epi16(-0x8000)));
+    });
+    if (!done) StoreRowScalar(row, width, depth);
+}
+#endif
+
+#ifdef CONVERSION_NEON
+void LoadRowNEON(const uint16_t * depth, int width, float * row)
+{
+    const bool done = ForEachVector(width, 8, [=](int x) {
+        const uint16x8_t d = vld1q_u16(depth + x);
+        vst1q_f32(row + x, vcvtq_f32_u32(vmovl_u16(vget_low_u16(d))));
+        vst1q_f32(row + x + 4, vcvtq_f32_u32(vmovl_u16(vget_high_u16(d))));
+    });
+    if (!done) LoadRowScalar(depth, width, row);
+}
+
+void StoreRowNEON(const float * row, int width, uint16_t * depth)
+{
+    const float32x4_t half = vdupq_n_f32(0.5f);
+    const bool done = ForEachVector(width, 8, [=](int x) {
+        const uint32x4_t a = vcvtq_u32_f32(vaddq_f32(vld1q_f32(row + x), half));
+        const uint32x4_t b = vcvtq_u32_f32(vaddq_f32(vld1q_f32(row + x + 4), half));
+        vst1q_u16(depth + x, vcombine_u16(vmovn_u32(a), vmovn_u32(b)));
+    });
+    if (!done) StoreRowScalar(row, width, depth);
+}
+#endif
+
+struct SpatialKernels
+{
+    void (*loadRow)(const uint16_t * depth, int width, float * row);
+    void (*storeRow)(const float * row, int width, uint16_t * depth);
+    void (*filterRows)(float * rows, int stride, int count, int width, const SpatialParams & params);
+    void (*filterColumns)(float * image, int stride, int width, int height, const SpatialParams & params);
+};
+
+const SpatialKernels g_scalarKernels = {LoadRowScalar, StoreRowScalar, FilterRows<ScalarOps>, FilterColumns<ScalarOps>};
+#ifdef CONVERSION_X86
+const SpatialKernels g_sse2Kernels = {LoadRowSSE2, StoreRowSSE2, FilterRows<Sse2Ops>, FilterColumns<Sse2Ops>};
+#endif
+#ifdef CONVERSION_NEON
+const SpatialKernels g_neonKernels = {LoadRowNEON, StoreRowNEON, FilterRows<NeonOps>, FilterColumns<NeonOps>};
+#endif
+
+// Follows SetConversionIsa() of ImageConversion.h
+const SpatialKernels & GetKernels()
+{
+    switch (GetConversionIsa())
+    {
+#ifdef CONVERSION_X86
+    case CONVERSION_ISA_SSE2:
+    case CONVERSION_ISA_SSSE3:
+    case CONVERSION_ISA_AVX2:
+        return g_sse2Kernels;
+#endif
+#ifdef CONVERSION_NEON
+    case CONVERSION_ISA_NEON:
+        return g_neonKernels;
+#endif
+    default:
+        return g_scalarKernels;
+    }
+}
+
+// Least bytes of the image in a band of rows or of columns handed to another thread
+const int g_bandBytes = 64 * 1024;
+
+// The image in single precision between the passes, its rows a whole number of cache lines apart
+thread_local std::vector<float> t_image;
+}
+
+void FilterDepthSpatial(const uint16_t * depthImage, int width, int height, int depthStride, uint16_t * filtered, int filteredStride,
+                        const SpatialFilterOptions & options)
+{
+    if (width <= 0 || height <= 0) return;
+    SpatialParams params;
+    params.k = 1 - std::min(1.0f, std::max(0.25f, options.alpha));
+    params.delta = std::max(0.0f, options.delta) * 1000 / (options.zUnits > 0 ? options.zUnits : 1000);
+    const int iterations = std::min(5, std::max(1, options.iterations));
+
+    const SpatialKernels & kernels = GetKernels();
+    const int stride = (width + g_lineFloats - 1) / g_lineFloats * g_lineFloats;
+    t_image.resize(static_cast<size_t>(stride) * height);
+    float * const image = t_image.data();
+
+    // The rows are filtered in bands of groups of rows, the first pass loading them as it goes; the columns in bands of cache lines
+    const int groups = (height + g_groupRows - 1) / g_groupRows, lines = (width + g_lineFloats - 1) / g_lineFloats;
+    const int groupBytes = g_groupRows * stride * 4, lineBytes = g_lineFloats * 4;
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        ParallelForRows(options.scheduler, groups, groupBytes, GrainRows(groupBytes, g_bandBytes), [=, &kernels, &params](int begin, int end) {
+            const int first = begin * g_groupRows, last = std::min(height, end * g_groupRows);
+            if (iteration == 0)
+                for (int y = first; y < last; ++y)
+                    kernels.loadRow(reinterpret_cast<const uint16_t *>(reinterpret_cast<const uint8_t *>(depthImage) + static_cast<ptrdiff_t>(y) * depthStride),
+                                    width, image + static_cast<ptrdiff_t>(y) * stride);
+            kernels.filterRows(image + static_cast<ptrdiff_t>(first) * stride, stride, last - first, width, params);
+        });
+        ParallelForRows(options.scheduler, lines, lineBytes, GrainRows(lineBytes * height, g_bandBytes), [=, &kernels, &params](int begin, int end) {
+            const int first = begin * g_lineFloats, last = std::min(width, end * g_lineFloats);
+            kernels.filterColumns(image + first, stride, last - first, height, params);
+        });
+    }
+
+    ParallelForRows(options.scheduler, height, filteredStride, GrainRows(width * 2, g_bandBytes), [=, &kernels](int begin, int end) {
+        for (int y = begin; y < end; ++y)
+            kernels.storeRow(image + static_cast<ptrdiff_t>(y) * stride, width,
+                             reinterpret_cast<uint16_t *>(reinterpret_cast<uint8_t *>(filtered) + static_cast<ptrdiff_t>(y) * filteredStride));
+    });
+}
+
+void FilterDepthSpatial(const uint16_t * depthImage, int width, int height, uint16_t * filtered, const SpatialFilterOptions & options)
+{
+    FilterDepthSpatial(depthImage, width, height, width * 2, filtered, width * 2, options);
+}
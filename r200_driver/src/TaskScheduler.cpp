@@ -0,0 +1,200 @@
+#include <r200_driver/TaskScheduler.h>
+#include <r200_driver/Trace.h>
+
+#include <algorithm>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace
+{
+thread_local const TaskScheduler * t_scheduler = nullptr;
+thread_local int t_worker = -1;
+
+// Shared by the calling thread of ParallelFor and its helper tasks. A helper task may only start after the call returned, so the last of
+// them to let go deletes it.
+struct ParallelJob
+{
+    std::function<void(int, int)> body;
+    int count, parts;
+    std::atomic<int> next;
+    std::atomic<int> references;
+    std::mutex mutex;
+    std::condition_variable finished;
+    int done;
+
+    // Runs ranges until there are none left to claim
+    void Work()
+    {
+        int ran = 0;
+        for (int part; (part = next.fetch_add(1)) < parts; ++ran)
+            body(static_cast<int>(static_cast<int64_t>(count) * part / parts), static_cast<int>(static_cast<int64_t>(count) * (part + 1) / parts));
+        if (!ran) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        if ((done += ran) == parts) finished.notify_one();
+    }
+
+    void Release()
+    {
+        if (references.fetch_sub(1) == 1) delete this;
+    }
+
+    static void Help(void * context, int, int)
+    {
+        ParallelJob * job = static_cast<ParallelJob *>(context);
+        job->Work();
+        job->Release();
+    }
+};
+}
+
+TaskScheduler::TaskScheduler(int threads, int firstCpu)
+    : queued(0)
+    , stopping(false)
+    , nextWorker(0)
+    , executed(0)
+    , stolen(0)
+{
+    const int cpuCount = static_cast<int>(std::thread::hardware_concurrency());
+    if (threads <= 0) threads = cpuCount;
+    if (threads <= 0) threads = 1;
+
+    // All queues exist before any worker starts looking at them
+    for (int i = 0; i < threads; ++i)
+        workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    for (int i = 0; i < threads; ++i)
+    {
+        workers[i]->thread = std::thread(&TaskScheduler::Run, this, i);
+        if (firstCpu >= 0 && cpuCount > 0)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET((firstCpu + i) % cpuCount, &cpus);
+            pthread_setaffinity_np(workers[i]->thread.native_handle(), sizeof(cpus), &cpus);
+        }
+    }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping.store(true);
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i]->thread.join();
+}
+
+void TaskScheduler::Spawn(TaskFunction function, void * context, int a, int b)
+{
+    const Task task = {function, context, a, b};
+    const int worker = t_scheduler == this ? t_worker : static_cast<int>(nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size());
+    {
+        std::lock_guard<std::mutex> lock(workers[worker]->mutex);
+        workers[worker]->tasks.push_back(task);
+    }
+
+    // Counted only once the task can be found, so that a worker that sees queued > 0 will find it. Taking sleepMutex before notifying
+    // means a worker that just found nothing is either still before its check of queued, or already waiting.
+    queued.fetch_add(1, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_one();
+}
+
+int TaskScheduler::CurrentWorker() const
+{
+    return t_scheduler == this ? t_worker : -1;
+}
+
+void TaskScheduler::ParallelFor(int count, int parts, const std::function<void(int begin, int end)> & body)
+{
+    if (count <= 0) return;
+    parts = std::max(1, std::min(parts, count));
+    if (parts == 1)
+    {
+        body(0, count);
+        return;
+    }
+
+    const int helpers = std::min(parts - 1, WorkerCount());
+    ParallelJob * job = new ParallelJob();
+    job->body = body;
+    job->count = count;
+    job->parts = parts;
+    job->next = 0;
+    job->references = helpers + 1;
+    job->done = 0;
+    for (int i = 0; i < helpers; ++i)
+        Spawn(&ParallelJob::Help, job);
+
+    job->Work();
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->finished.wait(lock, [job] { return job->done == job->parts; });
+    }
+    job->Release();
+}
+
+bool TaskScheduler::Pop(int index, Task & task)
+{
+    Worker & worker = *workers[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty()) return false;
+    task = worker.tasks.back();
+    worker.tasks.pop_back();
+    return true;
+}
+
+bool TaskScheduler::Steal(int index, Task & task)
+{
+    const int count = static_cast<int>(workers.size());
+    for (int i = 1; i < count; ++i)
+    {
+        Worker & victim = *workers[(index + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            stolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::Run(int index)
+{
+    t_scheduler = this;
+    t_worker = index;
+    Tracer::SetThreadName("worker");
+
+    for (;;)
+    {
+        Task task;
+        if (Pop(index, task) || Steal(index, task))
+        {
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            task.function(task.context, task.a, task.b);
+            executed.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return queued.load(std::memory_order_acquire) > 0 || stopping.load(); });
+        if (stopping.load() && queued.load(std::memory_order_acquire) == 0) return;
+    }
+}
+
+TaskSchedulerStats TaskScheduler::GetStats() const
+{
+    TaskSchedulerStats stats;
+    stats.workers = WorkerCount();
+    stats.queued = queued.load(std::memory_order_relaxed);
+    stats.executed = executed.load(std::memory_order_relaxed);
+    stats.stolen = stolen.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,197 @@
+#include <r200_driver/TemporalFilter.h>
+#include <r200_driver/ImageConversion.h>
+#include <r200_driver/ParallelRows.h>
+
+#include <algorithm>
+#include <cmath>
+
+// A frame is a few operations per pixel, so SSE2 does it on every x86 instruction set
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define CONVERSION_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERSION_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+// The options in the form the kernels use. The smoothed depth moves towards a new one n by (n - smoothed) * alpha / 256, rounded, which
+// fits 32 bits as the difference is within delta.
+struct TemporalParams
+{
+    int alpha;        // 0 to 256
+    int delta;        // 0 to 32767
+    int windowMask;   // Bits of the history within persistenceFrames
+    int minimumValid; // Bits of the window that must be set to persist
+};
+
+// Filters width pixels of a row. Every pixel is read and written once, so unlike the conversions the SIMD versions cannot finish a row
+// with a vector overlapping the one before it, and leave the last pixels to this one.
+void FilterRowScalar(const uint16_t * depth, int width, const TemporalParams & params, uint16_t * smoothed, uint8_t * history, uint16_t * out)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        const int n = depth[x], p = smoothed[x];
+        const int h = (history[x] << 1 | (n != 0)) & 0xFF;
+        int value;
+        if (n)
+            value = p && std::abs(n - p) <= params.delta ? p + (((n - p) * params.alpha + 128) >> 8) : n;
+        else
+            value = __builtin_popcount(h & params.windowMask) >= params.minimumValid ? p : 0;
+        history[x] = static_cast<uint8_t>(h);
+        smoothed[x] = out[x] = static_cast<uint16_t>(value);
+    }
+}
+
+#ifdef CONVERSION_X86
+void FilterRowSSE2(const uint16_t * depth, int width, const TemporalParams & params, uint16_t * smoothed, uint8_t * history, uint16_t * out)
+{
+    const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi16(1), low = _mm_set1_epi16(0xFF);
+    const __m128i alpha = _mm_set1_epi16(static_cast<int16_t>(params.alpha)), delta = _mm_set1_epi16(static_cast<int16_t>(params.delta));
+    const __m128i windowMask = _mm_set1_epi16(static_cast<int16_t>(params.windowMask));
+    const __m128i minimumValid = _mm_set1_epi16(static_cast<int16_t>(params.minimumValid - 1));
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        const __m128i n = _mm_loadu_si128(reinterpret_cast<const __m128i *>(depth + x));
+        const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(smoothed + x));
+        const __m128i invalid = _mm_cmpeq_epi16(n, zero);
+        const __m128i h = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(history + x)), zero), 1),
+                                                     _mm_andnot_si128(invalid, one)),
+                                        low);
+
+        // Bits of the window set in the history, counted in parallel within each word
+        __m128i count = _mm_and_si128(h, windowMask);
+        count = _mm_sub_epi16(count, _mm_and_si128(_mm_srli_epi16(count, 1), _mm_set1_epi16(0x55)));
+        count = _mm_add_epi16(_mm_and_si128(count, _mm_set1_epi16(0x33)), _mm_and_si128(_mm_srli_epi16(count, 2), _mm_set1_epi16(0x33)));
+        count = _mm_and_si128(_mm_add_epi16(count, _mm_srli_epi16(count, 4)), _mm_set1_epi16(0x0F));
+        const __m128i kept = _mm_and_si128(_mm_cmpgt_epi16(count, minimumValid), p);
+
+        const __m128i distance = _mm_or_si128(_mm_subs_epu16(n, p), _mm_subs_epu16(p, n));
+        const __m128i close = _mm_andnot_si128(_mm_cmpeq_epi16(p, zero), _mm_cmpeq_epi16(_mm_subs_epu16(distance, delta), zero));
+        const __m128i difference = _mm_sub_epi16(n, p);
+        const __m128i productLow = _mm_mullo_epi16(difference, alpha), productHigh = _mm_mulhi_epi16(difference, alpha);
+        const __m128i rounding = _mm_set1_epi32(128);
+        const __m128i step = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(productLow, productHigh), rounding), 8),
+                                             _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(productLow, productHigh), rounding), 8));
+        const __m128i valid = _mm_or_si128(_mm_and_si128(close, _mm_add_epi16(p, step)), _mm_andnot_si128(close, n));
+        const __m128i value = _mm_or_si128(_mm_and_si128(invalid, kept), _mm_andnot_si128(invalid, valid));
+
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(history + x), _mm_packus_epi16(h, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(smoothed + x), value);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), value);
+    }
+    FilterRowScalar(depth + x, width - x, params, smoothed + x, history + x, out + x);
+}
+#endif
+
+#ifdef CONVERSION_NEON
+void FilterRowNEON(const uint16_t * depth, int width, const TemporalParams & params, uint16_t * smoothed, uint8_t * history, uint16_t * out)
+{
+    const int16x4_t alpha = vdup_n_s16(static_cast<int16_t>(params.alpha));
+    const uint16x8_t delta = vdupq_n_u16(static_cast<uint16_t>(params.delta));
+    const uint8x8_t windowMask = vdup_n_u8(static_cast<uint8_t>(params.windowMask));
+    const uint8x8_t minimumValid = vdup_n_u8(static_cast<uint8_t>(params.minimumValid));
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        const uint16x8_t n = vld1q_u16(depth + x), p = vld1q_u16(smoothed + x);
+        const uint16x8_t valid = vtstq_u16(n, n);
+        const uint8x8_t h = vorr_u8(vshl_n_u8(vld1_u8(history + x), 1), vand_u8(vmovn_u16(valid), vdup_n_u8(1)));
+        // 0xFF bytes widened to 0xFFFF words
+        const uint8x8_t persist = vcge_u8(vcnt_u8(vand_u8(h, windowMask)), minimumValid);
+        const uint16x8_t kept = vandq_u16(vreinterpretq_u16_s16(vmovl_s8(vreinterpret_s8_u8(persist))), p);
+
+        const uint16x8_t close = vandq_u16(vtstq_u16(p, p), vcleq_u16(vabdq_u16(n, p), delta));
+        const int16x8_t difference = vreinterpretq_s16_u16(vsubq_u16(n, p));
+        const int16x8_t step = vcombine_s16(vrshrn_n_s32(vmull_s16(vget_low_s16(difference), alpha), 8),
+                                            vrshrn_n_s32(vmull_s16(vget_high_s16(difference), alpha), 8));
+        const uint16x8_t value = vbslq_u16(valid, vbslq_u16(close, vaddq_u16(p, vreinterpretq_u16_s16(step)), n), kept);
+
+        vst1_u8(history + x, h);
+        vst1q_u16(smoothed + x, value);
+        vst1q_u16(out + x, value);
+    }
+    FilterRowScalar(depth + x, width - x, params, smoothed + x, history + x, out + x);
+}
+#endif
+
+typedef void (*FilterRowFunction)(const uint16_t * depth, int width, const TemporalParams & params, uint16_t * smoothed, uint8_t * history,
+                                  uint16_t * out);
+
+// Follows SetConversionIsa() of ImageConversion.h
+FilterRowFunction GetFilterRow()
+{
+    switch (GetConversionIsa())
+    {
+#ifdef CONVERSION_X86
+    case CONVERSION_ISA_SSE2:
+    case CONVERSION_ISA_SSSE3:
+    case CONVERSION_ISA_AVX2:
+        return FilterRowSSE2;
+#endif
+#ifdef CONVERSION_NEON
+    case CONVERSION_ISA_NEON:
+        return FilterRowNEON;
+#endif
+    default:
+        return FilterRowScalar;
+    }
+}
+
+// Least depth bytes in a band of rows handed to another thread
+const int g_bandBytes = 32 * 1024;
+}
+
+TemporalDepthFilter::TemporalDepthFilter(int width, int height, const TemporalFilterOptions & options)
+    : options(options)
+    , width(0)
+    , height(0)
+{
+    Resize(width, height);
+}
+
+void TemporalDepthFilter::Reset()
+{
+    std::fill(smoothed.begin(), smoothed.end(), 0);
+    std::fill(history.begin(), history.end(), 0);
+}
+
+void TemporalDepthFilter::Resize(int newWidth, int newHeight)
+{
+    width = std::max(0, newWidth);
+    height = std::max(0, newHeight);
+    smoothed.assign(static_cast<size_t>(width) * height, 0);
+    history.assign(static_cast<size_t>(width) * height, 0);
+}
+
+void TemporalDepthFilter::Filter(const uint16_t * depthImage, int depthStride, uint16_t * filtered, int filteredStride)
+{
+    TemporalParams params;
+    params.alpha = static_cast<int>(std::lround(std::min(1.0f, std::max(0.0f, options.alpha)) * 256));
+    params.delta = std::min(32767, std::max(0, options.delta));
+    params.windowMask = (1 << std::min(8, std::max(1, options.persistenceFrames))) - 1;
+    params.minimumValid = std::min(9, std::max(0, options.persistenceValid));
+
+    const FilterRowFunction filterRow = GetFilterRow();
+    const int rowWidth = width;
+    uint16_t * const state = smoothed.data();
+    uint8_t * const valid = history.data();
+    ParallelForRows(options.scheduler, height, filteredStride, GrainRows(width * 2, g_bandBytes), [=, &params](int begin, int end) {
+        for (int y = begin; y < end; ++y)
+        {
+            const size_t offset = static_cast<size_t>(y) * rowWidth;
+            filterRow(reinterpret_cast<const uint16_t *>(reinterpret_cast<const uint8_t *>(depthImage) + static_cast<ptrdiff_t>(y) * depthStride), rowWidth,
+                      params, state + offset, valid + offset,
+                      reinterpret_cast<uint16_t *>(reinterpret_cast<uint8_t *>(filtered) + static_cast<ptrdiff_t>(y) * filteredStride));
+        }
+    });
+}
+
+void TemporalDepthFilter::Filter(const uint16_t * depthImage, uint16_t * filtered)
+{
+    Filter(depthImage, width * 2, filtered, width * 2);
+}
@@ -0,0 +1,267 @@
+#include <r200_driver/Trace.h>
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+std::atomic<bool> g_traceEnabled(false);
+
+namespace
+{
+// Histogram buckets: exact below 16 ns, then 8 buckets per power of two, i.e. within 12.5% of the true value
+const int LINEAR_BUCKETS = 16;
+const int MAX_EXPONENT = 47;
+const int BUCKETS = LINEAR_BUCKETS + (MAX_EXPONENT - 3) * 8;
+
+int BucketOf(int64_t value)
+{
+    if (value < LINEAR_BUCKETS) return value < 0 ? 0 : static_cast<int>(value);
+    int exponent = 63 - __builtin_clzll(static_cast<unsigned long long>(value));
+    if (exponent > MAX_EXPONENT) return BUCKETS - 1;
+    const int sub = static_cast<int>(value >> (exponent - 3)) & 7;
+    return LINEAR_BUCKETS + (exponent - 4) * 8 + sub;
+}
+
+int64_t BucketMidpoint(int bucket)
+{
+    if (bucket < LINEAR_BUCKETS) return bucket;
+    const int exponent = (bucket - LINEAR_BUCKETS) / 8 + 4;
+    const int sub = (bucket - LINEAR_BUCKETS) % 8;
+    const int64_t width = int64_t(1) << (exponent - 3);
+    return (8 + sub) * width + width / 2;
+}
+
+struct StageHistogram
+{
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<int64_t> max;
+};
+
+// One event slot of a thread's ring. sequence is a per-slot seqlock: odd while the owning thread writes it, 2 * (index + 1) once event
+// number index is complete, so an exporter can tell a finished event from one being overwritten.
+struct EventSlot
+{
+    std::atomic<uint64_t> sequence;
+    std::atomic<int64_t> begin, end, arg;
+    std::atomic<int> stage;
+};
+
+struct ThreadEvents
+{
+    int id;
+    std::string name;
+    bool exited; // The owning thread is gone, so another can take the ring over. Guarded by g_registryMutex.
+    std::atomic<uint64_t> head; // Number of events ever recorded, only written by the owning thread
+    EventSlot slots[Tracer::EVENTS_PER_THREAD];
+};
+
+std::mutex g_registryMutex; // Only taken to register stages and threads, and to export
+const char * g_stageNames[Tracer::MAX_STAGES];
+std::atomic<int> g_stageCount(0);
+StageHistogram g_histograms[Tracer::MAX_STAGES];
+std::vector<std::unique_ptr<ThreadEvents>> g_threads;
+int g_lastThreadId = 0;
+
+thread_local ThreadEvents * t_events = nullptr;
+thread_local const char * t_name = nullptr;
+
+// Hands the ring of a thread back when the thread exits, so that threads started and stopped over and over (capture restarts,
+// publishing threads) reuse the rings of the ones before them instead of adding one each
+struct ThreadEventsOwner
+{
+    ThreadEvents * events;
+
+    ~ThreadEventsOwner()
+    {
+        if (!events) return;
+        std::lock_guard<std::mutex> lock(g_registryMutex);
+        events->exited = true;
+    }
+};
+
+thread_local ThreadEventsOwner t_owner = {nullptr};
+
+ThreadEvents & GetThreadEvents()
+{
+    if (!t_events)
+    {
+        std::lock_guard<std::mutex> lock(g_registryMutex);
+        ThreadEvents * events = nullptr;
+        for (size_t t = 0; t < g_threads.size() && !events; ++t)
+            if (g_threads[t]->exited) events = g_threads[t].get();
+        if (!events)
+        {
+            g_threads.push_back(std::unique_ptr<ThreadEvents>(new ThreadEvents()));
+            events = g_threads.back().get();
+        }
+
+        // The events of the thread that exited go with it: exports hold the mutex, so none is reading them
+        events->head.store(0, std::memory_order_relaxed);
+        for (int i = 0; i < Tracer::EVENTS_PER_THREAD; ++i)
+            events->slots[i].sequence.store(0, std::memory_order_relaxed);
+        events->name = t_name ? t_name : "";
+        events->id = ++g_lastThreadId;
+        events->exited = false;
+        t_events = t_owner.events = events;
+    }
+    return *t_events;
+}
+
+void WriteJsonString(FILE * file, const char * s)
+{
+    fputc('"', file);
+    for (; *s; ++s)
+    {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', file);
+        if (static_cast<unsigned char>(*s) >= 0x20) fputc(*s, file);
+    }
+    fputc('"', file);
+}
+}
+
+void Tracer::Enable(bool enabled)
+{
+    g_traceEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+int Tracer::RegisterStage(const char * name)
+{
+    std::lock_guard<std::mutex> lock(g_registryMutex);
+    const int count = g_stageCount.load(std::memory_order_relaxed);
+    for (int i = 0; i < count; ++i)
+        if (strcmp(g_stageNames[i], name) == 0) return i;
+
+    // Past the limit every further stage is lumped into the last one rather than failing
+    if (count == MAX_STAGES) return MAX_STAGES - 1;
+    g_stageNames[count] = name;
+    g_stageCount.store(count + 1, std::memory_order_release);
+    return count;
+}
+
+void Tracer::Record(int stage, int64_t begin, int64_t end, int64_t arg)
+{
+    if (stage < 0 || stage >= MAX_STAGES) return;
+
+    ThreadEvents & events = GetThreadEvents();
+    const uint64_t index = events.head.load(std::memory_order_relaxed);
+    EventSlot & slot = events.slots[index % EVENTS_PER_THREAD];
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.begin.store(begin, std::memory_order_relaxed);
+    slot.end.store(end, std::memory_order_relaxed);
+    slot.arg.store(arg, std::memory_order_relaxed);
+    slot.stage.store(stage, std::memory_order_relaxed);
+    slot.sequence.store(2 * (index + 1), std::memory_order_release);
+    events.head.store(index + 1, std::memory_order_release);
+
+    StageHistogram & histogram = g_histograms[stage];
+    const int64_t duration = end - begin;
+    histogram.buckets[BucketOf(duration)].fetch_add(1, std::memory_order_relaxed);
+    int64_t max = histogram.max.load(std::memory_order_relaxed);
+    while (duration > max && !histogram.max.compare_exchange_weak(max, duration, std::memory_order_relaxed))
+    {
+    }
+}
+
+void Tracer::SetThreadName(const char * name)
+{
+    // The ring itself is only allocated once the thread records something
+    t_name = name;
+    if (t_events)
+    {
+        std::lock_guard<std::mutex> lock(g_registryMutex);
+        t_events->name = name;
+    }
+}
+
+bool Tracer::WriteChromeTrace(const char * path)
+{
+    FILE * file = fopen(path, "w");
+    if (!file) return false;
+
+    std::lock_guard<std::mutex> lock(g_registryMutex);
+    const int stageCount = g_stageCount.load(std::memory_order_acquire);
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file);
+    bool first = true;
+    for (size_t t = 0; t < g_threads.size(); ++t)
+    {
+        ThreadEvents & events = *g_threads[t];
+        if (!events.name.empty())
+        {
+            fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",", events.id);
+            WriteJsonString(file, events.name.c_str());
+            fputs("}}", file);
+            first = false;
+        }
+
+        const uint64_t head = events.head.load(std::memory_order_acquire);
+        const uint64_t oldest = head > static_cast<uint64_t>(EVENTS_PER_THREAD) ? head - EVENTS_PER_THREAD : 0;
+        for (uint64_t index = oldest; index < head; ++index)
+        {
+            EventSlot & slot = events.slots[index % EVENTS_PER_THREAD];
+            const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+            const int64_t begin = slot.begin.load(std::memory_order_relaxed);
+            const int64_t end = slot.end.load(std::memory_order_relaxed);
+            const int64_t arg = slot.arg.load(std::memory_order_relaxed);
+            const int stage = slot.stage.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // Skip events the owning thread overwrote while we were reading them
+            if (sequence != 2 * (index + 1) || slot.sequence.load(std::memory_order_relaxed) != sequence || stage >= stageCount) continue;
+
+            fprintf(file, "%s\n{\"name\":", first ? "" : ",");
+            WriteJsonString(file, g_stageNames[stage]);
+            fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", events.id, begin * 1e-3, (end - begin) * 1e-3);
+            if (arg >= 0) fprintf(file, ",\"args\":{\"arg\":%lld}", static_cast<long long>(arg));
+            fputc('}', file);
+            first = false;
+        }
+    }
+    fputs("\n]}\n", file);
+    return fclose(file) == 0;
+}
+
+std::vector<TraceStageStats> Tracer::GetStageStats()
+{
+    std::vector<TraceStageStats> result;
+    const int stageCount = g_stageCount.load(std::memory_order_acquire);
+    for (int stage = 0; stage < stageCount; ++stage)
+    {
+        StageHistogram & histogram = g_histograms[stage];
+        uint64_t counts[BUCKETS], total = 0;
+        for (int b = 0; b < BUCKETS; ++b)
+            total += counts[b] = histogram.buckets[b].load(std::memory_order_relaxed);
+
+        TraceStageStats stats;
+        stats.name = g_stageNames[stage];
+        stats.count = total;
+        stats.p50 = stats.p95 = stats.p99 = 0;
+        stats.max = histogram.max.load(std::memory_order_relaxed);
+
+        // Walk the cumulative distribution once, filling in each percentile as it is passed
+        const uint64_t ranks[3] = {(total * 50 + 99) / 100, (total * 95 + 99) / 100, (total * 99 + 99) / 100};
+        int64_t * values[3] = {&stats.p50, &stats.p95, &stats.p99};
+        uint64_t seen = 0;
+        int next = 0;
+        for (int b = 0; b < BUCKETS && next < 3 && total; ++b)
+        {
+            seen += counts[b];
+            while (next < 3 && seen >= ranks[next] && ranks[next])
+                *values[next++] = BucketMidpoint(b);
+        }
+        result.push_back(stats);
+    }
+    return result;
+}
+
+void Tracer::ResetStats()
+{
+    for (int stage = 0; stage < MAX_STAGES; ++stage)
+    {
+        for (int b = 0; b < BUCKETS; ++b)
+            g_histograms[stage].buckets[b].store(0, std::memory_order_relaxed);
+        g_histograms[stage].max.store(0, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,864 @@
+#include <r200_driver/ColorConversion.h>
+#include <r200_driver/DSAPIUtil.h>
+#include <r200_driver/Demosaic.h>
+#include <r200_driver/DepthColorizer.h>
+#include <r200_driver/Decimation.h>
+#include <r200_driver/DepthPyramid.h>
+#include <r200_driver/DepthUnits.h>
+#include <r200_driver/FrameSet.h>
+#include <r200_driver/HoleFilling.h>
+#include <r200_driver/ImageConversion.h>
+#include <r200_driver/ParallelRows.h>
+#include <r200_driver/Rectification.h>
+#include <r200_driver/SpatialFilter.h>
+#include <r200_driver/TemporalFilter.h>
+#include <r200_driver/DSAPI/DSImageRectification.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Times the open image conversions against the libDSAPI functions they replace, on every instruction set this CPU supports, after
+// checking that each one gives the same output as libDSAPI and exactly the same output as the scalar version. Needs no camera.
+// With --scaling, instead times every kernel that runs in bands of rows on 1 to N threads and prints its speedup over one.
+
+// What libDSAPI exports for NV12, which is not what DSImageConversion.h declares: RGB8 and RGBA8 in place of BGR8 and BGRA8, the
+// destination first, and a non-const source for Luminance8. Luminance16 is as declared.
+void DSConvertNV12ToRGB8(uint8_t * destImage, const uint8_t * sourceImage, int width, int height);
+void DSConvertNV12ToRGBA8(uint8_t * destImage, uint8_t alpha, const uint8_t * sourceImage, int width, int height);
+void DSConvertNV12ToLuminance8(uint8_t * sourceImage, int width, int height, uint8_t * destImage);
+
+// Runs one conversion from source into its output buffers
+typedef std::function<void(const uint8_t * source, std::vector<uint8_t> * outputs)> Conversion;
+
+struct BenchmarkCase
+{
+    std::string name;
+    int width, height;
+    size_t sourceSize;
+    std::vector<size_t> outputSizes;
+    Conversion reference; // libDSAPI, or none for options it does not have
+    Conversion open;      // ImageConversion.h or ColorConversion.h, on whatever SetConversionIsa() selected
+    int tolerance;        // Largest difference from libDSAPI allowed in any byte, for conversions that round differently, or -1 to only time it
+};
+
+static int g_iterations = 200;
+
+// Median time of one call, in microseconds
+static double Time(const Conversion & conversion, const uint8_t * source, std::vector<uint8_t> * outputs)
+{
+    conversion(source, outputs); // Warm up caches and page in the outputs
+    std::vector<double> times(g_iterations);
+    for (int i = 0; i < g_iterations; ++i)
+    {
+        const int64_t begin = GetHostTime();
+        conversion(source, outputs);
+        times[i] = (GetHostTime() - begin) * 1e-3;
+    }
+    std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+    return times[times.size() / 2];
+}
+
+static int MaxDifference(const std::vector<uint8_t> & a, const std::vector<uint8_t> & b)
+{
+    int difference = 0;
+    for (size_t i = 0; i < a.size(); ++i)
+        difference = std::max(difference, std::abs(a[i] - b[i]));
+    return difference;
+}
+
+static bool Run(const BenchmarkCase & test, const std::vector<ConversionIsa> & isas)
+{
+    std::mt19937 random(1234);
+    std::vector<uint8_t> source(test.sourceSize);
+    for (size_t i = 0; i < source.size(); ++i)
+        source[i] = static_cast<uint8_t>(random());
+
+    std::vector<std::vector<uint8_t>> expected(test.outputSizes.size()), scalar(test.outputSizes.size()), actual(test.outputSizes.size());
+    for (size_t i = 0; i < test.outputSizes.size(); ++i)
+    {
+        expected[i].resize(test.outputSizes[i]);
+        scalar[i].resize(test.outputSizes[i]);
+        actual[i].resize(test.outputSizes[i]);
+    }
+
+    printf("%-34s %4dx%-4d", test.name.c_str(), test.width, test.height);
+    if (test.reference)
+        printf(" %9.1f us", Time(test.reference, source.data(), expected.data()));
+    else
+        printf(" %12s", "-");
+    SetConversionIsa(CONVERSION_ISA_SCALAR);
+    test.open(source.data(), scalar.data());
+
+    bool identical = true;
+    for (size_t i = 0; i < isas.size(); ++i)
+    {
+        SetConversionIsa(isas[i]);
+        const double time = Time(test.open, source.data(), actual.data());
+        bool same = true;
+        for (size_t o = 0; o < expected.size(); ++o)
+        {
+            same = same && memcmp(scalar[o].data(), actual[o].data(), scalar[o].size()) == 0;
+            if (test.reference && test.tolerance >= 0) same = same && MaxDifference(expected[o], actual[o]) <= test.tolerance;
+        }
+        printf(" %9.1f us%s", time, same ? "" : " MISMATCH");
+        identical = identical && same;
+    }
+    printf("\n");
+    return identical;
+}
+
+// A table like DSRectificationTable makes for a camera rotated by a couple of degrees, sampling within the image
+static std::vector<uint32_t> MakeRectificationTable(int width, int height)
+{
+    std::vector<uint32_t> table(static_cast<size_t>(width) * height);
+    const double angle = 0.035, scale = 0.95, cx = width / 2.0, cy = height / 2.0;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            const double dx = x - cx, dy = y - cy;
+            const long column = std::lround(32 * (cx + scale * (std::cos(angle) * dx - std::sin(angle) * dy)));
+            const long row = std::lround(32 * (cy + scale * (std::sin(angle) * dx + std::cos(angle) * dy)));
+            table[static_cast<size_t>(y) * width + x] = static_cast<uint32_t>(std::max(0L, std::min(row, 32L * (height - 2)))) << 16 |
+                                                        static_cast<uint32_t>(std::max(0L, std::min(column, 32L * (width - 2))));
+        }
+    return table;
+}
+
+// Averages blocks of scale x scale BGRA8 pixels, rounding like FusedRectifier
+static void Downscale(const uint8_t * source, int width, int scale, int destWidth, int destHeight, uint8_t * dest)
+{
+    for (int y = 0; y < destHeight; ++y)
+        for (int x = 0; x < destWidth; ++x)
+            for (int c = 0; c < 4; ++c)
+            {
+                int sum = 0;
+                for (int j = 0; j < scale; ++j)
+                    for (int i = 0; i < scale; ++i)
+                        sum += source[(static_cast<size_t>(y * scale + j) * width + x * scale + i) * 4 + c];
+                dest[(static_cast<size_t>(y) * destWidth + x) * 4 + c] = static_cast<uint8_t>((sum + scale * scale / 2) / (scale * scale));
+            }
+}
+
+static std::vector<BenchmarkCase> GetCases(int width, int height)
+{
+    std::vector<BenchmarkCase> cases;
+    const size_t pixels = static_cast<size_t>(width) * height;
+    BenchmarkCase test;
+    test.width = width;
+    test.height = height;
+    test.tolerance = 0;
+
+    test.name = "RL8 -> L8";
+    test.sourceSize = pixels * 2;
+    test.outputSizes.assign(2, pixels);
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertRLLuminance8ToLuminance8(s, width, height, o[0].data(), o[1].data()); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertRLLuminance8ToLuminance8(s, width, height, o[0].data(), o[1].data()); };
+    cases.push_back(test);
+
+    test.name = "RL16 -> L16";
+    test.sourceSize = pixels * 4;
+    test.outputSizes.assign(2, pixels * 2);
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        DSConvertRLLuminance16ToLuminance16(s, width, height, reinterpret_cast<uint16_t *>(o[0].data()), reinterpret_cast<uint16_t *>(o[1].data()));
+    };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        ConvertRLLuminance16ToLuminance16(s, width, height, reinterpret_cast<uint16_t *>(o[0].data()), reinterpret_cast<uint16_t *>(o[1].data()));
+    };
+    cases.push_back(test);
+
+    test.name = "RL16 -> L8 (shift 2)";
+    test.sourceSize = pixels * 4;
+    test.outputSizes.assign(2, pixels);
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertRLLuminance16ToLuminance8(s, width, height, 2, o[0].data(), o[1].data()); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertRLLuminance16ToLuminance8(s, width, height, 2, o[0].data(), o[1].data()); };
+    cases.push_back(test);
+
+    test.name = "RL12 -> L16";
+    test.sourceSize = pixels * 3;
+    test.outputSizes.assign(2, pixels * 2);
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        DSConvertRLLuminance12ToLuminance16(s, width, height, reinterpret_cast<uint16_t *>(o[0].data()), reinterpret_cast<uint16_t *>(o[1].data()));
+    };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        ConvertRLLuminance12ToLuminance16(s, width, height, reinterpret_cast<uint16_t *>(o[0].data()), reinterpret_cast<uint16_t *>(o[1].data()));
+    };
+    cases.push_back(test);
+
+    test.name = "RL12 -> L8 (shift 4)";
+    test.sourceSize = pixels * 3;
+    test.outputSizes.assign(2, pixels);
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertRLLuminance12ToLuminance8(s, width, height, 4, o[0].data(), o[1].data()); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertRLLuminance12ToLuminance8(s, width, height, 4, o[0].data(), o[1].data()); };
+    cases.push_back(test);
+
+    // Rows padded to a 64 byte multiple, as a V4L2 driver might deliver them
+    const int stride = (width * 3 + 63) / 64 * 64;
+    test.name = "RL12 -> L8 (shift 4, padded rows)";
+    test.sourceSize = static_cast<size_t>(stride) * height;
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertRLLuminance12ToLuminance8(s, width, height, stride, 4, o[0].data(), o[1].data()); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertRLLuminance12ToLuminance8(s, width, height, stride, 4, o[0].data(), o[1].data()); };
+    cases.push_back(test);
+
+    // libDSAPI needs two passes over the source for what the open version does in one
+    test.name = "RL12 -> L8 (shift 4) + L16";
+    test.sourceSize = pixels * 3;
+    test.outputSizes.assign(2, pixels);
+    test.outputSizes.resize(4, pixels * 2);
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        DSConvertRLLuminance12ToLuminance8(s, width, height, 4, o[0].data(), o[1].data());
+        DSConvertRLLuminance12ToLuminance16(s, width, height, reinterpret_cast<uint16_t *>(o[2].data()), reinterpret_cast<uint16_t *>(o[3].data()));
+    };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        ConvertRLLuminance12ToLuminance8And16(s, width, height, 4, o[0].data(), o[1].data(), reinterpret_cast<uint16_t *>(o[2].data()),
+                                              reinterpret_cast<uint16_t *>(o[3].data()));
+    };
+    cases.push_back(test);
+
+    // The middle of the image into a tile of a mosaic twice as wide, which libDSAPI needs a copy for
+    const ConversionRegion middle(ImageRegion(width / 4 & ~1, height / 4, width / 2 & ~1, height / 2), width / 2 & ~1, 0);
+    test.name = "RL12 -> L8 + L16 (region to mosaic)";
+    test.outputSizes.assign(2, pixels * 2);
+    test.outputSizes.resize(4, pixels * 4);
+    test.reference = nullptr;
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        ConvertRLLuminance12ToLuminance8And16(s, width, height, width * 3, 4, o[0].data(), o[1].data(), width * 2, reinterpret_cast<uint16_t *>(o[2].data()),
+                                              reinterpret_cast<uint16_t *>(o[3].data()), width * 4, middle);
+    };
+    cases.push_back(test);
+
+    // The open YUV conversions round in their own way, so can be a level off libDSAPI
+    test.name = "YUY2 -> RGB8";
+    test.sourceSize = pixels * 2;
+    test.outputSizes.assign(1, pixels * 3);
+    test.tolerance = 1;
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertYUY2ToRGB8(s, width, height, o[0].data()); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertYUY2ToRGB8(s, width, height, o[0].data()); };
+    cases.push_back(test);
+
+    test.name = "YUY2 -> BGRA8";
+    test.outputSizes.assign(1, pixels * 4);
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertYUY2ToBGRA8(s, width, height, o[0].data()); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertYUY2ToBGRA8(s, width, height, o[0].data()); };
+    cases.push_back(test);
+
+    test.name = "YUY2 -> L8";
+    test.outputSizes.assign(1, pixels);
+    test.tolerance = 0;
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertYUY2ToLuminance8(s, width, height, o[0].data()); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertYUY2ToLuminance8(s, width, height, o[0].data()); };
+    cases.push_back(test);
+
+    test.name = "YUY2 -> L16 (shift 4)";
+    test.outputSizes.assign(1, pixels * 2);
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertYUY2ToLuminance16(s, width, height, 4, reinterpret_cast<uint16_t *>(o[0].data())); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertYUY2ToLuminance16(s, width, height, 4, reinterpret_cast<uint16_t *>(o[0].data())); };
+    cases.push_back(test);
+
+    // Options libDSAPI does not have, only checked against the scalar version
+    test.name = "YUY2 -> BGRA8 (BT.709, full range)";
+    test.outputSizes.assign(1, pixels * 4);
+    test.reference = nullptr;
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        YuvConversionOptions options;
+        options.matrix = YUV_BT709;
+        options.range = YUV_FULL_RANGE;
+        ConvertYUY2ToBGRA8(s, width, height, width * 2, o[0].data(), width * 4, options);
+    };
+    cases.push_back(test);
+
+    test.name = "YUY2 -> BGRA8 (region to mosaic)";
+    test.outputSizes.assign(1, pixels * 8);
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        YuvConversionOptions options;
+        options.region = middle;
+        ConvertYUY2ToBGRA8(s, width, height, width * 2, o[0].data(), width * 8, options);
+    };
+    cases.push_back(test);
+
+    test.name = "YUY2 -> BGRA8 (bands on 2 workers)";
+    test.outputSizes.assign(1, pixels * 4);
+    test.tolerance = 1;
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertYUY2ToBGRA8(s, width, height, o[0].data()); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        static TaskScheduler scheduler(2);
+        YuvConversionOptions options;
+        options.scheduler = &scheduler;
+        ConvertYUY2ToBGRA8(s, width, height, width * 2, o[0].data(), width * 4, options);
+    };
+    cases.push_back(test);
+
+    test.name = "NV12 -> RGB8";
+    test.sourceSize = pixels * 3 / 2;
+    test.outputSizes.assign(1, pixels * 3);
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertNV12ToRGB8(o[0].data(), s, width, height); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertNV12ToRGB8(s, width, height, o[0].data()); };
+    cases.push_back(test);
+
+    test.name = "NV12 -> BGR8";
+    test.reference = nullptr;
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertNV12ToBGR8(s, width, height, o[0].data()); };
+    cases.push_back(test);
+
+    // libDSAPI only has RGBA, so is only timed against it
+    test.name = "NV12 -> BGRA8";
+    test.outputSizes.assign(1, pixels * 4);
+    test.tolerance = -1;
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertNV12ToRGBA8(o[0].data(), 255, s, width, height); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertNV12ToBGRA8(s, width, height, o[0].data()); };
+    cases.push_back(test);
+
+    test.name = "NV12 -> BGRA8 (bands on 2 workers)";
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        static TaskScheduler scheduler(2);
+        YuvConversionOptions options;
+        options.scheduler = &scheduler;
+        ConvertNV12ToBGRA8(s, width, height, width, o[0].data(), width * 4, options);
+    };
+    cases.push_back(test);
+
+    test.name = "NV12 -> L8";
+    test.outputSizes.assign(1, pixels);
+    test.tolerance = 0;
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertNV12ToLuminance8(const_cast<uint8_t *>(s), width, height, o[0].data()); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertNV12ToLuminance8(s, width, height, o[0].data()); };
+    cases.push_back(test);
+
+    test.name = "NV12 -> L16 (shift 4)";
+    test.outputSizes.assign(1, pixels * 2);
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertNV12ToLuminance16(s, width, height, 4, reinterpret_cast<uint16_t *>(o[0].data())); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertNV12ToLuminance16(s, width, height, 4, reinterpret_cast<uint16_t *>(o[0].data())); };
+    cases.push_back(test);
+
+    // The middle of a frame with padded rows, into a destination with padded rows too
+    const int nv12Stride = (width + 63) / 64 * 64;
+    const ImageRegion region(width / 4 & ~1, height / 4, width / 2 & ~1, height / 2);
+    test.name = "NV12 -> BGRA8 (region, padded rows)";
+    test.sourceSize = static_cast<size_t>(nv12Stride) * height * 3 / 2;
+    test.outputSizes.assign(1, static_cast<size_t>(region.width * 4 + 64) * region.height);
+    test.reference = nullptr;
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        YuvConversionOptions options;
+        options.region = region;
+        ConvertNV12ToBGRA8(s, width, height, nv12Stride, o[0].data(), region.width * 4 + 64, options);
+    };
+    cases.push_back(test);
+
+    // A different demosaic from the one of libDSAPI, so only timed against it
+    const size_t raw10Size = pixels / 4 * 5;
+    test.name = "Raw10 -> RGB8 (bilinear)";
+    test.sourceSize = raw10Size;
+    test.outputSizes.assign(1, pixels * 3);
+    test.tolerance = -1;
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertRaw10ToRGB8(s, width, height, o[0].data()); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        DemosaicOptions options;
+        options.method = DEMOSAIC_BILINEAR;
+        ConvertRaw10ToRGB8(s, width, height, width / 4 * 5, o[0].data(), width * 3, options);
+    };
+    cases.push_back(test);
+
+    test.name = "Raw10 -> RGB8 (Malvar)";
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertRaw10ToRGB8(s, width, height, o[0].data()); };
+    cases.push_back(test);
+
+    test.name = "Raw10 -> BGRA8 (Malvar)";
+    test.outputSizes.assign(1, pixels * 4);
+    test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) { DSConvertRaw10ToBGRA8(s, width, height, o[0].data()); };
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { ConvertRaw10ToBGRA8(s, width, height, o[0].data()); };
+    cases.push_back(test);
+
+    test.name = "Raw10 -> BGRA8 (Malvar, WB, gamma)";
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        DemosaicOptions options;
+        options.redGain = 1.4f;
+        options.blueGain = 1.2f;
+        options.gamma = 2.2f;
+        ConvertRaw10ToBGRA8(s, width, height, width / 4 * 5, o[0].data(), width * 4, options);
+    };
+    cases.push_back(test);
+
+    test.name = "Raw10 -> BGRA8 (bands on 2 workers)";
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        static TaskScheduler scheduler(2);
+        DemosaicOptions options;
+        options.scheduler = &scheduler;
+        ConvertRaw10ToBGRA8(s, width, height, width / 4 * 5, o[0].data(), width * 4, options);
+    };
+    cases.push_back(test);
+
+    // The fused rectification against the three passes it replaces: converting the whole image, DSRectifyBGRA8ToBGRA8 and a downscale
+    const std::shared_ptr<std::vector<uint32_t>> table = std::make_shared<std::vector<uint32_t>>(MakeRectificationTable(width, height));
+    const std::shared_ptr<std::vector<uint8_t>> converted = std::make_shared<std::vector<uint8_t>>(pixels * 4 + 8);
+    const std::shared_ptr<std::vector<uint8_t>> rectified = std::make_shared<std::vector<uint8_t>>(pixels * 4);
+    const auto rectify = [=](int scale, uint8_t * dest) {
+        if (scale == 1)
+            DSRectifyBGRA8ToBGRA8(table->data(), converted->data(), width, width, height, dest);
+        else
+        {
+            DSRectifyBGRA8ToBGRA8(table->data(), converted->data(), width, width, height, rectified->data());
+            Downscale(rectified->data(), width, scale, width / scale, height / scale, dest);
+        }
+    };
+    for (int scale = 1; scale <= 3; scale += 2)
+    {
+        const std::shared_ptr<FusedRectifier> rectifier = std::make_shared<FusedRectifier>(table->data(), width, height, width, height, scale);
+        const std::string suffix = scale == 1 ? "" : " / 3";
+        test.name = "YUY2 -> rectified BGRA8" + suffix;
+        test.sourceSize = pixels * 2;
+        test.outputSizes.assign(1, static_cast<size_t>(rectifier->Width()) * rectifier->Height() * 4);
+        test.tolerance = 0;
+        test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+            ConvertYUY2ToBGRA8(s, width, height, converted->data());
+            rectify(scale, o[0].data());
+        };
+        test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { rectifier->RectifyYUY2ToBGRA8(s, width * 2, o[0].data(), rectifier->Width() * 4); };
+        cases.push_back(test);
+
+        test.name = "Raw10 -> rectified BGRA8" + suffix;
+        test.sourceSize = raw10Size;
+        test.reference = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+            ConvertRaw10ToBGRA8(s, width, height, converted->data());
+            rectify(scale, o[0].data());
+        };
+        test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { rectifier->RectifyRaw10ToBGRA8(s, width / 4 * 5, o[0].data(), rectifier->Width() * 4); };
+        cases.push_back(test);
+
+        test.name = "Raw10 -> rectified BGRA8" + suffix + " (2 workers)";
+        test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+            static TaskScheduler scheduler(2);
+            DemosaicOptions options;
+            options.scheduler = &scheduler;
+            rectifier->RectifyRaw10ToBGRA8(s, width / 4 * 5, o[0].data(), rectifier->Width() * 4, options);
+        };
+        cases.push_back(test);
+    }
+
+    test.name = "Raw10 unpack";
+    test.sourceSize = raw10Size;
+    test.outputSizes.assign(1, pixels * 2);
+    test.reference = nullptr;
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        UnpackRaw10(s, width, height, width / 4 * 5, reinterpret_cast<uint16_t *>(o[0].data()), width * 2);
+    };
+    cases.push_back(test);
+
+    // Not in libDSAPI, so only checked against the scalar version
+    const char * const reductions[] = {"min", "median", "mean"};
+    for (int reduction = DEPTH_REDUCE_MIN; reduction <= DEPTH_REDUCE_MEAN; ++reduction)
+    {
+        test.name = std::string("Z16 pyramid (") + reductions[reduction] + ")";
+        test.sourceSize = pixels * 2;
+        test.outputSizes.clear();
+        for (int level = 1; level <= 3; ++level)
+            test.outputSizes.push_back(static_cast<size_t>(width >> level) * (height >> level) * 2);
+        test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+            uint16_t * const levels[3] = {reinterpret_cast<uint16_t *>(o[0].data()), reinterpret_cast<uint16_t *>(o[1].data()),
+                                          reinterpret_cast<uint16_t *>(o[2].data())};
+            DepthPyramidOptions options;
+            options.reduction = static_cast<DepthReduction>(reduction);
+            BuildDepthPyramid(reinterpret_cast<const uint16_t *>(s), width, height, levels, options);
+        };
+        cases.push_back(test);
+    }
+
+    for (int factor = 2; factor <= 8; factor *= 2)
+    {
+        for (int reduction = DEPTH_REDUCE_MIN; reduction <= DEPTH_REDUCE_MEDIAN; ++reduction)
+        {
+            test.name = std::string("Z16 decimation x") + std::to_string(factor) + " (" + reductions[reduction] + ")";
+            test.sourceSize = pixels * 2;
+            test.outputSizes.assign(1, static_cast<size_t>(width / factor) * (height / factor) * 2);
+            test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+                DecimationOptions options;
+                options.factor = factor;
+                options.reduction = static_cast<DepthReduction>(reduction);
+                DecimateDepth(reinterpret_cast<const uint16_t *>(s), width, height, reinterpret_cast<uint16_t *>(o[0].data()), options);
+            };
+            cases.push_back(test);
+        }
+    }
+
+    // Each conversion keeps 0.5 to 4 m, making the valid mask as it goes
+    const std::shared_ptr<std::vector<uint8_t>> validMask = std::make_shared<std::vector<uint8_t>>(static_cast<size_t>((width + 7) / 8) * height);
+    const int destUnits[] = {DS_MILLIMETERS, DS_CENTIMETERS, DS_INCHES};
+    const char * const unitNames[] = {"mm", "cm", "in"};
+    for (int units = 0; units < 3; ++units)
+    {
+        test.name = std::string("Z16 mm -> Z16 ") + unitNames[units] + " (0.5-4 m, mask)";
+        test.sourceSize = pixels * 2;
+        test.outputSizes.assign(1, pixels * 2);
+        test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+            DepthRangeOptions options;
+            options.minDepth = 0.5;
+            options.maxDepth = 4;
+            options.rangeUnits = DS_METERS;
+            options.validMask = validMask->data();
+            ConvertDepthUnits(reinterpret_cast<const uint16_t *>(s), width, height, reinterpret_cast<uint16_t *>(o[0].data()), destUnits[units], options);
+        };
+        cases.push_back(test);
+    }
+
+    test.name = "Z16 mm -> float metres (0.5-4 m, mask)";
+    test.outputSizes.assign(1, pixels * 4);
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        DepthRangeOptions options;
+        options.minDepth = 0.5;
+        options.maxDepth = 4;
+        options.rangeUnits = DS_METERS;
+        options.validMask = validMask->data();
+        ConvertDepthToMeters(reinterpret_cast<const uint16_t *>(s), width, height, reinterpret_cast<float *>(o[0].data()), options);
+    };
+    cases.push_back(test);
+
+    test.name = "Z16 mm -> half metres (0.5-4 m, mask)";
+    test.outputSizes.assign(1, pixels * 2);
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        DepthRangeOptions options;
+        options.minDepth = 0.5;
+        options.maxDepth = 4;
+        options.rangeUnits = DS_METERS;
+        options.validMask = validMask->data();
+        ConvertDepthToHalfMeters(reinterpret_cast<const uint16_t *>(s), width, height, reinterpret_cast<uint16_t *>(o[0].data()), options);
+    };
+    cases.push_back(test);
+
+    const char * const colormaps[] = {"histogram", "jet", "turbo", "grayscale"};
+    for (int colormap = DEPTH_COLORMAP_HISTOGRAM; colormap <= DEPTH_COLORMAP_TURBO; colormap += 2)
+    {
+        DepthColorizerOptions options;
+        options.colormap = static_cast<DepthColormap>(colormap);
+        const std::shared_ptr<DepthColorizer> colorizer = std::make_shared<DepthColorizer>(options);
+        test.name = std::string("Z16 -> RGB8 (") + colormaps[colormap] + ")";
+        test.sourceSize = pixels * 2;
+        test.outputSizes.assign(1, pixels * 3);
+        test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) { colorizer->Colorize(reinterpret_cast<const uint16_t *>(s), width, height, o[0].data()); };
+        cases.push_back(test);
+    }
+
+    // The filter keeps state from frame to frame, so every run starts from a reset one and filters two frames: a first that only fills the
+    // state and a second that is smoothed against it
+    const std::shared_ptr<TemporalDepthFilter> temporal = std::make_shared<TemporalDepthFilter>(width, height);
+    test.name = "Z16 temporal filter (2 frames)";
+    test.sourceSize = pixels * 4;
+    test.outputSizes.assign(1, pixels * 2);
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        uint16_t * filtered = reinterpret_cast<uint16_t *>(o[0].data());
+        temporal->Reset();
+        temporal->Filter(reinterpret_cast<const uint16_t *>(s), filtered);
+        temporal->Filter(reinterpret_cast<const uint16_t *>(s) + pixels, filtered);
+    };
+    cases.push_back(test);
+
+    test.name = "Z16 spatial filter";
+    test.sourceSize = pixels * 2;
+    test.outputSizes.assign(1, pixels * 2);
+    test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+        FilterDepthSpatial(reinterpret_cast<const uint16_t *>(s), width, height, reinterpret_cast<uint16_t *>(o[0].data()));
+    };
+    cases.push_back(test);
+
+    const char * const fillModes[] = {"left", "farthest", "nearest"};
+    for (int mode = HOLE_FILL_LEFT; mode <= HOLE_FILL_NEAREST; ++mode)
+    {
+        test.name = std::string("Z16 hole filling (") + fillModes[mode] + ")";
+        test.open = [=](const uint8_t * s, std::vector<uint8_t> * o) {
+            HoleFillOptions options;
+            options.mode = static_cast<HoleFillMode>(mode);
+            FillDepthHoles(reinterpret_cast<const uint16_t *>(s), width, height, reinterpret_cast<uint16_t *>(o[0].data()), options);
+        };
+        cases.push_back(test);
+    }
+
+    return cases;
+}
+
+// A kernel that runs in bands of rows on the scheduler it is given, or on the calling thread alone without one
+struct ScalingCase
+{
+    std::string name;
+    size_t sourceSize;
+    std::vector<size_t> outputSizes;
+    std::function<void(const uint8_t * source, std::vector<uint8_t> * outputs, TaskScheduler * scheduler)> run;
+};
+
+static std::vector<ScalingCase> GetScalingCases(int width, int height)
+{
+    std::vector<ScalingCase> cases;
+    const size_t pixels = static_cast<size_t>(width) * height;
+    ScalingCase test;
+
+    test.name = "RL8 -> L8";
+    test.sourceSize = pixels * 2;
+    test.outputSizes.assign(2, pixels);
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        ConvertRLLuminance8ToLuminance8(s, width, height, width * 2, o[0].data(), o[1].data(), width, ConversionRegion(), scheduler);
+    };
+    cases.push_back(test);
+
+    test.name = "RL16 -> L16";
+    test.sourceSize = pixels * 4;
+    test.outputSizes.assign(2, pixels * 2);
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        ConvertRLLuminance16ToLuminance16(s, width, height, width * 4, reinterpret_cast<uint16_t *>(o[0].data()),
+                                          reinterpret_cast<uint16_t *>(o[1].data()), width * 2, ConversionRegion(), scheduler);
+    };
+    cases.push_back(test);
+
+    test.name = "RL12 -> L8 + L16";
+    test.sourceSize = pixels * 3;
+    test.outputSizes.assign(4, pixels);
+    test.outputSizes[2] = test.outputSizes[3] = pixels * 2;
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        ConvertRLLuminance12ToLuminance8And16(s, width, height, width * 3, 4, o[0].data(), o[1].data(), width, reinterpret_cast<uint16_t *>(o[2].data()),
+                                              reinterpret_cast<uint16_t *>(o[3].data()), width * 2, ConversionRegion(), scheduler);
+    };
+    cases.push_back(test);
+
+    test.name = "YUY2 -> BGRA8";
+    test.sourceSize = pixels * 2;
+    test.outputSizes.assign(1, pixels * 4);
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        YuvConversionOptions options;
+        options.scheduler = scheduler;
+        ConvertYUY2ToBGRA8(s, width, height, width * 2, o[0].data(), width * 4, options);
+    };
+    cases.push_back(test);
+
+    test.name = "NV12 -> BGRA8";
+    test.sourceSize = pixels * 3 / 2;
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        YuvConversionOptions options;
+        options.scheduler = scheduler;
+        ConvertNV12ToBGRA8(s, width, height, width, o[0].data(), width * 4, options);
+    };
+    cases.push_back(test);
+
+    test.name = "Raw10 -> BGRA8 (Malvar)";
+    test.sourceSize = pixels / 4 * 5;
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        DemosaicOptions options;
+        options.scheduler = scheduler;
+        ConvertRaw10ToBGRA8(s, width, height, width / 4 * 5, o[0].data(), width * 4, options);
+    };
+    cases.push_back(test);
+
+    // DSRectifyBGRA8ToBGRA8 itself knows nothing of threads, but each band of table rows can be rectified on its own
+    const std::shared_ptr<std::vector<uint32_t>> table = std::make_shared<std::vector<uint32_t>>(MakeRectificationTable(width, height));
+    test.name = "DSRectifyBGRA8ToBGRA8";
+    test.sourceSize = pixels * 4 + 8;
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        ParallelForRows(scheduler, height, width * 4, GrainRows(width * 4, 64 * 1024), [&](int begin, int end) {
+            DSRectifyBGRA8ToBGRA8(table->data() + static_cast<size_t>(begin) * width, s, width, width, end - begin,
+                                  o[0].data() + static_cast<size_t>(begin) * width * 4);
+        });
+    };
+    cases.push_back(test);
+
+    const std::shared_ptr<FusedRectifier> rectifier = std::make_shared<FusedRectifier>(table->data(), width, height, width, height);
+    test.name = "YUY2 -> rectified BGRA8";
+    test.sourceSize = pixels * 2;
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        YuvConversionOptions options;
+        options.scheduler = scheduler;
+        rectifier->RectifyYUY2ToBGRA8(s, width * 2, o[0].data(), width * 4, options);
+    };
+    cases.push_back(test);
+
+    test.name = "Z16 -> colorized RGB8";
+    test.sourceSize = pixels * 2;
+    test.outputSizes.assign(1, pixels * 3);
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        const uint8_t nearColor[] = {255, 0, 0}, farColor[] = {20, 40, 255};
+        ConvertDepthToRGBUsingHistogram(reinterpret_cast<const uint16_t *>(s), width, height, nearColor, farColor, o[0].data(), scheduler);
+    };
+    cases.push_back(test);
+
+    const std::shared_ptr<TemporalDepthFilter> temporal = std::make_shared<TemporalDepthFilter>(width, height);
+    test.name = "Z16 temporal filter";
+    test.outputSizes.assign(1, pixels * 2);
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        TemporalFilterOptions options;
+        options.scheduler = scheduler;
+        temporal->SetOptions(options);
+        temporal->Filter(reinterpret_cast<const uint16_t *>(s), reinterpret_cast<uint16_t *>(o[0].data()));
+    };
+    cases.push_back(test);
+
+    test.name = "Z16 spatial filter";
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        SpatialFilterOptions options;
+        options.scheduler = scheduler;
+        FilterDepthSpatial(reinterpret_cast<const uint16_t *>(s), width, height, reinterpret_cast<uint16_t *>(o[0].data()), options);
+    };
+    cases.push_back(test);
+
+    test.name = "Z16 hole filling (farthest)";
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        HoleFillOptions options;
+        options.scheduler = scheduler;
+        FillDepthHoles(reinterpret_cast<const uint16_t *>(s), width, height, reinterpret_cast<uint16_t *>(o[0].data()), options);
+    };
+    cases.push_back(test);
+
+    test.name = "Z16 decimation x2 (median)";
+    test.outputSizes.assign(1, static_cast<size_t>(width / 2) * (height / 2) * 2);
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        DecimationOptions options;
+        options.scheduler = scheduler;
+        DecimateDepth(reinterpret_cast<const uint16_t *>(s), width, height, reinterpret_cast<uint16_t *>(o[0].data()), options);
+    };
+    cases.push_back(test);
+
+    test.name = "Z16 mm -> float metres";
+    test.outputSizes.assign(1, pixels * 4);
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        DepthRangeOptions options;
+        options.scheduler = scheduler;
+        ConvertDepthToMeters(reinterpret_cast<const uint16_t *>(s), width, height, reinterpret_cast<float *>(o[0].data()), options);
+    };
+    cases.push_back(test);
+
+    test.name = "Z16 pyramid (mean)";
+    test.outputSizes.clear();
+    for (int level = 1; level <= 3; ++level)
+        test.outputSizes.push_back(static_cast<size_t>(width >> level) * (height >> level) * 2);
+    test.run = [=](const uint8_t * s, std::vector<uint8_t> * o, TaskScheduler * scheduler) {
+        uint16_t * const levels[3] = {reinterpret_cast<uint16_t *>(o[0].data()), reinterpret_cast<uint16_t *>(o[1].data()),
+                                      reinterpret_cast<uint16_t *>(o[2].data())};
+        DepthPyramidOptions options;
+        options.reduction = DEPTH_REDUCE_MEAN;
+        options.scheduler = scheduler;
+        BuildDepthPyramid(reinterpret_cast<const uint16_t *>(s), width, height, levels, options);
+    };
+    cases.push_back(test);
+
+    return cases;
+}
+
+// Thread counts the scaling is measured at: powers of two up to threads, and threads itself
+static std::vector<int> ThreadCounts(int threads)
+{
+    std::vector<int> counts;
+    for (int n = 1; n < threads; n *= 2)
+        counts.push_back(n);
+    counts.push_back(threads);
+    return counts;
+}
+
+// Times each case on 1 thread, then prints its speedup on each count of threads: the calling thread plus workers pinned to one CPU each
+static void RunScaling(const std::vector<std::pair<int, int>> & sizes, const std::string & filter, int threads)
+{
+    const std::vector<int> counts = ThreadCounts(threads);
+    std::vector<std::unique_ptr<TaskScheduler>> schedulers(counts.size());
+    printf("%-34s %9s %12s", "Speedup over 1 thread", "Size", "1 thread");
+    for (size_t c = 1; c < counts.size(); ++c)
+    {
+        schedulers[c].reset(new TaskScheduler(counts[c] - 1, 1));
+        printf(" %9d thr", counts[c]);
+    }
+    printf("\n");
+
+    for (size_t s = 0; s < sizes.size(); ++s)
+    {
+        const std::vector<ScalingCase> cases = GetScalingCases(sizes[s].first, sizes[s].second);
+        for (size_t i = 0; i < cases.size(); ++i)
+        {
+            const ScalingCase & test = cases[i];
+            if (test.name.find(filter) == std::string::npos) continue;
+
+            std::mt19937 random(1234);
+            std::vector<uint8_t> source(test.sourceSize);
+            for (size_t b = 0; b < source.size(); ++b)
+                source[b] = static_cast<uint8_t>(random());
+            std::vector<std::vector<uint8_t>> outputs(test.outputSizes.size());
+            for (size_t o = 0; o < outputs.size(); ++o)
+                outputs[o].resize(test.outputSizes[o]);
+
+            printf("%-34s %4dx%-4d", test.name.c_str(), sizes[s].first, sizes[s].second);
+            double single = 0;
+            for (size_t c = 0; c < counts.size(); ++c)
+            {
+                TaskScheduler * scheduler = schedulers[c].get();
+                const double time =
+                    Time([&](const uint8_t * source, std::vector<uint8_t> * outputs) { test.run(source, outputs, scheduler); }, source.data(), outputs.data());
+                if (c == 0)
+                {
+                    single = time;
+                    printf(" %9.1f us", time);
+                }
+                else
+                    printf(" %12.2fx", single / time);
+            }
+            printf("\n");
+        }
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    std::string filter;
+    std::vector<std::pair<int, int>> sizes;
+    int scaling = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        int width, height;
+        if (arg.compare(0, 9, "--filter=") == 0)
+            filter = arg.substr(9);
+        else if (arg.compare(0, 13, "--iterations=") == 0 && (g_iterations = atoi(arg.c_str() + 13)) > 0)
+            continue;
+        else if (arg == "--scaling")
+            scaling = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        else if (arg.compare(0, 10, "--scaling=") == 0 && (scaling = atoi(arg.c_str() + 10)) > 0)
+            continue;
+        else if (arg.compare(0, 7, "--size=") == 0 && sscanf(arg.c_str() + 7, "%dx%d", &width, &height) == 2)
+            sizes.push_back(std::make_pair(width, height));
+        else
+        {
+            printf("Usage: %s [--filter=TEXT] [--iterations=N] [--scaling[=THREADS]] [--size=WxH]...\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (sizes.empty())
+    {
+        sizes.push_back(std::make_pair(628, 468));
+        sizes.push_back(std::make_pair(640, 480));
+        sizes.push_back(std::make_pair(1920, 1080));
+    }
+    if (scaling)
+    {
+        RunScaling(sizes, filter, scaling);
+        return EXIT_SUCCESS;
+    }
+
+    std::vector<ConversionIsa> isas;
+    const ConversionIsa all[] = {CONVERSION_ISA_SCALAR, CONVERSION_ISA_SSE2, CONVERSION_ISA_SSSE3, CONVERSION_ISA_AVX2, CONVERSION_ISA_NEON};
+    printf("%-34s %9s %12s", "Median time per frame", "Size", "libDSAPI");
+    for (int i = 0; i < 5; ++i)
+    {
+        if (!SetConversionIsa(all[i])) continue;
+        isas.push_back(all[i]);
+        printf(" %12s", ConversionIsaString(all[i]));
+    }
+    printf("\n");
+
+    bool identical = true;
+    for (size_t s = 0; s < sizes.size(); ++s)
+    {
+        const std::vector<BenchmarkCase> cases = GetCases(sizes[s].first, sizes[s].second);
+        for (size_t i = 0; i < cases.size(); ++i)
+            if (cases[i].name.find(filter) != std::string::npos) identical = Run(cases[i], isas) && identical;
+    }
+
+    if (!identical) printf("Some conversions did not match libDSAPI\n");
+    return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
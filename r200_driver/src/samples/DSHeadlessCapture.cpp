@@ -0,0 +1,801 @@
+#include <r200_driver/DSAPI.h>
+#include <r200_driver/DSAPIUtil.h>
+#include <r200_driver/BufferPool.h>
+#include <r200_driver/CaptureEngine.h>
+#include <r200_driver/ColorConversion.h>
+#include <r200_driver/DepthColorizer.h>
+#include <r200_driver/Demosaic.h>
+#include <r200_driver/FramePipeline.h>
+#include <r200_driver/HoleFilling.h>
+#include <r200_driver/ImageConversion.h>
+#include <r200_driver/PollableGrabber.h>
+#include <r200_driver/SpatialFilter.h>
+#include <r200_driver/TemporalFilter.h>
+#include <r200_driver/Trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+// Headless capture: no GL, no prompts. Frames are grabbed on the CaptureEngine thread and fanned out to a processing stage (the same
+// conversions the GL samples do before display), DSAPI's own recorder, and a publishing stage that streams the newest images of every
+// enabled stream to a file, FIFO or stdout. With --benchmark it reports sustained FPS, CPU time per stage and drop rates.
+
+struct Options
+{
+    std::string file;           // Read from a DSAPI recording in this directory instead of a live camera
+    bool loop = false;          // Loop the recording
+    bool configure = true;      // Apply the stream configuration below. Defaults to false for recordings, which bring their own.
+    uint32_t serial = 0xFFFFFFFF;
+    bool z = true, left = false, right = false, third = false;
+    bool rectified = true, crop = true;
+    int zWidth = 628, zHeight = 468, lrzFps = 30;
+    DSPixelFormat lrFormat = DS_LUMINANCE8;
+    bool thirdRectified = false;
+    int thirdWidth = 640, thirdHeight = 480, thirdFps = 30;
+    DSPixelFormat thirdFormat = DS_RGB8;
+    bool autoExposure = true;
+    std::string record;         // Record to this directory with DSAPI's recorder
+    int recordEvery = 1;
+    bool process = true;        // Run the processing stage
+    bool temporal = false;      // Filter depth over time before colorizing it
+    bool spatial = false;       // Smooth depth within each frame, keeping its edges, before colorizing it
+    int fillHoles = -1;         // HoleFillMode to fill depth holes with before colorizing, -1 for none
+    std::string publish;        // Stream the newest images of every enabled stream here, "-" for stdout
+    bool zeroCopy = false;      // Share DSAPI's capture buffers instead of copying frames
+    int ringCapacity = 8;
+    int cpu = -1;               // Pin the grab thread to this CPU
+    int workers = 0;            // Processing threads, 0 for one per hardware thread
+    int inFlight = 2;           // Frame sets the processing stages work on at once
+    double duration = 0;        // Seconds to run, 0 for no limit
+    uint64_t frames = 0;        // Frames to grab, 0 for no limit
+    bool benchmark = false;
+    std::string trace;          // Write a Chrome trace here on exit
+    bool quiet = false;
+};
+
+static std::atomic<bool> g_stop(false);
+
+static void OnSignal(int)
+{
+    g_stop.store(true);
+}
+
+// Thread CPU time in nanoseconds
+static int64_t GetThreadCpuTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t GetProcessCpuTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Holes of the depth frames seen by the hole filling, and how many it filled
+static std::atomic<uint64_t> g_depthHoles(0), g_filledHoles(0);
+
+// CPU time spent in one stage, summed over every thread that runs it
+struct StageCpu
+{
+    const char * name;
+    std::atomic<int64_t> cpu;
+    std::atomic<uint64_t> runs;
+};
+
+static StageCpu g_stages[] = {{"filter depth", {0}, {0}}, {"colorize depth", {0}, {0}}, {"convert left/right", {0}, {0}}, {"convert third", {0}, {0}},
+                              {"publish", {0}, {0}}};
+enum
+{
+    STAGE_FILTER,
+    STAGE_COLORIZE,
+    STAGE_CONVERT_LR,
+    STAGE_CONVERT_THIRD,
+    STAGE_PUBLISH,
+    STAGE_COUNT
+};
+
+class CpuScope
+{
+    StageCpu & stage;
+    int64_t begin;
+
+public:
+    explicit CpuScope(StageCpu & stage)
+        : stage(stage)
+        , begin(GetThreadCpuTime())
+    {
+    }
+    ~CpuScope()
+    {
+        stage.cpu.fetch_add(GetThreadCpuTime() - begin, std::memory_order_relaxed);
+        stage.runs.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+static bool ParsePixelFormat(std::string name, DSPixelFormat & format)
+{
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    if (name.compare(0, 3, "DS_") != 0) name = "DS_" + name;
+    for (int i = DS_LUMINANCE8; i <= DS_NATIVE_RAW10; ++i)
+    {
+        if (name == DSPixelFormatString(static_cast<DSPixelFormat>(i)))
+        {
+            format = static_cast<DSPixelFormat>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parses WIDTHxHEIGHT@FPS
+static bool ParseMode(const std::string & mode, int & width, int & height, int & fps)
+{
+    return sscanf(mode.c_str(), "%dx%d@%d", &width, &height, &fps) == 3;
+}
+
+static bool ParseBool(const std::string & value, bool & out)
+{
+    if (value == "1" || value == "true" || value == "yes" || value == "on")
+        out = true;
+    else if (value == "0" || value == "false" || value == "no" || value == "off")
+        out = false;
+    else
+        return false;
+    return true;
+}
+
+static bool LoadConfig(const std::string & path, Options & options);
+
+// Applies one option, given as on the command line without the leading dashes. Flags take an optional boolean value.
+static bool SetOption(Options & options, const std::string & key, const std::string & value, bool hasValue)
+{
+    bool flag = true;
+    if (!hasValue || ParseBool(value, flag))
+    {
+        if (key == "loop") return options.loop = flag, true;
+        if (key == "configure") return options.configure = flag, true;
+        if (key == "z") return options.z = flag, true;
+        if (key == "left") return options.left = flag, true;
+        if (key == "right") return options.right = flag, true;
+        if (key == "third") return options.third = flag, true;
+        if (key == "rectified") return options.rectified = flag, true;
+        if (key == "crop") return options.crop = flag, true;
+        if (key == "third-rectified") return options.thirdRectified = flag, true;
+        if (key == "auto-exposure") return options.autoExposure = flag, true;
+        if (key == "process") return options.process = flag, true;
+        if (key == "temporal") return options.temporal = flag, true;
+        if (key == "spatial") return options.spatial = flag, true;
+        if (key == "zero-copy") return options.zeroCopy = flag, true;
+        if (key == "benchmark") return options.benchmark = flag, true;
+        if (key == "quiet") return options.quiet = flag, true;
+    }
+    if (!hasValue) return false;
+
+    if (key == "config") return LoadConfig(value, options);
+    if (key == "file")
+    {
+        options.file = value;
+        options.configure = false;
+        return true;
+    }
+    if (key == "serial") return options.serial = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 0)), true;
+    if (key == "lrz-mode") return ParseMode(value, options.zWidth, options.zHeight, options.lrzFps);
+    if (key == "lr-format") return ParsePixelFormat(value, options.lrFormat);
+    if (key == "third-mode") return ParseMode(value, options.thirdWidth, options.thirdHeight, options.thirdFps);
+    if (key == "third-format") return ParsePixelFormat(value, options.thirdFormat);
+    if (key == "record") return options.record = value, true;
+    if (key == "record-every") return (options.recordEvery = atoi(value.c_str())) > 0;
+    if (key == "publish") return options.publish = value, true;
+    if (key == "ring") return (options.ringCapacity = atoi(value.c_str())) > 0;
+    if (key == "cpu") return options.cpu = atoi(value.c_str()), true;
+    if (key == "workers") return (options.workers = atoi(value.c_str())) >= 0;
+    if (key == "in-flight") return (options.inFlight = atoi(value.c_str())) > 0;
+    if (key == "duration") return (options.duration = atof(value.c_str())) >= 0;
+    if (key == "frames") return options.frames = strtoull(value.c_str(), nullptr, 10), true;
+    if (key == "trace") return options.trace = value, true;
+    if (key == "fill-holes")
+    {
+        const char * const modes[] = {"left", "farthest", "nearest"};
+        for (int mode = HOLE_FILL_LEFT; mode <= HOLE_FILL_NEAREST; ++mode)
+            if (value == modes[mode]) return options.fillHoles = mode, true;
+        return false;
+    }
+    return false;
+}
+
+// Config files hold one "key = value" (or bare "key" for a flag) per line, with the same keys as the command line. '#' starts a comment.
+static bool LoadConfig(const std::string & path, Options & options)
+{
+    std::ifstream in(path.c_str());
+    if (!in)
+    {
+        std::cerr << "Cannot open config file " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(in, line); ++number)
+    {
+        line = line.substr(0, line.find('#'));
+        const size_t equals = line.find('=');
+        std::string key = line.substr(0, equals), value = equals == std::string::npos ? "" : line.substr(equals + 1);
+        key.erase(0, key.find_first_not_of(" \t\r"));
+        key.erase(key.find_last_not_of(" \t\r") + 1);
+        value.erase(0, value.find_first_not_of(" \t\r"));
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+        if (key.empty()) continue;
+        if (!SetOption(options, key, value, equals != std::string::npos))
+        {
+            std::cerr << path << ":" << number << ": invalid option '" << line << "'" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static void PrintUsage(const char * program)
+{
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --config=FILE             Read options from FILE (key = value per line)\n"
+              << "  --file=DIR                Play back a recording made with DSAPI instead of using a camera\n"
+              << "  --loop                    Loop the recording\n"
+              << "  --configure               Apply the stream options below to a recording too\n"
+              << "  --serial=N                Open the camera with this serial number\n"
+              << "  --z, --left, --right, --third[=true|false]   Streams to enable (default: Z only)\n"
+              << "  --lrz-mode=WxH@FPS        Left/right/Z mode (default 628x468@30)\n"
+              << "  --lr-format=FORMAT        Left/right pixel format, e.g. LUMINANCE8, NATIVE_RL_LUMINANCE8\n"
+              << "  --rectified, --crop       Rectify / crop left/right (default on)\n"
+              << "  --third-mode=WxH@FPS      Third mode (default 640x480@30)\n"
+              << "  --third-format=FORMAT     Third pixel format, e.g. RGB8, NATIVE_YUY2\n"
+              << "  --auto-exposure           Left/right auto exposure (default on)\n"
+              << "  --record=DIR              Record with DSAPI's recorder\n"
+              << "  --record-every=N          Record one out of every N frames\n"
+              << "  --process                 Run the processing stage (default on)\n"
+              << "  --temporal                Filter depth over time before colorizing it\n"
+              << "  --spatial                 Smooth depth within each frame, keeping its edges, before colorizing it\n"
+              << "  --fill-holes=MODE         Fill depth holes before colorizing: left, farthest or nearest\n"
+              << "  --publish=PATH            Stream the newest Z/left/right/third images to PATH (file or FIFO, - for stdout)\n"
+              << "  --zero-copy               Share DSAPI's capture buffers instead of copying frames\n"
+              << "  --ring=N                  Frames the capture ring holds (default 8)\n"
+              << "  --cpu=N                   Pin the grab thread to CPU N\n"
+              << "  --workers=N               Processing threads (default: one per hardware thread)\n"
+              << "  --in-flight=N             Frame sets processed at once (default 2, must be below --ring)\n"
+              << "  --duration=SECONDS        Stop after this long\n"
+              << "  --frames=N                Stop after this many grabs\n"
+              << "  --benchmark               Report FPS, CPU time per stage and drop rates on exit\n"
+              << "  --trace=FILE              Write a Chrome trace of every stage on exit\n"
+              << "  --quiet                   No periodic status lines\n";
+}
+
+static bool Check(DSAPI & ds, bool ok, const char * what)
+{
+    if (!ok) std::cerr << what << " failed: " << DSStatusString(ds.getLastErrorStatus()) << ": " << ds.getLastErrorDescription() << std::endl;
+    return ok;
+}
+
+// The conversions the GL samples run before display, as independent stages of a FramePipeline. None of them keeps state between frames,
+// so they are unordered and may run on several frames at once, each writing into the buffers of its frame's pipeline slot. The exception
+// is the temporal filter, which needs every frame in order and so makes the depth filter stage that colorizing waits for an ordered one.
+class Processor
+{
+    struct Outputs
+    {
+        std::vector<uint16_t> depth, unfilled;
+        std::vector<uint8_t> depthRGB, left, right, third;
+    };
+    std::vector<Outputs> outputs;
+    int maxLRBits;
+    std::unique_ptr<TemporalDepthFilter> temporal;
+    bool spatial, fillHoles;
+    SpatialFilterOptions spatialOptions;
+    HoleFillOptions fillOptions;
+
+    void FilterDepth(const FrameSet & frame, int slot)
+    {
+        if (!frame.z.valid()) return;
+        CpuScope cpu(g_stages[STAGE_FILTER]);
+        std::vector<uint16_t> & depth = outputs[slot].depth;
+        depth.resize(frame.z.width * frame.z.height);
+        const uint16_t * source = frame.z.dataAs<uint16_t>();
+        int sourceStride = frame.z.stride;
+        if (temporal)
+        {
+            if (temporal->Width() != frame.z.width || temporal->Height() != frame.z.height) temporal->Resize(frame.z.width, frame.z.height);
+            temporal->Filter(source, sourceStride, depth.data(), frame.z.width * 2);
+            source = depth.data();
+            sourceStride = frame.z.width * 2;
+        }
+        if (spatial)
+        {
+            FilterDepthSpatial(source, frame.z.width, frame.z.height, sourceStride, depth.data(), frame.z.width * 2, spatialOptions);
+            source = depth.data();
+            sourceStride = frame.z.width * 2;
+        }
+        if (fillHoles)
+        {
+            // The holes are filled from another image than the one they go to
+            std::vector<uint16_t> & unfilled = outputs[slot].unfilled;
+            if (source == depth.data())
+            {
+                unfilled.swap(depth);
+                depth.resize(frame.z.width * frame.z.height);
+                source = unfilled.data();
+            }
+            const HoleFillStats stats = FillDepthHoles(source, frame.z.width, frame.z.height, sourceStride, depth.data(), frame.z.width * 2, fillOptions);
+            g_depthHoles.fetch_add(stats.holes, std::memory_order_relaxed);
+            g_filledHoles.fetch_add(stats.filled, std::memory_order_relaxed);
+        }
+    }
+
+    void ColorizeDepth(const FrameSet & frame, int slot)
+    {
+        if (!frame.z.valid()) return;
+        CpuScope cpu(g_stages[STAGE_COLORIZE]);
+        const uint8_t nearColor[] = {255, 0, 0}, farColor[] = {20, 40, 255};
+        std::vector<uint8_t> & depthRGB = outputs[slot].depthRGB;
+        depthRGB.resize(frame.z.width * frame.z.height * 3);
+        const uint16_t * depth = temporal || spatial || fillHoles ? outputs[slot].depth.data() : frame.z.dataAs<uint16_t>();
+        ConvertDepthToRGBUsingHistogram(depth, frame.z.width, frame.z.height, nearColor, farColor, depthRGB.data());
+    }
+
+    void ConvertLeftRight(const FrameSet & frame, int slot)
+    {
+        if (!frame.left.valid() || !IsInterleavedLRFormat(frame.left.format)) return;
+        CpuScope cpu(g_stages[STAGE_CONVERT_LR]);
+        const FrameImage & lr = frame.left;
+        std::vector<uint8_t> & left = outputs[slot].left, & right = outputs[slot].right;
+        left.resize(lr.width * lr.height);
+        right.resize(lr.width * lr.height);
+        if (lr.format == DS_NATIVE_RL_LUMINANCE8)
+            ConvertRLLuminance8ToLuminance8(lr.data(), lr.width, lr.height, left.data(), right.data());
+        else if (lr.format == DS_NATIVE_RL_LUMINANCE12)
+            ConvertRLLuminance12ToLuminance8(lr.data(), lr.width, lr.height, maxLRBits - 8, left.data(), right.data());
+        else
+            ConvertRLLuminance16ToLuminance8(lr.data(), lr.width, lr.height, maxLRBits - 8, left.data(), right.data());
+    }
+
+    void ConvertThird(const FrameSet & frame, int slot)
+    {
+        if (!frame.third.valid() || (frame.third.format != DS_NATIVE_YUY2 && frame.third.format != DS_NATIVE_RAW10)) return;
+        CpuScope cpu(g_stages[STAGE_CONVERT_THIRD]);
+        std::vector<uint8_t> & third = outputs[slot].third;
+        third.resize(frame.third.width * frame.third.height * 4);
+        if (frame.third.format == DS_NATIVE_YUY2)
+            ConvertYUY2ToBGRA8(frame.third.data(), frame.third.width, frame.third.height, frame.third.stride, third.data(), frame.third.width * 4);
+        else
+            ConvertRaw10ToBGRA8(frame.third.data(), frame.third.width, frame.third.height, frame.third.stride, third.data(), frame.third.width * 4);
+    }
+
+public:
+    // zUnits is DSAPI::getZUnits(), which the spatial filter's threshold in millimetres is converted with
+    Processor(FramePipeline & pipeline, const Options & options, int maxLRBits, int zUnits)
+        : outputs(pipeline.MaxInFlight())
+        , maxLRBits(maxLRBits)
+        , spatial(options.spatial)
+        , fillHoles(options.fillHoles >= 0)
+    {
+        using namespace std::placeholders;
+        spatialOptions.zUnits = zUnits;
+        if (fillHoles) fillOptions.mode = static_cast<HoleFillMode>(options.fillHoles);
+        if (options.temporal) temporal.reset(new TemporalDepthFilter(0, 0));
+        std::vector<int> colorizeAfter;
+        if (options.temporal || spatial || fillHoles)
+            colorizeAfter.push_back(pipeline.AddStage("filter depth", std::bind(&Processor::FilterDepth, this, _1, _2), std::vector<int>(), options.temporal));
+        pipeline.AddStage("colorize depth", std::bind(&Processor::ColorizeDepth, this, _1, _2), colorizeAfter, false);
+        pipeline.AddStage("convert left/right", std::bind(&Processor::ConvertLeftRight, this, _1, _2), std::vector<int>(), false);
+        pipeline.AddStage("convert third", std::bind(&Processor::ConvertThird, this, _1, _2), std::vector<int>(), false);
+    }
+};
+
+// Feeds every frame set in order to the pipeline, waiting while it is full. If that falls behind the camera, the ring recycles frames
+// under the reader and it counts them as dropped.
+static void RunProcessing(CaptureEngine & engine, FrameSetReader & reader, FramePipeline & pipeline)
+{
+    Tracer::SetThreadName("process");
+    const int notifier = engine.AcquireNotifier();
+    while (!g_stop.load() && engine.IsRunning())
+    {
+        uint64_t count;
+        if (notifier >= 0 && read(engine.NotifierFd(notifier), &count, sizeof(count)) < 0 && errno != EAGAIN) break;
+
+        while (FrameSetHandle frame = reader.Pop())
+            pipeline.Submit(std::move(frame));
+
+        if (notifier >= 0)
+        {
+            pollfd pfd = {engine.NotifierFd(notifier), POLLIN, 0};
+            poll(&pfd, 1, 100);
+        }
+        else
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    engine.ReleaseNotifier(notifier);
+}
+
+// Streams a published image can come from
+enum PublishedStream
+{
+    PUBLISHED_Z,
+    PUBLISHED_LEFT,
+    PUBLISHED_RIGHT,
+    PUBLISHED_THIRD
+};
+
+// Header written before every published image, followed by height rows of stride bytes in the given DSPixelFormat. The images of one
+// frame set follow each other in PublishedStream order, all with its frame number.
+struct PublishedFrameHeader
+{
+    char magic[4];       // "R2F2"
+    int32_t stream;      // PublishedStream
+    int32_t format;      // DSPixelFormat
+    int32_t frameNumber; // DSThird::getThirdFrameNumber() for the third stream
+    int32_t width, height, stride;
+    int32_t zUnits;      // DSAPI::getZUnits() for the Z stream, 0 for the others
+    double frameTime;    // DSAPI::getFrameTime(false), or DSThird::getThirdFrameTime(false) for the third stream
+    int64_t hostTime;
+};
+
+static bool WriteAll(int fd, const void * data, size_t size)
+{
+    const uint8_t * p = static_cast<const uint8_t *>(data);
+    for (size_t done = 0; done < size;)
+    {
+        const ssize_t n = write(fd, p + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+static bool PublishImage(int fd, PublishedStream stream, const FrameImage & image, int frameNumber, double frameTime, int64_t hostTime, int zUnits)
+{
+    if (!image.valid()) return true;
+    PublishedFrameHeader header;
+    memcpy(header.magic, "R2F2", 4);
+    header.stream = stream;
+    header.format = image.format;
+    header.frameNumber = frameNumber;
+    header.width = image.width;
+    header.height = image.height;
+    header.stride = image.stride;
+    header.zUnits = stream == PUBLISHED_Z ? zUnits : 0;
+    header.frameTime = frameTime;
+    header.hostTime = hostTime;
+    return WriteAll(fd, &header, sizeof(header)) && WriteAll(fd, image.pixels, static_cast<size_t>(image.stride) * image.height);
+}
+
+// Streams the newest frame set whenever the destination is ready for one, skipping whatever arrived in between. The destination is a
+// raw stream rather than ROS topics so that the tool runs on the robot with no ROS master, like the other samples of this package, which
+// do not use roscpp either; a node can relay it as sensor_msgs/Image from the header fields.
+static void RunPublishing(PollableGrabber & grabber, int fd, int zUnits)
+{
+    Tracer::SetThreadName("publish");
+    while (!g_stop.load())
+    {
+        FrameSetHandle frame;
+        const GrabResult result = grabber.grabFor(frame, std::chrono::milliseconds(100));
+        if (result == GRAB_STOPPED) break;
+        if (result == GRAB_STALLED && !g_stop.load()) std::cerr << "No frames for " << grabber.GetSecondsSinceLastFrame() << " s" << std::endl;
+        if (result != GRAB_FRAME) continue;
+
+        CpuScope cpu(g_stages[STAGE_PUBLISH]);
+        TRACE_SCOPE_ARG("publish", frame->frameNumber);
+        if (!PublishImage(fd, PUBLISHED_Z, frame->z, frame->frameNumber, frame->frameTime, frame->hostTime, zUnits) ||
+            !PublishImage(fd, PUBLISHED_LEFT, frame->left, frame->frameNumber, frame->frameTime, frame->hostTime, zUnits) ||
+            !PublishImage(fd, PUBLISHED_RIGHT, frame->right, frame->frameNumber, frame->frameTime, frame->hostTime, zUnits) ||
+            !PublishImage(fd, PUBLISHED_THIRD, frame->third, frame->thirdFrameNumber, frame->thirdFrameTime, frame->hostTime, zUnits))
+        {
+            std::cerr << "Publishing failed: " << strerror(errno) << std::endl;
+            return;
+        }
+    }
+}
+
+static bool Configure(DSAPI & ds, const Options & options)
+{
+    if (options.configure)
+    {
+        if (!Check(ds, ds.enableZ(options.z), "enableZ") || !Check(ds, ds.enableLeft(options.left), "enableLeft") || !Check(ds, ds.enableRight(options.right), "enableRight"))
+            return false;
+        if ((options.z || options.left || options.right) && !Check(ds, ds.setLRZResolutionMode(options.rectified, options.zWidth, options.zHeight, options.lrzFps, options.lrFormat), "setLRZResolutionMode"))
+            return false;
+        if ((options.left || options.right) && options.z && !Check(ds, ds.enableLRCrop(options.crop), "enableLRCrop")) return false;
+
+        if (DSThird * third = ds.accessThird())
+        {
+            if (!Check(ds, third->enableThird(options.third), "enableThird")) return false;
+            if (options.third && !Check(ds, third->setThirdResolutionMode(options.thirdRectified, options.thirdWidth, options.thirdHeight, options.thirdFps, options.thirdFormat), "setThirdResolutionMode"))
+                return false;
+        }
+        else if (options.third)
+        {
+            std::cerr << "This camera has no third imager" << std::endl;
+            return false;
+        }
+    }
+
+    if (DSHardware * hardware = ds.accessHardware()) hardware->setAutoExposure(DS_BOTH_IMAGERS, options.autoExposure);
+
+    if (!options.record.empty())
+    {
+        ds.setRecordingFilePath(options.record.c_str());
+        ds.startRecordingToFile(true, options.recordEvery);
+    }
+    return true;
+}
+
+// Readers the capture engine can have at once: processing and publishing, with room to spare
+static const int g_maxReaders = 4;
+
+// Capture buffers DSAPI keeps per stream beyond the one the application sees, which it does not report: a guess on the safe side
+static const int g_dsapiBuffersPerStream = 4;
+
+// Enough buffers of the largest configured image for every frame set the ring, its readers and the processing stages can hold, as
+// CaptureEngine::SetBufferPool() asks, plus what DSAPI keeps in flight, for each enabled stream
+static BufferPoolOptions MakePoolOptions(DSAPI & ds, const Options & options)
+{
+    size_t largest = 0;
+    int streams = 0;
+    if (ds.isZEnabled())
+    {
+        largest = std::max(largest, static_cast<size_t>(ds.zWidth()) * ds.zHeight() * 2);
+        ++streams;
+    }
+    const DSPixelFormat lrFormat = ds.getLRPixelFormat();
+    const size_t lrSize = static_cast<size_t>(GetRowBytes(lrFormat, ds.lrWidth())) * ds.lrHeight();
+    if (ds.isLeftEnabled())
+    {
+        largest = std::max(largest, lrSize);
+        ++streams;
+    }
+    if (ds.isRightEnabled() && !IsInterleavedLRFormat(lrFormat))
+    {
+        largest = std::max(largest, lrSize);
+        ++streams;
+    }
+    DSThird * third = ds.accessThird();
+    if (third && third->isThirdEnabled())
+    {
+        largest = std::max(largest, static_cast<size_t>(GetRowBytes(third->getThirdPixelFormat(), third->thirdWidth())) * third->thirdHeight());
+        ++streams;
+    }
+
+    const int frameSets = options.ringCapacity + g_maxReaders + 1 + (options.process ? options.inFlight : 0);
+    BufferPoolOptions poolOptions;
+    poolOptions.bufferCount = std::max(1, streams) * (frameSets + g_dsapiBuffersPerStream);
+    if (largest) poolOptions.bufferSize = largest;
+    return poolOptions;
+}
+
+static void PrintPacing(const char * stream, const PacingStats & pacing)
+{
+    const uint64_t expected = pacing.frames + pacing.dropped;
+    std::cout << "  " << stream << ": " << pacing.frames << " frames, " << std::setprecision(2) << pacing.framesPerSecond << " FPS, jitter " << pacing.jitter * 1e3
+              << " ms, latency " << pacing.meanLatency * 1e3 << " ms (max " << pacing.maxLatency * 1e3 << " ms), camera drops " << pacing.dropped << " ("
+              << (expected ? 100.0 * pacing.dropped / expected : 0.0) << "%)\n";
+}
+
+static void PrintBenchmark(CaptureEngine & engine, const FrameSetReader * processing, const TaskScheduler * scheduler, const PollableGrabber * publishing,
+                           double seconds, int64_t processCpu, bool third)
+{
+    const uint64_t grabs = engine.GetGrabCount();
+    const FrameRingStats ring = engine.Frames().GetStats();
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "\nBenchmark over " << seconds << " s\n";
+    std::cout << "  Sustained: " << grabs / seconds << " grabs/s (" << grabs << " grabs)\n";
+    PrintPacing("Left/right/Z", engine.GetPacingStats());
+    if (third) PrintPacing("Third", engine.GetThirdPacingStats());
+    std::cout << "  Ring: " << ring.published << " published, " << ring.droppedByPolicy + ring.droppedNoBuffer << " dropped before publishing\n";
+    if (processing)
+        std::cout << "  Processing: " << processing->Delivered() << " processed, " << processing->Dropped() << " dropped ("
+                  << (ring.published ? 100.0 * processing->Dropped() / ring.published : 0.0) << "%)\n";
+    if (scheduler)
+    {
+        const TaskSchedulerStats tasks = scheduler->GetStats();
+        std::cout << "  Workers: " << tasks.workers << ", " << tasks.executed << " stages run, " << tasks.stolen << " stolen\n";
+    }
+    if (publishing) std::cout << "  Publishing: " << g_stages[STAGE_PUBLISH].runs.load() << " published\n";
+    const uint64_t holes = g_depthHoles.load();
+    if (holes) std::cout << "  Hole filling: " << g_filledHoles.load() << " of " << holes << " holes filled (" << 100.0 * g_filledHoles.load() / holes << "%)\n";
+
+    std::cout << "  CPU time per stage (ms per run, % of one core):\n";
+    int64_t stagesCpu = 0;
+    for (int i = 0; i < STAGE_COUNT; ++i)
+    {
+        const int64_t cpu = g_stages[i].cpu.load();
+        const uint64_t runs = g_stages[i].runs.load();
+        stagesCpu += cpu;
+        if (runs) std::cout << "    " << std::left << std::setw(20) << g_stages[i].name << std::right << std::setw(8) << cpu * 1e-6 / runs << " ms " << std::setw(7) << cpu * 1e-7 / seconds << " %\n";
+    }
+    // Everything not attributed to a stage: the grab thread, DSAPI's internal threads and this one
+    const int64_t capture = processCpu - stagesCpu;
+    std::cout << "    " << std::left << std::setw(20) << "capture (rest)" << std::right << std::setw(8) << (grabs ? capture * 1e-6 / grabs : 0.0) << " ms " << std::setw(7)
+              << capture * 1e-7 / seconds << " %\n";
+
+    const std::vector<TraceStageStats> stats = Tracer::GetStageStats();
+    if (!stats.empty())
+    {
+        std::cout << "  Latency per stage (p50 / p95 / p99 / max ms):\n";
+        for (size_t i = 0; i < stats.size(); ++i)
+            std::cout << "    " << std::left << std::setw(20) << stats[i].name << std::right << std::setw(8) << stats[i].p50 * 1e-6 << std::setw(8) << stats[i].p95 * 1e-6
+                      << std::setw(8) << stats[i].p99 * 1e-6 << std::setw(8) << stats[i].max * 1e-6 << "\n";
+    }
+    std::cout << std::flush;
+}
+
+int main(int argc, char * argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+        {
+            PrintUsage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        const size_t equals = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || !SetOption(options, arg.substr(2, equals - 2), equals == std::string::npos ? "" : arg.substr(equals + 1), equals != std::string::npos))
+        {
+            std::cerr << "Invalid argument " << arg << "\n\n";
+            PrintUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // With stdout carrying frames, status goes to stderr
+    std::ostream & status = options.publish == "-" ? std::cerr : std::cout;
+    if (options.publish == "-") options.quiet = true;
+
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    // The pool must outlive DSAPI, which holds its buffers until it is destroyed. It is made once the streams are configured.
+    std::unique_ptr<BufferPool> pool;
+
+    std::shared_ptr<DSAPI> ds(DSCreate(options.file.empty() ? DS_DS4_PLATFORM : DS_DS4_FILE_PLATFORM), DSDestroy);
+    if (!ds)
+    {
+        std::cerr << "DSCreate failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    ds->setLoggingLevelAndFile(DS_LOG_ERROR, "DSHeadlessCapture.log");
+    if (options.file.empty())
+    {
+        if (!Check(*ds, ds->openDevice(options.serial), "openDevice")) return EXIT_FAILURE;
+    }
+    else
+    {
+        ds->accessFile()->setReadFileModeParams(options.file.c_str());
+        ds->accessFile()->enableReadFileModeLoop(options.loop);
+    }
+    if (!Check(*ds, ds->probeConfiguration(), "probeConfiguration") || !Configure(*ds, options)) return EXIT_FAILURE;
+    if (options.zeroCopy)
+    {
+        const BufferPoolOptions poolOptions = MakePoolOptions(*ds, options);
+        pool.reset(new BufferPool(poolOptions));
+        if (!pool->valid())
+        {
+            std::cerr << "Cannot reserve " << poolOptions.bufferCount << " capture buffers of " << poolOptions.bufferSize << " bytes" << std::endl;
+            return EXIT_FAILURE;
+        }
+        pool->Register(*ds);
+    }
+
+    if (!Check(*ds, ds->startCapture(), "startCapture"))
+    {
+        if (pool && pool->GetStats().largestRequest > static_cast<int>(pool->BufferSize()))
+            std::cerr << "DSAPI asked for buffers of " << pool->GetStats().largestRequest << " bytes, the pool has " << pool->BufferSize() << std::endl;
+        return EXIT_FAILURE;
+    }
+    DSThird * third = ds->accessThird();
+    const bool thirdEnabled = third && third->isThirdEnabled();
+    status << "Capturing" << (ds->isZEnabled() ? " Z" : "") << (ds->isLeftEnabled() ? " left" : "") << (ds->isRightEnabled() ? " right" : "") << (thirdEnabled ? " third" : "")
+           << " at " << ds->getLRZFramerate() << " FPS" << std::endl;
+
+    Tracer::Enable(options.benchmark || !options.trace.empty());
+    Tracer::SetThreadName("main");
+
+    CaptureEngine engine(*ds, options.ringCapacity, g_maxReaders);
+    engine.SetCpuAffinity(options.cpu);
+    if (pool) engine.SetBufferPool(pool.get());
+
+    std::unique_ptr<FrameSetReader> processing;
+    std::unique_ptr<TaskScheduler> scheduler;
+    std::unique_ptr<FramePipeline> pipeline;
+    std::unique_ptr<Processor> processor;
+    if (options.process)
+    {
+        if (options.inFlight >= options.ringCapacity)
+        {
+            std::cerr << "--in-flight must be below --ring" << std::endl;
+            return EXIT_FAILURE;
+        }
+        processing.reset(new FrameSetReader(engine.Frames()));
+        scheduler.reset(new TaskScheduler(options.workers));
+        pipeline.reset(new FramePipeline(*scheduler, options.inFlight));
+        processor.reset(new Processor(*pipeline, options, ds->maxLRBits(), ds->getZUnits()));
+    }
+
+    int publishFd = -1;
+    std::unique_ptr<PollableGrabber> publishing;
+    if (!options.publish.empty())
+    {
+        publishFd = options.publish == "-" ? STDOUT_FILENO : open(options.publish.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (publishFd < 0)
+        {
+            std::cerr << "Cannot open " << options.publish << ": " << strerror(errno) << std::endl;
+            return EXIT_FAILURE;
+        }
+        publishing.reset(new PollableGrabber(engine));
+    }
+
+    const int64_t startTime = GetHostTime(), startCpu = GetProcessCpuTime();
+    if (!engine.Start()) return EXIT_FAILURE;
+
+    std::thread processingThread, publishingThread;
+    if (processing) processingThread = std::thread(RunProcessing, std::ref(engine), std::ref(*processing), std::ref(*pipeline));
+    if (publishing) publishingThread = std::thread(RunPublishing, std::ref(*publishing), publishFd, ds->getZUnits());
+
+    int64_t lastReport = startTime;
+    while (!g_stop.load() && engine.IsRunning())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        const int64_t now = GetHostTime();
+        if (options.duration > 0 && (now - startTime) * 1e-9 >= options.duration) break;
+        if (options.frames && engine.GetGrabCount() >= options.frames) break;
+        if (!options.quiet && now - lastReport >= 1000000000)
+        {
+            const PacingStats pacing = engine.GetPacingStats();
+            status << std::fixed << std::setprecision(1) << "Frame " << pacing.frames << ": " << pacing.framesPerSecond << " FPS, jitter " << pacing.jitter * 1e3
+                   << " ms, dropped " << pacing.dropped << std::endl;
+            lastReport = now;
+        }
+    }
+
+    const double seconds = (GetHostTime() - startTime) * 1e-9;
+    g_stop.store(true);
+    engine.Stop();
+    if (processingThread.joinable()) processingThread.join();
+    if (publishingThread.joinable()) publishingThread.join();
+    if (pipeline) pipeline->Flush();
+    const int64_t processCpu = GetProcessCpuTime() - startCpu;
+    if (publishFd >= 0 && publishFd != STDOUT_FILENO) close(publishFd);
+
+    if (!engine.IsRunning() && engine.GetLastGrabStatus() != DS_NO_ERROR)
+        std::cerr << "grab failed: " << DSStatusString(engine.GetLastGrabStatus()) << ": " << ds->getLastErrorDescription() << std::endl;
+
+    if (!options.record.empty()) ds->stopRecordingToFile();
+    ds->stopCapture();
+
+    if (options.benchmark) PrintBenchmark(engine, processing.get(), scheduler.get(), publishing.get(), seconds, processCpu, thirdEnabled);
+    if (!options.trace.empty() && !Tracer::WriteChromeTrace(options.trace.c_str())) std::cerr << "Could not write trace to " << options.trace << std::endl;
+
+    return engine.GetLastGrabStatus() == DS_NO_ERROR ? EXIT_SUCCESS : EXIT_FAILURE;
+}
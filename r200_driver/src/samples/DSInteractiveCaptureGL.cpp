@@ -10,12 +10,18 @@ Copyright(c) 2014-2015 Intel Corporation. All Rights Reserved.
 
 #include <r200_driver/DSAPI.h>
 #include <r200_driver/Common.h>
+#include <r200_driver/CaptureEngine.h>
+#include <r200_driver/ColorConversion.h>
+#include <r200_driver/Demosaic.h>
+#include <r200_driver/ImageConversion.h>
 #include <cctype>
 #include <algorithm>
 #include <sstream>
 #include <string>
 #include <memory>
 #include <map>
+#include <chrono>
+#include <thread>
 #include <stdio.h>
 
 #ifndef _WIN32
@@ -28,12 +34,16 @@ Copyright(c) 2014-2015 Intel Corporation. All Rights Reserved.
 
 static std::shared_ptr<DSAPI> g_dsapi;
 
+/// Grabs on its own thread so that drawing never stalls the camera. Declared after g_dsapi so that it is stopped before DSAPI is destroyed.
+static std::unique_ptr<CaptureEngine> g_engine;
+static std::unique_ptr<FrameSetReader> g_display;
+static FrameSetHandle g_frame; // The frame set currently on screen
+
 DSFile * g_file;
 DSThird * g_third;
 DSHardware * g_hardware;
 bool g_paused, g_showOverlay = true, g_showImages = true, g_stopped = true;
 GlutWindow g_depthWindow, g_leftWindow, g_rightWindow, g_thirdWindow; // Windows where we will display depth, left, right, third images
-Timer g_timer, g_thirdTimer;
 bool g_useAutoExposure;
 float g_exposure, g_gain;
 // min and max values are reset from the camera after startCapture.
@@ -42,6 +52,7 @@ float g_maxExposure = 7.0f;
 float g_minGain = 1.0f;
 float g_maxGain = 64.0f;
 int g_lastThirdFrame;
+int g_maxLRBits;
 
 uint8_t g_zImageRGB[640 * 480 * 3];
 uint8_t g_leftImage[640 * 480], g_rightImage[640 * 480];
@@ -52,62 +63,90 @@ __declspec(align(16)) uint8_t g_thirdImage[1920 * 1080 * 4];
 uint8_t g_thirdImage alignas(16)[1920 * 1080 * 4];
 #endif
 
-void DrawGLImage(GlutWindow & window, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid * pixels, GLfloat multiplier);
+void DrawGLImage(GlutWindow & window, GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid * pixels, GLfloat multiplier);
 
 void OnIdle()
 {
     if (g_stopped)
         return;
 
+    DS_CHECK_ERRORS(g_engine->IsRunning());
+
+    // Frames are grabbed on the capture engine's thread, here we just pick up the newest one
     if (!g_paused)
     {
-        DS_CHECK_ERRORS(g_dsapi->grab());
+        if (FrameSetHandle frame = g_display->PopLatest())
+        {
+            g_frame = std::move(frame);
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return;
+        }
     }
+    if (!g_frame)
+        return;
+    const FrameSet & frame = *g_frame;
+    TRACE_SCOPE_ARG("display", frame.frameNumber);
 
     if (g_showImages)
     {
         // Display Z image, if it is enabled
-        if (g_dsapi->isZEnabled())
+        if (frame.z.valid())
         {
             const uint8_t nearColor[] = {255, 0, 0}, farColor[] = {20, 40, 255};
-            ConvertDepthToRGBUsingHistogram(g_dsapi->getZImage(), g_dsapi->zWidth(), g_dsapi->zHeight(), nearColor, farColor, g_zImageRGB);
-            DrawGLImage(g_depthWindow, g_dsapi->zWidth(), g_dsapi->zHeight(), GL_RGB, GL_UNSIGNED_BYTE, g_zImageRGB, 1);
+            {
+                TRACE_SCOPE("colorize depth");
+                ConvertDepthToRGBUsingHistogram(frame.z.dataAs<uint16_t>(), frame.z.width, frame.z.height, nearColor, farColor, g_zImageRGB);
+            }
+            DrawGLImage(g_depthWindow, frame.z.width, frame.z.height, GL_RGB, GL_UNSIGNED_BYTE, g_zImageRGB, 1);
         }
 
         // Display left/right images, if they are enabled
-        if (g_dsapi->isLeftEnabled() || g_dsapi->isRightEnabled())
+        if (frame.left.valid() || frame.right.valid())
         {
-            float multiplier = static_cast<float>(1 << (16 - g_dsapi->maxLRBits()));
-            switch (g_dsapi->getLRPixelFormat())
+            const FrameImage & lr = frame.left.valid() ? frame.left : frame.right;
+            float multiplier = static_cast<float>(1 << (16 - g_maxLRBits));
+            switch (lr.format)
             {
             case DS_LUMINANCE8:
-                if (g_dsapi->isLeftEnabled()) DrawGLImage(g_leftWindow, g_dsapi->lrWidth(), g_dsapi->lrHeight(), GL_LUMINANCE, GL_UNSIGNED_BYTE, g_dsapi->getLImage(), 1);
-                if (g_dsapi->isRightEnabled()) DrawGLImage(g_rightWindow, g_dsapi->lrWidth(), g_dsapi->lrHeight(), GL_LUMINANCE, GL_UNSIGNED_BYTE, g_dsapi->getRImage(), 1);
+                if (frame.left.valid()) DrawGLImage(g_leftWindow, lr.width, lr.height, GL_LUMINANCE, GL_UNSIGNED_BYTE, frame.left.data(), 1);
+                if (frame.right.valid()) DrawGLImage(g_rightWindow, lr.width, lr.height, GL_LUMINANCE, GL_UNSIGNED_BYTE, frame.right.data(), 1);
                 break;
             case DS_LUMINANCE16:
-                if (g_dsapi->isLeftEnabled()) DrawGLImage(g_leftWindow, g_dsapi->lrWidth(), g_dsapi->lrHeight(), GL_LUMINANCE, GL_UNSIGNED_SHORT, g_dsapi->getLImage(), multiplier);
-                if (g_dsapi->isRightEnabled()) DrawGLImage(g_rightWindow, g_dsapi->lrWidth(), g_dsapi->lrHeight(), GL_LUMINANCE, GL_UNSIGNED_SHORT, g_dsapi->getRImage(), multiplier);
+                if (frame.left.valid()) DrawGLImage(g_leftWindow, lr.width, lr.height, GL_LUMINANCE, GL_UNSIGNED_SHORT, frame.left.data(), multiplier);
+                if (frame.right.valid()) DrawGLImage(g_rightWindow, lr.width, lr.height, GL_LUMINANCE, GL_UNSIGNED_SHORT, frame.right.data(), multiplier);
                 break;
             case DS_NATIVE_L_LUMINANCE8:
-                if (g_dsapi->isLeftEnabled()) DrawGLImage(g_leftWindow, g_dsapi->lrWidth(), g_dsapi->lrHeight(), GL_LUMINANCE, GL_UNSIGNED_BYTE, g_dsapi->getLImage(), 1);
+                if (frame.left.valid()) DrawGLImage(g_leftWindow, lr.width, lr.height, GL_LUMINANCE, GL_UNSIGNED_BYTE, frame.left.data(), 1);
                 break;
             case DS_NATIVE_L_LUMINANCE16:
-                if (g_dsapi->isLeftEnabled()) DrawGLImage(g_leftWindow, g_dsapi->lrWidth(), g_dsapi->lrHeight(), GL_LUMINANCE, GL_UNSIGNED_SHORT, g_dsapi->getLImage(), multiplier);
+                if (frame.left.valid()) DrawGLImage(g_leftWindow, lr.width, lr.height, GL_LUMINANCE, GL_UNSIGNED_SHORT, frame.left.data(), multiplier);
                 break;
             case DS_NATIVE_RL_LUMINANCE8:
-                DSConvertRLLuminance8ToLuminance8(g_dsapi->getLImage(), g_dsapi->lrWidth(), g_dsapi->lrHeight(), g_leftImage, g_rightImage);
-                if (g_dsapi->isLeftEnabled()) DrawGLImage(g_leftWindow, g_dsapi->lrWidth(), g_dsapi->lrHeight(), GL_LUMINANCE, GL_UNSIGNED_BYTE, g_leftImage, 1);
-                if (g_dsapi->isRightEnabled()) DrawGLImage(g_rightWindow, g_dsapi->lrWidth(), g_dsapi->lrHeight(), GL_LUMINANCE, GL_UNSIGNED_BYTE, g_rightImage, 1);
+                {
+                    TRACE_SCOPE("convert left/right");
+                    ConvertRLLuminance8ToLuminance8(lr.data(), lr.width, lr.height, g_leftImage, g_rightImage);
+                }
+                if (g_dsapi->isLeftEnabled()) DrawGLImage(g_leftWindow, lr.width, lr.height, GL_LUMINANCE, GL_UNSIGNED_BYTE, g_leftImage, 1);
+                if (g_dsapi->isRightEnabled()) DrawGLImage(g_rightWindow, lr.width, lr.height, GL_LUMINANCE, GL_UNSIGNED_BYTE, g_rightImage, 1);
                 break;
             case DS_NATIVE_RL_LUMINANCE12:
-                DSConvertRLLuminance12ToLuminance8(g_dsapi->getLImage(), g_dsapi->lrWidth(), g_dsapi->lrHeight(), g_dsapi->maxLRBits() - 8, g_leftImage, g_rightImage);
-                if (g_dsapi->isLeftEnabled()) DrawGLImage(g_leftWindow, g_dsapi->lrWidth(), g_dsapi->lrHeight(), GL_LUMINANCE, GL_UNSIGNED_BYTE, g_leftImage, 1);
-                if (g_dsapi->isRightEnabled()) DrawGLImage(g_rightWindow, g_dsapi->lrWidth(), g_dsapi->lrHeight(), GL_LUMINANCE, GL_UNSIGNED_BYTE, g_rightImage, 1);
+                {
+                    TRACE_SCOPE("convert left/right");
+                    ConvertRLLuminance12ToLuminance8(lr.data(), lr.width, lr.height, g_maxLRBits - 8, g_leftImage, g_rightImage);
+                }
+                if (g_dsapi->isLeftEnabled()) DrawGLImage(g_leftWindow, lr.width, lr.height, GL_LUMINANCE, GL_UNSIGNED_BYTE, g_leftImage, 1);
+                if (g_dsapi->isRightEnabled()) DrawGLImage(g_rightWindow, lr.width, lr.height, GL_LUMINANCE, GL_UNSIGNED_BYTE, g_rightImage, 1);
                 break;
             case DS_NATIVE_RL_LUMINANCE16:
-                DSConvertRLLuminance16ToLuminance8(g_dsapi->getLImage(), g_dsapi->lrWidth(), g_dsapi->lrHeight(), g_dsapi->maxLRBits() - 8, g_leftImage, g_rightImage);
-                if (g_dsapi->isLeftEnabled()) DrawGLImage(g_leftWindow, g_dsapi->lrWidth(), g_dsapi->lrHeight(), GL_LUMINANCE, GL_UNSIGNED_BYTE, g_leftImage, 1);
-                if (g_dsapi->isRightEnabled()) DrawGLImage(g_rightWindow, g_dsapi->lrWidth(), g_dsapi->lrHeight(), GL_LUMINANCE, GL_UNSIGNED_BYTE, g_rightImage, 1);
+                {
+                    TRACE_SCOPE("convert left/right");
+                    ConvertRLLuminance16ToLuminance8(lr.data(), lr.width, lr.height, g_maxLRBits - 8, g_leftImage, g_rightImage);
+                }
+                if (g_dsapi->isLeftEnabled()) DrawGLImage(g_leftWindow, lr.width, lr.height, GL_LUMINANCE, GL_UNSIGNED_BYTE, g_leftImage, 1);
+                if (g_dsapi->isRightEnabled()) DrawGLImage(g_rightWindow, lr.width, lr.height, GL_LUMINANCE, GL_UNSIGNED_BYTE, g_rightImage, 1);
                 break;
             default:
                 break;
@@ -115,46 +154,53 @@ void OnIdle()
         }
 
         // Display third image, if it is enabled
-        if (g_third && g_third->isThirdEnabled() && g_third->getThirdFrameNumber() != g_lastThirdFrame)
+        if (frame.third.valid() && frame.thirdFrameNumber != g_lastThirdFrame)
         {
-            switch (g_third->getThirdPixelFormat())
+            const FrameImage & third = frame.third;
+            switch (third.format)
             {
             case DS_RGB8:
-                DrawGLImage(g_thirdWindow, g_third->thirdWidth(), g_third->thirdHeight(), GL_RGB, GL_UNSIGNED_BYTE, g_third->getThirdImage(), 1);
+                DrawGLImage(g_thirdWindow, third.width, third.height, GL_RGB, GL_UNSIGNED_BYTE, third.data(), 1);
                 break;
             case DS_BGRA8:
-                DrawGLImage(g_thirdWindow, g_third->thirdWidth(), g_third->thirdHeight(), GL_BGRA_EXT, GL_UNSIGNED_BYTE, g_third->getThirdImage(), 1);
+                DrawGLImage(g_thirdWindow, third.width, third.height, GL_BGRA_EXT, GL_UNSIGNED_BYTE, third.data(), 1);
                 break;
             case DS_NATIVE_YUY2:
-                DSConvertYUY2ToBGRA8((const uint8_t *)g_third->getThirdImage(), g_third->thirdWidth(), g_third->thirdHeight(), g_thirdImage);
-                DrawGLImage(g_thirdWindow, g_third->thirdWidth(), g_third->thirdHeight(), GL_BGRA_EXT, GL_UNSIGNED_BYTE, g_thirdImage, 1);
+                {
+                    TRACE_SCOPE("convert third");
+                    ConvertYUY2ToBGRA8(third.data(), third.width, third.height, third.stride, g_thirdImage, third.width * 4);
+                }
+                DrawGLImage(g_thirdWindow, third.width, third.height, GL_BGRA_EXT, GL_UNSIGNED_BYTE, g_thirdImage, 1);
                 break;
             case DS_NATIVE_RAW10:
-                DSConvertRaw10ToBGRA8((uint8_t *)g_third->getThirdImage(), g_third->thirdWidth(), g_third->thirdHeight(), g_thirdImage);
-                DrawGLImage(g_thirdWindow, g_third->thirdWidth(), g_third->thirdHeight(), GL_BGRA_EXT, GL_UNSIGNED_BYTE, g_thirdImage, 1);
+                {
+                    TRACE_SCOPE("convert third");
+                    ConvertRaw10ToBGRA8(third.data(), third.width, third.height, third.stride, g_thirdImage, third.width * 4);
+                }
+                DrawGLImage(g_thirdWindow, third.width, third.height, GL_BGRA_EXT, GL_UNSIGNED_BYTE, g_thirdImage, 1);
                 break;
             default:
                 break;
             }
 
-            g_lastThirdFrame = g_third->getThirdFrameNumber();
-            g_thirdTimer.OnFrame();
+            g_lastThirdFrame = frame.thirdFrameNumber;
         }
     }
     else
     {
-        if (g_dsapi->isZEnabled()) DrawGLImage(g_depthWindow, 0, 0, 0, 0, nullptr, 1);
+        if (frame.z.valid()) DrawGLImage(g_depthWindow, 0, 0, 0, 0, nullptr, 1);
         if (g_dsapi->isLeftEnabled()) DrawGLImage(g_leftWindow, 0, 0, 0, 0, nullptr, 1);
         if (g_dsapi->isRightEnabled()) DrawGLImage(g_rightWindow, 0, 0, 0, 0, nullptr, 1);
-        if (g_third && g_third->isThirdEnabled() && g_third->getThirdFrameNumber() != g_lastThirdFrame)
+        if (frame.third.valid() && frame.thirdFrameNumber != g_lastThirdFrame)
         {
             DrawGLImage(g_thirdWindow, 0, 0, 0, 0, nullptr, 1);
-            g_lastThirdFrame = g_third->getThirdFrameNumber();
-            g_thirdTimer.OnFrame();
+            g_lastThirdFrame = frame.thirdFrameNumber;
         }
     }
 
-    g_timer.OnFrame();
+    // From grab() returning on the capture thread to the frame being on screen
+    static const int latencyStage = Tracer::RegisterStage("grab to display");
+    if (Tracer::IsEnabled() && !g_paused) Tracer::Record(latencyStage, frame.hostTime, GetHostTime(), frame.frameNumber);
 }
 
 void PrintControls()
@@ -224,10 +270,11 @@ void OnKeyboard(unsigned char key, int x, int y)
         glutLeaveMainLoop();
         break;
     case 'r':
-        if (g_dsapi->startCapture())
-            g_stopped = false;
+        if (g_stopped && g_dsapi->startCapture())
+            g_stopped = !g_engine->Start();
         break;
     case 't':
+        g_engine->Stop();
         if (g_dsapi->stopCapture())
             g_stopped = true;
         break;
@@ -443,6 +490,10 @@ int main(int argc, char * argv[])
     // Begin capturing images
     std::cout << "Starting capture." << std::endl;
     DS_CHECK_ERRORS(g_dsapi->startCapture());
+    g_maxLRBits = g_dsapi->maxLRBits();
+    g_engine.reset(new CaptureEngine(*g_dsapi));
+    g_display.reset(new FrameSetReader(g_engine->Frames()));
+    DS_CHECK_ERRORS(g_engine->Start());
     g_stopped = false;
 
     if (g_hardware)
@@ -546,11 +597,19 @@ int main(int argc, char * argv[])
         g_thirdWindow.Open(title.str(), 300 * g_third->thirdWidth() / g_third->thirdHeight(), 300, 520, 60, OnKeyboard);
     }
 
+    // Set R200_TRACE to a file name to trace every stage, show the latencies in the overlay and write a Chrome trace on exit
+    const char * tracePath = getenv("R200_TRACE");
+    Tracer::Enable(tracePath != nullptr);
+    Tracer::SetThreadName("display");
+
     // Turn control over to GLUT
     PrintControls();
     glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS);
     glutMainLoop();
 
+    if (tracePath && !Tracer::WriteChromeTrace(tracePath))
+        std::cerr << "Could not write trace to " << tracePath << std::endl;
+
     return 0;
 }
 
@@ -569,21 +628,26 @@ int CreateGLWindow(std::string name, int width, int height, int startX, int star
     return windowNum;
 }
 
-void DrawGLImage(GlutWindow & window, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid * pixels, GLfloat multiplier)
+void DrawGLImage(GlutWindow & window, GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid * pixels, GLfloat multiplier)
 {
     window.ClearScreen(0.1f, 0.1f, 0.15f);
 
     if (g_showImages)
     {
+        TRACE_SCOPE("upload image");
         window.DrawImage(width, height, format, type, pixels, multiplier);
     }
 
     if (g_showOverlay)
     {
-        DrawString(10, 10, "FPS: %0.1f", (&window == &g_thirdWindow ? g_thirdTimer : g_timer).GetFramesPerSecond());
-        DrawString(10, 28, "Frame #: %d", &window == &g_thirdWindow ? g_third->getThirdFrameNumber() : g_dsapi->getFrameNumber());
-        DrawString(10, 46, "Frame time: %s", GetHumanTime(&window == &g_thirdWindow ? g_third->getThirdFrameTime() : g_dsapi->getFrameTime()).c_str());
+        const PacingStats pacing = &window == &g_thirdWindow ? g_engine->GetThirdPacingStats() : g_engine->GetPacingStats();
+        DrawString(10, 10, "FPS: %0.1f (jitter %0.2f ms)", pacing.framesPerSecond, pacing.jitter * 1e3);
+        DrawString(10, 28, "Frame #: %d", &window == &g_thirdWindow ? g_frame->thirdFrameNumber : g_frame->frameNumber);
+        DrawString(10, 46, "Frame time: %s", GetHumanTime(&window == &g_thirdWindow ? g_frame->thirdFrameTime : g_frame->frameTime).c_str());
+        DrawString(10, 64, "Dropped: %llu, latency: %0.1f ms (max %0.1f ms)", static_cast<unsigned long long>(pacing.dropped), pacing.meanLatency * 1e3, pacing.maxLatency * 1e3);
+        if (&window == &g_depthWindow) DrawTraceStats(10, 82);
     }
 
+    TRACE_SCOPE("swap buffers");
     glutSwapBuffers();
 }
@@ -11,12 +11,15 @@ Copyright(c) 2014-2015 Intel Corporation. All Rights Reserved.
 #include <r200_driver/DSAPI.h>
 #include <r200_driver/DSAPI/DSAPITypes.h>
 #include <r200_driver/Common.h>
+#include <r200_driver/CaptureEngine.h>
 #include <cassert>
 #include <cctype>
 #include <algorithm>
 #include <sstream>
 #include <memory>
 #include <map>
+#include <chrono>
+#include <thread>
 
 #ifndef _WIN32
 #include <stdalign.h>
@@ -28,12 +31,15 @@ Copyright(c) 2014-2015 Intel Corporation. All Rights Reserved.
 
 static std::shared_ptr<DSAPI> g_dsapi;
 
+/// Grabs on its own thread so that drawing never stalls the camera. Declared after g_dsapi so that it is stopped before DSAPI is destroyed.
+static std::unique_ptr<CaptureEngine> g_engine;
+static std::unique_ptr<FrameSetReader> g_display;
+static FrameSetHandle g_frame; // The frame set currently on screen
 
 DSThird * g_third;
 DSHardware * g_hardware;
 bool g_paused, g_showOverlay = true, g_showImages = true, g_stopped = true;
 GlutWindow g_depthWindow, g_leftWindow, g_rightWindow, g_thirdWindow; // Windows where we will display depth, left, right, third images
-Timer g_timer, g_thirdTimer;
 int g_lastThirdFrame;
 float g_exposure, g_gain;
 bool g_useAutoExposure = false;
@@ -46,7 +52,7 @@ float g_maxExposure = 16.3f;
 float g_minGain = 1.0f;
 float g_maxGain = 64.0f;
 
-void DrawGLImage(GlutWindow & window, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid * pixels);
+void DrawGLImage(GlutWindow & window, GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid * pixels);
 
 uint8_t g_leftImage[640 * 480], g_rightImage[640 * 480];
 
@@ -62,38 +68,57 @@ void OnIdle()
     if (g_stopped)
         return;
 
+    DS_CHECK_ERRORS(g_engine->IsRunning());
+
+    // Frames are grabbed on the capture engine's thread, here we just pick up the newest one
     if (!g_paused)
     {
-        DS_CHECK_ERRORS(g_dsapi->grab());
+        if (FrameSetHandle frame = g_display->PopLatest())
+        {
+            g_frame = std::move(frame);
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return;
+        }
     }
+    if (!g_frame)
+        return;
+    const FrameSet & frame = *g_frame;
+    TRACE_SCOPE_ARG("display", frame.frameNumber);
 
     // Display Z image, if it is enabled
-    if (g_dsapi->isZEnabled() && g_depthWindow.alive())
+    if (frame.z.valid() && g_depthWindow.alive())
     {
         const uint8_t nearColor[] = {255, 0, 0}, farColor[] = {20, 40, 255};
-        if (g_showImages) ConvertDepthToRGBUsingHistogram(g_dsapi->getZImage(), g_dsapi->zWidth(), g_dsapi->zHeight(), nearColor, farColor, g_zImageRGB);
-        DrawGLImage(g_depthWindow, g_dsapi->zWidth(), g_dsapi->zHeight(), GL_RGB, GL_UNSIGNED_BYTE, g_zImageRGB);
+        if (g_showImages)
+        {
+            TRACE_SCOPE("colorize depth");
+            ConvertDepthToRGBUsingHistogram(frame.z.dataAs<uint16_t>(), frame.z.width, frame.z.height, nearColor, farColor, g_zImageRGB);
+        }
+        DrawGLImage(g_depthWindow, frame.z.width, frame.z.height, GL_RGB, GL_UNSIGNED_BYTE, g_zImageRGB);
     }
 
     // Display left/right images, if they are enabled
-    if ((g_dsapi->isLeftEnabled() && g_leftWindow.alive()) || (g_dsapi->isRightEnabled() && g_rightWindow.alive()))
+    if ((frame.left.valid() && g_leftWindow.alive()) || (frame.right.valid() && g_rightWindow.alive()))
     {
-        assert(g_dsapi->getLRPixelFormat() == DS_LUMINANCE8);
-        if (g_dsapi->isLeftEnabled()) DrawGLImage(g_leftWindow, g_dsapi->lrWidth(), g_dsapi->lrHeight(), GL_LUMINANCE, GL_UNSIGNED_BYTE, g_showImages ? g_dsapi->getLImage() : nullptr);
-        if (g_dsapi->isRightEnabled()) DrawGLImage(g_rightWindow, g_dsapi->lrWidth(), g_dsapi->lrHeight(), GL_LUMINANCE, GL_UNSIGNED_BYTE, g_showImages ? g_dsapi->getRImage() : nullptr);
+        assert((frame.left.valid() ? frame.left : frame.right).format == DS_LUMINANCE8);
+        if (frame.left.valid()) DrawGLImage(g_leftWindow, frame.left.width, frame.left.height, GL_LUMINANCE, GL_UNSIGNED_BYTE, g_showImages ? frame.left.data() : nullptr);
+        if (frame.right.valid()) DrawGLImage(g_rightWindow, frame.right.width, frame.right.height, GL_LUMINANCE, GL_UNSIGNED_BYTE, g_showImages ? frame.right.data() : nullptr);
     }
 
     // Display third image, if it is enabled
-    if (g_third && g_third->isThirdEnabled() && g_thirdWindow.alive() && g_third->getThirdFrameNumber() != g_lastThirdFrame)
+    if (frame.third.valid() && g_thirdWindow.alive() && frame.thirdFrameNumber != g_lastThirdFrame)
     {
-        assert(g_third->getThirdPixelFormat() == DS_RGB8);
-        DrawGLImage(g_thirdWindow, g_third->thirdWidth(), g_third->thirdHeight(), GL_RGB, GL_UNSIGNED_BYTE, g_showImages ? g_third->getThirdImage() : nullptr);
-        g_lastThirdFrame = g_third->getThirdFrameNumber();
-
-        g_thirdTimer.OnFrame();
+        assert(frame.third.format == DS_RGB8);
+        DrawGLImage(g_thirdWindow, frame.third.width, frame.third.height, GL_RGB, GL_UNSIGNED_BYTE, g_showImages ? frame.third.data() : nullptr);
+        g_lastThirdFrame = frame.thirdFrameNumber;
     }
 
-    g_timer.OnFrame();
+    // From grab() returning on the capture thread to the frame being on screen
+    static const int latencyStage = Tracer::RegisterStage("grab to display");
+    if (Tracer::IsEnabled() && !g_paused) Tracer::Record(latencyStage, frame.hostTime, GetHostTime(), frame.frameNumber);
 }
 
 void PrintControls()
@@ -169,10 +194,11 @@ void OnKeyboard(unsigned char key, int x, int y)
         glutLeaveMainLoop();
         break;
     case 'r':
-        if (g_dsapi->startCapture())
-            g_stopped = false;
+        if (g_stopped && g_dsapi->startCapture())
+            g_stopped = !g_engine->Start();
         break;
     case 't':
+        g_engine->Stop();
         if (g_dsapi->stopCapture())
             g_stopped = true;
         break;
@@ -241,6 +267,9 @@ int main(int argc, char * argv[])
 
     // Begin capturing images
     DS_CHECK_ERRORS(g_dsapi->startCapture());
+    g_engine.reset(new CaptureEngine(*g_dsapi));
+    g_display.reset(new FrameSetReader(g_engine->Frames()));
+    DS_CHECK_ERRORS(g_engine->Start());
     g_stopped = false;
 
     float defaultExposure = 0.0f;
@@ -292,30 +321,43 @@ int main(int argc, char * argv[])
         g_thirdWindow.Open(title.str(), 300 * g_third->thirdWidth() / g_third->thirdHeight(), 300, 520, 60, OnKeyboard);
     }
 
+    // Set R200_TRACE to a file name to trace every stage, show the latencies in the overlay and write a Chrome trace on exit
+    const char * tracePath = getenv("R200_TRACE");
+    Tracer::Enable(tracePath != nullptr);
+    Tracer::SetThreadName("display");
+
     // Turn control over to GLUT
     PrintControls();
     glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS);
     glutMainLoop();
 
+    if (tracePath && !Tracer::WriteChromeTrace(tracePath))
+        std::cerr << "Could not write trace to " << tracePath << std::endl;
+
     return 0;
 }
 
 
-void DrawGLImage(GlutWindow & window, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid * pixels)
+void DrawGLImage(GlutWindow & window, GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid * pixels)
 {
     window.ClearScreen(0.1f, 0.1f, 0.15f);
 
     if (g_showImages)
     {
+        TRACE_SCOPE("upload image");
         window.DrawImage(width, height, format, type, pixels, 1);
     }
 
     if (g_showOverlay)
     {
-        DrawString(10, 10, "FPS: %0.1f", (&window == &g_thirdWindow ? g_thirdTimer : g_timer).GetFramesPerSecond());
-        DrawString(10, 28, "Frame #: %d", &window == &g_thirdWindow ? g_third->getThirdFrameNumber() : g_dsapi->getFrameNumber());
-        DrawString(10, 46, "Frame time: %s", GetHumanTime(&window == &g_thirdWindow ? g_third->getThirdFrameTime() : g_dsapi->getFrameTime()).c_str());
+        const PacingStats pacing = &window == &g_thirdWindow ? g_engine->GetThirdPacingStats() : g_engine->GetPacingStats();
+        DrawString(10, 10, "FPS: %0.1f (jitter %0.2f ms)", pacing.framesPerSecond, pacing.jitter * 1e3);
+        DrawString(10, 28, "Frame #: %d", &window == &g_thirdWindow ? g_frame->thirdFrameNumber : g_frame->frameNumber);
+        DrawString(10, 46, "Frame time: %s", GetHumanTime(&window == &g_thirdWindow ? g_frame->thirdFrameTime : g_frame->frameTime).c_str());
+        DrawString(10, 64, "Dropped: %llu, latency: %0.1f ms (max %0.1f ms)", static_cast<unsigned long long>(pacing.dropped), pacing.meanLatency * 1e3, pacing.maxLatency * 1e3);
+        if (&window == &g_depthWindow) DrawTraceStats(10, 82);
     }
 
+    TRACE_SCOPE("swap buffers");
     glutSwapBuffers();
 }
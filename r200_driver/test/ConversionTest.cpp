@@ -0,0 +1,420 @@
+#include "TestImages.h"
+
+#include <r200_driver/ColorConversion.h>
+#include <r200_driver/Demosaic.h>
+#include <r200_driver/ImageConversion.h>
+#include <r200_driver/Rectification.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// Rows of the images below, odd so that bands split unevenly
+const int g_height = 9;
+
+// Every left/right deinterleaver, into destinations with padded rows, against the definition of each format
+TEST(ImageConversion, LeftRight)
+{
+    for (int width : g_testWidths)
+    {
+        SCOPED_TRACE(width);
+        const int sourceStride = width * 4 + 6, destStride = width + 5;
+        const std::vector<uint8_t> source = RandomBytes(static_cast<size_t>(sourceStride) * g_height, width);
+        const int shift = 2;
+
+        // Left images then right images, each of g_height rows destStride pixels apart
+        std::vector<uint8_t> expectedRL8(destStride * g_height * 2);
+        for (int y = 0; y < g_height; ++y)
+            for (int x = 0; x < width; ++x)
+            {
+                const uint8_t * rl8 = &source[y * sourceStride + 2 * x];
+                expectedRL8[y * destStride + x] = rl8[0];
+                expectedRL8[(g_height + y) * destStride + x] = rl8[1];
+            }
+        EXPECT_TRUE(ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+                        std::vector<uint8_t> out(destStride * g_height * 2);
+                        ConvertRLLuminance8ToLuminance8(source.data(), width, g_height, sourceStride, out.data(), out.data() + destStride * g_height, destStride,
+                                                        ConversionRegion(), scheduler);
+                        return out;
+                    }) == expectedRL8);
+
+        // The 16 bit formats read pairs of words, the 12 bit ones pairs of 12 bit values in 3 bytes. Destination strides are in bytes.
+        std::vector<uint16_t> expected16(destStride * g_height * 2);
+        std::vector<uint8_t> expected8(destStride * g_height * 2), expected12To8(destStride * g_height * 2);
+        std::vector<uint16_t> expected12(destStride * g_height * 2);
+        for (int y = 0; y < g_height; ++y)
+            for (int x = 0; x < width; ++x)
+            {
+                const uint8_t * row = &source[y * sourceStride];
+                const uint16_t first = static_cast<uint16_t>(row[4 * x] | row[4 * x + 1] << 8);
+                const uint16_t second = static_cast<uint16_t>(row[4 * x + 2] | row[4 * x + 3] << 8);
+                const int left = y * destStride + x, right = left + destStride * g_height;
+                expected16[left] = first;
+                expected16[right] = second;
+                expected8[left] = static_cast<uint8_t>(second >> shift);
+                expected8[right] = static_cast<uint8_t>(first >> shift);
+
+                const uint8_t * rl12 = row + 3 * x;
+                const uint16_t right12 = static_cast<uint16_t>(rl12[0] | (rl12[1] & 0x0F) << 8);
+                const uint16_t left12 = static_cast<uint16_t>(rl12[1] >> 4 | rl12[2] << 4);
+                expected12[left] = left12;
+                expected12[right] = right12;
+                expected12To8[left] = static_cast<uint8_t>(left12 >> shift);
+                expected12To8[right] = static_cast<uint8_t>(right12 >> shift);
+            }
+
+        EXPECT_TRUE(ExpectSameOnEveryIsa<uint16_t>([&](TaskScheduler * scheduler) {
+                        std::vector<uint16_t> out(destStride * g_height * 2);
+                        ConvertRLLuminance16ToLuminance16(source.data(), width, g_height, sourceStride, out.data(), out.data() + destStride * g_height,
+                                                          destStride * 2, ConversionRegion(), scheduler);
+                        return out;
+                    }) == expected16);
+        EXPECT_TRUE(ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+                        std::vector<uint8_t> out(destStride * g_height * 2);
+                        ConvertRLLuminance16ToLuminance8(source.data(), width, g_height, sourceStride, shift, out.data(), out.data() + destStride * g_height,
+                                                         destStride, ConversionRegion(), scheduler);
+                        return out;
+                    }) == expected8);
+        EXPECT_TRUE(ExpectSameOnEveryIsa<uint16_t>([&](TaskScheduler * scheduler) {
+                        std::vector<uint16_t> out(destStride * g_height * 2);
+                        ConvertRLLuminance12ToLuminance16(source.data(), width, g_height, sourceStride, out.data(), out.data() + destStride * g_height,
+                                                          destStride * 2, ConversionRegion(), scheduler);
+                        return out;
+                    }) == expected12);
+        EXPECT_TRUE(ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+                        std::vector<uint8_t> out(destStride * g_height * 2);
+                        ConvertRLLuminance12ToLuminance8(source.data(), width, g_height, sourceStride, shift, out.data(), out.data() + destStride * g_height,
+                                                         destStride, ConversionRegion(), scheduler);
+                        return out;
+                    }) == expected12To8);
+        ForEachIsa([&](TaskScheduler * scheduler) {
+            std::vector<uint8_t> out8(destStride * g_height * 2);
+            std::vector<uint16_t> out16(destStride * g_height * 2);
+            ConvertRLLuminance12ToLuminance8And16(source.data(), width, g_height, sourceStride, shift, out8.data(), out8.data() + destStride * g_height,
+                                                  destStride, out16.data(), out16.data() + destStride * g_height, destStride * 2, ConversionRegion(),
+                                                  scheduler);
+            EXPECT_TRUE(out8 == expected12To8);
+            EXPECT_TRUE(out16 == expected12);
+        });
+    }
+}
+
+// A region of the source lands where the region says, and nothing else of the destination is written
+TEST(ImageConversion, Region)
+{
+    const int width = 70, destStride = 40;
+    const std::vector<uint8_t> source = RandomBytes(width * 2 * g_height, 1);
+    const ConversionRegion region(ImageRegion(5, 2, 33, 6), 3, 1);
+    ForEachIsa([&](TaskScheduler * scheduler) {
+        std::vector<uint8_t> left(destStride * g_height, 0xEE), right(destStride * g_height, 0xEE);
+        ConvertRLLuminance8ToLuminance8(source.data(), width, g_height, width * 2, left.data(), right.data(), destStride, region, scheduler);
+        for (int y = 0; y < g_height; ++y)
+            for (int x = 0; x < destStride; ++x)
+            {
+                const int sx = x - region.destX + region.source.x, sy = y - region.destY + region.source.y;
+                const bool inside = x >= region.destX && x < region.destX + region.source.width && y >= region.destY && y < region.destY + region.source.height;
+                ASSERT_EQ(inside ? source[sy * width * 2 + 2 * sx] : 0xEE, left[y * destStride + x]) << x << ", " << y;
+                ASSERT_EQ(inside ? source[sy * width * 2 + 2 * sx + 1] : 0xEE, right[y * destStride + x]) << x << ", " << y;
+            }
+    });
+}
+
+TEST(ColorConversion, YUY2)
+{
+    for (int width : g_testWidths)
+    {
+        if (width % 2) ++width;
+        SCOPED_TRACE(width);
+        const int sourceStride = width * 2 + 4;
+        const std::vector<uint8_t> source = RandomBytes(static_cast<size_t>(sourceStride) * g_height, width);
+        for (int matrix = YUV_BT601; matrix <= YUV_BT709; ++matrix)
+            for (int range = YUV_LIMITED_RANGE; range <= YUV_FULL_RANGE; ++range)
+            {
+                const auto options = [=](TaskScheduler * scheduler) {
+                    YuvConversionOptions options;
+                    options.matrix = static_cast<YuvMatrix>(matrix);
+                    options.range = static_cast<YuvRange>(range);
+                    options.scheduler = scheduler;
+                    return options;
+                };
+                ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+                    std::vector<uint8_t> out(width * 3 * g_height);
+                    ConvertYUY2ToRGB8(source.data(), width, g_height, sourceStride, out.data(), width * 3, options(scheduler));
+                    return out;
+                });
+                ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+                    std::vector<uint8_t> out(width * 4 * g_height);
+                    ConvertYUY2ToBGRA8(source.data(), width, g_height, sourceStride, out.data(), width * 4, options(scheduler));
+                    return out;
+                });
+                ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+                    std::vector<uint8_t> out(width * g_height);
+                    ConvertYUY2ToLuminance8(source.data(), width, g_height, sourceStride, out.data(), width, options(scheduler));
+                    return out;
+                });
+                ExpectSameOnEveryIsa<uint16_t>([&](TaskScheduler * scheduler) {
+                    std::vector<uint16_t> out(width * g_height);
+                    ConvertYUY2ToLuminance16(source.data(), width, g_height, sourceStride, 4, out.data(), width * 2, options(scheduler));
+                    return out;
+                });
+            }
+    }
+}
+
+// The definition of each matrix and range in double precision, rounded to nearest and clamped, which the fixed point kernels match to
+// within one level
+static void YuvToRgbNaive(int y, int u, int v, YuvMatrix matrix, YuvRange range, uint8_t rgb[3])
+{
+    const double kr = matrix == YUV_BT709 ? 0.2126 : 0.299, kb = matrix == YUV_BT709 ? 0.0722 : 0.114, kg = 1 - kr - kb;
+    const bool limited = range == YUV_LIMITED_RANGE;
+    const double luma = (y - (limited ? 16 : 0)) * (limited ? 255.0 / 219 : 1);
+    const double cb = (u - 128) * (limited ? 255.0 / 224 : 1), cr = (v - 128) * (limited ? 255.0 / 224 : 1);
+    const double values[3] = {luma + 2 * (1 - kr) * cr, luma - 2 * (1 - kb) * kb / kg * cb - 2 * (1 - kr) * kr / kg * cr, luma + 2 * (1 - kb) * cb};
+    for (int c = 0; c < 3; ++c)
+        rgb[c] = static_cast<uint8_t>(std::min(255.0, std::max(0.0, std::floor(values[c] + 0.5))));
+}
+
+// RGB of every pixel of an NV12 image with rows stride bytes apart, taking Y below yMin as yMin
+static std::vector<uint8_t> NV12ToRgbNaive(const std::vector<uint8_t> & source, int width, int height, int stride, YuvMatrix matrix, YuvRange range,
+                                           int yMin = 0)
+{
+    std::vector<uint8_t> rgb(width * 3 * height);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            const uint8_t * chroma = &source[(height + y / 2) * stride + (x & ~1)];
+            YuvToRgbNaive(std::max<int>(source[y * stride + x], yMin), chroma[0], chroma[1], matrix, range, &rgb[(y * width + x) * 3]);
+        }
+    return rgb;
+}
+
+// Every byte of an image of pixelSize bytes per pixel within one level of the RGB reference, with its channels in the order of r, g and b
+static void ExpectNearRgb(const std::vector<uint8_t> & expected, const std::vector<uint8_t> & actual, int pixelSize, int r, int g, int b)
+{
+    for (size_t i = 0; i < expected.size() / 3; ++i)
+    {
+        const int channels[3] = {r, g, b};
+        for (int c = 0; c < 3; ++c)
+            if (std::abs(expected[i * 3 + c] - actual[i * pixelSize + channels[c]]) > 1)
+            {
+                ADD_FAILURE() << "pixel " << i << " channel " << c << " is " << +actual[i * pixelSize + channels[c]] << " instead of " << +expected[i * 3 + c];
+                return;
+            }
+        if (pixelSize == 4 && actual[i * 4 + 3] != 255)
+        {
+            ADD_FAILURE() << "pixel " << i << " has alpha " << +actual[i * 4 + 3];
+            return;
+        }
+    }
+}
+
+TEST(ColorConversion, NV12)
+{
+    const int height = 10;
+    for (int width : g_testWidths)
+    {
+        if (width % 2) ++width;
+        SCOPED_TRACE(width);
+        const int sourceStride = width + 6;
+        const std::vector<uint8_t> source = RandomBytes(static_cast<size_t>(sourceStride) * height * 3 / 2, width);
+        for (int matrix = YUV_BT601; matrix <= YUV_BT709; ++matrix)
+            for (int range = YUV_LIMITED_RANGE; range <= YUV_FULL_RANGE; ++range)
+            {
+                SCOPED_TRACE(testing::Message() << "matrix " << matrix << ", range " << range);
+                const auto options = [=](TaskScheduler * scheduler) {
+                    YuvConversionOptions options;
+                    options.matrix = static_cast<YuvMatrix>(matrix);
+                    options.range = static_cast<YuvRange>(range);
+                    options.scheduler = scheduler;
+                    return options;
+                };
+                const std::vector<uint8_t> expected =
+                    NV12ToRgbNaive(source, width, height, sourceStride, static_cast<YuvMatrix>(matrix), static_cast<YuvRange>(range));
+                ExpectNearRgb(expected, ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+                                  std::vector<uint8_t> out(width * 3 * height);
+                                  ConvertNV12ToRGB8(source.data(), width, height, sourceStride, out.data(), width * 3, options(scheduler));
+                                  return out;
+                              }),
+                              3, 0, 1, 2);
+                ExpectNearRgb(expected, ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+                                  std::vector<uint8_t> out(width * 3 * height);
+                                  ConvertNV12ToBGR8(source.data(), width, height, sourceStride, out.data(), width * 3, options(scheduler));
+                                  return out;
+                              }),
+                              3, 2, 1, 0);
+                ExpectNearRgb(expected, ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+                                  std::vector<uint8_t> out(width * 4 * height);
+                                  ConvertNV12ToBGRA8(source.data(), width, height, sourceStride, out.data(), width * 4, options(scheduler));
+                                  return out;
+                              }),
+                              4, 2, 1, 0);
+            }
+
+        // The luminance outputs are the Y samples as they are
+        std::vector<uint8_t> expected8(width * height);
+        std::vector<uint16_t> expected16(width * height);
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x)
+            {
+                expected8[y * width + x] = source[y * sourceStride + x];
+                expected16[y * width + x] = static_cast<uint16_t>(source[y * sourceStride + x] << 4);
+            }
+        EXPECT_TRUE(ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+                        YuvConversionOptions options;
+                        options.scheduler = scheduler;
+                        std::vector<uint8_t> out(width * height);
+                        ConvertNV12ToLuminance8(source.data(), width, height, sourceStride, out.data(), width, options);
+                        return out;
+                    }) == expected8);
+        EXPECT_TRUE(ExpectSameOnEveryIsa<uint16_t>([&](TaskScheduler * scheduler) {
+                        YuvConversionOptions options;
+                        options.scheduler = scheduler;
+                        std::vector<uint16_t> out(width * height);
+                        ConvertNV12ToLuminance16(source.data(), width, height, sourceStride, 4, out.data(), width * 2, options);
+                        return out;
+                    }) == expected16);
+    }
+}
+
+// Y below 16, blacker than black, is stretched below black by the general conversions but taken as 16 by the ones in place of libDSAPI's,
+// like libDSAPI does, in every lane of the vectors and in the scalar tails
+TEST(ColorConversion, NV12BelowBlack)
+{
+    const int height = 4;
+    for (int width : g_testWidths)
+    {
+        if (width % 2) ++width;
+        SCOPED_TRACE(width);
+        std::vector<uint8_t> source = RandomBytes(static_cast<size_t>(width) * height * 3 / 2, width);
+        for (int i = 0; i < width * height; ++i)
+            source[i] %= 32;
+        const std::vector<uint8_t> stretched = NV12ToRgbNaive(source, width, height, width, YUV_BT601, YUV_LIMITED_RANGE);
+        const std::vector<uint8_t> clamped = NV12ToRgbNaive(source, width, height, width, YUV_BT601, YUV_LIMITED_RANGE, 16);
+        ForEachIsa([&](TaskScheduler * scheduler) {
+            YuvConversionOptions options;
+            options.scheduler = scheduler;
+            std::vector<uint8_t> rgb(width * 3 * height), bgr(width * 3 * height), bgra(width * 4 * height);
+            ConvertNV12ToRGB8(source.data(), width, height, width, rgb.data(), width * 3, options);
+            ExpectNearRgb(stretched, rgb, 3, 0, 1, 2);
+
+            ConvertNV12ToRGB8(source.data(), width, height, rgb.data());
+            ConvertNV12ToBGR8(source.data(), width, height, bgr.data());
+            ConvertNV12ToBGRA8(source.data(), width, height, bgra.data());
+            ExpectNearRgb(clamped, rgb, 3, 0, 1, 2);
+            ExpectNearRgb(clamped, bgr, 3, 2, 1, 0);
+            ExpectNearRgb(clamped, bgra, 4, 2, 1, 0);
+        });
+    }
+}
+
+TEST(Demosaic, Raw10)
+{
+    const int height = 10;
+    for (int width : g_testWidths)
+    {
+        width = (width + 3) / 4 * 4;
+        SCOPED_TRACE(width);
+        const int sourceStride = width / 4 * 5 + 3;
+        const std::vector<uint8_t> source = RandomBytes(static_cast<size_t>(sourceStride) * height, width);
+        for (int method = DEMOSAIC_BILINEAR; method <= DEMOSAIC_MALVAR; ++method)
+        {
+            const auto options = [=](TaskScheduler * scheduler) {
+                DemosaicOptions options;
+                options.method = static_cast<DemosaicMethod>(method);
+                options.redGain = 1.25f;
+                options.blueGain = 0.8f;
+                options.gamma = 2.2f;
+                options.scheduler = scheduler;
+                options.bandRows = 4;
+                return options;
+            };
+            ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+                std::vector<uint8_t> out(width * 3 * height);
+                ConvertRaw10ToRGB8(source.data(), width, height, sourceStride, out.data(), width * 3, options(scheduler));
+                return out;
+            });
+            ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+                std::vector<uint8_t> out(width * 4 * height);
+                ConvertRaw10ToBGRA8(source.data(), width, height, sourceStride, out.data(), width * 4, options(scheduler));
+                return out;
+            });
+        }
+    }
+}
+
+// A slightly rotated and scaled table like the calibration's, in the DSRectificationTable format of Rectification.cpp
+static std::vector<uint32_t> MakeTable(int width, int height)
+{
+    std::vector<uint32_t> table(static_cast<size_t>(width) * height);
+    const double angle = 0.035, scale = 0.95, cx = width / 2.0, cy = height / 2.0;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            const double dx = x - cx, dy = y - cy;
+            const long column = std::lround(32 * (cx + scale * (std::cos(angle) * dx - std::sin(angle) * dy)));
+            const long row = std::lround(32 * (cy + scale * (std::sin(angle) * dx + std::cos(angle) * dy)));
+            table[static_cast<size_t>(y) * width + x] = static_cast<uint32_t>(std::max(0L, std::min(row, 32L * (height - 2)))) << 16 |
+                                                        static_cast<uint32_t>(std::max(0L, std::min(column, 32L * (width - 2))));
+        }
+    return table;
+}
+
+// Without downscaling, rectifying YUY2 in one pass gives what converting to BGRA8 and interpolating each table entry the way
+// DSRectifyBGRA8ToBGRA8 does gives
+TEST(Rectification, YUY2MatchesSeparatePasses)
+{
+    const int width = 300, height = 140;
+    const std::vector<uint8_t> source = RandomBytes(width * 2 * height, 3);
+    const std::vector<uint32_t> table = MakeTable(width, height);
+
+    std::vector<uint8_t> bgra(width * 4 * height), expected(width * 4 * height);
+    ConvertYUY2ToBGRA8(source.data(), width, height, bgra.data());
+    for (int i = 0; i < width * height; ++i)
+    {
+        const uint32_t entry = table[i];
+        const int row = entry >> 21, column = entry >> 5 & 0x7FF, fy = entry >> 16 & 31, fx = entry & 31;
+        const uint8_t * p = &bgra[(row * width + column) * 4];
+        for (int c = 0; c < 4; ++c)
+        {
+            const int top = p[c] * (32 - fx) + p[c + 4] * fx;
+            const int bottom = p[width * 4 + c] * (32 - fx) + p[width * 4 + c + 4] * fx;
+            expected[i * 4 + c] = static_cast<uint8_t>((top * (32 - fy) + bottom * fy) >> 10);
+        }
+    }
+
+    const FusedRectifier rectifier(table.data(), width, height, width, height);
+    EXPECT_TRUE(ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+                    YuvConversionOptions options;
+                    options.scheduler = scheduler;
+                    std::vector<uint8_t> out(width * 4 * height);
+                    rectifier.RectifyYUY2ToBGRA8(source.data(), width * 2, out.data(), width * 4, options);
+                    return out;
+                }) == expected);
+}
+
+TEST(Rectification, Downscaled)
+{
+    const int width = 300, height = 140;
+    const std::vector<uint8_t> yuy2 = RandomBytes(width * 2 * height, 4), raw10 = RandomBytes(width / 4 * 5 * height, 5);
+    const std::vector<uint32_t> table = MakeTable(width, height);
+    for (int downscale = 1; downscale <= 3; downscale += 2)
+    {
+        SCOPED_TRACE(downscale);
+        const FusedRectifier rectifier(table.data(), width, height, width, height, downscale);
+        const int outWidth = rectifier.Width(), outHeight = rectifier.Height();
+        ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+            YuvConversionOptions options;
+            options.scheduler = scheduler;
+            std::vector<uint8_t> out(outWidth * 3 * outHeight);
+            rectifier.RectifyYUY2ToRGB8(yuy2.data(), width * 2, out.data(), outWidth * 3, options);
+            return out;
+        });
+        ExpectSameOnEveryIsa<uint8_t>([&](TaskScheduler * scheduler) {
+            DemosaicOptions options;
+            options.scheduler = scheduler;
+            std::vector<uint8_t> out(outWidth * 4 * outHeight);
+            rectifier.RectifyRaw10ToBGRA8(raw10.data(), width / 4 * 5, out.data(), outWidth * 4, options);
+            return out;
+        });
+    }
+}
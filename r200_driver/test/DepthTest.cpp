@@ -0,0 +1,692 @@
+#include "TestImages.h"
+
+#include <r200_driver/Decimation.h>
+#include <r200_driver/DepthColorizer.h>
+#include <r200_driver/DepthPyramid.h>
+#include <r200_driver/DepthUnits.h>
+#include <r200_driver/HoleFilling.h>
+#include <r200_driver/SpatialFilter.h>
+#include <r200_driver/TemporalFilter.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+const int g_height = 13;
+
+// The definition of each mode: the nearest valid depth to the left within the radius, or the largest or smallest valid depth of the
+// square about the hole, read from the source only
+static std::vector<uint16_t> FillHolesNaive(const std::vector<uint16_t> & depth, int width, int height, const HoleFillOptions & options, HoleFillStats & stats)
+{
+    std::vector<uint16_t> filled(depth);
+    const int radius = options.mode == HOLE_FILL_LEFT ? options.radius : std::min(8, std::max(1, options.radius));
+    const bool unbounded = options.mode == HOLE_FILL_LEFT && (radius <= 0 || radius > 32766);
+    stats = HoleFillStats();
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            if (depth[y * width + x]) continue;
+            ++stats.holes;
+            if (options.mask && !options.mask[y * width + x]) continue;
+
+            int value = 0;
+            if (options.mode == HOLE_FILL_LEFT)
+            {
+                for (int i = x - 1; i >= 0 && (unbounded || x - i <= radius) && !value; --i)
+                    value = depth[y * width + i];
+            }
+            else
+            {
+                for (int j = std::max(0, y - radius); j <= std::min(height - 1, y + radius); ++j)
+                    for (int i = std::max(0, x - radius); i <= std::min(width - 1, x + radius); ++i)
+                    {
+                        const int d = depth[j * width + i];
+                        if (d && (!value || (options.mode == HOLE_FILL_FARTHEST ? d > value : d < value))) value = d;
+                    }
+            }
+            filled[y * width + x] = static_cast<uint16_t>(value);
+            stats.filled += value != 0;
+        }
+    return filled;
+}
+
+TEST(HoleFilling, MatchesDefinition)
+{
+    const int radii[] = {0, 1, 3, 8, 40000};
+    for (int width : g_testWidths)
+    {
+        SCOPED_TRACE(width);
+        const std::vector<uint16_t> depth = RandomDepth(width, g_height, width, width, 40);
+        const std::vector<uint8_t> mask = RandomBytes(width * g_height, width + 1);
+        for (int mode = HOLE_FILL_LEFT; mode <= HOLE_FILL_NEAREST; ++mode)
+            for (int radius : radii)
+                for (int masked = 0; masked < 2; ++masked)
+                {
+                    SCOPED_TRACE(testing::Message() << "mode " << mode << ", radius " << radius << (masked ? ", masked" : ""));
+                    HoleFillOptions options;
+                    options.mode = static_cast<HoleFillMode>(mode);
+                    options.radius = radius;
+                    options.mask = masked ? mask.data() : nullptr;
+                    HoleFillStats expectedStats;
+                    const std::vector<uint16_t> expected = FillHolesNaive(depth, width, g_height, options, expectedStats);
+
+                    ForEachIsa([&](TaskScheduler * scheduler) {
+                        options.scheduler = scheduler;
+                        std::vector<uint16_t> filled(width * g_height);
+                        const HoleFillStats stats = FillDepthHoles(depth.data(), width, g_height, filled.data(), options);
+                        EXPECT_TRUE(filled == expected);
+                        EXPECT_EQ(expectedStats.holes, stats.holes);
+                        EXPECT_EQ(expectedStats.filled, stats.filled);
+                    });
+                }
+    }
+}
+
+// The valid depths of each block, reduced: the least, the lower median or the mean rounded to nearest, 0 for a block without any
+static std::vector<uint16_t> DecimateNaive(const std::vector<uint16_t> & depth, int width, int height, int factor, DepthReduction reduction)
+{
+    const int decimatedWidth = width / factor, decimatedHeight = height / factor;
+    std::vector<uint16_t> decimated(decimatedWidth * decimatedHeight);
+    for (int y = 0; y < decimatedHeight; ++y)
+        for (int x = 0; x < decimatedWidth; ++x)
+        {
+            std::vector<int> valid;
+            for (int j = 0; j < factor; ++j)
+                for (int i = 0; i < factor; ++i)
+                    if (const int d = depth[(y * factor + j) * width + x * factor + i]) valid.push_back(d);
+            if (valid.empty()) continue;
+
+            std::sort(valid.begin(), valid.end());
+            int value = valid[0];
+            if (reduction == DEPTH_REDUCE_MEDIAN) value = valid[(valid.size() - 1) / 2];
+            if (reduction == DEPTH_REDUCE_MEAN)
+            {
+                int sum = 0;
+                for (int d : valid)
+                    sum += d;
+                value = (sum + static_cast<int>(valid.size()) / 2) / static_cast<int>(valid.size());
+            }
+            decimated[y * decimatedWidth + x] = static_cast<uint16_t>(value);
+        }
+    return decimated;
+}
+
+TEST(Decimation, MatchesDefinition)
+{
+    const int height = 35;
+    for (int width : g_testWidths)
+    {
+        SCOPED_TRACE(width);
+        // Every count of valid pixels in a block, up to all of them
+        for (int holePercent = 0; holePercent <= 90; holePercent += 30)
+        {
+            const std::vector<uint16_t> depth = RandomDepth(width, height, width, width * 100 + holePercent, holePercent);
+            for (int factor = 2; factor <= 8; ++factor)
+                for (int reduction = DEPTH_REDUCE_MIN; reduction <= DEPTH_REDUCE_MEAN; ++reduction)
+                {
+                    SCOPED_TRACE(testing::Message() << "factor " << factor << ", reduction " << reduction << ", holes " << holePercent << "%");
+                    const std::vector<uint16_t> expected = DecimateNaive(depth, width, height, factor, static_cast<DepthReduction>(reduction));
+                    ForEachIsa([&](TaskScheduler * scheduler) {
+                        DecimationOptions options;
+                        options.factor = factor;
+                        options.reduction = static_cast<DepthReduction>(reduction);
+                        options.scheduler = scheduler;
+                        std::vector<uint16_t> decimated(expected.size() + 1, 0xEEEE);
+                        DecimateDepth(depth.data(), width, height, decimated.data(), options);
+                        EXPECT_TRUE(std::equal(expected.begin(), expected.end(), decimated.begin()));
+                        EXPECT_EQ(0xEEEE, decimated.back());
+                    });
+                }
+        }
+    }
+}
+
+TEST(Decimation, Intrinsics)
+{
+    DSCalibIntrinsicsRectified intrinsics;
+    intrinsics.rfx = 600;
+    intrinsics.rfy = 610;
+    intrinsics.rpx = 319.5f;
+    intrinsics.rpy = 239.5f;
+    intrinsics.rw = 640;
+    intrinsics.rh = 480;
+    const DSCalibIntrinsicsRectified decimated = DecimateIntrinsics(intrinsics, 4);
+    EXPECT_FLOAT_EQ(150, decimated.rfx);
+    EXPECT_FLOAT_EQ(152.5f, decimated.rfy);
+    EXPECT_FLOAT_EQ(79.5f, decimated.rpx);
+    EXPECT_FLOAT_EQ(59.5f, decimated.rpy);
+    EXPECT_EQ(160u, decimated.rw);
+    EXPECT_EQ(120u, decimated.rh);
+}
+
+// Each level of a pyramid is the least or the mean of the valid depths of its whole block of the source, or the median of the 2x2
+// medians of the level below: of the valid depths, unlike the median of DecimateDepth(), which takes the whole block at once
+TEST(DepthPyramid, MatchesDefinition)
+{
+    const int height = 35;
+    for (int width : g_testWidths)
+    {
+        SCOPED_TRACE(width);
+        // Patches like the camera's, then depths over all 16 bits and near the top of them, whose means have to divide exactly
+        for (int range = 0; range < 3; ++range)
+        {
+            std::vector<uint16_t> depth = RandomDepth(width, height, width, width + range, 30);
+            std::mt19937 random(width);
+            for (uint16_t & d : depth)
+                if (d && range) d = static_cast<uint16_t>(range == 1 ? 1 + random() % 65535 : 65535 - random() % 64);
+
+            for (int reduction = DEPTH_REDUCE_MIN; reduction <= DEPTH_REDUCE_MEAN; ++reduction)
+            {
+                SCOPED_TRACE(testing::Message() << "reduction " << reduction << ", range " << range);
+                std::vector<uint16_t> expected[3];
+                for (int level = 0; level < 3; ++level)
+                    expected[level] = reduction == DEPTH_REDUCE_MEDIAN
+                                          ? DecimateNaive(level ? expected[level - 1] : depth, width >> level, height >> level, 2, DEPTH_REDUCE_MEDIAN)
+                                          : DecimateNaive(depth, width, height, 2 << level, static_cast<DepthReduction>(reduction));
+
+                ForEachIsa([&](TaskScheduler * scheduler) {
+                    // Rows of each level padded by 3 pixels, which must stay as they are
+                    std::vector<uint16_t> levels[3];
+                    uint16_t * levelPointers[3];
+                    int levelStrides[3];
+                    for (int level = 0; level < 3; ++level)
+                    {
+                        levels[level].assign(((width >> (level + 1)) + 3) * (height >> (level + 1)), 0xEEEE);
+                        levelPointers[level] = levels[level].data();
+                        levelStrides[level] = ((width >> (level + 1)) + 3) * 2;
+                    }
+                    DepthPyramidOptions options;
+                    options.reduction = static_cast<DepthReduction>(reduction);
+                    options.scheduler = scheduler;
+                    BuildDepthPyramid(depth.data(), width, height, width * 2, levelPointers, levelStrides, options);
+
+                    for (int level = 0; level < 3; ++level)
+                    {
+                        const int levelWidth = width >> (level + 1), stride = levelWidth + 3;
+                        for (int y = 0; y < height >> (level + 1); ++y)
+                        {
+                            ASSERT_TRUE(std::equal(levels[level].begin() + y * stride, levels[level].begin() + y * stride + levelWidth,
+                                                   expected[level].begin() + y * levelWidth))
+                                << "level " << level << ", row " << y;
+                            ASSERT_TRUE(std::all_of(levels[level].begin() + y * stride + levelWidth, levels[level].begin() + (y + 1) * stride,
+                                                    [](uint16_t d) { return d == 0xEEEE; }))
+                                << "level " << level << ", row " << y;
+                        }
+                    }
+                });
+            }
+        }
+    }
+}
+
+// IEEE 754 half precision, rounded to nearest even, from the value in double precision
+static uint16_t HalfNaive(double value)
+{
+    if (value == 0) return 0;
+    if (value < std::ldexp(1.0, -14)) return static_cast<uint16_t>(std::nearbyint(std::ldexp(value, 24)));
+    int exponent;
+    double mantissa = std::ldexp(std::frexp(value, &exponent), 11); // 1024 to 2048
+    --exponent;
+    mantissa = std::nearbyint(mantissa);
+    if (mantissa == 2048)
+    {
+        mantissa = 1024;
+        ++exponent;
+    }
+    if (exponent > 15) return 0x7C00;
+    return static_cast<uint16_t>((exponent + 15) << 10 | (static_cast<int>(mantissa) - 1024));
+}
+
+// Every depth through every pair of units, with a range in yet another unit
+TEST(DepthUnits, MatchesDefinition)
+{
+    const int units[] = {DS_MILLIMETERS, DS_CENTIMETERS, DS_METERS, DS_INCHES, DS_FEET, 1, 2500};
+    const int width = 256, height = 256;
+    std::vector<uint16_t> depth(width * height);
+    for (int i = 0; i < width * height; ++i)
+        depth[i] = static_cast<uint16_t>(i);
+
+    for (int zUnits : units)
+        for (int destZUnits : units)
+        {
+            SCOPED_TRACE(testing::Message() << zUnits << " to " << destZUnits);
+            DepthRangeOptions options;
+            options.zUnits = zUnits;
+            options.rangeUnits = DS_CENTIMETERS;
+            options.minDepth = 3;
+            options.maxDepth = 2000;
+            const double minMicrometres = options.minDepth * options.rangeUnits, maxMicrometres = options.maxDepth * options.rangeUnits;
+            const double ratio = static_cast<double>(zUnits) / destZUnits;
+            const bool wholeRatio = zUnits % destZUnits == 0;
+
+            std::vector<uint16_t> expected(width * height), expectedHalf(width * height);
+            std::vector<float> expectedMeters(width * height);
+            std::vector<uint8_t> expectedMask(width / 8 * height);
+            for (int i = 0; i < width * height; ++i)
+            {
+                const double micrometres = static_cast<double>(depth[i]) * zUnits;
+                if (!depth[i] || micrometres < minMicrometres || micrometres > maxMicrometres) continue;
+                expectedMask[i / 8] |= 1 << i % 8;
+                const double converted = std::floor(depth[i] * ratio + 0.5);
+                expected[i] = converted < 65536 ? static_cast<uint16_t>(converted) : 0;
+                expectedMeters[i] = static_cast<float>(depth[i]) * static_cast<float>(zUnits / 1e6);
+                expectedHalf[i] = HalfNaive(expectedMeters[i]);
+            }
+
+            ForEachIsa([&](TaskScheduler * scheduler) {
+                options.scheduler = scheduler;
+                std::vector<uint8_t> mask(expectedMask.size(), 0xEE);
+                options.validMask = mask.data();
+                std::vector<uint16_t> converted(width * height);
+                ConvertDepthUnits(depth.data(), width, height, converted.data(), destZUnits, options);
+                EXPECT_TRUE(mask == expectedMask);
+                for (int i = 0; i < width * height; ++i)
+                {
+                    // Single precision rounds the other way within its error of a tie, which whole-number ratios never leave
+                    const double exact = depth[i] * ratio;
+                    if (converted[i] != expected[i] && (wholeRatio || std::abs(exact - std::floor(exact) - 0.5) > 1e-3 * (exact + 1)))
+                    {
+                        ADD_FAILURE() << depth[i] << " became " << converted[i] << " instead of " << expected[i];
+                        break;
+                    }
+                }
+
+                std::vector<float> meters(width * height);
+                options.validMask = nullptr;
+                ConvertDepthToMeters(depth.data(), width, height, meters.data(), options);
+                EXPECT_TRUE(meters == expectedMeters);
+
+                std::vector<uint16_t> half(width * height);
+                ConvertDepthToHalfMeters(depth.data(), width, height, half.data(), options);
+                EXPECT_TRUE(half == expectedHalf);
+            });
+        }
+}
+
+// Conversions between units round in single precision, so depths whose exact conversion is within its error of a tie can round away
+// from the exact result; metres to feet at 16310 m is one, 53510.498 ft rounding up. This pins that behaviour on every instruction set.
+TEST(DepthUnits, SinglePrecisionTies)
+{
+    const uint16_t depth[8] = {16310, 16310, 16310, 16310, 16310, 16310, 16310, 16310};
+    ForEachIsa([&](TaskScheduler * scheduler) {
+        DepthRangeOptions options;
+        options.zUnits = DS_METERS;
+        options.scheduler = scheduler;
+        uint16_t feet[8];
+        ConvertDepthUnits(depth, 8, 1, feet, DS_FEET, options);
+        for (int i = 0; i < 8; ++i)
+            EXPECT_EQ(53511, feet[i]);
+    });
+}
+
+TEST(DepthUnits, EmptyRange)
+{
+    const std::vector<uint16_t> depth = RandomDepth(70, g_height, 70, 7);
+    ForEachIsa([&](TaskScheduler * scheduler) {
+        DepthRangeOptions options;
+        options.minDepth = 5000;
+        options.maxDepth = 100;
+        options.scheduler = scheduler;
+        std::vector<uint16_t> converted(depth.size(), 1);
+        ConvertDepthUnits(depth.data(), 70, g_height, converted.data(), DS_MILLIMETERS, options);
+        EXPECT_TRUE(std::all_of(converted.begin(), converted.end(), [](uint16_t d) { return d == 0; }));
+    });
+}
+
+TEST(SpatialFilter, SameOnEveryIsa)
+{
+    for (int width : g_testWidths)
+    {
+        SCOPED_TRACE(width);
+        const int stride = width + 3;
+        const std::vector<uint16_t> depth = RandomDepth(width, g_height, stride, width);
+        for (int iterations = 1; iterations <= 3; iterations += 2)
+        {
+            const std::vector<uint16_t> scalar = ExpectSameOnEveryIsa<uint16_t>([&](TaskScheduler * scheduler) {
+                SpatialFilterOptions options;
+                options.iterations = iterations;
+                options.scheduler = scheduler;
+                std::vector<uint16_t> filtered(stride * g_height);
+                FilterDepthSpatial(depth.data(), width, g_height, stride * 2, filtered.data(), stride * 2, options);
+                return filtered;
+            });
+
+            // In place gives the same, and holes stay holes
+            std::vector<uint16_t> inPlace(depth);
+            SpatialFilterOptions options;
+            options.iterations = iterations;
+            FilterDepthSpatial(inPlace.data(), width, g_height, stride * 2, inPlace.data(), stride * 2, options);
+            for (int y = 0; y < g_height; ++y)
+                for (int x = 0; x < width; ++x)
+                {
+                    ASSERT_EQ(scalar[y * stride + x], inPlace[y * stride + x]);
+                    ASSERT_EQ(depth[y * stride + x] == 0, scalar[y * stride + x] == 0);
+                }
+        }
+    }
+}
+
+// Two flat surfaces, across the rows or down the columns, keep a step of delta or more as it is however many passes run, and have a
+// smaller one smoothed, with delta given in millimetres and the depths in Z units of zUnits micrometres
+TEST(SpatialFilter, PreservesEdges)
+{
+    const struct
+    {
+        int zUnits;
+        float delta;
+        int step;
+        bool edge;
+    } cases[] = {{1000, 20, 50, true}, {1000, 20, 20, true}, {1000, 20, 19, false}, {1000, 20, 6, false},
+                 {100, 20, 200, true},  {100, 20, 199, false}, {10000, 25, 3, true}, {10000, 25, 2, false}};
+    for (int width : g_testWidths)
+    {
+        if (width < 2) continue;
+        SCOPED_TRACE(width);
+        for (const auto & c : cases)
+            for (int across = 0; across < 2; ++across)
+            {
+                SCOPED_TRACE(testing::Message() << "zUnits " << c.zUnits << ", delta " << c.delta << ", step " << c.step << (across ? " across the rows" : " down the columns"));
+                std::vector<uint16_t> depth(width * g_height);
+                for (int y = 0; y < g_height; ++y)
+                    for (int x = 0; x < width; ++x)
+                        depth[y * width + x] = static_cast<uint16_t>(1000 + ((across ? y >= g_height / 2 : x >= width / 2) ? c.step : 0));
+
+                ForEachIsa([&](TaskScheduler * scheduler) {
+                    for (int iterations = 1; iterations <= 5; iterations += 2)
+                    {
+                        SpatialFilterOptions options;
+                        options.delta = c.delta;
+                        options.zUnits = c.zUnits;
+                        options.iterations = iterations;
+                        options.scheduler = scheduler;
+                        std::vector<uint16_t> filtered(depth.size());
+                        FilterDepthSpatial(depth.data(), width, g_height, filtered.data(), options);
+                        if (c.edge)
+                        {
+                            EXPECT_TRUE(filtered == depth) << iterations << " iterations";
+                            continue;
+                        }
+
+                        // The surfaces move towards each other, each pixel staying between them
+                        EXPECT_TRUE(std::all_of(filtered.begin(), filtered.end(), [&](uint16_t d) { return d >= 1000 && d <= 1000 + c.step; }));
+                        const int near = across ? (g_height / 2 - 1) * width : width / 2 - 1, far = across ? g_height / 2 * width : width / 2;
+                        EXPECT_LT(filtered[far] - filtered[near], c.step) << iterations << " iterations";
+                    }
+                });
+            }
+    }
+}
+
+// How often each rule of the temporal filter decided a pixel
+struct TemporalRuleCounts
+{
+    int smoothed, replaced, held, dropped;
+};
+
+// The definition, pixel by pixel over the whole stream: a depth within delta of the smoothed one moves it by alpha of the difference, in
+// 256ths rounded to nearest, a larger step or a first depth replaces it, and a dropout keeps it only if the pixel was valid in
+// persistenceValid of the last persistenceFrames frames, this one and any before the stream counting as invalid
+static std::vector<uint16_t> FilterTemporalNaive(const std::vector<std::vector<uint16_t>> & frames, const TemporalFilterOptions & options, TemporalRuleCounts & counts)
+{
+    const int pixels = static_cast<int>(frames[0].size()), alpha = static_cast<int>(std::lround(options.alpha * 256));
+    std::vector<uint16_t> all(frames.size() * pixels);
+    counts = TemporalRuleCounts();
+    for (int i = 0; i < pixels; ++i)
+    {
+        int smoothed = 0;
+        std::vector<bool> valid;
+        for (size_t frame = 0; frame < frames.size(); ++frame)
+        {
+            const int n = frames[frame][i];
+            valid.push_back(n != 0);
+            if (n && smoothed && std::abs(n - smoothed) <= options.delta)
+            {
+                smoothed += static_cast<int>(std::floor((n - smoothed) * alpha / 256.0 + 0.5));
+                ++counts.smoothed;
+            }
+            else if (n)
+            {
+                counts.replaced += smoothed != 0;
+                smoothed = n;
+            }
+            else if (smoothed)
+            {
+                const int window = std::min<int>(options.persistenceFrames, static_cast<int>(valid.size()));
+                if (std::count(valid.end() - window, valid.end(), true) >= options.persistenceValid)
+                    ++counts.held;
+                else
+                {
+                    smoothed = 0;
+                    ++counts.dropped;
+                }
+            }
+            all[frame * pixels + i] = static_cast<uint16_t>(smoothed);
+        }
+    }
+    return all;
+}
+
+TEST(TemporalFilter, MatchesDefinition)
+{
+    // alpha, delta, persistenceValid and persistenceFrames, with deltas on both sides of the noise, and no smoothing or no persistence
+    const struct
+    {
+        float alpha;
+        int delta, persistenceValid, persistenceFrames;
+    } settings[] = {{0.4f, 20, 2, 4}, {1 / 3.0f, 4, 3, 8}, {0.9f, 100, 7, 8}, {1, 0, 0, 1}, {0.05f, 600, 1, 2}};
+    for (int width : g_testWidths)
+    {
+        SCOPED_TRACE(width);
+        // The same scene in every frame with new noise and holes, then with a step past every delta over its left half
+        const std::vector<uint16_t> scene = RandomDepth(width, g_height, width, width, 0);
+        std::mt19937 random(width);
+        std::vector<std::vector<uint16_t>> frames;
+        for (int frame = 0; frame < 12; ++frame)
+        {
+            frames.push_back(scene);
+            for (int i = 0; i < width * g_height; ++i)
+            {
+                uint16_t & d = frames.back()[i];
+                d = static_cast<int>(random() % 100) < 35 ? 0 : static_cast<uint16_t>(d + static_cast<int>(random() % 9) - 4 + (frame >= 8 && i % width < width / 2 ? 700 : 0));
+            }
+        }
+
+        for (const auto & setting : settings)
+        {
+            SCOPED_TRACE(testing::Message() << "alpha " << setting.alpha << ", delta " << setting.delta << ", " << setting.persistenceValid << " of "
+                                            << setting.persistenceFrames);
+            TemporalFilterOptions options;
+            options.alpha = setting.alpha;
+            options.delta = setting.delta;
+            options.persistenceValid = setting.persistenceValid;
+            options.persistenceFrames = setting.persistenceFrames;
+            TemporalRuleCounts counts;
+            const std::vector<uint16_t> expected = FilterTemporalNaive(frames, options, counts);
+            if (width >= 16)
+            {
+                EXPECT_GT(counts.smoothed, 0);
+                EXPECT_GT(counts.replaced, 0);
+                EXPECT_GT(counts.held, 0);
+                EXPECT_TRUE(counts.dropped > 0 || !setting.persistenceValid);
+            }
+
+            ForEachIsa([&](TaskScheduler * scheduler) {
+                options.scheduler = scheduler;
+                TemporalDepthFilter filter(width, g_height, options);
+                for (size_t frame = 0; frame < frames.size(); ++frame)
+                {
+                    std::vector<uint16_t> filtered(frames[frame].size());
+                    filter.Filter(frames[frame].data(), filtered.data());
+                    ASSERT_TRUE(std::equal(filtered.begin(), filtered.end(), expected.begin() + frame * filtered.size())) << "frame " << frame;
+                }
+            });
+        }
+    }
+}
+
+// The definition of each colormap: the histogram one gives a depth the share of valid pixels of the frame at or nearer than it, the
+// fixed ones its place between minZ and maxZ, rounded to one of 256 colors. Invalid pixels are black.
+static std::vector<uint8_t> ColorizeNaive(const std::vector<uint16_t> & depth, int width, int height, const DepthColorizerOptions & options)
+{
+    std::vector<uint64_t> atOrNearer(65536);
+    for (int i = 0; i < width * height; ++i)
+        if (depth[i]) ++atOrNearer[depth[i]];
+    for (int d = 1; d < 65536; ++d)
+        atOrNearer[d] += atOrNearer[d - 1];
+
+    std::vector<uint8_t> rgb(width * height * 3);
+    for (int i = 0; i < width * height; ++i)
+    {
+        const int d = depth[i];
+        if (!d) continue;
+        double color[3];
+        if (options.colormap == DEPTH_COLORMAP_HISTOGRAM)
+        {
+            const int index = static_cast<int>(atOrNearer[d] * 255 / atOrNearer[65535]);
+            for (int c = 0; c < 3; ++c)
+                color[c] = ((255 - index) * options.nearColor[c] + index * options.farColor[c]) / 255.0;
+        }
+        else
+        {
+            const double clamped = std::min<double>(options.maxZ, std::max<double>(options.minZ, d));
+            const double x = std::round(255 * (clamped - options.minZ) / (options.maxZ - options.minZ)) / 255;
+            if (options.colormap == DEPTH_COLORMAP_JET)
+            {
+                color[0] = 1.5 - std::abs(4 * x - 3);
+                color[1] = 1.5 - std::abs(4 * x - 2);
+                color[2] = 1.5 - std::abs(4 * x - 1);
+            }
+            else if (options.colormap == DEPTH_COLORMAP_TURBO)
+            {
+                color[0] = 0.13572138 + x * (4.61539260 + x * (-42.66032258 + x * (132.13108234 + x * (-152.94239396 + x * 59.28637943))));
+                color[1] = 0.09140261 + x * (2.19418839 + x * (4.84296658 + x * (-14.18503333 + x * (4.27729857 + x * 2.82956604))));
+                color[2] = 0.10667330 + x * (12.64194608 + x * (-60.58204836 + x * (110.36276771 + x * (-89.90310912 + x * 27.34824973))));
+            }
+            else
+                color[0] = color[1] = color[2] = x;
+            for (int c = 0; c < 3; ++c)
+                color[c] = 255 * std::min(1.0, std::max(0.0, color[c]));
+        }
+        for (int c = 0; c < 3; ++c)
+            rgb[i * 3 + c] = static_cast<uint8_t>(std::lround(color[c]));
+    }
+    return rgb;
+}
+
+// The histogram colormap before DepthColorizer, whose output it stays within 2 levels of
+static std::vector<uint8_t> ColorizeHistogramOld(const std::vector<uint16_t> & depth, int width, int height, const uint8_t nearColor[3], const uint8_t farColor[3])
+{
+    std::vector<int> histogram(256 * 256);
+    histogram[0] = 1;
+    for (int i = 0; i < width * height; ++i)
+        if (auto d = depth[i]) ++histogram[d];
+    for (int i = 1; i < 256 * 256; i++)
+        histogram[i] += histogram[i - 1];
+    for (int i = 1; i < 256 * 256; i++)
+        histogram[i] = (histogram[i] << 8) / histogram[256 * 256 - 1];
+
+    std::vector<uint8_t> rgb(width * height * 3);
+    for (int i = 0; i < width * height; i++)
+        if (uint16_t d = depth[i])
+        {
+            const int t = histogram[d];
+            for (int c = 0; c < 3; ++c)
+                rgb[i * 3 + c] = static_cast<uint8_t>(((256 - t) * nearColor[c] + t * farColor[c]) >> 8);
+        }
+    return rgb;
+}
+
+// Depths spread over [nearest, furthest], in patches as RandomDepth() makes them
+static std::vector<uint16_t> DepthInRange(int width, int height, uint32_t seed, int nearest, int furthest)
+{
+    std::vector<uint16_t> depth = RandomDepth(width, height, width, seed);
+    for (uint16_t & d : depth)
+        if (d) d = static_cast<uint16_t>(nearest + static_cast<int64_t>(d - 296) * (furthest - nearest) / (6303 - 296));
+    return depth;
+}
+
+TEST(DepthColorizer, MatchesDefinition)
+{
+    const int height = 5;
+    // The histogram tables are reused from frame to frame, their bins cleared only between the nearest and the furthest depth of each, so
+    // the ranges shrink, grow and move, up to depth 65535, whose palette index the gathers read past
+    const int ranges[][2] = {{500, 4000}, {1000, 2000}, {1500, 1501}, {0, 0}, {100, 60000}, {65000, 65535}, {1, 65535}, {300, 8000}, {7, 7}};
+    for (int width : g_testWidths)
+    {
+        SCOPED_TRACE(width);
+        for (int colormap = DEPTH_COLORMAP_HISTOGRAM; colormap <= DEPTH_COLORMAP_GRAYSCALE; ++colormap)
+        {
+            SCOPED_TRACE(testing::Message() << "colormap " << colormap);
+            DepthColorizerOptions options;
+            options.colormap = static_cast<DepthColormap>(colormap);
+            options.minZ = 400;
+            options.maxZ = 50000;
+            std::vector<std::vector<uint16_t>> frames;
+            for (const auto & range : ranges)
+                frames.push_back(range[1] ? DepthInRange(width, height, width + range[0], range[0], range[1]) : std::vector<uint16_t>(width * height));
+
+            ForEachIsa([&](TaskScheduler * scheduler) {
+                options.scheduler = scheduler;
+                DepthColorizer colorizer(options);
+                for (size_t frame = 0; frame < frames.size(); ++frame)
+                {
+                    // Rows padded by 5 bytes, past the last 24-byte store, which must stay as they are
+                    const int rgbStride = width * 3 + 5;
+                    std::vector<uint8_t> rgb(rgbStride * height, 0xEE);
+                    colorizer.Colorize(frames[frame].data(), width, height, width * 2, rgb.data(), rgbStride);
+
+                    const std::vector<uint8_t> expected = ColorizeNaive(frames[frame], width, height, options);
+                    for (int y = 0; y < height; ++y)
+                    {
+                        ASSERT_TRUE(std::equal(expected.begin() + y * width * 3, expected.begin() + (y + 1) * width * 3, rgb.begin() + y * rgbStride))
+                            << "frame " << frame << ", row " << y;
+                        ASSERT_TRUE(std::all_of(rgb.begin() + y * rgbStride + width * 3, rgb.begin() + (y + 1) * rgbStride, [](uint8_t b) { return b == 0xEE; }))
+                            << "frame " << frame << ", row " << y;
+                    }
+                }
+            });
+        }
+    }
+}
+
+TEST(DepthColorizer, Colormaps)
+{
+    // minZ and below, a quarter, half and three quarters of the way, maxZ and beyond, and invalid: palette indices 0, 64, 128, 191 and 255
+    const std::vector<uint16_t> depth = {1000, 1, 1255, 1510, 1765, 2020, 65535, 0};
+    const uint8_t expected[][8][3] = {
+        {{0, 0, 128}, {0, 0, 128}, {0, 129, 255}, {130, 255, 126}, {255, 129, 0}, {128, 0, 0}, {128, 0, 0}, {0, 0, 0}},
+        {{35, 23, 27}, {35, 23, 27}, {38, 189, 224}, {152, 250, 79}, {255, 129, 29}, {144, 13, 0}, {144, 13, 0}, {0, 0, 0}},
+        {{0, 0, 0}, {0, 0, 0}, {64, 64, 64}, {128, 128, 128}, {191, 191, 191}, {255, 255, 255}, {255, 255, 255}, {0, 0, 0}}};
+    for (int colormap = DEPTH_COLORMAP_JET; colormap <= DEPTH_COLORMAP_GRAYSCALE; ++colormap)
+    {
+        SCOPED_TRACE(testing::Message() << "colormap " << colormap);
+        DepthColorizerOptions options;
+        options.colormap = static_cast<DepthColormap>(colormap);
+        options.minZ = 1000;
+        options.maxZ = 2020;
+        std::vector<uint8_t> rgb(depth.size() * 3);
+        DepthColorizer(options).Colorize(depth.data(), static_cast<int>(depth.size()), 1, rgb.data());
+        for (size_t i = 0; i < depth.size(); ++i)
+            for (int c = 0; c < 3; ++c)
+                EXPECT_EQ(expected[colormap - DEPTH_COLORMAP_JET][i][c], rgb[i * 3 + c]) << "depth " << depth[i] << ", channel " << c;
+    }
+}
+
+TEST(DepthColorizer, NearTheHistogramBefore)
+{
+    const uint8_t colors[][2][3] = {{{255, 0, 0}, {20, 40, 255}}, {{0, 0, 0}, {255, 255, 255}}, {{255, 255, 255}, {0, 0, 0}}};
+    for (int seed = 0; seed < 4; ++seed)
+    {
+        const std::vector<uint16_t> depth = RandomDepth(640, 480, 640, seed, seed * 25);
+        for (const auto & color : colors)
+        {
+            std::vector<uint8_t> rgb(640 * 480 * 3);
+            ConvertDepthToRGBUsingHistogram(depth.data(), 640, 480, color[0], color[1], rgb.data());
+            const std::vector<uint8_t> old = ColorizeHistogramOld(depth, 640, 480, color[0], color[1]);
+            int difference = 0;
+            for (size_t i = 0; i < rgb.size(); ++i)
+                difference = std::max(difference, std::abs(rgb[i] - old[i]));
+            EXPECT_LE(difference, 2) << "seed " << seed;
+        }
+    }
+}
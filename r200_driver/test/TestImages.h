@@ -0,0 +1,89 @@
+#pragma once
+
+#include <r200_driver/ImageConversion.h>
+#include <r200_driver/TaskScheduler.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <vector>
+
+// Shared by the kernel tests: random images, and a loop running a conversion on every instruction set this machine supports, with and
+// without a scheduler, so that each can be compared with the scalar result and with a naive reference.
+
+// Widths on both sides of every vector size the kernels use, and not a multiple of any, so that the overlapping last vectors and the
+// scalar tails are all run
+const int g_testWidths[] = {1, 7, 15, 16, 17, 31, 33, 63, 70, 129};
+
+inline std::vector<uint8_t> RandomBytes(size_t size, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    std::vector<uint8_t> bytes(size);
+    for (size_t i = 0; i < size; ++i)
+        bytes[i] = static_cast<uint8_t>(random());
+    return bytes;
+}
+
+// Depths in smooth patches with steps between them and holes scattered over them, like the camera's, in rows stride words apart
+inline std::vector<uint16_t> RandomDepth(int width, int height, int stride, uint32_t seed, int holePercent = 20)
+{
+    std::mt19937 random(seed);
+    std::vector<uint16_t> depth(static_cast<size_t>(stride) * height);
+    int patch = 1000;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            if (random() % 16 == 0) patch = 300 + random() % 6000;
+            const int value = patch + static_cast<int>(random() % 9) - 4;
+            depth[static_cast<size_t>(y) * stride + x] = static_cast<int>(random() % 100) < holePercent ? 0 : static_cast<uint16_t>(value);
+        }
+    return depth;
+}
+
+// Restores the instruction set picked at startup when a test ends
+class IsaGuard
+{
+    ConversionIsa isa;
+
+public:
+    IsaGuard()
+        : isa(GetConversionIsa())
+    {
+    }
+    ~IsaGuard() { SetConversionIsa(isa); }
+};
+
+// Calls run(scheduler) on every supported instruction set, the scalar one first, without and with a scheduler, with the trace saying
+// which one failed
+inline void ForEachIsa(const std::function<void(TaskScheduler * scheduler)> & run)
+{
+    static TaskScheduler scheduler(3);
+    IsaGuard guard;
+    for (int isa = CONVERSION_ISA_SCALAR; isa <= CONVERSION_ISA_NEON; ++isa)
+    {
+        if (!SetConversionIsa(static_cast<ConversionIsa>(isa))) continue;
+        for (int threaded = 0; threaded < 2; ++threaded)
+        {
+            SCOPED_TRACE(std::string(ConversionIsaString(static_cast<ConversionIsa>(isa))) + (threaded ? " with a scheduler" : ""));
+            run(threaded ? &scheduler : nullptr);
+        }
+    }
+}
+
+// Runs convert on every instruction set as ForEachIsa() does and expects the same output from each as from the scalar one, which it returns
+template <class T> std::vector<T> ExpectSameOnEveryIsa(const std::function<std::vector<T>(TaskScheduler * scheduler)> & convert)
+{
+    std::vector<T> scalar;
+    bool first = true;
+    ForEachIsa([&](TaskScheduler * scheduler) {
+        std::vector<T> output = convert(scheduler);
+        if (first)
+            scalar.swap(output);
+        else
+            EXPECT_TRUE(output == scalar);
+        first = false;
+    });
+    return scalar;
+}